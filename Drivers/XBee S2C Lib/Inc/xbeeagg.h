@@ -0,0 +1,105 @@
+/*
+Copyright 2018 Jesper Wlivaara
+
+Permission is hereby granted, free of charge, to any person obtaining
+a copy of this software and associated documentation files (the "Software"),
+to deal in the Software without restriction, including without limitation the
+rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is furnished to
+do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all copies
+or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR
+PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE
+FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+
+#ifndef XBEE_S2C_LIB_INC_XBEEAGG_H_
+#define XBEE_S2C_LIB_INC_XBEEAGG_H_
+
+/*
+ * Coalescing of small application records (sensor readings and the like)
+ * into full RF payloads. Records to the same destination are packed into
+ * one payload, which is sent when the next record does not fit or when
+ * the oldest record in it has waited for the deadline of its stream.
+ * The receiver walks the records of a payload where they are, in the
+ * received frame block, with xbeeAggBegin() and xbeeAggNext().
+ * This header is included by xbeelib.h, include that one instead.
+ */
+
+/*
+ * GENERAL SETTINGS
+ * MODIFY TO FIT YOUR APPLICATION
+ */
+
+// Destinations an aggregator can coalesce records for at the same time
+#define XBEE_AGG_STREAMS 4
+
+// First RF payload byte of a coalesced payload, tells it apart from
+// other application data
+#define XBEE_AGG_TYPE 0xA1
+
+// Largest record, it has to fit a payload with the type and length bytes
+#define XBEE_AGG_MAX_RECORD (XBEE_MAX_PAYLOAD-2)	// bytes
+
+/*
+ * Records waiting for one destination. The payload is built in place:
+ * XBEE_AGG_TYPE | Length | Record | Length | Record ...
+ */
+typedef struct {
+	uint32_t sh;			// 64-bit destination address
+	uint32_t sl;
+	uint16_t my;			// 16-bit destination address, XBEE_ADDR16_UNKNOWN to send by sh/sl
+	uint16_t deadline;		// Longest a record waits before the payload is sent (ms)
+	uint8_t options;		// XBEE_TXOPT_xx of the payloads
+	uint8_t len;			// Payload bytes used, 0 when no record waits
+	uint8_t records;		// Records in the payload
+	bool used;
+	uint32_t opened;		// HAL tick of the oldest record in the payload
+	uint32_t cycles;		// Cycle count of the oldest record in the payload
+	uint8_t payload[XBEE_MAX_PAYLOAD];
+} xbee_agg_stream;
+
+struct xbee_module;
+
+/*
+ * Coalescing stage in front of the transmit queue of a local module.
+ */
+typedef struct {
+	struct xbee_module *xbee;
+	xbee_agg_stream stream[XBEE_AGG_STREAMS];
+	platform_timer timer;	// Wakes the main loop at the next deadline
+	uint32_t records;		// Records packed
+	uint32_t payloads;		// Payloads sent, records - payloads frames were saved
+	uint32_t expired;		// Payloads sent on their deadline instead of full
+	uint32_t failed;		// Payloads not delivered (TX Status other than success)
+	xbee_hist wait;			// Oldest record of a payload, added to latency (cycles)
+} xbee_aggregator;
+
+/*
+ * Walks the records of a received coalesced payload. "data" and "len"
+ * describe the current record, which stays where it is in the frame
+ * block, so it is valid as long as the block is.
+ */
+typedef struct {
+	const uint8_t *data;	// Current record
+	uint8_t len;
+	const uint8_t *pos;		// Next length byte
+	const uint8_t *end;
+} xbee_agg_iter;
+
+void xbeeAggInit(xbee_aggregator *agg, struct xbee_module *xbee);
+xbee_agg_stream *xbeeAggOpen(xbee_aggregator *agg, uint32_t sh, uint32_t sl, uint16_t my,
+							 uint16_t deadline, uint8_t options);
+XBEE_STAT xbeeAggClose(xbee_aggregator *agg, xbee_agg_stream *stream);
+XBEE_STAT xbeeAggPut(xbee_aggregator *agg, xbee_agg_stream *stream, const uint8_t *data, uint8_t len);
+XBEE_STAT xbeeAggFlush(xbee_aggregator *agg, xbee_agg_stream *stream);
+void xbeeAggService(xbee_aggregator *agg);
+bool xbeeAggBegin(xbee_agg_iter *it, xbee_frame *frame);
+bool xbeeAggNext(xbee_agg_iter *it);
+
+#endif /* XBEE_S2C_LIB_INC_XBEEAGG_H_ */
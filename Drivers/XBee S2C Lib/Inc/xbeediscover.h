@@ -0,0 +1,63 @@
+/*
+Copyright 2018 Jesper Wlivaara
+
+Permission is hereby granted, free of charge, to any person obtaining
+a copy of this software and associated documentation files (the "Software"),
+to deal in the Software without restriction, including without limitation the
+rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is furnished to
+do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all copies
+or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR
+PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE
+FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+
+#ifndef XBEE_S2C_LIB_INC_XBEEDISCOVER_H_
+#define XBEE_S2C_LIB_INC_XBEEDISCOVER_H_
+
+/*
+ * Streaming Node Discovery (ND) over API frames.
+ * This header is included by xbeelib.h, include that one instead.
+ */
+
+/*
+ * GENERAL SETTINGS
+ * MODIFY TO FIT YOUR APPLICATION
+ */
+
+// NT used when the modules own value has not been read (0x19 = 2.5 s)
+#define XBEE_ND_DEFAULT_NT 0x19
+// Added to NT before a discovery is considered finished
+#define XBEE_ND_MARGIN 200	// milliseconds
+
+struct xbee_module;
+
+// Called once for every node as its ND response arrives
+typedef void (*xbee_nd_callback)(struct xbee_module *xbee, xbee_node *node, void *ctx);
+// Called when the discovery is over, "found" counts the responses
+typedef void (*xbee_nd_done)(struct xbee_module *xbee, uint16_t found, void *ctx);
+
+typedef struct {
+	bool active;
+	uint8_t frameid;
+	uint32_t started;		// HAL tick the ND command was sent
+	uint32_t timeout;		// milliseconds
+	uint16_t found;
+	xbee_nd_callback onnode;
+	xbee_nd_done ondone;
+	void *ctx;
+} xbee_discovery;
+
+void xbeeDiscoverInit(xbee_discovery *nd);
+XBEE_STAT xbeeDiscover(struct xbee_module *xbee, xbee_nd_callback onnode, xbee_nd_done ondone, void *ctx);
+bool xbeeDiscoverBusy(struct xbee_module *xbee, uint8_t frameid);
+void xbeeDiscoverHandleResponse(struct xbee_module *xbee, const uint8_t *frame, uint16_t len);
+void xbeeDiscoverService(struct xbee_module *xbee);
+
+#endif /* XBEE_S2C_LIB_INC_XBEEDISCOVER_H_ */
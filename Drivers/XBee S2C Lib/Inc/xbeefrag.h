@@ -0,0 +1,161 @@
+/*
+Copyright 2018 Jesper Wlivaara
+
+Permission is hereby granted, free of charge, to any person obtaining
+a copy of this software and associated documentation files (the "Software"),
+to deal in the Software without restriction, including without limitation the
+rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is furnished to
+do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all copies
+or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR
+PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE
+FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+
+#ifndef XBEE_S2C_LIB_INC_XBEEFRAG_H_
+#define XBEE_S2C_LIB_INC_XBEEFRAG_H_
+
+/*
+ * Transfer of blocks larger than one RF payload (calibration tables,
+ * sample logs, configuration blobs). The sender splits the block into
+ * numbered fragments and hands them to the transmit queue back to back.
+ * The receiver rebuilds the block in a fixed arena and answers with a
+ * bitmap of the fragments it holds, after which only the missing ones
+ * are sent again.
+ * This header is included by xbeelib.h, include that one instead.
+ */
+
+/*
+ * GENERAL SETTINGS
+ * MODIFY TO FIT YOUR APPLICATION
+ */
+
+// Reassembly arena of a receiver, the largest block it accepts.
+// At most XBEE_FRAG_MAX_FRAGS * XBEE_FRAG_DATA (3072) bytes.
+#define XBEE_FRAG_ARENA 2048	// bytes
+
+// Time the sender waits for the bitmap after the last fragment of a round
+#define XBEE_FRAG_ACK_TIMEOUT 500	// milliseconds
+
+// Quiet time after which a receiver with missing fragments asks for them
+#define XBEE_FRAG_GAP 200	// milliseconds
+
+// Time after which a receiver gives an unfinished block up
+#define XBEE_FRAG_RX_TIMEOUT 5000	// milliseconds
+
+// Bitmap waits in a row the sender gives up after, and rounds of
+// retransmissions a transfer may take
+#define XBEE_FRAG_RETRIES 3
+#define XBEE_FRAG_ROUNDS 8
+
+// First RF payload byte of fragments and of the receivers bitmap
+#define XBEE_FRAG_TYPE 0xA2
+#define XBEE_FRAG_STATUS_TYPE 0xA3
+
+// Fragment: XBEE_FRAG_TYPE | Transfer ID | Index | Count | Data
+#define XBEE_FRAG_HEADER 4
+#define XBEE_FRAG_DATA (XBEE_MAX_PAYLOAD - XBEE_FRAG_HEADER)	// Data bytes of every fragment but the last
+#define XBEE_FRAG_MAX_FRAGS 32	// Fragments of a block (bits of the bitmap)
+
+// Bitmap: XBEE_FRAG_STATUS_TYPE | Transfer ID | Flags | Fragments held (32 bits, LSB first)
+#define XBEE_FRAG_ST_DONE		0x01	// Block complete
+#define XBEE_FRAG_ST_REFUSED	0x02	// Block does not fit the arena
+
+typedef enum {
+	XBEE_FRAG_OK = 0x0,
+	XBEE_FRAG_REFUSED = 0x1,		// Receiver can not take the block
+	XBEE_FRAG_TIMEOUT = 0x2			// Receiver stopped answering
+} XBEE_FRAG_STATUS;
+
+typedef enum {
+	XBEE_FRAG_IDLE = 0x0,
+	XBEE_FRAG_SENDING = 0x1,		// Handing a round of fragments to the transmit queue
+	XBEE_FRAG_WAITING = 0x2			// Waiting for the bitmap of the round
+} XBEE_FRAG_STATE;
+
+struct xbee_module;
+struct xbee_frag_sender;
+struct xbee_frag_receiver;
+
+/*
+ * Called when a transfer is finished (XBEE_FRAG_STATUS).
+ */
+typedef void (*xbee_frag_callback)(struct xbee_frag_sender *tx, uint8_t status, void *ctx);
+
+/*
+ * Called with a complete block. The data stays in the arena until the
+ * next block starts arriving.
+ */
+typedef void (*xbee_frag_receive_callback)(struct xbee_frag_receiver *rx, const uint8_t *data,
+										   uint16_t len, void *ctx);
+
+/*
+ * A block being sent. The data is sent from the callers memory, it has
+ * to stay as it is until the callback.
+ */
+typedef struct xbee_frag_sender {
+	struct xbee_module *xbee;
+	uint32_t sh;			// 64-bit destination address
+	uint32_t sl;
+	uint16_t my;			// 16-bit destination address, XBEE_ADDR16_UNKNOWN to send by sh/sl
+	uint8_t options;		// XBEE_TXOPT_xx of the fragments
+	uint8_t state;			// XBEE_FRAG_STATE
+	uint8_t id;				// Transfer ID
+	uint8_t count;			// Fragments of the block
+	uint8_t next;			// Next fragment to look at in the round
+	uint8_t retries;		// Bitmap waits left
+	uint8_t rounds;			// Rounds left
+	const uint8_t *data;
+	uint16_t len;
+	uint32_t tosend;		// Fragments still to send in this round
+	uint32_t deadline;		// HAL tick the bitmap is given up at
+	platform_timer timer;	// Wakes the main loop at the deadline
+	xbee_frag_callback cb;
+	void *ctx;
+	uint32_t fragments;		// Fragments sent, retransmissions included
+	uint32_t resent;		// Fragments sent again
+	uint32_t macfail;		// Fragments the MAC did not get an acknowledgement for
+} xbee_frag_sender;
+
+/*
+ * Reassembly of blocks from one sender at a time.
+ */
+typedef struct xbee_frag_receiver {
+	struct xbee_module *xbee;
+	uint32_t sh;			// Sender of the block, as it was received
+	uint32_t sl;
+	uint16_t my;
+	bool active;			// A block is being received
+	bool done;				// The block of "id" is complete
+	uint8_t id;				// Transfer ID of the block
+	uint8_t count;
+	uint8_t asked;			// Bitmaps sent for missing fragments since the last one arrived
+	uint16_t len;			// Block length, known once the last fragment is in
+	uint32_t held;			// Fragments received
+	uint32_t started;		// HAL tick of the first fragment
+	uint32_t last;			// HAL tick of the latest fragment
+	platform_timer timer;	// Wakes the main loop when a gap is due
+	xbee_frag_receive_callback cb;
+	void *ctx;
+	uint32_t blocks;		// Blocks received
+	uint32_t duplicates;	// Fragments received again
+	uint32_t dropped;		// Blocks given up
+	uint8_t arena[XBEE_FRAG_ARENA];
+} xbee_frag_receiver;
+
+XBEE_STAT xbeeFragSend(xbee_frag_sender *tx, struct xbee_module *xbee, uint32_t sh, uint32_t sl, uint16_t my,
+					   const uint8_t *data, uint16_t len, uint8_t options, xbee_frag_callback cb, void *ctx);
+bool xbeeFragSenderHandleFrame(xbee_frag_sender *tx, xbee_frame *frame);
+void xbeeFragSenderService(xbee_frag_sender *tx);
+void xbeeFragReceiverInit(xbee_frag_receiver *rx, struct xbee_module *xbee,
+						  xbee_frag_receive_callback cb, void *ctx);
+bool xbeeFragReceive(xbee_frag_receiver *rx, xbee_frame *frame);
+void xbeeFragReceiverService(xbee_frag_receiver *rx);
+
+#endif /* XBEE_S2C_LIB_INC_XBEEFRAG_H_ */
@@ -0,0 +1,90 @@
+/*
+Copyright 2018 Jesper Wlivaara
+
+Permission is hereby granted, free of charge, to any person obtaining
+a copy of this software and associated documentation files (the "Software"),
+to deal in the Software without restriction, including without limitation the
+rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is furnished to
+do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all copies
+or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR
+PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE
+FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+
+#ifndef XBEE_S2C_LIB_INC_XBEEINIT_H_
+#define XBEE_S2C_LIB_INC_XBEEINIT_H_
+
+/*
+ * Non-blocking bring-up of the local module: UART sync, API mode enable
+ * and configuration, run as a state machine from xbeeService().
+ * This header is included by xbeelib.h, include that one instead.
+ */
+
+/*
+ * GENERAL SETTINGS
+ * MODIFY TO FIT YOUR APPLICATION
+ */
+
+// Times a failed step is tried again before the bring-up gives up
+#define XBEE_INIT_RETRIES 2
+
+// Every rate in baudrates[] plus the one the UART is configured with
+#define XBEE_INIT_MAX_PROBES 10
+
+typedef enum {
+	XBEE_INIT_IDLE = 0x0,		// Not running, see "result" for how the last run went
+	XBEE_INIT_GUARD = 0x1,		// Line kept silent for the leading guard time
+	XBEE_INIT_PROBE = 0x2,		// Command sequence sent, waiting for "OK"
+	XBEE_INIT_FASTGT = 0x3,		// Programming XBEE_FAST_GT
+	XBEE_INIT_APIREAD = 0x4,	// Reading AP
+	XBEE_INIT_APIWRITE = 0x5,	// Writing AP = XBEE_API_MODE
+	XBEE_INIT_CONFIG = 0x6,		// Writing changed settings with local AT frames
+	XBEE_INIT_WARM = 0x7		// Stored profile being checked with one API frame
+} XBEE_INIT_STATE;
+
+struct xbee_module;
+struct xbee_radio;
+
+// Called once when the bring-up (or configuration) has finished
+typedef void (*xbee_init_callback)(struct xbee_module *xbee, XBEE_STAT stat, void *ctx);
+
+typedef struct {
+	uint8_t state;			// XBEE_INIT_STATE
+	uint8_t retries;		// Tries left for the current step
+	uint8_t reached;		// Furthest step reached (XBEE_INIT_STATE)
+	uint8_t pass;			// 0 = last known guard time, 1 = factory guard time
+	uint8_t probe;			// Index into order[] being probed
+	uint8_t probes;			// Rates in order[]
+	uint8_t replies;		// Response lines still expected
+	uint16_t gt;			// Guard time of the current pass (ms)
+	uint32_t order[XBEE_INIT_MAX_PROBES];	// Baud rates in the order they are probed
+	char line[24];			// Response line being received
+	uint8_t linelen;
+	uint8_t configidx;		// Next setting to look at in XBEE_INIT_CONFIG
+	uint8_t configpending;	// Local AT frames waiting for their response
+	uint8_t configfailed;	// Local AT frames answered with an error
+	uint8_t probeid;		// Frame ID of the warm boot probe
+	bool warm;				// The last bring-up used the stored profile
+	uint32_t elapsed;		// Duration of the last bring-up or configuration (ms)
+	XBEE_STAT result;		// Outcome so far / of the last run
+	uint32_t start;			// HAL tick the bring-up started at
+	platform_timer timer;	// Guard time / response timeout
+	xbee_init_callback ondone;
+	void *ctx;
+} xbee_initstate;
+
+XBEE_STAT xbeeInitStart(struct xbee_radio *radio, UART_HandleTypeDef *hxbee, xbee_init_callback ondone, void *ctx);
+XBEE_STAT xbeeConfigure(struct xbee_module *xbee, xbee_init_callback ondone, void *ctx);
+bool xbeeInitBusy(struct xbee_module *xbee);
+void xbeeInitHandleResponse(struct xbee_module *xbee, const uint8_t *frame, uint16_t len);
+void xbeeInitService(struct xbee_module *xbee);
+void xbeeService(struct xbee_module *xbee);
+
+#endif /* XBEE_S2C_LIB_INC_XBEEINIT_H_ */
@@ -21,28 +21,146 @@ FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TOR
 #ifndef XBEE_S2C_LIB_INC_XBEELIB_H_
 #define XBEE_S2C_LIB_INC_XBEELIB_H_
 
-#include "stm32f3xx_hal.h"
+#include "xbeeport.h"
 #include "string.h"
 #include "stdbool.h"
+#include "stddef.h"
+#include "stdlib.h"
 #include "miscfunc.h"
+#include "xbeenodes.h"
 
 /*
  * GENERAL SETTINGS
  * MODIFY TO FIT YOUR APPLICATION
  */
 
-#define MAX_STORED_DEVICES 5
+// Modules whose complete xbee_settings are kept per radio: the local
+// module, and MAX_STORED_DEVICES-1 remote modules that are being
+// configured. Every other remote node only needs an entry in the node
+// registry (see xbeenodes.h). About 2 KB of RAM per module.
+#ifndef MAX_STORED_DEVICES
+#define MAX_STORED_DEVICES 2
+#endif
+
+/*
+ * RAM budget: every xbee_radio holds
+ *	- MAX_STORED_DEVICES modules, about 2 KB each (1.1 KB of it the TX and
+ *	  Remote AT state, 0.5 KB the statistics)
+ *	- the node registry, XBEE_MAX_NODES * 60 + XBEE_NODE_BUCKETS * 4 bytes
+ *	- the frame pool, XBEE_POOL_BLOCKS * 140 bytes
+ * which is about 9.5 KB with the defaults. The STM32F303K8 has 12 KB of
+ * SRAM, so for a second radio, or for a larger application next to one,
+ * build with smaller limits, e.g. -DXBEE_MAX_NODES=16 -DXBEE_NODE_BUCKETS=16
+ * -DXBEE_POOL_BLOCKS=6 -DMAX_STORED_DEVICES=1 brings a radio down to about
+ * 3.9 KB. Check the result with sizeof(xbee_radio).
+ */
 
 // Safety margin for guard time when entering commmand mode
 #define XBEE_ADDED_GT_MARGIN 50	// milliseconds
 
+// Time allowed for the module to answer once it has accepted a command
+#define XBEE_REPLY_TIMEOUT 50	// milliseconds
+
+// Guard time (GT) the local module is programmed with after the first
+// successful sync, which makes later command mode entries and syncs faster.
+// Set to 0 to leave GT untouched.
+#ifndef XBEE_FAST_GT
+#define XBEE_FAST_GT 100	// milliseconds
+#endif
+
+// Probe passes of a UART sync, see xbeeProbeGuardTime()
+#define XBEE_SYNC_PASSES 2
+
+// Index into baudrates[] of the factory default interface rate (BD = 3, 9600)
+#define XBEE_DEFAULT_BD 3
+
+// API mode (AP) the local module is run in. 1 sends frames as they are,
+// 2 escapes 0x7E, 0x7D, 0x11 and 0x13, which is needed when the line also
+// carries XON/XOFF flow control.
+#define XBEE_API_MODE 1
+
+// Longest command line sent in command mode, and the time allowed for
+// all of its responses to come back
+#define XBEE_AT_LINE_MAX 64		// characters
+#define XBEE_AT_TIMEOUT 500		// milliseconds
+
+// Largest API frame data (API identifier + payload) the frame parser accepts
+#define XBEE_API_MAX_FRAME 128	// bytes
+
 typedef enum {
 	XBEE_MSG_OK = 0x0,
 	XBEE_ERR_UART_SYNC = 0x1,
 	XBEE_ERR_APIMODE_ENABLE = 0x2,
-	XBEE_MSG_SETTING_CHANGED = 0x3
+	XBEE_MSG_SETTING_CHANGED = 0x3,
+	XBEE_ERR_AT_TIMEOUT = 0x4,
+	XBEE_ERR_AT_COMMAND = 0x5,
+	XBEE_ERR_TX_FULL = 0x6,
+	XBEE_ERR_TX_BUSY = 0x7
 } XBEE_STAT;
 
+/*
+ * API frame identifiers used by the 802.15.4 firmware of the S2C.
+ * Every API frame on the UART has the layout:
+ * 0x7E | Length MSB | Length LSB | Frame data (API identifier + payload) | Checksum
+ */
+#define XBEE_API_START_DELIM 0x7E
+
+/*
+ * In escaped API mode (AP = 2) every byte after the start delimiter that
+ * equals one of the four below is sent as 0x7D followed by the byte XOR 0x20.
+ */
+#define XBEE_API_ESCAPED 2		// AP value of escaped API mode
+#define XBEE_API_ESCAPE 0x7D
+#define XBEE_API_XON 0x11
+#define XBEE_API_XOFF 0x13
+#define XBEE_API_ESCAPE_XOR 0x20
+
+typedef enum {
+	XBEE_API_TX64 = 0x00,				// TX Request: 64-bit address
+	XBEE_API_TX16 = 0x01,				// TX Request: 16-bit address
+	XBEE_API_AT_CMD = 0x08,				// Local AT Command
+	XBEE_API_AT_QUEUE = 0x09,			// Local AT Command, queue parameter value
+	XBEE_API_REMOTE_AT = 0x17,			// Remote AT Command Request
+	XBEE_API_RX64 = 0x80,				// RX Packet: 64-bit address
+	XBEE_API_RX16 = 0x81,				// RX Packet: 16-bit address
+	XBEE_API_RX64_IO = 0x82,			// RX I/O Sample: 64-bit address
+	XBEE_API_RX16_IO = 0x83,			// RX I/O Sample: 16-bit address
+	XBEE_API_AT_RESPONSE = 0x88,		// Local AT Command Response
+	XBEE_API_TX_STATUS = 0x89,			// TX Status
+	XBEE_API_MODEM_STATUS = 0x8A,		// Modem Status
+	XBEE_API_REMOTE_AT_RESPONSE = 0x97	// Remote AT Command Response
+} XBEE_API_ID;
+
+#include "xbeepool.h"
+
+typedef enum {
+	XBEE_PARSE_DELIM = 0x0,		// Waiting for start delimiter
+	XBEE_PARSE_LEN_MSB = 0x1,
+	XBEE_PARSE_LEN_LSB = 0x2,
+	XBEE_PARSE_DATA = 0x3,
+	XBEE_PARSE_CHECKSUM = 0x4
+} XBEE_PARSE_STATE;
+
+/*
+ * Incremental API frame decoder state. Bytes may be fed in chunks of any
+ * size, a frame split across several UART reads is resumed where it left off.
+ * The checksum is accumulated while the frame data is being stored, so a
+ * complete frame is verified the moment its last byte arrives.
+ * Frame data is stored straight into a block taken from the pool of the radio.
+ */
+typedef struct {
+	XBEE_PARSE_STATE state;
+	uint16_t len;		// Length of the frame currently being received
+	uint16_t cnt;		// Frame data bytes received so far
+	uint8_t sum;		// Running sum of the frame data
+	bool unescape;		// Escaped mode: the next byte follows 0x7D
+	xbee_frame *block;	// Block the frame is received into, NULL if the pool was empty
+	uint32_t frames;	// Frames successfully decoded
+	uint32_t cserrors;	// Frames dropped due to checksum mismatch
+	uint32_t overflows;	// Frames dropped due to exceeding XBEE_API_MAX_FRAME
+	uint32_t nobuffer;	// Frames dropped because no block was free
+} xbee_parser;
+
 /*
  * This struct contains storage locations for
  * all of the different Xbee settings. They have been listed
@@ -167,18 +285,227 @@ typedef struct {
 } xbee_settings;
 
 
+/*
+ * Every field of xbee_settings, in struct order, by its two letter AT command:
+ * X(command, flags, default value)
+ * Used to build the settings descriptor table and the matching indices
+ * (XBEE_SETTING_CH etc.).
+ */
+#define XBEE_SETTING_READONLY	0x1		// Read only, never written to the module
+#define XBEE_SETTING_WRITEONLY	0x2		// Write only, the module does not report it
+
+#define XBEE_SETTINGS_LIST(X) \
+	/* +++ Networking and security +++ */ \
+	X(C8, 0, 0) \
+	X(CH, 0, 0) \
+	X(ID, 0, 0) \
+	X(DH, 0, 0) \
+	X(DL, 0, 0) \
+	X(MY, 0, 0) \
+	X(SH, XBEE_SETTING_READONLY, 0) \
+	X(SL, XBEE_SETTING_READONLY, 0) \
+	X(MM, 0, 0) \
+	X(RR, 0, 0) \
+	X(RN, 0, 0) \
+	X(NT, 0, 0) \
+	X(NO, 0, 0) \
+	X(CE, 0, 0) \
+	X(SC, 0, 0) \
+	X(SD, 0, 0) \
+	X(A1, 0, 0) \
+	X(A2, 0, 0) \
+	X(EE, 0, 0) \
+	X(NI, 0, 0) \
+	/* +++ RF Interfacing Commands +++ */ \
+	X(PL, 0, 0) \
+	X(PM, 0, 0) \
+	X(CA, 0, 0) \
+	/* +++ Sleep Commands +++ */ \
+	X(SM, 0, 0) \
+	X(ST, 0, 0) \
+	X(SP, 0, 0) \
+	X(DP, 0, 0) \
+	X(SO, 0, 0) \
+	/* +++ Serial Interfacing Commands +++ */ \
+	X(BD, 0, 0) \
+	X(NB, 0, 0) \
+	X(RO, 0, 0) \
+	X(D7, 0, 0) \
+	X(D6, 0, 0) \
+	X(AP, 0, 0) \
+	/* +++ I/O Settings Commands +++ */ \
+	X(D0, 0, 0) \
+	X(D1, 0, 0) \
+	X(D2, 0, 0) \
+	X(D3, 0, 0) \
+	X(D4, 0, 0) \
+	X(D5, 0, 0) \
+	X(D8, 0, 0) \
+	X(P0, 0, 0) \
+	X(P1, 0, 0) \
+	X(P2, 0, 0) \
+	X(M0, 0, 0) \
+	X(M1, 0, 0) \
+	X(P5, 0, 0) \
+	X(P6, 0, 0) \
+	X(P7, 0, 0) \
+	X(P8, 0, 0) \
+	X(P9, 0, 0) \
+	X(PR, 0, 0) \
+	X(PD, 0, 0) \
+	X(IU, 0, 0) \
+	X(IT, 0, 0) \
+	X(IC, 0, 0) \
+	X(IR, 0, 0) \
+	X(RP, 0, 0) \
+	/* +++ I/O Line Passing Commands +++ */ \
+	X(IA, 0, 0) \
+	X(T0, 0, 0) \
+	X(T1, 0, 0) \
+	X(T2, 0, 0) \
+	X(T3, 0, 0) \
+	X(T4, 0, 0) \
+	X(T5, 0, 0) \
+	X(T6, 0, 0) \
+	X(T7, 0, 0) \
+	X(PT, 0, 0) \
+	/* +++ Command Mode Options +++ */ \
+	X(CT, 0, 0x64) \
+	X(GT, 0, 0x3E8) \
+	X(CC, 0, 0x2B)
+
+#define XBEE_SETTING_INDEX(name, flags, def) XBEE_SETTING_##name,
+typedef enum {
+	XBEE_SETTINGS_LIST(XBEE_SETTING_INDEX)
+	XBEE_SETTING_COUNT
+} XBEE_SETTING;
+#undef XBEE_SETTING_INDEX
+
+#define XBEE_SETTING_WORDS ((XBEE_SETTING_COUNT+31)/32)
+
+/*
+ * Describes an AT parameter and where it is stored in xbee_settings.
+ * A width of 1, 2, 4 or 8 bytes is a number, sent most significant byte
+ * first (8 = IA, stored high word first), anything wider is a string (NI).
+ */
 typedef struct {
+	char cmd[3];		// AT command, NULL terminated
+	uint8_t width;		// Size of the field in bytes
+	uint16_t offset;	// Offset of the field in xbee_settings
+	uint8_t flags;		// XBEE_SETTING_READONLY / _WRITEONLY
+	uint32_t def;		// Default value (0 for strings)
+} xbee_setting_desc;
+
+extern const xbee_setting_desc xbeeSettingTable[XBEE_SETTING_COUNT];
+
+#include "xbeetx.h"
+#include "xbeestats.h"
+#include "xbeeremote.h"
+#include "xbeediscover.h"
+#include "xbeeinit.h"
+#include "xbeeprofile.h"
+#include "xbeeagg.h"
+#include "xbeefrag.h"
+#include "xbeerel.h"
+
+struct xbee_module;
+struct xbee_radio;
+
+/*
+ * Called once for every complete and checksum verified API frame.
+ * The block is released when the call returns, take a reference with
+ * xbeeFrameRef() to keep it (e.g. to queue it for processing, or to
+ * build a reply in it and pass it to xbeeSendBlock()).
+ */
+typedef void (*xbee_frame_callback)(struct xbee_module *xbee, xbee_frame *frame);
+
+typedef struct xbee_module {
 	UART_HandleTypeDef *hxbee;
+	struct xbee_radio *radio;	// Radio the module belongs to
+	struct xbee_module *via;	// Local module a remote module is reached through (by SH/SL), NULL if local
 	xbee_settings settings;	// Xbee device settings
+	uint32_t dirty[XBEE_SETTING_WORDS];	// Settings changed locally but not yet on the module
+	uint32_t writing[XBEE_SETTING_WORDS];	// Settings written in API frames, waiting for the response
+	uint8_t frameid;		// Last API frame ID used for settings frames
+	xbee_parser parser;		// API frame decoder state
+	xbee_frame_callback onframe;
+	xbee_txstate tx;		// RF data frames waiting for TX Status
+	xbee_ratstate rat;		// Remote AT requests queued or in flight
+	xbee_discovery nd;		// Ongoing Node Discovery
+	xbee_stats stats;		// Runtime counters and latency histograms
+	xbee_initstate init;	// Ongoing bring-up or configuration
+	uint32_t synctime;		// Duration of the last UART sync (ms)
+	bool cmdmode;			// Local module believed to be in command mode
+	uint32_t cmdtick;		// Time of the last command sent in command mode
 } xbee_module;
 
+/*
+ * Everything that belongs to one local radio: the local module, the
+ * remote modules whose settings are mirrored, the node registry and the
+ * frame blocks. Declare one per radio and hand it to xbeeInitStart(),
+ * radios share no state in the driver and can run side by side on
+ * separate UARTs.
+ */
+typedef struct xbee_radio {
+	xbee_module local;
+	xbee_module remote[MAX_STORED_DEVICES-1];	// Reached through "local"
+	xbee_nodetable nodes;
+	xbee_pool pool;
+} xbee_radio;
+
+// Flags for xbeeBatchRun()
+#define XBEE_BATCH_APPLY	0x1		// Finish with AC (apply changes)
+#define XBEE_BATCH_SAVE		0x2		// Finish with WR (write to non-volatile memory)
+#define XBEE_BATCH_KEEPOPEN	0x4		// Stay in command mode (no CN) for a following batch
+
+/*
+ * A set of AT parameter reads and writes that are carried out together in
+ * one command mode session. Writes send the value currently held in the
+ * modules xbee_settings, reads store the reply there.
+ */
+typedef struct {
+	xbee_module *xbee;
+	uint32_t read[XBEE_SETTING_WORDS];	// Bit n set = read xbeeSettingTable[n]
+	uint32_t write[XBEE_SETTING_WORDS];	// Bit n set = write xbeeSettingTable[n]
+	uint8_t failed;						// Commands answered with ERROR
+} xbee_at_batch;
+
+extern const uint32_t baudrates[9];
+
 bool isCoordinator(xbee_module *xbee);
 void xbeeSetDefaultValues(xbee_module *xbee);
-bool xbeeSyncUART();
-XBEE_STAT xbeeEnsureAPIMode();
-XBEE_STAT xbeeInit();
-void xbeeEnterCMDMode();
-void xbeeExitCMDMode();
-void initLocalXbee();
+uint8_t xbeeProbeOrder(xbee_module *xbee, uint32_t *order);
+uint16_t xbeeProbeGuardTime(xbee_module *xbee, uint8_t pass);
+bool xbeeSyncUART(xbee_module *xbee);
+XBEE_STAT xbeeEnsureAPIMode(xbee_module *xbee);
+XBEE_STAT xbeeInit(xbee_radio *radio, UART_HandleTypeDef *hxbee);
+void xbeeEnterCMDMode(xbee_module *xbee);
+void xbeeExitCMDMode(xbee_module *xbee);
+void initLocalXbee(xbee_radio *radio, UART_HandleTypeDef *hxbee, UART_HandleTypeDef *hterm);
+const xbee_setting_desc *xbeeFindSetting(const char *cmd);
+uint64_t xbeeGetSetting(const xbee_settings *settings, uint8_t idx);
+void xbeeSetSetting(xbee_settings *settings, uint8_t idx, uint64_t value);
+void xbeeBatchInit(xbee_at_batch *batch, xbee_module *xbee);
+bool xbeeBatchRead(xbee_at_batch *batch, const char *cmd);
+bool xbeeBatchWrite(xbee_at_batch *batch, const char *cmd);
+XBEE_STAT xbeeBatchRun(xbee_at_batch *batch, uint8_t flags);
+XBEE_STAT xbeeReadSettings(xbee_module *xbee);
+void xbeeChangeSetting(xbee_module *xbee, uint8_t idx, uint64_t value);
+void xbeeMarkDirty(xbee_module *xbee, uint8_t idx);
+uint8_t xbeeEncodeSetting(const xbee_settings *settings, uint8_t idx, uint8_t *dst);
+XBEE_STAT xbeeSyncSettings(xbee_module *xbee);
+XBEE_STAT xbeeSendFrame(xbee_module *xbee, const uint8_t *data, uint16_t len);
+XBEE_STAT xbeeSendBlock(xbee_module *xbee, xbee_frame *frame);
+const uint8_t *xbeeRxData(xbee_frame *frame, uint8_t *len);
+bool xbeeRxSource(xbee_frame *frame, uint32_t *sh, uint32_t *sl, uint16_t *my);
+uint8_t xbeeNextFrameId(xbee_module *xbee);
+void xbeeParserReset(xbee_parser *parser);
+void xbeeParseBytes(xbee_module *xbee, const uint8_t *data, uint16_t len);
+void xbeeReceive(xbee_module *xbee);
+uint8_t xbeeChecksum(const uint8_t *data, uint16_t len);
+uint16_t xbeeEncodeFrame(uint8_t *dst, uint16_t size, const uint8_t *data, uint16_t len);
+uint16_t xbeeEscapeScan(const uint8_t *data, uint16_t len);
+uint16_t xbeeEscapedLength(const uint8_t *data, uint16_t len);
+uint16_t xbeeEscape(uint8_t *dst, uint16_t size, const uint8_t *data, uint16_t len);
 
 #endif /* XBEE_S2C_LIB_INC_XBEELIB_H_ */
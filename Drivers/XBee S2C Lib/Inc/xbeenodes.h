@@ -0,0 +1,93 @@
+/*
+Copyright 2018 Jesper Wlivaara
+
+Permission is hereby granted, free of charge, to any person obtaining
+a copy of this software and associated documentation files (the "Software"),
+to deal in the Software without restriction, including without limitation the
+rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is furnished to
+do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all copies
+or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR
+PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE
+FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+
+#ifndef XBEE_S2C_LIB_INC_XBEENODES_H_
+#define XBEE_S2C_LIB_INC_XBEENODES_H_
+
+#include "stdint.h"
+#include "string.h"
+#include "stdbool.h"
+
+/*
+ * GENERAL SETTINGS
+ * MODIFY TO FIT YOUR APPLICATION
+ */
+
+// Remote nodes the registry can hold, the least recently used
+// node is evicted when a new one arrives and the registry is full.
+// 60 bytes of RAM per node, at most 65534.
+#ifndef XBEE_MAX_NODES
+#define XBEE_MAX_NODES 64
+#endif
+
+// Hash buckets per address type, must be a power of two
+#ifndef XBEE_NODE_BUCKETS
+#define XBEE_NODE_BUCKETS 64
+#endif
+
+#define XBEE_NODE_NONE 0xFFFF		// End of a chain/list
+#define XBEE_ADDR16_UNKNOWN 0xFFFE	// MY of a node without a 16-bit address
+
+/*
+ * What is kept about every remote node: its addresses, name and
+ * a few link statistics. The full xbee_settings are only kept for
+ * modules that are actually being configured (see xbee_module).
+ */
+typedef struct {
+	uint32_t SH;			// 64-bit address High
+	uint32_t SL;			// 64-bit address Low
+	uint16_t MY;			// 16-bit address, XBEE_ADDR16_UNKNOWN if none
+	char NI[21];			// Node Identifier, NULL terminated
+	uint8_t rssi;			// Signal strength of the last packet (-dBm)
+	uint32_t lastseen;		// HAL tick of the last packet
+	uint32_t rxframes;		// Packets received from the node
+	uint32_t txframes;		// Packets sent to the node
+	uint32_t txfail;		// Packets to the node that were not acknowledged
+	uint16_t next64;		// Next node in the same 64-bit hash bucket
+	uint16_t next16;		// Next node in the same 16-bit hash bucket
+	uint16_t prev;			// Neighbours in the LRU list (or free list)
+	uint16_t next;
+	bool used;
+} xbee_node;
+
+/*
+ * Fixed size node registry. Nodes are found through two chained hash
+ * tables (64-bit and 16-bit address) and kept in a least recently used
+ * list, so lookups are O(1) on average and no memory is ever allocated.
+ */
+typedef struct {
+	xbee_node node[XBEE_MAX_NODES];
+	uint16_t bucket64[XBEE_NODE_BUCKETS];
+	uint16_t bucket16[XBEE_NODE_BUCKETS];
+	uint16_t mru;			// Most recently used node
+	uint16_t lru;			// Least recently used node
+	uint16_t freelist;
+	uint16_t count;
+	uint32_t evictions;
+} xbee_nodetable;
+
+void xbeeNodesInit(xbee_nodetable *table);
+xbee_node *xbeeNodeFind64(xbee_nodetable *table, uint32_t sh, uint32_t sl);
+xbee_node *xbeeNodeFind16(xbee_nodetable *table, uint16_t my);
+xbee_node *xbeeNodeAdd(xbee_nodetable *table, uint32_t sh, uint32_t sl, uint16_t my);
+void xbeeNodeSetMY(xbee_nodetable *table, xbee_node *node, uint16_t my);
+void xbeeNodeRemove(xbee_nodetable *table, xbee_node *node);
+
+#endif /* XBEE_S2C_LIB_INC_XBEENODES_H_ */
@@ -0,0 +1,85 @@
+/*
+Copyright 2018 Jesper Wlivaara
+
+Permission is hereby granted, free of charge, to any person obtaining
+a copy of this software and associated documentation files (the "Software"),
+to deal in the Software without restriction, including without limitation the
+rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is furnished to
+do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all copies
+or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR
+PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE
+FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+
+#ifndef XBEE_S2C_LIB_INC_XBEEPOOL_H_
+#define XBEE_S2C_LIB_INC_XBEEPOOL_H_
+
+/*
+ * Fixed-block API frame pool.
+ * This header is included by xbeelib.h, include that one instead.
+ */
+
+/*
+ * GENERAL SETTINGS
+ * MODIFY TO FIT YOUR APPLICATION
+ */
+
+// Number of frame blocks, at most 254. RAM used is XBEE_POOL_BLOCKS *
+// sizeof(xbee_frame), about 140 bytes each with XBEE_API_MAX_FRAME at 128.
+// Received frames and TX requests waiting in their class queue share the
+// blocks.
+#ifndef XBEE_POOL_BLOCKS
+#define XBEE_POOL_BLOCKS 10
+#endif
+
+// Room in front of the frame data for the start delimiter and length,
+// so a block can be sent as a complete API frame where it is
+#define XBEE_FRAME_HEADROOM 3
+
+#define XBEE_POOL_NONE 0xFF
+
+/*
+ * One API frame. The frame data (API identifier first) is stored at
+ * raw[XBEE_FRAME_HEADROOM], leaving room to wrap it into a complete
+ * frame in place. Blocks are reference counted: whoever holds on to a
+ * block past the call it was handed over in takes a reference with
+ * xbeeFrameRef(), and every reference is given back with xbeeFrameRelease().
+ */
+typedef struct {
+	uint8_t raw[XBEE_FRAME_HEADROOM + XBEE_API_MAX_FRAME + 1];	// 0x7E | Length | Frame data | Checksum
+	uint16_t len;			// Length of the frame data
+	volatile uint8_t refs;
+	uint8_t next;			// Free list link
+	struct xbee_pool *pool;	// Pool the block belongs to
+} xbee_frame;
+
+typedef struct xbee_pool {
+	xbee_frame block[XBEE_POOL_BLOCKS];
+	uint8_t freelist;
+	uint8_t used;			// Blocks currently handed out
+	uint8_t highwater;		// Most blocks handed out at once
+	uint32_t allocs;
+	uint32_t exhausted;		// Allocations refused because every block was in use
+} xbee_pool;
+
+/*
+ * Frame data (API identifier first) of a block.
+ */
+static inline uint8_t *xbeeFrameData(xbee_frame *frame)
+{
+	return &frame->raw[XBEE_FRAME_HEADROOM];
+}
+
+void xbeePoolInit(xbee_pool *pool);
+xbee_frame *xbeeFrameAlloc(xbee_pool *pool);
+void xbeeFrameRef(xbee_frame *frame);
+void xbeeFrameRelease(xbee_pool *pool, xbee_frame *frame);
+
+#endif /* XBEE_S2C_LIB_INC_XBEEPOOL_H_ */
@@ -0,0 +1,66 @@
+/*
+Copyright 2018 Jesper Wlivaara
+
+Permission is hereby granted, free of charge, to any person obtaining
+a copy of this software and associated documentation files (the "Software"),
+to deal in the Software without restriction, including without limitation the
+rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is furnished to
+do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all copies
+or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR
+PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE
+FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+
+#ifndef XBEE_S2C_LIB_INC_XBEEPORT_H_
+#define XBEE_S2C_LIB_INC_XBEEPORT_H_
+
+/*
+ * Platform seam of the driver.
+ *
+ * Everything the driver (and the UART helpers in miscfunc.c) needs from
+ * the platform is listed below. On target it all comes from the STM32 HAL.
+ * To build for something else, e.g. a host build running against a model
+ * of the radio, define XBEE_PORT_HEADER (-DXBEE_PORT_HEADER=\"hostport.h\")
+ * as a header that provides the same names:
+ *
+ *	- UART_HandleTypeDef and DMA_HandleTypeDef with the members
+ *	  Instance, hdmarx, hdmatx, Init.BaudRate and Init.Mode
+ *	- HAL_UART_Init, HAL_UART_Abort, HAL_UART_Transmit,
+ *	  HAL_UART_Transmit_DMA, HAL_UART_Transmit_IT, HAL_UART_Receive_DMA
+ *	  and HAL_DMA_Init, with HAL_StatusTypeDef and HAL_OK
+ *	- __HAL_UART_GET_FLAG, __HAL_UART_CLEAR_IDLEFLAG, __HAL_UART_ENABLE_IT,
+ *	  __HAL_DMA_GET_COUNTER, UART_FLAG_IDLE, UART_IT_IDLE and DMA_CIRCULAR
+ *	- __get_PRIMASK, __disable_irq, __set_PRIMASK, __WFI, __CLZ and __weak
+ *	- SystemCoreClock, and DWT for the cycle counter (optional, without it
+ *	  platformCycles() returns 0 unless it is replaced)
+ *	- TIM2 with CR1, PSC, ARR, CNT, EGR, SR, DIER and CCR1, TIM2_IRQn,
+ *	  HAL_NVIC_SetPriority and HAL_NVIC_EnableIRQ for platformtimer.c
+ *	  (optional, without TIM2 platformTimeUs() must be provided)
+ *	- HAL_GetTick and HAL_Delay, millisecond time and blocking delay, and
+ *	  HAL_SuspendTick, HAL_ResumeTick and HAL_IncTick for long sleeps
+ *	- HAL_FLASH_Unlock, HAL_FLASH_Lock, HAL_FLASH_Program and
+ *	  HAL_FLASHEx_Erase for the link profile (not used with XBEE_PROFILE_RAM)
+ *
+ * All waiting in the driver (guard times, reply timeouts, retries) is done
+ * through HAL_GetTick and the timer service in platformtimer.c.
+ * HAL_GetTick, platformTimeUs, platformSleep and platformDelayUs are weak,
+ * so they can also be replaced, e.g. by a virtual clock where sleeping
+ * only advances the time to the next timer.
+ *
+ * Test/Inc/hostport.h is such a header, see Test/Makefile.
+ */
+
+#ifdef XBEE_PORT_HEADER
+#include XBEE_PORT_HEADER
+#else
+#include "stm32f3xx_hal.h"
+#endif
+
+#endif /* XBEE_S2C_LIB_INC_XBEEPORT_H_ */
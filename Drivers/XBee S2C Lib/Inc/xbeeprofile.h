@@ -0,0 +1,94 @@
+/*
+Copyright 2018 Jesper Wlivaara
+
+Permission is hereby granted, free of charge, to any person obtaining
+a copy of this software and associated documentation files (the "Software"),
+to deal in the Software without restriction, including without limitation the
+rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is furnished to
+do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all copies
+or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR
+PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE
+FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+
+#ifndef XBEE_S2C_LIB_INC_XBEEPROFILE_H_
+#define XBEE_S2C_LIB_INC_XBEEPROFILE_H_
+
+/*
+ * Link profile of the local module kept in a reserved flash page: the baud
+ * rate and xbee_settings of the last successful bring-up. On the next boot
+ * the profile is checked with a single API frame instead of a full sync.
+ * Every radio keeps its own profile in the page, told apart by UART.
+ * This header is included by xbeelib.h, include that one instead.
+ */
+
+/*
+ * GENERAL SETTINGS
+ * MODIFY TO FIT YOUR APPLICATION
+ */
+
+// Set to 0 to always sync on boot and never touch flash
+#define XBEE_ENABLE_PROFILE 1
+
+// Flash page the profile is kept in. Must be left out of the linker script
+// (default: last 2 KB page of the 64 KB STM32F303K8).
+#define XBEE_PROFILE_ADDR 0x0800F800
+#define XBEE_PROFILE_PAGE_SIZE 2048		// bytes
+
+// Set to 1 to keep the page in RAM instead of flash, for host builds and
+// for trying the warm boot out without wearing the flash
+#ifndef XBEE_PROFILE_RAM
+#define XBEE_PROFILE_RAM 0
+#endif
+
+// Radios whose profiles share the page. Their latest records are written
+// back when the full page is erased, from a copy on the stack
+// (XBEE_PROFILE_RADIOS-1 records of about 150 bytes).
+#ifndef XBEE_PROFILE_RADIOS
+#define XBEE_PROFILE_RADIOS 2
+#endif
+
+// Time the module is given to answer the warm boot probe
+#define XBEE_PROFILE_PROBE_TIMEOUT 100	// milliseconds
+
+// Change when the meaning of a stored profile changes
+#define XBEE_PROFILE_VERSION 2
+
+#define XBEE_PROFILE_MAGIC 0x5842	// "XB"
+
+/*
+ * One record of the page. Records are appended one after another and the
+ * last one of a radio with a matching CRC is the valid one, the page is
+ * only erased when it is full (keeping the latest record of every radio).
+ */
+typedef struct {
+	uint16_t magic;				// XBEE_PROFILE_MAGIC, 0xFFFF = never written
+	uint8_t version;			// XBEE_PROFILE_VERSION
+	uint8_t reserved;
+	uint16_t size;				// sizeof(xbee_settings) when written
+	uint16_t reserved2;
+	uint32_t port;				// UART the radio is on (peripheral address)
+	uint32_t baud;				// UART rate the module answered at
+	xbee_settings settings;
+	uint32_t crc;				// CRC-32 of everything above
+} xbee_profile;
+
+// Records are stored 8-byte aligned
+#define XBEE_PROFILE_SLOT ((sizeof(xbee_profile) + 7) & ~7)
+#define XBEE_PROFILE_SLOTS (XBEE_PROFILE_PAGE_SIZE / XBEE_PROFILE_SLOT)
+
+struct xbee_module;
+
+bool xbeeProfileLoad(xbee_profile *profile, UART_HandleTypeDef *hxbee);
+bool xbeeProfileSave(struct xbee_module *xbee);
+void xbeeProfileErase();
+uint16_t xbeeProfileUsed();
+
+#endif /* XBEE_S2C_LIB_INC_XBEEPROFILE_H_ */
@@ -0,0 +1,130 @@
+/*
+Copyright 2018 Jesper Wlivaara
+
+Permission is hereby granted, free of charge, to any person obtaining
+a copy of this software and associated documentation files (the "Software"),
+to deal in the Software without restriction, including without limitation the
+rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is furnished to
+do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all copies
+or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR
+PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE
+FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+
+#ifndef XBEE_S2C_LIB_INC_XBEEREL_H_
+#define XBEE_S2C_LIB_INC_XBEEREL_H_
+
+/*
+ * Reliable, ordered delivery between two nodes on top of the transmit
+ * API. Frames are numbered, up to "window" of them are in flight, and
+ * the receiver acknowledges cumulatively with a bitmap of the frames it
+ * holds past the gap, in the header of its own frames when there are any.
+ * Frames received twice (a MAC retry after a lost acknowledgement) are
+ * dropped by sequence number, so the application sees every frame once.
+ * This header is included by xbeelib.h, include that one instead.
+ */
+
+/*
+ * GENERAL SETTINGS
+ * MODIFY TO FIT YOUR APPLICATION
+ */
+
+// Largest window, frames a link keeps for retransmission (RAM used is
+// about XBEE_REL_WINDOW * XBEE_MAX_PAYLOAD per link). A power of two, at most 8.
+#define XBEE_REL_WINDOW 8
+
+// Time after which an unacknowledged frame is sent again
+#define XBEE_REL_RTO 150	// milliseconds
+
+// Sends of a frame before the link is given up on
+#define XBEE_REL_RETRIES 6
+
+// Longest an acknowledgement waits for a frame to ride on
+#define XBEE_REL_ACK_DELAY 10	// milliseconds
+
+// First RF payload byte of the frames of a link
+#define XBEE_REL_TYPE 0xA4
+
+// Frame: XBEE_REL_TYPE | Flags | Epoch | Seq | Una | Ack epoch | Ack | Selective ack | Data
+#define XBEE_REL_HEADER 8
+#define XBEE_REL_DATA (XBEE_MAX_PAYLOAD - XBEE_REL_HEADER)	// bytes
+
+// Header flags
+#define XBEE_REL_FLAG_DATA	0x01	// Epoch, Seq and Una number a data frame
+#define XBEE_REL_FLAG_ACK	0x02	// Ack epoch, Ack and Selective ack are valid
+
+typedef enum {
+	XBEE_REL_FREE = 0x0,
+	XBEE_REL_UNSENT = 0x1,		// Waiting for room in the transmit queue
+	XBEE_REL_SENT = 0x2			// Waiting for an acknowledgement
+} XBEE_REL_STATE;
+
+struct xbee_module;
+struct xbee_rel_link;
+
+/*
+ * Called with every frame received on the link, in order and once.
+ * The data is in the received frame block and only valid during the call.
+ */
+typedef void (*xbee_rel_callback)(struct xbee_rel_link *link, const uint8_t *data, uint8_t len, void *ctx);
+
+typedef struct {
+	uint8_t state;			// XBEE_REL_STATE
+	uint8_t len;
+	uint8_t tries;			// Times sent
+	bool sacked;			// Held by the receiver past a gap
+	bool fast;				// Already sent again because of a gap
+	uint32_t sent;			// HAL tick of the latest send
+	uint8_t data[XBEE_REL_DATA];
+} xbee_rel_entry;
+
+/*
+ * One end of a link to a peer. Sequence numbers are 8-bit and start over
+ * in a new epoch whenever a link is initialized. Data frames carry the
+ * oldest frame not acknowledged yet (Una), so a receiver that meets a new
+ * epoch, because either end started over, delivers from there on.
+ */
+typedef struct xbee_rel_link {
+	struct xbee_module *xbee;
+	uint32_t sh;			// 64-bit address of the peer
+	uint32_t sl;
+	uint16_t my;			// 16-bit address of the peer, XBEE_ADDR16_UNKNOWN to send by sh/sl
+	uint8_t window;			// Frames allowed in flight (1..XBEE_REL_WINDOW)
+	uint8_t options;		// XBEE_TXOPT_xx of the data frames
+	uint8_t epoch;			// Epoch of the frames sent
+	uint8_t una;			// Oldest frame not acknowledged
+	uint8_t nxt;			// Next sequence number to send
+	bool broken;			// A frame ran out of retries, no more are taken
+	xbee_rel_entry entry[XBEE_REL_WINDOW];	// Indexed by sequence number
+	bool synced;			// Epoch of the peer is known
+	uint8_t peerepoch;		// Epoch of the frames received
+	uint8_t expected;		// Next sequence number to deliver
+	bool ackpending;		// An acknowledgement is owed
+	uint32_t ackdue;		// HAL tick it is sent at on its own
+	xbee_frame *held[XBEE_REL_WINDOW];	// Received past a gap, indexed by sequence number
+	platform_timer timer;	// Wakes the main loop for retransmissions and acknowledgements
+	xbee_rel_callback cb;
+	void *ctx;
+	uint32_t sentframes;	// Data frames sent, retransmissions included
+	uint32_t retransmits;
+	uint32_t delivered;		// Frames handed to the application
+	uint32_t duplicates;	// Frames received again and dropped
+	uint32_t acks;			// Acknowledgements sent on their own
+} xbee_rel_link;
+
+void xbeeRelInit(xbee_rel_link *link, struct xbee_module *xbee, uint32_t sh, uint32_t sl, uint16_t my,
+				 uint8_t window, uint8_t options, xbee_rel_callback cb, void *ctx);
+void xbeeRelSetWindow(xbee_rel_link *link, uint8_t window);
+XBEE_STAT xbeeRelSend(xbee_rel_link *link, const uint8_t *data, uint8_t len);
+uint8_t xbeeRelPending(xbee_rel_link *link);
+bool xbeeRelHandleFrame(xbee_rel_link *link, xbee_frame *frame);
+void xbeeRelService(xbee_rel_link *link);
+
+#endif /* XBEE_S2C_LIB_INC_XBEEREL_H_ */
@@ -0,0 +1,119 @@
+/*
+Copyright 2018 Jesper Wlivaara
+
+Permission is hereby granted, free of charge, to any person obtaining
+a copy of this software and associated documentation files (the "Software"),
+to deal in the Software without restriction, including without limitation the
+rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is furnished to
+do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all copies
+or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR
+PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE
+FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+
+#ifndef XBEE_S2C_LIB_INC_XBEEREMOTE_H_
+#define XBEE_S2C_LIB_INC_XBEEREMOTE_H_
+
+/*
+ * Pipelined Remote AT Commands (0x17/0x97). Asynchronous local AT
+ * Commands (0x08/0x88) go through the same queue.
+ * This header is included by xbeelib.h, include that one instead.
+ */
+
+/*
+ * GENERAL SETTINGS
+ * MODIFY TO FIT YOUR APPLICATION
+ */
+
+// Remote AT requests that can be queued, and how many of them
+// may wait for their response at the same time
+#define XBEE_RAT_QUEUE 8
+#define XBEE_RAT_INFLIGHT 4
+
+// Time to wait for a Remote AT Command Response, and how many
+// times a request is resent before it is given up on
+#define XBEE_RAT_TIMEOUT 1500	// milliseconds
+#define XBEE_RAT_RETRIES 2
+
+// Largest parameter value of a remote request (NI is 20 characters)
+#define XBEE_RAT_MAX_PARAM 20	// bytes
+
+// Remote AT request options
+#define XBEE_RATOPT_APPLY 0x02	// Apply changes on the remote module
+
+/*
+ * Command status as reported in the response frame (0x97),
+ * plus XBEE_RATS_TIMEOUT when all retries went unanswered.
+ */
+typedef enum {
+	XBEE_RATS_OK = 0x0,
+	XBEE_RATS_ERROR = 0x1,
+	XBEE_RATS_INVALID_CMD = 0x2,
+	XBEE_RATS_INVALID_PARAM = 0x3,
+	XBEE_RATS_TX_FAILURE = 0x4,		// Remote module could not be reached
+	XBEE_RATS_TIMEOUT = 0xFF
+} XBEE_RAT_STATUS;
+
+typedef enum {
+	XBEE_RAT_FREE = 0x0,
+	XBEE_RAT_QUEUED = 0x1,		// Waiting for a free place in flight
+	XBEE_RAT_SENT = 0x2			// Waiting for the response
+} XBEE_RAT_STATE;
+
+struct xbee_module;
+
+/*
+ * Called when a request is finished. "data" holds the returned parameter
+ * value (for reads) and is only valid during the call. "node" is NULL for
+ * local requests and for remote nodes that could not be reached.
+ */
+typedef void (*xbee_rat_callback)(struct xbee_module *xbee, xbee_node *node, const char *cmd,
+								  uint8_t status, const uint8_t *data, uint8_t len, void *ctx);
+
+typedef struct {
+	uint8_t state;			// XBEE_RAT_STATE
+	uint8_t frameid;
+	uint8_t tries;			// Transmissions so far
+	uint8_t options;		// XBEE_RATOPT_xx
+	bool local;				// Local AT Command, sh/sl unused
+	uint32_t seq;			// Submission order
+	uint32_t sent;			// HAL tick of the last transmission
+	uint32_t sh;			// Destination 64-bit address
+	uint32_t sl;
+	char cmd[2];
+	uint8_t plen;
+	uint8_t param[XBEE_RAT_MAX_PARAM];
+	xbee_rat_callback cb;
+	void *ctx;
+} xbee_rat_request;
+
+typedef struct {
+	xbee_rat_request req[XBEE_RAT_QUEUE];
+	uint8_t inflight;
+	uint32_t seq;
+	uint32_t completed;
+	uint32_t failed;
+	uint32_t retries;
+} xbee_ratstate;
+
+void xbeeRemoteATInit(xbee_ratstate *rat);
+XBEE_STAT xbeeRemoteAT(struct xbee_module *xbee, uint32_t sh, uint32_t sl, const char *cmd,
+					   const uint8_t *param, uint8_t plen, uint8_t options,
+					   xbee_rat_callback cb, void *ctx);
+XBEE_STAT xbeeLocalAT(struct xbee_module *xbee, const char *cmd, const uint8_t *param, uint8_t plen,
+					  xbee_rat_callback cb, void *ctx);
+XBEE_STAT xbeeRemoteATSet(struct xbee_module *xbee, uint32_t sh, uint32_t sl, const char *cmd,
+						  uint32_t value, uint8_t options, xbee_rat_callback cb, void *ctx);
+bool xbeeRemoteATBusy(struct xbee_module *xbee, uint8_t frameid);
+uint8_t xbeeRemoteATPending(struct xbee_module *xbee);
+void xbeeRemoteATHandleResponse(struct xbee_module *xbee, const uint8_t *frame, uint16_t len);
+void xbeeRemoteATService(struct xbee_module *xbee);
+
+#endif /* XBEE_S2C_LIB_INC_XBEEREMOTE_H_ */
@@ -0,0 +1,88 @@
+/*
+Copyright 2018 Jesper Wlivaara
+
+Permission is hereby granted, free of charge, to any person obtaining
+a copy of this software and associated documentation files (the "Software"),
+to deal in the Software without restriction, including without limitation the
+rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is furnished to
+do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all copies
+or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR
+PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE
+FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+
+#ifndef XBEE_S2C_LIB_INC_XBEESTATS_H_
+#define XBEE_S2C_LIB_INC_XBEESTATS_H_
+
+/*
+ * Runtime statistics of an xbee module.
+ * This header is included by xbeelib.h, include that one instead.
+ */
+
+/*
+ * GENERAL SETTINGS
+ * MODIFY TO FIT YOUR APPLICATION
+ */
+
+// Recording costs a few cycles per frame and is meant to stay enabled
+#ifndef XBEE_ENABLE_STATS
+#define XBEE_ENABLE_STATS 1
+#endif
+
+// Bucket n of a histogram counts latencies of 2^n to 2^(n+1)-1 cycles
+#define XBEE_HIST_BUCKETS 32
+
+// Version and size of the binary layout written by xbeeStatsDump()
+#define XBEE_STATS_VERSION 2
+#define XBEE_STATS_VALUES (15 + (2+XBEE_TX_CLASSES)*(XBEE_HIST_BUCKETS+1))
+#define XBEE_STATS_DUMP_SIZE (4 + 4*XBEE_STATS_VALUES)
+
+typedef struct {
+	uint32_t bucket[XBEE_HIST_BUCKETS];
+	uint32_t max;			// Longest latency seen (cycles)
+} xbee_hist;
+
+/*
+ * Counters that are not kept elsewhere already. The parser, the UART
+ * rings and queues, the TX window and the frame pool each count their
+ * own errors, xbeeStatsPrint() and xbeeStatsDump() gather them all.
+ */
+typedef struct {
+	uint32_t rxstamp;		// Cycle count the input being parsed was received at, 0 if unknown
+	uint32_t txnoack;		// TX Status: no MAC acknowledgement (as counted by EA)
+	uint32_t txcca;			// TX Status: clear channel assessment failure (as counted by EC)
+	uint32_t txpurged;		// TX Status: purged
+	xbee_hist rxlatency;	// UART reception to application callback
+	xbee_hist txlatency;	// Frame handed to the UART (submitted to the window) to TX Status
+	xbee_hist txqueue[XBEE_TX_CLASSES];	// xbeeTransmit() to handed to the UART, per class
+} xbee_stats;
+
+/*
+ * Adds a latency to a histogram.
+ */
+static inline void xbeeStatsRecord(xbee_hist *hist, uint32_t cycles)
+{
+#if XBEE_ENABLE_STATS
+	++hist->bucket[(cycles != 0) ? 31 - __CLZ(cycles) : 0];
+	if(cycles > hist->max)
+	{
+		hist->max = cycles;
+	}
+#endif
+}
+
+struct xbee_module;
+struct terminal;
+
+void xbeeStatsReset(struct xbee_module *xbee);
+void xbeeStatsPrint(struct xbee_module *xbee, struct terminal *term);
+uint16_t xbeeStatsDump(struct xbee_module *xbee, uint8_t *dst, uint16_t size);
+
+#endif /* XBEE_S2C_LIB_INC_XBEESTATS_H_ */
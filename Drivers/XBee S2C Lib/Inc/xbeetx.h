@@ -0,0 +1,154 @@
+/*
+Copyright 2018 Jesper Wlivaara
+
+Permission is hereby granted, free of charge, to any person obtaining
+a copy of this software and associated documentation files (the "Software"),
+to deal in the Software without restriction, including without limitation the
+rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is furnished to
+do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all copies
+or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR
+PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE
+FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+
+#ifndef XBEE_S2C_LIB_INC_XBEETX_H_
+#define XBEE_S2C_LIB_INC_XBEETX_H_
+
+/*
+ * Asynchronous transmission of RF data (TX64/TX16 requests).
+ * Requests are queued in two classes. Urgent frames (actuator set-points
+ * and the like) are sent ahead of queued bulk frames, while bulk frames
+ * are still let through at a bounded rate.
+ * This header is included by xbeelib.h, include that one instead.
+ */
+
+/*
+ * GENERAL SETTINGS
+ * MODIFY TO FIT YOUR APPLICATION
+ */
+
+// Most frames that can wait for a TX Status at the same time
+#define XBEE_TX_WINDOW 8
+
+// Frames that can be queued or in flight at the same time, both classes
+// together. Every queued frame holds a block of the frame pool.
+#define XBEE_TX_QUEUE 12
+
+// Places of XBEE_TX_QUEUE that only urgent frames can take, so a backlog
+// of bulk frames never refuses an urgent one
+#define XBEE_TX_URGENT_RESERVE 4
+
+// Pool blocks a queued urgent frame never takes, so received frames (the
+// TX Status ones included) always find a block. Bulk frames leave twice as many.
+#define XBEE_TX_POOL_RESERVE 2
+
+// Bulk frames in flight at once. Every one of them may be ahead of an
+// urgent frame inside the module, so this bounds the wait of urgent frames.
+// Two keep one bulk frame on the air while the next one is on its way.
+#define XBEE_TX_BULK_INFLIGHT 2
+
+// Urgent frames sent in a row while bulk frames wait, before one bulk
+// frame is let through. Bulk traffic gets at least 1/(BURST+1) of the sends.
+#define XBEE_TX_URGENT_BURST 4
+
+// Time to wait for a TX Status before a frame is given up on
+#define XBEE_TX_TIMEOUT 1000	// milliseconds
+
+// Largest RF payload of one TX request (802.15.4 firmware)
+#define XBEE_MAX_PAYLOAD 100	// bytes
+
+// TX request options
+#define XBEE_TXOPT_NOACK		0x01	// Disable MAC acknowledgement
+#define XBEE_TXOPT_BROADCAST_PAN	0x04	// Send to broadcast PAN ID
+#define XBEE_TXOPT_URGENT		0x80	// Urgent class (driver only, not sent to the module)
+
+// Priority classes, urgent first
+typedef enum {
+	XBEE_TX_URGENT = 0x0,
+	XBEE_TX_BULK = 0x1
+} XBEE_TX_CLASS;
+
+#define XBEE_TX_CLASSES 2
+
+/*
+ * Delivery status as reported in the TX Status frame (0x89),
+ * plus XBEE_TXS_TIMEOUT when no status arrived in time.
+ */
+typedef enum {
+	XBEE_TXS_SUCCESS = 0x0,
+	XBEE_TXS_NOACK = 0x1,		// No MAC acknowledgement received
+	XBEE_TXS_CCA = 0x2,			// Clear channel assessment failure
+	XBEE_TXS_PURGED = 0x3,		// Transmission purged
+	XBEE_TXS_TIMEOUT = 0xFF		// No TX Status received within XBEE_TX_TIMEOUT
+} XBEE_TX_STATUS;
+
+typedef enum {
+	XBEE_TX_FREE = 0x0,
+	XBEE_TX_PENDING = 0x1,		// Waiting for TX Status
+	XBEE_TX_DONE = 0x2,			// Status received, waiting to be polled
+	XBEE_TX_QUEUED = 0x3		// Waiting for room in the window
+} XBEE_TX_STATE;
+
+struct xbee_module;
+
+/*
+ * Called when the TX Status of a frame arrives (or it times out).
+ */
+typedef void (*xbee_tx_callback)(struct xbee_module *xbee, uint8_t frameid, uint8_t status, void *ctx);
+
+typedef struct {
+	uint8_t frameid;
+	uint8_t state;			// XBEE_TX_STATE
+	uint8_t status;			// XBEE_TX_STATUS once done
+	uint8_t cls;			// XBEE_TX_CLASS
+	uint16_t seq;			// Queue order within the class
+	xbee_frame *frame;		// Request waiting to be sent (XBEE_TX_QUEUED only)
+	uint32_t submitted;		// HAL tick when handed to the UART
+	uint32_t cycles;		// Cycle count when queued, then when handed to the UART
+	xbee_node *node;		// Destination in the node registry, if known
+	xbee_tx_callback cb;
+	void *ctx;
+} xbee_tx_slot;
+
+/*
+ * Frames queued and in flight on a local module. Up to "window" frames are
+ * sent before the first TX Status comes back, which keeps both the UART and
+ * the radio busy while earlier frames still wait for their MAC
+ * acknowledgement. Frames beyond that wait in their class queue.
+ */
+typedef struct {
+	xbee_tx_slot slot[XBEE_TX_QUEUE];
+	uint8_t window;			// Frames allowed in flight (1..XBEE_TX_WINDOW)
+	uint8_t inflight;		// Frames waiting for TX Status
+	uint8_t bulkinflight;	// Of which bulk frames
+	uint8_t queued[XBEE_TX_CLASSES];	// Frames waiting to be sent, per class
+	uint8_t burst;			// Urgent frames sent in a row while bulk frames waited
+	uint8_t frameid;		// Last frame ID handed out
+	uint16_t seq;			// Last queue order handed out
+	uint32_t fairshare;		// Bulk frames let through ahead of waiting urgent frames
+	uint32_t sent;
+	uint32_t acked;
+	uint32_t failed;
+	uint32_t timeouts;
+} xbee_txstate;
+
+void xbeeTxInit(xbee_txstate *tx);
+void xbeeTxSetWindow(struct xbee_module *xbee, uint8_t window);
+XBEE_STAT xbeeTransmit64(struct xbee_module *xbee, uint32_t sh, uint32_t sl, const uint8_t *data, uint8_t len,
+						 uint8_t options, xbee_tx_callback cb, void *ctx, uint8_t *frameid);
+XBEE_STAT xbeeTransmit16(struct xbee_module *xbee, uint16_t my, const uint8_t *data, uint8_t len,
+						 uint8_t options, xbee_tx_callback cb, void *ctx, uint8_t *frameid);
+XBEE_STAT xbeeTransmitTo(struct xbee_module *xbee, uint32_t sh, uint32_t sl, uint16_t my, const uint8_t *data,
+						 uint8_t len, uint8_t options, xbee_tx_callback cb, void *ctx, uint8_t *frameid);
+XBEE_TX_STATE xbeeTxPoll(struct xbee_module *xbee, uint8_t frameid, uint8_t *status);
+void xbeeTxHandleStatus(struct xbee_module *xbee, const uint8_t *frame, uint16_t len);
+void xbeeTxService(struct xbee_module *xbee);
+
+#endif /* XBEE_S2C_LIB_INC_XBEETX_H_ */
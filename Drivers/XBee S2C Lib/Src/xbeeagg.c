@@ -0,0 +1,303 @@
+/*
+Copyright 2018 Jesper Wlivaara
+
+Permission is hereby granted, free of charge, to any person obtaining
+a copy of this software and associated documentation files (the "Software"),
+to deal in the Software without restriction, including without limitation the
+rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is furnished to
+do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all copies
+or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR
+PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE
+FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+
+#include "xbeelib.h"
+
+
+/*
+ *	Sets up an aggregator in front of a local module.
+ *
+ *	@param *agg, aggregator to initialize
+ *	@param *xbee, handle for the local xbee module the payloads are sent with
+ */
+void xbeeAggInit(xbee_aggregator *agg, xbee_module *xbee)
+{
+	platformTimerStop(&agg->timer);
+	memset(agg, 0, sizeof(xbee_aggregator));
+	agg->xbee = xbee;
+}
+
+
+/*
+ *	Finds the stream of a destination, or starts a new one.
+ *
+ *	@param *agg, aggregator to use
+ *	@param sh, sl, 64-bit destination address
+ *	@param my, 16-bit destination address, XBEE_ADDR16_UNKNOWN to send by sh/sl
+ *	@param deadline, longest a record may wait before it is sent (ms)
+ *	@param options, XBEE_TXOPT_xx of the payloads
+ *	@retval the stream, NULL if every stream is in use
+ */
+xbee_agg_stream *xbeeAggOpen(xbee_aggregator *agg, uint32_t sh, uint32_t sl, uint16_t my,
+							 uint16_t deadline, uint8_t options)
+{
+	xbee_agg_stream *free = NULL;
+
+	for(int i = 0; i < XBEE_AGG_STREAMS; ++i)
+	{
+		xbee_agg_stream *stream = &agg->stream[i];
+		if(!stream->used)
+		{
+			if(free == NULL)
+			{
+				free = stream;
+			}
+		}
+		else if(stream->my == my && (my != XBEE_ADDR16_UNKNOWN || (stream->sh == sh && stream->sl == sl)))
+		{
+			stream->deadline = deadline;
+			stream->options = options;
+			return stream;
+		}
+	}
+	if(free != NULL)
+	{
+		memset(free, 0, sizeof(xbee_agg_stream));
+		free->sh = sh;
+		free->sl = sl;
+		free->my = my;
+		free->deadline = deadline;
+		free->options = options;
+		free->used = true;
+	}
+	return free;
+}
+
+
+/*
+ *	Reports how the payloads did.
+ */
+static void xbeeAggSent(xbee_module *xbee, uint8_t frameid, uint8_t status, void *ctx)
+{
+	xbee_aggregator *agg = (xbee_aggregator *)ctx;
+
+	(void)xbee;
+	(void)frameid;
+	if(status != XBEE_TXS_SUCCESS)
+	{
+		++agg->failed;
+	}
+}
+
+
+/*
+ *	Sends the records waiting in a stream as one payload. When the transmit
+ *	queue is full the records keep waiting and the flush is tried again
+ *	from xbeeAggService().
+ *
+ *	@param *agg, aggregator the stream belongs to
+ *	@param *stream, stream to send
+ *	@retval XBEE_MSG_OK (also when no record waits), or the error of the
+ *			transmit queue
+ */
+XBEE_STAT xbeeAggFlush(xbee_aggregator *agg, xbee_agg_stream *stream)
+{
+	if(stream->len == 0)
+	{
+		return XBEE_MSG_OK;
+	}
+	XBEE_STAT stat = xbeeTransmitTo(agg->xbee, stream->sh, stream->sl, stream->my, stream->payload,
+									stream->len, stream->options, xbeeAggSent, agg, NULL);
+	if(stat != XBEE_MSG_OK)
+	{
+		return stat;
+	}
+
+	xbeeStatsRecord(&agg->wait, platformCycles() - stream->cycles);
+	++agg->payloads;
+	stream->len = 0;
+	stream->records = 0;
+	return XBEE_MSG_OK;
+}
+
+
+/*
+ *	Sends whatever waits in a stream and gives the stream up. If the
+ *	records can not be queued the stream stays open with them, so that
+ *	the close can be tried again (or xbeeAggService() sends them).
+ *
+ *	@param *agg, aggregator the stream belongs to
+ *	@param *stream, stream to close
+ *	@retval XBEE_MSG_OK if the stream was closed, or the error of the
+ *			transmit queue
+ */
+XBEE_STAT xbeeAggClose(xbee_aggregator *agg, xbee_agg_stream *stream)
+{
+	XBEE_STAT stat = xbeeAggFlush(agg, stream);
+	if(stat != XBEE_MSG_OK)
+	{
+		return stat;
+	}
+
+	stream->used = false;
+	return XBEE_MSG_OK;
+}
+
+
+/*
+ *	Sets the timer to wake the main loop when the soonest deadline of the
+ *	waiting records is due.
+ */
+static void xbeeAggArm(xbee_aggregator *agg)
+{
+	uint32_t now = HAL_GetTick();
+	uint32_t soonest = UINT32_MAX;
+
+	for(int i = 0; i < XBEE_AGG_STREAMS; ++i)
+	{
+		xbee_agg_stream *stream = &agg->stream[i];
+		if(stream->used && stream->len > 0)
+		{
+			uint32_t waited = now - stream->opened;
+			uint32_t left = (waited < stream->deadline) ? stream->deadline - waited : 0;
+			if(left < soonest)
+			{
+				soonest = left;
+			}
+		}
+	}
+	if(soonest != UINT32_MAX)
+	{
+		// One tick late at most, the deadline is checked in whole ticks
+		platformTimerStart(&agg->timer, (soonest+1)*1000, NULL, NULL);
+	}
+}
+
+
+/*
+ *	Adds a record to the payload of a stream. The payload is sent first if
+ *	the record does not fit in it. A record is never split.
+ *
+ *	@param *agg, aggregator the stream belongs to
+ *	@param *stream, stream of the destination (see xbeeAggOpen())
+ *	@param *data, record
+ *	@param len, record length, 1 to XBEE_AGG_MAX_RECORD bytes
+ *	@retval XBEE_MSG_OK, XBEE_ERR_TX_FULL for a record that is too long,
+ *			or the error of the transmit queue if the waiting payload had
+ *			to be sent and could not be (the record was not taken)
+ */
+XBEE_STAT xbeeAggPut(xbee_aggregator *agg, xbee_agg_stream *stream, const uint8_t *data, uint8_t len)
+{
+	if(len == 0 || len > XBEE_AGG_MAX_RECORD)
+	{
+		return XBEE_ERR_TX_FULL;
+	}
+	if(stream->len > 0 && stream->len + 1 + len > XBEE_MAX_PAYLOAD)
+	{
+		XBEE_STAT stat = xbeeAggFlush(agg, stream);
+		if(stat != XBEE_MSG_OK)
+		{
+			return stat;
+		}
+	}
+
+	if(stream->len == 0)
+	{
+		stream->payload[0] = XBEE_AGG_TYPE;
+		stream->len = 1;
+		stream->opened = HAL_GetTick();
+		stream->cycles = platformCycles();
+		xbeeAggArm(agg);
+	}
+	stream->payload[stream->len++] = len;
+	memcpy(&stream->payload[stream->len], data, len);
+	stream->len += len;
+	++stream->records;
+	++agg->records;
+
+	// Nothing more fits, no reason to wait for the deadline
+	if(stream->len + 2 > XBEE_MAX_PAYLOAD)
+	{
+		xbeeAggFlush(agg, stream);
+	}
+	return XBEE_MSG_OK;
+}
+
+
+/*
+ *	Sends the payloads whose oldest record has reached the deadline of its
+ *	stream, and those that could not be sent before. Call from the main
+ *	loop, the aggregator timer wakes it up when a deadline is due.
+ *
+ *	@param *agg, aggregator to serve
+ */
+void xbeeAggService(xbee_aggregator *agg)
+{
+	uint32_t now = HAL_GetTick();
+
+	for(int i = 0; i < XBEE_AGG_STREAMS; ++i)
+	{
+		xbee_agg_stream *stream = &agg->stream[i];
+		if(stream->used && stream->len > 0 && (now - stream->opened) >= stream->deadline &&
+		   xbeeAggFlush(agg, stream) == XBEE_MSG_OK)
+		{
+			++agg->expired;
+		}
+	}
+	if(!agg->timer.active)
+	{
+		xbeeAggArm(agg);
+	}
+}
+
+
+/*
+ *	Starts walking the records of a received frame.
+ *
+ *	@param *it, iterator to set up
+ *	@param *frame, received frame block
+ *	@retval false if the frame is not an RX Packet with a coalesced payload
+ */
+bool xbeeAggBegin(xbee_agg_iter *it, xbee_frame *frame)
+{
+	uint8_t len;
+	const uint8_t *payload = xbeeRxData(frame, &len);
+
+	if(payload == NULL || len < 1 || payload[0] != XBEE_AGG_TYPE)
+	{
+		return false;
+	}
+	it->data = NULL;
+	it->len = 0;
+	it->pos = &payload[1];
+	it->end = &payload[len];
+	return true;
+}
+
+
+/*
+ *	Moves to the next record of the payload.
+ *
+ *	@param *it, iterator set up by xbeeAggBegin()
+ *	@retval false when there are no more records (or the rest of the
+ *			payload is malformed)
+ */
+bool xbeeAggNext(xbee_agg_iter *it)
+{
+	if(it->pos >= it->end || it->pos[0] == 0 || it->pos[0] > it->end - it->pos - 1)
+	{
+		it->pos = it->end;
+		return false;
+	}
+	it->len = it->pos[0];
+	it->data = &it->pos[1];
+	it->pos += 1 + it->len;
+	return true;
+}
@@ -0,0 +1,168 @@
+/*
+Copyright 2018 Jesper Wlivaara
+
+Permission is hereby granted, free of charge, to any person obtaining
+a copy of this software and associated documentation files (the "Software"),
+to deal in the Software without restriction, including without limitation the
+rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is furnished to
+do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all copies
+or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR
+PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE
+FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+
+#include "xbeelib.h"
+
+
+/*
+ *	Clears the discovery state.
+ *
+ *	@param *nd, discovery state to initialize
+ */
+void xbeeDiscoverInit(xbee_discovery *nd)
+{
+	memset(nd, 0, sizeof(xbee_discovery));
+}
+
+
+/*
+ *	Finishes an ongoing discovery and reports it.
+ */
+static void xbeeDiscoverFinish(xbee_module *xbee)
+{
+	xbee_discovery *nd = &xbee->nd;
+
+	nd->active = false;
+	if(nd->ondone != NULL)
+	{
+		nd->ondone(xbee, nd->found, nd->ctx);
+	}
+}
+
+
+/*
+ *	Starts a Node Discovery through the local module by sending ND as an
+ *	AT Command frame. Every node answers with its own AT Command Response
+ *	(0x88) which is put in the node registry as soon as it is received, so
+ *	the registry is usable long before the discovery is over. The discovery
+ *	ends when the module sends its closing empty response or when NT
+ *	(plus XBEE_ND_MARGIN) has passed, whichever comes first.
+ *
+ *	@param *xbee, handle for the local xbee module
+ *	@param onnode, called for every discovered node (may be NULL)
+ *	@param ondone, called when the discovery is over (may be NULL)
+ *	@param *ctx, passed on to the callbacks
+ *	@retval XBEE_MSG_OK, XBEE_ERR_TX_BUSY if a discovery is already running
+ *			or XBEE_ERR_TX_FULL if the frame could not be queued
+ */
+XBEE_STAT xbeeDiscover(xbee_module *xbee, xbee_nd_callback onnode, xbee_nd_done ondone, void *ctx)
+{
+	xbee_discovery *nd = &xbee->nd;
+	uint8_t nt = (xbee->settings.NT != 0) ? xbee->settings.NT : XBEE_ND_DEFAULT_NT;
+
+	if(nd->active)
+	{
+		return XBEE_ERR_TX_BUSY;
+	}
+
+	uint8_t frameid = xbeeNextFrameId(xbee);
+	uint8_t frame[4] = {XBEE_API_AT_CMD, frameid, 'N', 'D'};
+	if(xbeeSendFrame(xbee, frame, sizeof(frame)) != XBEE_MSG_OK)
+	{
+		return XBEE_ERR_TX_FULL;
+	}
+
+	nd->active = true;
+	nd->frameid = frameid;
+	nd->started = HAL_GetTick();
+	nd->timeout = (uint32_t)nt * 100 + XBEE_ND_MARGIN;
+	nd->found = 0;
+	nd->onnode = onnode;
+	nd->ondone = ondone;
+	nd->ctx = ctx;
+	return XBEE_MSG_OK;
+}
+
+
+/*
+ *	Tells if a frame ID belongs to the ongoing discovery.
+ *
+ *	@param *xbee, handle for the local xbee module
+ *	@param frameid, frame ID to check
+ */
+bool xbeeDiscoverBusy(xbee_module *xbee, uint8_t frameid)
+{
+	return xbee->nd.active && xbee->nd.frameid == frameid;
+}
+
+
+/*
+ *	Handles an AT Command Response (0x88) to ND. Responses that belong
+ *	to something else are ignored.
+ *
+ *	@param *xbee, handle for the local xbee module
+ */
+void xbeeDiscoverHandleResponse(xbee_module *xbee, const uint8_t *frame, uint16_t len)
+{
+	xbee_discovery *nd = &xbee->nd;
+
+	// 0x88 | Frame ID | 'N' 'D' | Status | MY (2) | SH (4) | SL (4) | DB | NI (null terminated)
+	if(!nd->active || len < 5 || frame[1] != nd->frameid || frame[2] != 'N' || frame[3] != 'D')
+	{
+		return;
+	}
+	if(frame[4] != 0 || len == 5)
+	{
+		// An empty response closes the discovery
+		xbeeDiscoverFinish(xbee);
+		return;
+	}
+	if(len < 16)
+	{
+		return;
+	}
+
+	uint16_t my = ((uint16_t)frame[5] << 8) | frame[6];
+	uint32_t sh = ((uint32_t)frame[7] << 24) | ((uint32_t)frame[8] << 16) | ((uint32_t)frame[9] << 8) | frame[10];
+	uint32_t sl = ((uint32_t)frame[11] << 24) | ((uint32_t)frame[12] << 16) | ((uint32_t)frame[13] << 8) | frame[14];
+	xbee_node *node = xbeeNodeAdd(&xbee->radio->nodes, sh, sl, my);
+
+	node->rssi = frame[15];
+	node->lastseen = HAL_GetTick();
+
+	uint16_t n = 0;
+	while(16+n < len && frame[16+n] != 0x0 && n < sizeof(node->NI)-1)
+	{
+		node->NI[n] = frame[16+n];
+		++n;
+	}
+	node->NI[n] = 0x0;
+
+	++nd->found;
+	if(nd->onnode != NULL)
+	{
+		nd->onnode(xbee, node, nd->ctx);
+	}
+}
+
+
+/*
+ *	Ends the ongoing discovery once NT has passed without the module
+ *	closing it. Call regularly from the main loop.
+ *
+ *	@param *xbee, handle for the local xbee module
+ */
+void xbeeDiscoverService(xbee_module *xbee)
+{
+	if(xbee->nd.active && (HAL_GetTick() - xbee->nd.started) > xbee->nd.timeout)
+	{
+		xbeeDiscoverFinish(xbee);
+	}
+}
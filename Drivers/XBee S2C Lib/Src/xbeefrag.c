@@ -0,0 +1,456 @@
+/*
+Copyright 2018 Jesper Wlivaara
+
+Permission is hereby granted, free of charge, to any person obtaining
+a copy of this software and associated documentation files (the "Software"),
+to deal in the Software without restriction, including without limitation the
+rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is furnished to
+do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all copies
+or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR
+PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE
+FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+
+#include "xbeelib.h"
+
+
+/*
+ *	Bitmap with the first "count" fragments set.
+ */
+static inline uint32_t xbeeFragMask(uint8_t count)
+{
+	return (count >= 32) ? 0xFFFFFFFF : ((uint32_t)1 << count) - 1;
+}
+
+
+/*
+ *	Counts fragments the MAC could not deliver. They are not sent again
+ *	from here, the bitmap of the receiver tells which ones are missing.
+ */
+static void xbeeFragSent(xbee_module *xbee, uint8_t frameid, uint8_t status, void *ctx)
+{
+	xbee_frag_sender *tx = (xbee_frag_sender *)ctx;
+
+	(void)xbee;
+	(void)frameid;
+	if(status != XBEE_TXS_SUCCESS)
+	{
+		++tx->macfail;
+	}
+}
+
+
+/*
+ *	Ends a transfer and reports it.
+ */
+static void xbeeFragFinish(xbee_frag_sender *tx, uint8_t status)
+{
+	platformTimerStop(&tx->timer);
+	tx->state = XBEE_FRAG_IDLE;
+	if(tx->cb != NULL)
+	{
+		tx->cb(tx, status, tx->ctx);
+	}
+}
+
+
+/*
+ *	Hands the fragments of the round to the transmit queue until it is
+ *	full, then waits for the bitmap once the round is out.
+ */
+static void xbeeFragPump(xbee_frag_sender *tx)
+{
+	uint8_t payload[XBEE_MAX_PAYLOAD];
+
+	while(tx->state == XBEE_FRAG_SENDING)
+	{
+		while(tx->next < tx->count && !(tx->tosend & ((uint32_t)1 << tx->next)))
+		{
+			++tx->next;
+		}
+		if(tx->next >= tx->count)
+		{
+			tx->state = XBEE_FRAG_WAITING;
+			tx->deadline = HAL_GetTick() + XBEE_FRAG_ACK_TIMEOUT;
+			platformTimerStart(&tx->timer, XBEE_FRAG_ACK_TIMEOUT*1000, NULL, NULL);
+			return;
+		}
+
+		uint16_t offset = tx->next * XBEE_FRAG_DATA;
+		uint8_t len = (tx->len - offset > XBEE_FRAG_DATA) ? XBEE_FRAG_DATA : tx->len - offset;
+		payload[0] = XBEE_FRAG_TYPE;
+		payload[1] = tx->id;
+		payload[2] = tx->next;
+		payload[3] = tx->count;
+		memcpy(&payload[XBEE_FRAG_HEADER], &tx->data[offset], len);
+		if(xbeeTransmitTo(tx->xbee, tx->sh, tx->sl, tx->my, payload, XBEE_FRAG_HEADER+len, tx->options,
+						  xbeeFragSent, tx, NULL) != XBEE_MSG_OK)
+		{
+			// Transmit queue full, continued from xbeeFragSenderService()
+			return;
+		}
+		tx->tosend &= ~((uint32_t)1 << tx->next);
+		++tx->next;
+		if(++tx->fragments > tx->count)
+		{
+			++tx->resent;
+		}
+	}
+}
+
+
+/*
+ *	Starts sending a block. Returns at once, the fragments go out as the
+ *	transmit queue takes them and the outcome is reported to "cb".
+ *
+ *	@param *tx, sender to use, one block at a time
+ *	@param *xbee, handle for the local xbee module
+ *	@param sh, sl, 64-bit destination address
+ *	@param my, 16-bit destination address, XBEE_ADDR16_UNKNOWN to send by sh/sl
+ *	@param *data, block, left as it is until the callback
+ *	@param len, block length, at most XBEE_FRAG_MAX_FRAGS * XBEE_FRAG_DATA bytes
+ *	@param options, XBEE_TXOPT_xx of the fragments
+ *	@param cb, completion callback (may be NULL)
+ *	@param *ctx, passed on to cb
+ *	@retval XBEE_MSG_OK, XBEE_ERR_TX_BUSY if a block is being sent,
+ *			XBEE_ERR_TX_FULL if the block is too large
+ */
+XBEE_STAT xbeeFragSend(xbee_frag_sender *tx, xbee_module *xbee, uint32_t sh, uint32_t sl, uint16_t my,
+					   const uint8_t *data, uint16_t len, uint8_t options, xbee_frag_callback cb, void *ctx)
+{
+	if(tx->state != XBEE_FRAG_IDLE)
+	{
+		return XBEE_ERR_TX_BUSY;
+	}
+	if(len == 0 || len > XBEE_FRAG_MAX_FRAGS * XBEE_FRAG_DATA)
+	{
+		return XBEE_ERR_TX_FULL;
+	}
+
+	tx->xbee = xbee;
+	tx->sh = sh;
+	tx->sl = sl;
+	tx->my = my;
+	tx->options = options;
+	tx->data = data;
+	tx->len = len;
+	tx->cb = cb;
+	tx->ctx = ctx;
+	++tx->id;
+	tx->count = (len + XBEE_FRAG_DATA - 1) / XBEE_FRAG_DATA;
+	tx->tosend = xbeeFragMask(tx->count);
+	tx->next = 0;
+	tx->retries = XBEE_FRAG_RETRIES;
+	tx->rounds = XBEE_FRAG_ROUNDS;
+	tx->fragments = 0;
+	tx->resent = 0;
+	tx->macfail = 0;
+	tx->state = XBEE_FRAG_SENDING;
+
+	xbeeFragPump(tx);
+	return XBEE_MSG_OK;
+}
+
+
+/*
+ *	Takes the bitmap of the receiver: finishes the transfer, or starts a
+ *	round with the fragments that are missing. Pass every received frame.
+ *
+ *	@param *tx, sender the frame may be for
+ *	@param *frame, received frame block
+ *	@retval true if the frame was a bitmap of the transfer
+ */
+bool xbeeFragSenderHandleFrame(xbee_frag_sender *tx, xbee_frame *frame)
+{
+	uint8_t len;
+	const uint8_t *p = xbeeRxData(frame, &len);
+	uint32_t sh, sl;
+	uint16_t my;
+
+	if(p == NULL || len < 7 || p[0] != XBEE_FRAG_STATUS_TYPE || p[1] != tx->id)
+	{
+		return false;
+	}
+	xbeeRxSource(frame, &sh, &sl, &my);
+	if(my != tx->my || (my == XBEE_ADDR16_UNKNOWN && (sh != tx->sh || sl != tx->sl)))
+	{
+		return false;
+	}
+	if(tx->state == XBEE_FRAG_IDLE)
+	{
+		// Answer to a repeated last fragment of a finished transfer
+		return true;
+	}
+
+	uint32_t held = (uint32_t)p[3] | ((uint32_t)p[4] << 8) | ((uint32_t)p[5] << 16) | ((uint32_t)p[6] << 24);
+	if(p[2] & XBEE_FRAG_ST_DONE)
+	{
+		xbeeFragFinish(tx, XBEE_FRAG_OK);
+	}
+	else if(p[2] & XBEE_FRAG_ST_REFUSED)
+	{
+		xbeeFragFinish(tx, XBEE_FRAG_REFUSED);
+	}
+	else if(tx->rounds == 0)
+	{
+		xbeeFragFinish(tx, XBEE_FRAG_TIMEOUT);
+	}
+	else
+	{
+		--tx->rounds;
+		tx->retries = XBEE_FRAG_RETRIES;
+		tx->tosend = xbeeFragMask(tx->count) & ~held;
+		if(tx->tosend == 0)
+		{
+			// Nothing missing but not done either, the last fragment asks again
+			tx->tosend = (uint32_t)1 << (tx->count-1);
+		}
+		tx->next = 0;
+		tx->state = XBEE_FRAG_SENDING;
+		platformTimerStop(&tx->timer);
+		xbeeFragPump(tx);
+	}
+	return true;
+}
+
+
+/*
+ *	Continues a round the transmit queue had no room for, and sends the
+ *	last fragment again when the bitmap does not arrive, which makes the
+ *	receiver answer. Call from the main loop.
+ *
+ *	@param *tx, sender to serve
+ */
+void xbeeFragSenderService(xbee_frag_sender *tx)
+{
+	if(tx->state == XBEE_FRAG_SENDING)
+	{
+		xbeeFragPump(tx);
+	}
+	else if(tx->state == XBEE_FRAG_WAITING && (int32_t)(HAL_GetTick() - tx->deadline) >= 0)
+	{
+		if(tx->retries == 0)
+		{
+			xbeeFragFinish(tx, XBEE_FRAG_TIMEOUT);
+			return;
+		}
+		--tx->retries;
+		tx->tosend = (uint32_t)1 << (tx->count-1);
+		tx->next = tx->count-1;
+		tx->state = XBEE_FRAG_SENDING;
+		xbeeFragPump(tx);
+	}
+}
+
+
+/*
+ *	Sets up a receiver.
+ *
+ *	@param *rx, receiver to initialize
+ *	@param *xbee, handle for the local xbee module bitmaps are sent with
+ *	@param cb, called with every complete block
+ *	@param *ctx, passed on to cb
+ */
+void xbeeFragReceiverInit(xbee_frag_receiver *rx, xbee_module *xbee,
+						  xbee_frag_receive_callback cb, void *ctx)
+{
+	platformTimerStop(&rx->timer);
+	memset(rx, 0, sizeof(xbee_frag_receiver) - XBEE_FRAG_ARENA);
+	rx->xbee = xbee;
+	rx->cb = cb;
+	rx->ctx = ctx;
+}
+
+
+/*
+ *	Bitmaps are sent in the urgent class and never waited on.
+ */
+static void xbeeFragStatusSent(xbee_module *xbee, uint8_t frameid, uint8_t status, void *ctx)
+{
+	(void)xbee;
+	(void)frameid;
+	(void)status;
+	(void)ctx;
+}
+
+
+/*
+ *	Sends the bitmap of the fragments held to the sender of the block.
+ */
+static void xbeeFragStatus(xbee_frag_receiver *rx, uint8_t flags)
+{
+	uint8_t payload[7];
+
+	payload[0] = XBEE_FRAG_STATUS_TYPE;
+	payload[1] = rx->id;
+	payload[2] = flags;
+	payload[3] = (uint8_t)rx->held;
+	payload[4] = (uint8_t)(rx->held >> 8);
+	payload[5] = (uint8_t)(rx->held >> 16);
+	payload[6] = (uint8_t)(rx->held >> 24);
+	xbeeTransmitTo(rx->xbee, rx->sh, rx->sl, rx->my, payload, sizeof(payload), XBEE_TXOPT_URGENT,
+				   xbeeFragStatusSent, rx, NULL);
+}
+
+
+/*
+ *	Takes a fragment into the arena. A block from another sender is only
+ *	started when the current one is complete or has timed out. Pass every
+ *	received frame.
+ *
+ *	@param *rx, receiver to use
+ *	@param *frame, received frame block
+ *	@retval true if the frame was a fragment
+ */
+bool xbeeFragReceive(xbee_frag_receiver *rx, xbee_frame *frame)
+{
+	uint8_t len;
+	const uint8_t *p = xbeeRxData(frame, &len);
+	uint32_t now = HAL_GetTick();
+	uint32_t sh, sl;
+	uint16_t my;
+
+	if(p == NULL || len < XBEE_FRAG_HEADER || p[0] != XBEE_FRAG_TYPE)
+	{
+		return false;
+	}
+	uint8_t id = p[1];
+	uint8_t idx = p[2];
+	uint8_t count = p[3];
+	uint8_t dlen = len - XBEE_FRAG_HEADER;
+	if(count == 0 || idx >= count || (idx < count-1 && dlen != XBEE_FRAG_DATA))
+	{
+		return true;
+	}
+
+	xbeeRxSource(frame, &sh, &sl, &my);
+	bool sender = (my == rx->my && (my != XBEE_ADDR16_UNKNOWN || (sh == rx->sh && sl == rx->sl)));
+	if(!sender || id != rx->id || (!rx->active && !rx->done))
+	{
+		if(rx->active)
+		{
+			if(!sender && (now - rx->last) < XBEE_FRAG_RX_TIMEOUT)
+			{
+				// Busy with another sender, this one tries again later
+				return true;
+			}
+			++rx->dropped;
+		}
+		rx->sh = sh;
+		rx->sl = sl;
+		rx->my = my;
+		rx->id = id;
+		rx->count = count;
+		rx->held = 0;
+		rx->len = 0;
+		rx->asked = 0;
+		rx->started = now;
+		rx->done = false;
+		rx->active = true;
+		if(count > XBEE_FRAG_MAX_FRAGS || (uint32_t)(count-1) * XBEE_FRAG_DATA >= XBEE_FRAG_ARENA)
+		{
+			rx->active = false;
+			xbeeFragStatus(rx, XBEE_FRAG_ST_REFUSED);
+			return true;
+		}
+	}
+
+	if(rx->done)
+	{
+		// The sender missed the final bitmap
+		++rx->duplicates;
+		if(idx == count-1)
+		{
+			xbeeFragStatus(rx, XBEE_FRAG_ST_DONE);
+		}
+		return true;
+	}
+
+	uint16_t offset = idx * XBEE_FRAG_DATA;
+	if(offset + dlen > XBEE_FRAG_ARENA)
+	{
+		rx->active = false;
+		xbeeFragStatus(rx, XBEE_FRAG_ST_REFUSED);
+		return true;
+	}
+	if(rx->held & ((uint32_t)1 << idx))
+	{
+		++rx->duplicates;
+	}
+	else
+	{
+		memcpy(&rx->arena[offset], &p[XBEE_FRAG_HEADER], dlen);
+		rx->held |= (uint32_t)1 << idx;
+	}
+	if(idx == count-1)
+	{
+		rx->len = offset + dlen;
+	}
+	rx->last = now;
+	rx->asked = 0;
+
+	if(rx->held == xbeeFragMask(count))
+	{
+		platformTimerStop(&rx->timer);
+		rx->active = false;
+		rx->done = true;
+		++rx->blocks;
+		xbeeFragStatus(rx, XBEE_FRAG_ST_DONE);
+		if(rx->cb != NULL)
+		{
+			rx->cb(rx, rx->arena, rx->len, rx->ctx);
+		}
+	}
+	else if(idx == count-1)
+	{
+		// End of a round with gaps, ask for the missing fragments at once
+		xbeeFragStatus(rx, 0);
+		platformTimerStart(&rx->timer, XBEE_FRAG_GAP*1000, NULL, NULL);
+	}
+	else
+	{
+		platformTimerStart(&rx->timer, XBEE_FRAG_GAP*1000, NULL, NULL);
+	}
+	return true;
+}
+
+
+/*
+ *	Asks for the missing fragments of a block that has gone quiet, and
+ *	gives it up after XBEE_FRAG_RX_TIMEOUT. Call from the main loop.
+ *
+ *	@param *rx, receiver to serve
+ */
+void xbeeFragReceiverService(xbee_frag_receiver *rx)
+{
+	if(!rx->active)
+	{
+		return;
+	}
+
+	uint32_t quiet = HAL_GetTick() - rx->last;
+	if(quiet >= XBEE_FRAG_RX_TIMEOUT)
+	{
+		rx->active = false;
+		++rx->dropped;
+		return;
+	}
+	uint32_t due = XBEE_FRAG_GAP * (rx->asked+1);
+	if(quiet >= due && rx->asked < XBEE_FRAG_RETRIES)
+	{
+		++rx->asked;
+		xbeeFragStatus(rx, 0);
+		due += XBEE_FRAG_GAP;
+	}
+	if(!rx->timer.active && rx->asked < XBEE_FRAG_RETRIES && due > quiet)
+	{
+		platformTimerStart(&rx->timer, (due - quiet)*1000, NULL, NULL);
+	}
+}
@@ -0,0 +1,730 @@
+/*
+Copyright 2018 Jesper Wlivaara
+
+Permission is hereby granted, free of charge, to any person obtaining
+a copy of this software and associated documentation files (the "Software"),
+to deal in the Software without restriction, including without limitation the
+rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is furnished to
+do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all copies
+or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR
+PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE
+FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+
+#include "xbeelib.h"
+
+static void xbeeInitReadAP(xbee_module *xbee);
+static void xbeeInitBeginConfig(xbee_module *xbee);
+
+
+/*
+ *	Ends the bring-up (or configuration) and reports the outcome.
+ */
+static void xbeeInitFinish(xbee_module *xbee, XBEE_STAT stat)
+{
+	xbee_initstate *st = &xbee->init;
+
+	platformTimerStop(&st->timer);
+	st->state = XBEE_INIT_IDLE;
+	st->result = stat;
+	st->elapsed = HAL_GetTick() - st->start;
+#if XBEE_ENABLE_PROFILE
+	if((stat == XBEE_MSG_OK || stat == XBEE_MSG_SETTING_CHANGED) && xbee->via == NULL)
+	{
+		xbeeProfileSave(xbee);
+	}
+#endif
+	if(st->ondone != NULL)
+	{
+		st->ondone(xbee, stat, st->ctx);
+	}
+}
+
+
+/*
+ *	Moves on to a step. A step gets a full set of tries the first time it
+ *	is reached, coming back to it on a retry keeps the tries it has left.
+ */
+static void xbeeInitEnter(xbee_module *xbee, XBEE_INIT_STATE state)
+{
+	if(state > xbee->init.reached)
+	{
+		xbee->init.reached = state;
+		xbee->init.retries = XBEE_INIT_RETRIES;
+	}
+	xbee->init.state = state;
+	xbee->init.linelen = 0;
+}
+
+
+/*
+ *	Starts a probe pass over every rate in order[], with the guard time
+ *	given by xbeeProbeGuardTime().
+ *
+ *	@retval false if there are no passes left
+ */
+static bool xbeeInitBeginPass(xbee_module *xbee, uint8_t pass)
+{
+	xbee_initstate *st = &xbee->init;
+
+	for(; pass < XBEE_SYNC_PASSES; ++pass)
+	{
+		uint16_t gt = xbeeProbeGuardTime(xbee, pass);
+		if(gt == 0)
+		{
+			continue;
+		}
+		st->pass = pass;
+		st->gt = gt;
+		st->probe = 0;
+
+		// Only the first probe of a pass waits for the leading guard time,
+		// a failed probe leaves the line silent for a full guard time
+		if(st->order[0] != xbee->hxbee->Init.BaudRate)
+		{
+			uartSetBaudRate(xbee->hxbee, st->order[0]);
+		}
+		st->state = XBEE_INIT_GUARD;
+		st->linelen = 0;
+		platformTimerStart(&st->timer, (gt+XBEE_ADDED_GT_MARGIN)*1000, NULL, NULL);
+		return true;
+	}
+	return false;
+}
+
+
+/*
+ *	Enters command mode again at the rate and guard time already found,
+ *	used to try a failed command mode step once more.
+ */
+static void xbeeInitReenter(xbee_module *xbee)
+{
+	xbee_initstate *st = &xbee->init;
+
+	xbee->cmdmode = false;
+	st->order[0] = xbee->hxbee->Init.BaudRate;
+	st->probes = 1;
+	st->pass = 1;
+	st->gt = xbee->settings.GT;
+	st->probe = 0;
+	st->state = XBEE_INIT_GUARD;
+	st->linelen = 0;
+	platformTimerStart(&st->timer, (st->gt+XBEE_ADDED_GT_MARGIN)*1000, NULL, NULL);
+}
+
+
+/*
+ *	Handles a failed step: tries it again if it has tries left,
+ *	otherwise ends the bring-up with "stat".
+ */
+static void xbeeInitRetry(xbee_module *xbee, XBEE_STAT stat)
+{
+	xbee_initstate *st = &xbee->init;
+	XBEE_INIT_STATE failed = st->state;
+
+	if(st->retries == 0)
+	{
+		if(xbee->cmdmode)
+		{
+			xbeeExitCMDMode(xbee);
+		}
+		xbeeInitFinish(xbee, stat);
+		return;
+	}
+	--st->retries;
+
+	switch(failed)
+	{
+	case XBEE_INIT_GUARD:
+	case XBEE_INIT_PROBE:
+		// Start the scan over, the module may have been powering up
+		st->probes = xbeeProbeOrder(xbee, st->order);
+		xbeeInitBeginPass(xbee, 0);
+		break;
+	case XBEE_INIT_CONFIG:
+		// Failed settings are marked again, send those once more
+		st->configidx = 0;
+		st->configfailed = 0;
+		break;
+	default:
+		// The rate is known. Within the command mode timeout (CT) the
+		// command is just sent again, otherwise command mode is entered again
+		if(xbee->cmdmode && (HAL_GetTick() - xbee->cmdtick) + XBEE_AT_TIMEOUT < (uint32_t)xbee->settings.CT*100)
+		{
+			xbeeInitReadAP(xbee);
+		}
+		else
+		{
+			xbeeInitReenter(xbee);
+		}
+		break;
+	}
+}
+
+
+/*
+ *	Starts the full sync, from a cold boot or when the stored profile
+ *	did not hold.
+ */
+static void xbeeInitCold(xbee_module *xbee)
+{
+	xbee_initstate *st = &xbee->init;
+
+	st->warm = false;
+	st->probes = xbeeProbeOrder(xbee, st->order);
+	if(!xbeeInitBeginPass(xbee, 0))
+	{
+		xbeeInitFinish(xbee, XBEE_ERR_UART_SYNC);
+	}
+}
+
+
+#if XBEE_ENABLE_PROFILE
+/*
+ *	Restores the stored profile and checks it with a single Local AT
+ *	Command frame reading AP. If the module answers with AP = XBEE_API_MODE
+ *	at the stored rate it is up, and the sync and read back are skipped.
+ *
+ *	@retval false if there is no profile to try
+ */
+static bool xbeeInitWarm(xbee_module *xbee)
+{
+	xbee_initstate *st = &xbee->init;
+	xbee_profile profile;
+
+	if(!xbeeProfileLoad(&profile, xbee->hxbee))
+	{
+		return false;
+	}
+	if(profile.baud != xbee->hxbee->Init.BaudRate)
+	{
+		uartSetBaudRate(xbee->hxbee, profile.baud);
+	}
+	memcpy(&xbee->settings, &profile.settings, sizeof(xbee_settings));
+
+	uint8_t data[4] = {XBEE_API_AT_CMD, 0, 'A', 'P'};
+	data[1] = st->probeid = xbeeNextFrameId(xbee);
+	uartRxDiscard(xbee->hxbee);
+	if(xbeeSendFrame(xbee, data, sizeof(data)) != XBEE_MSG_OK)
+	{
+		return false;
+	}
+	st->state = XBEE_INIT_WARM;
+	platformTimerStart(&st->timer, XBEE_PROFILE_PROBE_TIMEOUT*1000, NULL, NULL);
+	return true;
+}
+#endif
+
+
+/*
+ *	Checks a Local AT Command Response (0x88) against the warm boot probe.
+ *
+ *	@param *xbee, handle for the local xbee module
+ */
+void xbeeInitHandleResponse(xbee_module *xbee, const uint8_t *frame, uint16_t len)
+{
+	xbee_initstate *st = &xbee->init;
+
+	// 0x88 | Frame ID | AT command (2) | Status | Data
+	if(st->state != XBEE_INIT_WARM || len < 5 || frame[1] != st->probeid)
+	{
+		return;
+	}
+	platformTimerStop(&st->timer);
+	if(frame[4] == XBEE_RATS_OK && len == 6 && frame[5] == XBEE_API_MODE)
+	{
+		st->warm = true;
+		xbee->synctime = 0;
+		xbeeInitBeginConfig(xbee);
+	}
+	else
+	{
+		xbeeInitCold(xbee);
+	}
+}
+
+
+/*
+ *	Collects one carriage return terminated response line from the
+ *	local module without waiting for it.
+ *
+ *	@retval true if st->line now holds a complete line (without the \r)
+ */
+static bool xbeeInitReadLine(xbee_module *xbee)
+{
+	xbee_initstate *st = &xbee->init;
+	uart_rxring *ring = uartRxFind(xbee->hxbee);
+	uint8_t c;
+
+	while(ring != NULL && uartRxRead(ring, &c, 1) == 1)
+	{
+		if(c == '\r')
+		{
+			st->line[st->linelen] = 0x0;
+			st->linelen = 0;
+			return true;
+		}
+		if(st->linelen < sizeof(st->line)-1)
+		{
+			st->line[st->linelen++] = c;
+		}
+	}
+	return false;
+}
+
+
+/*
+ *	Sends the "enter command mode" sequence at the rate being probed.
+ *	The module replies once the trailing guard time has passed.
+ */
+static void xbeeInitProbe(xbee_module *xbee)
+{
+	xbee_initstate *st = &xbee->init;
+	uint8_t tmp = xbee->settings.CC;
+	uint8_t cmdsequence[3] = {tmp,tmp,tmp};
+	uint32_t baud = st->order[st->probe];
+
+	if(baud != xbee->hxbee->Init.BaudRate)
+	{
+		uartSetBaudRate(xbee->hxbee, baud);
+	}
+
+	// Whatever arrived before the sequence belongs to an earlier attempt
+	uartRxDiscard(xbee->hxbee);
+	uartTxWrite(xbee->hxbee, cmdsequence, 3);
+
+	// Three characters (30 bits) on the line, then the trailing guard time
+	uint32_t wait = 30000/baud + 1 + st->gt + XBEE_ADDED_GT_MARGIN + XBEE_REPLY_TIMEOUT;
+	st->state = XBEE_INIT_PROBE;
+	st->linelen = 0;
+	platformTimerStart(&st->timer, wait*1000, NULL, NULL);
+}
+
+
+/*
+ *	The module answered a probe: stores the rate and guard time it uses,
+ *	then moves on to the API mode check in the same command mode session.
+ */
+static void xbeeInitSynced(xbee_module *xbee)
+{
+	xbee_initstate *st = &xbee->init;
+
+	for(uint8_t bd = 0; bd < sizeof(baudrates)/sizeof(uint32_t); ++bd)
+	{
+		if(baudrates[bd] == st->order[st->probe])
+		{
+			xbee->settings.BD = bd;
+		}
+	}
+	xbee->settings.GT = st->gt;
+	xbee->cmdmode = true;
+	xbee->cmdtick = HAL_GetTick();
+	xbee->synctime = HAL_GetTick() - st->start;
+
+#if XBEE_FAST_GT
+	if(xbee->settings.GT != XBEE_FAST_GT)
+	{
+		// Make every following command mode entry cheaper
+		char xbeecmd[20];
+		uint16_t len = sprintf(xbeecmd, "ATGT%X,WR\r", XBEE_FAST_GT);
+		uartTxWrite(xbee->hxbee, (uint8_t *)xbeecmd, len);
+		xbeeInitEnter(xbee, XBEE_INIT_FASTGT);
+		st->replies = 2;
+		platformTimerStart(&st->timer, XBEE_REPLY_TIMEOUT*4*1000, NULL, NULL);
+		return;
+	}
+#endif
+	xbeeInitReadAP(xbee);
+}
+
+
+/*
+ *	Asks for the current value of AP.
+ */
+static void xbeeInitReadAP(xbee_module *xbee)
+{
+	xbee_initstate *st = &xbee->init;
+	static const uint8_t cmd[5] = {'A','T','A','P','\r'};
+
+	xbeeInitEnter(xbee, XBEE_INIT_APIREAD);
+	uartRxDiscard(xbee->hxbee);
+	uartTxWrite(xbee->hxbee, cmd, 5);
+	st->replies = 1;
+	platformTimerStart(&st->timer, XBEE_AT_TIMEOUT*1000, NULL, NULL);
+}
+
+
+/*
+ *	Moves on to writing the settings that have been changed, this time
+ *	over API frames.
+ */
+static void xbeeInitBeginConfig(xbee_module *xbee)
+{
+	xbeeInitEnter(xbee, XBEE_INIT_CONFIG);
+	xbee->init.configidx = 0;
+	xbee->init.configpending = 0;
+	xbee->init.configfailed = 0;
+}
+
+
+/*
+ *	Response to a configuration write. Settings that could not be written
+ *	are marked as changed again and sent once more by the retry.
+ */
+static void xbeeInitConfigResponse(xbee_module *xbee, xbee_node *node, const char *cmd,
+								   uint8_t status, const uint8_t *data, uint8_t len, void *ctx)
+{
+	xbee_initstate *st = &xbee->init;
+
+	(void)node;
+	(void)data;
+	(void)len;
+	(void)ctx;
+
+	if(st->configpending > 0)
+	{
+		--st->configpending;
+	}
+	if(status != XBEE_RATS_OK)
+	{
+		const xbee_setting_desc *desc = xbeeFindSetting(cmd);
+		if(desc != NULL)
+		{
+			xbeeMarkDirty(xbee, desc - xbeeSettingTable);
+		}
+		++st->configfailed;
+	}
+}
+
+
+/*
+ *	Queues a local AT Command frame for every setting marked as changed,
+ *	as many as the request queue takes per call.
+ */
+static void xbeeInitConfigStep(xbee_module *xbee)
+{
+	xbee_initstate *st = &xbee->init;
+
+	for(; st->configidx < XBEE_SETTING_COUNT; ++st->configidx)
+	{
+		uint8_t idx = st->configidx;
+		if(!(xbee->dirty[idx/32] & (1UL << (idx%32))))
+		{
+			continue;
+		}
+
+		uint8_t param[XBEE_RAT_MAX_PARAM];
+		uint8_t plen = xbeeEncodeSetting(&xbee->settings, idx, param);
+		if(xbeeLocalAT(xbee, xbeeSettingTable[idx].cmd, param, plen, xbeeInitConfigResponse, NULL) != XBEE_MSG_OK)
+		{
+			// Queue full, continue from here on the next call
+			return;
+		}
+		xbee->dirty[idx/32] &= ~(1UL << (idx%32));
+		++st->configpending;
+	}
+
+	if(st->configpending > 0)
+	{
+		return;
+	}
+	if(st->configfailed > 0)
+	{
+		xbeeInitRetry(xbee, XBEE_ERR_AT_COMMAND);
+		return;
+	}
+	xbeeInitFinish(xbee, st->result);
+}
+
+
+/*
+ *	Starts bringing up the local Xbee module (connected to STM UART HAL
+ *	handle "hxbee") without waiting for it. xbeeService() then carries
+ *	out, one step per call:
+ *	- UART sync: the "enter command mode" sequence is probed on a set of
+ *	  baud rates until the module replies with "OK" (see xbeeSyncUART())
+ *	- API mode: AP is read and, if needed, set to XBEE_API_MODE and saved
+ *	  in the same command mode session (see xbeeEnsureAPIMode())
+ *	- Configuration: settings changed with xbeeChangeSetting() since the
+ *	  start are written with local AT Command frames (see xbeeConfigure())
+ *	A step that fails is tried again (up to XBEE_INIT_RETRIES times)
+ *	without going through the steps before it. Guard times and response
+ *	timeouts run on a platform timer, so the rest of the system keeps
+ *	running in the meantime.
+ *
+ *	@param *radio, radio to bring up, every part of it is reset
+ *	@param *hxbee, STM HAL Handle for the UART interface going to the local Xbee module
+ *	@param ondone, called when the bring-up has finished (may be NULL)
+ *	@param *ctx, passed on to ondone
+ *	@retval XBEE_MSG_OK, or XBEE_ERR_TX_BUSY if a bring-up is already running
+ */
+XBEE_STAT xbeeInitStart(xbee_radio *radio, UART_HandleTypeDef *hxbee, xbee_init_callback ondone, void *ctx)
+{
+	xbee_module *local = &radio->local;
+
+	if(xbeeInitBusy(local))
+	{
+		return XBEE_ERR_TX_BUSY;
+	}
+
+	for(int i = 0; i < MAX_STORED_DEVICES; ++i)
+	{
+		xbee_module *xbee = (i == 0) ? local : &radio->remote[i-1];
+		xbeeSetDefaultValues(xbee);
+		xbee->parser.block = NULL;		// The pool is reset below
+		xbeeParserReset(&xbee->parser);
+		xbee->hxbee = (i == 0) ? hxbee : NULL;
+		xbee->radio = radio;
+		xbee->via = (i != 0) ? local : NULL;
+		xbee->frameid = 0;
+		xbeeTxInit(&xbee->tx);
+		xbeeRemoteATInit(&xbee->rat);
+		xbeeDiscoverInit(&xbee->nd);
+		xbeeStatsReset(xbee);
+		memset(&xbee->init, 0, sizeof(xbee_initstate));
+	}
+	xbeePoolInit(&radio->pool);
+#if XBEE_ENABLE_STATS
+	platformCycleCounterInit();
+#endif
+	xbeeNodesInit(&radio->nodes);
+
+	xbee_initstate *st = &local->init;
+	st->ondone = ondone;
+	st->ctx = ctx;
+	st->start = HAL_GetTick();
+	st->result = XBEE_MSG_OK;
+	st->retries = XBEE_INIT_RETRIES;
+	st->reached = XBEE_INIT_PROBE;
+#if XBEE_ENABLE_PROFILE
+	if(xbeeInitWarm(local))
+	{
+		return XBEE_MSG_OK;
+	}
+#endif
+	xbeeInitCold(local);
+	return XBEE_MSG_OK;
+}
+
+
+/*
+ *	Writes every setting of the local module that has been changed with
+ *	xbeeChangeSetting() using local AT Command frames, without waiting for
+ *	the responses. Settings answered with an error are tried again (up to
+ *	XBEE_INIT_RETRIES times). Requires API mode, and xbeeService() to be
+ *	called regularly.
+ *
+ *	@param *xbee, handle for the local xbee module
+ *	@param ondone, called when every setting has been written (may be NULL)
+ *	@param *ctx, passed on to ondone
+ *	@retval XBEE_MSG_OK, or XBEE_ERR_TX_BUSY if a bring-up or configuration is running
+ */
+XBEE_STAT xbeeConfigure(xbee_module *xbee, xbee_init_callback ondone, void *ctx)
+{
+	if(xbeeInitBusy(xbee))
+	{
+		return XBEE_ERR_TX_BUSY;
+	}
+	xbee->init.ondone = ondone;
+	xbee->init.ctx = ctx;
+	xbee->init.start = HAL_GetTick();
+	xbee->init.result = XBEE_MSG_OK;
+	xbee->init.reached = XBEE_INIT_IDLE;
+	xbeeInitBeginConfig(xbee);
+	return XBEE_MSG_OK;
+}
+
+
+/*
+ *	Tells if a bring-up or configuration is running.
+ *
+ *	@param *xbee, handle for the local xbee module
+ */
+bool xbeeInitBusy(xbee_module *xbee)
+{
+	return (xbee->init.state != XBEE_INIT_IDLE);
+}
+
+
+/*
+ *	Carries the bring-up one step further. Never waits, a step that has
+ *	to wait for a reply or a guard time returns and is resumed on a
+ *	later call.
+ *
+ *	@param *xbee, handle for the local xbee module
+ */
+void xbeeInitService(xbee_module *xbee)
+{
+	xbee_initstate *st = &xbee->init;
+
+	switch(st->state)
+	{
+	case XBEE_INIT_GUARD:
+		if(!st->timer.active)
+		{
+			xbeeInitProbe(xbee);
+		}
+		break;
+
+	case XBEE_INIT_PROBE:
+		while(xbeeInitReadLine(xbee))
+		{
+			uint8_t n = strlen(st->line);
+			if(n >= 2 && !strcmp(&st->line[n-2], "OK"))
+			{
+				platformTimerStop(&st->timer);
+				xbeeInitSynced(xbee);
+				return;
+			}
+		}
+		if(!st->timer.active)
+		{
+			// No reply, move on to the next rate or pass
+			if(++st->probe < st->probes)
+			{
+				xbeeInitProbe(xbee);
+			}
+			else if(!xbeeInitBeginPass(xbee, st->pass + 1))
+			{
+				xbee->synctime = HAL_GetTick() - st->start;
+				xbeeInitRetry(xbee, XBEE_ERR_UART_SYNC);
+			}
+		}
+		break;
+
+	case XBEE_INIT_FASTGT:
+		while(st->replies > 0 && xbeeInitReadLine(xbee))
+		{
+			if(strcmp(st->line, "OK"))
+			{
+				break;
+			}
+			if(--st->replies == 0)
+			{
+				xbee->settings.GT = XBEE_FAST_GT;
+			}
+		}
+		if(st->replies == 0 || !st->timer.active)
+		{
+			// Not being able to shorten GT is not an error
+			platformTimerStop(&st->timer);
+			xbee->cmdtick = HAL_GetTick();
+			xbeeInitReadAP(xbee);
+		}
+		break;
+
+	case XBEE_INIT_APIREAD:
+		if(xbeeInitReadLine(xbee))
+		{
+			platformTimerStop(&st->timer);
+			xbee->cmdtick = HAL_GetTick();
+			if(!strcmp(st->line, "ERROR"))
+			{
+				xbeeInitRetry(xbee, XBEE_ERR_APIMODE_ENABLE);
+				break;
+			}
+			xbee->settings.AP = strtoul(st->line, NULL, 16);
+
+			if(xbee->settings.AP == XBEE_API_MODE)
+			{
+				xbeeExitCMDMode(xbee);
+				xbeeInitBeginConfig(xbee);
+				break;
+			}
+
+			// API Mode must be configured! Set, apply, save and leave in one line
+			static const uint8_t cmd[15] = {'A','T','A','P','0'+XBEE_API_MODE,',','A','C',',','W','R',',','C','N','\r'};
+			xbee->settings.AP = XBEE_API_MODE;
+			st->result = XBEE_MSG_SETTING_CHANGED;
+			xbeeInitEnter(xbee, XBEE_INIT_APIWRITE);
+			uartTxWrite(xbee->hxbee, cmd, sizeof(cmd));
+			st->replies = 4;
+			platformTimerStart(&st->timer, XBEE_AT_TIMEOUT*1000, NULL, NULL);
+		}
+		else if(!st->timer.active)
+		{
+			xbeeInitRetry(xbee, XBEE_ERR_APIMODE_ENABLE);
+		}
+		break;
+
+	case XBEE_INIT_APIWRITE:
+		while(st->replies > 0 && xbeeInitReadLine(xbee))
+		{
+			if(strcmp(st->line, "OK"))
+			{
+				// Whether CN was carried out is unknown
+				platformTimerStop(&st->timer);
+				xbee->cmdmode = false;
+				xbeeInitRetry(xbee, XBEE_ERR_APIMODE_ENABLE);
+				return;
+			}
+			--st->replies;
+		}
+		if(st->replies == 0)
+		{
+			// CN was part of the line, the module has left command mode
+			platformTimerStop(&st->timer);
+			xbee->cmdmode = false;
+			xbeeInitBeginConfig(xbee);
+		}
+		else if(!st->timer.active)
+		{
+			xbee->cmdmode = false;
+			xbeeInitRetry(xbee, XBEE_ERR_APIMODE_ENABLE);
+		}
+		break;
+
+	case XBEE_INIT_CONFIG:
+		xbeeInitConfigStep(xbee);
+		break;
+
+	case XBEE_INIT_WARM:
+		if(!st->timer.active)
+		{
+			// No answer at the stored rate, sync from scratch with the
+			// guard time and command character the module starts with
+			xbeeSetSetting(&xbee->settings, XBEE_SETTING_GT, xbeeSettingTable[XBEE_SETTING_GT].def);
+			xbeeSetSetting(&xbee->settings, XBEE_SETTING_CC, xbeeSettingTable[XBEE_SETTING_CC].def);
+			xbeeInitCold(xbee);
+		}
+		break;
+
+	default:
+		break;
+	}
+}
+
+
+/*
+ *	Poll entry point of the driver, call regularly from the main loop.
+ *	While the bring-up talks to the module in command mode only that is
+ *	served, otherwise received frames are parsed and every queue of the
+ *	module (TX window, AT requests, Node Discovery) is serviced.
+ *
+ *	@param *xbee, handle for the local xbee module
+ */
+void xbeeService(xbee_module *xbee)
+{
+	uint8_t state = xbee->init.state;
+	if(state >= XBEE_INIT_GUARD && state <= XBEE_INIT_APIWRITE)
+	{
+		xbeeInitService(xbee);
+		return;
+	}
+
+	xbeeReceive(xbee);
+	xbeeTxService(xbee);
+	xbeeRemoteATService(xbee);
+	xbeeDiscoverService(xbee);
+	if(state != XBEE_INIT_IDLE)
+	{
+		xbeeInitService(xbee);
+	}
+}
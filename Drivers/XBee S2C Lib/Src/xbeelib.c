@@ -20,16 +20,21 @@ FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TOR
 
 #include "xbeelib.h"
 
-// xbee[0] is always going to be the local device
-// any additional devices will be remote nodes
-xbee_module xbee[MAX_STORED_DEVICES];
-
 /* "Standard" list of baudrates for the UART interface on the Xbee module.
  * Values represent baud rates given in baud per second (b/s).
  */
-uint32_t baudrates[9] = {1200, 2400, 4800, 9600, 19200, 38400,
+const uint32_t baudrates[9] = {1200, 2400, 4800, 9600, 19200, 38400,
 						 57600, 115200, 230400};
 
+/* Location, size, flags and default value of every AT parameter
+ * in xbee_settings, indexed by XBEE_SETTING_xx.
+ */
+#define XBEE_SETTING_DESC(name, flags, def) {#name, sizeof(((xbee_settings *)0)->name), offsetof(xbee_settings, name), flags, def},
+const xbee_setting_desc xbeeSettingTable[XBEE_SETTING_COUNT] = {
+	XBEE_SETTINGS_LIST(XBEE_SETTING_DESC)
+};
+#undef XBEE_SETTING_DESC
+
 
 
 
@@ -39,158 +44,292 @@ uint32_t baudrates[9] = {1200, 2400, 4800, 9600, 19200, 38400,
  *	This code will also attempt to synchronize the micro-controller baud
  *	rate with the target Xbee module.
  *
+ *	Waits for the bring-up to finish, use xbeeInitStart() and xbeeService()
+ *	to let the rest of the system run in the meantime.
+ *
+ *	@param *radio, radio to bring up
  *	@param *hxbee, STM HAL Handle for the UART interface going to the local Xbee module
  *	@retval Status flag
  */
-XBEE_STAT xbeeInit(UART_HandleTypeDef *hxbee)
+XBEE_STAT xbeeInit(xbee_radio *radio, UART_HandleTypeDef *hxbee)
 {
-	for(int i = 0; i < MAX_STORED_DEVICES; ++i)
+	XBEE_STAT stat = xbeeInitStart(radio, hxbee, NULL, NULL);
+	if(stat != XBEE_MSG_OK)
 	{
-		xbeeSetDefaultValues(&xbee[i]);
+		return stat;
 	}
-	xbee[0].hxbee = hxbee;
 
-	// Synchronize UART with the local Xbee module
-	if(xbeeSyncUART())
-	{
-		// Ensure that API Mode will be enabled
-		//return xbeeEnsureAPIMode();
-		return XBEE_MSG_OK;
-	}
-	else
+	while(xbeeInitBusy(&radio->local))
 	{
-		return XBEE_ERR_UART_SYNC;
+		xbeeService(&radio->local);
+		platformSleepTickless();
 	}
-
-	return XBEE_MSG_OK;
+	return radio->local.init.result;
 }
 
 
 /*
- *	This function will try to synchronize the micro-controller baud rate
- *	with the one of the Xbee module. This will be done by sending the "enter command mode"
- *	character sequence until the module replies with "OK" on a set of different baud rate values.
- *	This method will work whether the target Xbee module has API mode enabled
- *	or not.
+ *	Waits for an expected reply from the local Xbee module. Returns as soon
+ *	as the reply has been received rather than waiting out a fixed delay.
+ *
+ *	@param *xbee, handle for the local xbee module
+ *	@param *expect, NULL terminated reply to look for, e.g. "OK\r"
+ *	@param timeout, maximum time to wait in milliseconds
+ *	@retval true if the reply was received in time
  */
-bool xbeeSyncUART()
+static bool xbeeWaitForReply(xbee_module *xbee, const char *expect, uint32_t timeout)
 {
-	// TODO: BUG - it seemingly runs into an infinite loop situation when iterating through baud rates.
-	uint8_t rec[11];	// Null char at end
+	uint8_t rec[21];	// Null char at end
 	buffer recbuf;
-	recbuf.data = rec;
-	recbuf.size = 10;
-	recbuf.datacnt = 0;
-	for(int i = 0; i < recbuf.size+1; ++i)
-	{
-		rec[i] = 0x0;
-	}
-
-	// ++ Attempt to enter command mode (with current baud) ++
-	xbeeEnterCMDMode();
-	HAL_Delay(300);
-	readAvailableData(xbee[0].hxbee, &recbuf);
-	char *strpos = strstr((char *)recbuf.data, "OK");
-
-	if((strpos != NULL) && (((uint8_t *)strpos-recbuf.data) < recbuf.datacnt))
-	{
-		// Xbee replied sucessfully!
-		xbeeExitCMDMode();
-		return true;
-	}
-
-	return false; 	// DEBUG
+	uint16_t cnt = 0;
+	platform_timer timer = {0};
 
-	// ++ Iterate through list of baud rates and attempt to enter command mode ++
-	// Iteration is performed in the order of high to low baud rates
-	for (int i = (sizeof(baudrates)/sizeof(uint32_t))-1; i >= 0 ; --i)
+	// Sleeps between checks, reception (UART IDLE) or the timer wakes it up
+	platformTimerStart(&timer, timeout*1000, NULL, NULL);
+	do
 	{
-		if(baudrates[i] != xbee[0].hxbee->Init.BaudRate)
+		recbuf.data = &rec[cnt];
+		recbuf.size = 20 - cnt;
+		if(readAvailableData(xbee->hxbee, &recbuf))
 		{
-			xbee[0].hxbee->Init.BaudRate = baudrates[i];
-			HAL_UART_Init(xbee[0].hxbee);
-
-			xbeeEnterCMDMode();
-			HAL_Delay(300);
-			readAvailableData(xbee[0].hxbee, &recbuf);
-			*strpos = strstr((char *)recbuf.data, "OK");
-			if((strpos != NULL) && (((uint8_t *)strpos-recbuf.data) < recbuf.datacnt))
+			cnt += recbuf.datacnt;
+			rec[cnt] = 0x0;
+			if(strstr((char *)rec, expect) != NULL)
 			{
-				xbeeExitCMDMode();
+				platformTimerStop(&timer);
 				return true;
 			}
+			if(cnt == 20)
+			{
+				// Keep the tail in case the reply straddles the cut
+				memmove(rec, &rec[15], 5);
+				cnt = 5;
+			}
 		}
-	}
+		else
+		{
+			platformSleepTickless();
+		}
+	} while(timer.active);
 
-	// Synchronization process was unsuccessful
 	return false;
 }
 
 
-XBEE_STAT xbeeEnsureAPIMode()
+/*
+ *	Sends the "enter command mode" sequence at the given baud rate and
+ *	waits for the "OK" reply.
+ *
+ *	@param *xbee, handle for the local xbee module
+ *	@param baud, baud rate to probe
+ *	@param gt, guard time (ms) the Xbee module is assumed to be using
+ *	@param leadguard, false if the line is already known to have been silent for gt
+ *	@retval true if the module replied
+ */
+static bool xbeeProbeBaud(xbee_module *xbee, uint32_t baud, uint16_t gt, bool leadguard)
 {
-	//TODO: Xbee seemingly responds with "OK" when ATAP is sent???? Instead of the parameter value.
-	buffer recbuf;
-	volatile uint8_t rec[21];	// Null char at end
-	recbuf.data = rec;
-	recbuf.size = 20;
-	recbuf.datacnt = 0;
-	for(int i = 0; i < recbuf.size+1; ++i)
+	uint8_t tmp = xbee->settings.CC;
+	uint8_t cmdsequence[3] = {tmp,tmp,tmp};
+
+	if(baud != xbee->hxbee->Init.BaudRate)
 	{
-		rec[i] = 0x0;
+		uartSetBaudRate(xbee->hxbee, baud);
 	}
 
-	char xbeecmd[20];
-	uint16_t len = sprintf(xbeecmd, "ATAP\r");
-	xbeeEnterCMDMode();
-	while(HAL_UART_Transmit(xbee[0].hxbee, (uint8_t *)xbeecmd, len, 100) == HAL_BUSY)
+	if(leadguard)
 	{
-		// Busy loop
+		uartTxFlush(xbee->hxbee, 100);
+		platformDelayMs(gt+XBEE_ADDED_GT_MARGIN);
 	}
-	HAL_Delay(300);
-	readAvailableData(xbee[0].hxbee, &recbuf);
 
-	// AP = 0x1 means API Mode without escape characters is active
-	char *chrpos = strchr((char *)recbuf.data, '1');
-	if((chrpos != NULL) && (((uint8_t *)chrpos-recbuf.data) < recbuf.datacnt))
+	// Whatever arrived before the sequence belongs to an earlier attempt
+	uartRxDiscard(xbee->hxbee);
+	uartTxWrite(xbee->hxbee, cmdsequence, 3);
+	uartTxFlush(xbee->hxbee, 100);
+
+	// The module replies once the trailing guard time has passed
+	return xbeeWaitForReply(xbee, "OK\r", gt+XBEE_ADDED_GT_MARGIN+XBEE_REPLY_TIMEOUT);
+}
+
+
+/*
+ *	Lists the baud rates to probe when synchronizing with the local module:
+ *	the one the UART is currently configured with (the last one that
+ *	worked), then the factory default, then the rest from high to low.
+ *
+ *	@param *xbee, handle for the local xbee module
+ *	@param *order, destination, room for XBEE_INIT_MAX_PROBES rates
+ *	@retval Number of rates listed
+ */
+uint8_t xbeeProbeOrder(xbee_module *xbee, uint32_t *order)
+{
+	uint8_t cnt = 0;
+
+	order[cnt++] = xbee->hxbee->Init.BaudRate;
+	if(baudrates[XBEE_DEFAULT_BD] != order[0])
 	{
-		return XBEE_MSG_OK;
+		order[cnt++] = baudrates[XBEE_DEFAULT_BD];
 	}
+	for (int i = (sizeof(baudrates)/sizeof(uint32_t))-1; i >= 0 ; --i)
+	{
+		if(baudrates[i] != order[0] && i != XBEE_DEFAULT_BD)
+		{
+			order[cnt++] = baudrates[i];
+		}
+	}
+	return cnt;
+}
 
-	// API Mode must be configured!
-	len = sprintf(xbeecmd, "ATAP%c\r", '1');
-	while(HAL_UART_Transmit(xbee[0].hxbee, xbeecmd, len, 100) == HAL_BUSY)
+
+/*
+ *	Gives the guard time a UART sync pass assumes. The first pass uses the
+ *	guard time the module was last known to have, which is XBEE_FAST_GT once
+ *	it has been programmed with it. The second pass falls back on the
+ *	factory guard time, for a module that was replaced or reset to its
+ *	defaults, and is skipped when it would not be longer.
+ *
+ *	A probe assuming a longer guard time than the module uses is still
+ *	answered, as the module replies once its own guard time has passed.
+ *	The other way around is not safe: the module may accept a sequence
+ *	after a long silence on the line and reply after the probe has given
+ *	up, so a shorter guard time is only assumed once it is known.
+ *
+ *	@param *xbee, handle for the local xbee module
+ *	@param pass, 0 to XBEE_SYNC_PASSES-1
+ *	@retval Guard time (ms), 0 if the pass is skipped
+ */
+uint16_t xbeeProbeGuardTime(xbee_module *xbee, uint8_t pass)
+{
+	uint16_t factory = (uint16_t)xbeeSettingTable[XBEE_SETTING_GT].def;
+
+	if(pass == 0)
 	{
-		// Busy loop
+		return xbee->settings.GT;
 	}
-	readAvailableData(xbee[0].hxbee, &recbuf);
+	return (factory > xbee->settings.GT) ? factory : 0;
+}
+
 
-	char *strpos = strstr((char *)recbuf.data, "OK");
-	if((strpos != NULL) && (((uint8_t *)strpos-recbuf.data) < recbuf.datacnt))
+/*
+ *	This function will try to synchronize the micro-controller baud rate
+ *	with the one of the Xbee module. This will be done by sending the "enter command mode"
+ *	character sequence until the module replies with "OK" on a set of different baud rate values.
+ *	This method will work whether the target Xbee module has API mode enabled
+ *	or not.
+ *
+ *	The rate the UART is currently configured with (the last one that worked)
+ *	is tried first, then the factory default, then the rest of the table from
+ *	high to low, in the passes given by xbeeProbeGuardTime(). Each probe
+ *	returns as soon as "OK" arrives, and a failed probe already leaves the
+ *	line silent for a full guard time, so only the first probe of a pass
+ *	waits for the leading guard time. Once found, the module is programmed
+ *	with XBEE_FAST_GT.
+ *
+ *	The bit rate is found by probing rather than measured: the module sends
+ *	nothing on its own in transparent mode (the factory default) until it
+ *	has received the command sequence at its own rate, so there are no RX
+ *	edges to time before the rate is already known.
+ *
+ *	@param *xbee, handle for the local xbee module
+ *	@retval true if the module answered
+ */
+bool xbeeSyncUART(xbee_module *xbee)
+{
+	uint32_t order[XBEE_INIT_MAX_PROBES];
+	uint16_t cnt = xbeeProbeOrder(xbee, order);
+	uint32_t start = HAL_GetTick();
+
+	for(int pass = 0; pass < XBEE_SYNC_PASSES; ++pass)
 	{
-		// Save to non-volatile memory
-		len = sprintf(xbeecmd, "ATWR\r");
-		while(HAL_UART_Transmit(xbee[0].hxbee, (uint8_t *)xbeecmd, len, 100) == HAL_BUSY)
+		uint16_t gt = xbeeProbeGuardTime(xbee, pass);
+		if(gt == 0)
 		{
-			// Busy loop
+			continue;
 		}
 
-		*strpos = strstr((char *)recbuf.data, "OK");
-		if((strpos != NULL) && (((uint8_t *)strpos-recbuf.data) < recbuf.datacnt))
+		for(int i = 0; i < cnt; ++i)
 		{
-			xbeeExitCMDMode();
-			return XBEE_MSG_SETTING_CHANGED;
+			if(!xbeeProbeBaud(xbee, order[i], gt, (i == 0)))
+			{
+				continue;
+			}
+
+			// Xbee replied sucessfully!
+			for(uint8_t bd = 0; bd < sizeof(baudrates)/sizeof(uint32_t); ++bd)
+			{
+				if(baudrates[bd] == order[i])
+				{
+					xbee->settings.BD = bd;
+				}
+			}
+			xbee->settings.GT = gt;
+
+#if XBEE_FAST_GT
+			if(xbee->settings.GT != XBEE_FAST_GT)
+			{
+				// Make every following command mode entry cheaper
+				char xbeecmd[20];
+				uint16_t len = sprintf(xbeecmd, "ATGT%X,WR\r", XBEE_FAST_GT);
+				uartTxWrite(xbee->hxbee, (uint8_t *)xbeecmd, len);
+				if(xbeeWaitForReply(xbee, "OK\r", XBEE_REPLY_TIMEOUT*4))
+				{
+					xbee->settings.GT = XBEE_FAST_GT;
+				}
+			}
+#endif
+			xbee->cmdmode = true;
+			xbee->cmdtick = HAL_GetTick();
+			xbeeExitCMDMode(xbee);
+			xbee->synctime = HAL_GetTick() - start;
+			return true;
 		}
 	}
 
-	return XBEE_ERR_APIMODE_ENABLE;
+	// Synchronization process was unsuccessful
+	xbee->synctime = HAL_GetTick() - start;
+	return false;
 }
 
 
+/*
+ *	Makes sure the local Xbee module runs in the API mode set by
+ *	XBEE_API_MODE (AP = 1, or AP = 2 with escaped characters). The current
+ *	value is read and, if needed, changed and saved in the same command
+ *	mode session. Frames are escaped or not from then on.
+ *
+ *	@param *xbee, handle for the local xbee module
+ *	@retval XBEE_MSG_OK if API mode was already enabled,
+ *			XBEE_MSG_SETTING_CHANGED if it was enabled now
+ */
+XBEE_STAT xbeeEnsureAPIMode(xbee_module *xbee)
+{
+	xbee_at_batch batch;
 
+	xbeeBatchInit(&batch, xbee);
+	xbeeBatchRead(&batch, "AP");
+	if(xbeeBatchRun(&batch, XBEE_BATCH_KEEPOPEN) != XBEE_MSG_OK)
+	{
+		xbeeExitCMDMode(xbee);
+		return XBEE_ERR_APIMODE_ENABLE;
+	}
 
+	if(xbee->settings.AP == XBEE_API_MODE)
+	{
+		xbeeExitCMDMode(xbee);
+		return XBEE_MSG_OK;
+	}
 
+	// API Mode must be configured!
+	xbee->settings.AP = XBEE_API_MODE;
+	xbeeBatchInit(&batch, xbee);
+	xbeeBatchWrite(&batch, "AP");
+	if(xbeeBatchRun(&batch, XBEE_BATCH_APPLY | XBEE_BATCH_SAVE) == XBEE_MSG_OK)
+	{
+		return XBEE_MSG_SETTING_CHANGED;
+	}
 
+	return XBEE_ERR_APIMODE_ENABLE;
+}
 
 
 /*
@@ -198,14 +337,15 @@ XBEE_STAT xbeeEnsureAPIMode()
  *	out to a terminal window (if it exists). When print out is not required,
  *	replace hterm with either NULL or 0x0.
  *
+ *	@param *radio, radio to bring up
  *	@param hxbee, HAL UART handle for the connection going to the xbee
  *	@param hterm, HAL UART handle for the connection going to the terminal
  */
-void initLocalXbee(UART_HandleTypeDef *hxbee, UART_HandleTypeDef *hterm)
+void initLocalXbee(xbee_radio *radio, UART_HandleTypeDef *hxbee, UART_HandleTypeDef *hterm)
 {
 	uint8_t initmsg[100];
 	uint16_t len = 0;
-	XBEE_STAT initstat = xbeeInit(hxbee);
+	XBEE_STAT initstat = xbeeInit(radio, hxbee);
 //	XBEE_STAT initstat = XBEE_MSG_OK;
 
 	if(hterm != NULL && hterm != 0x0)
@@ -214,19 +354,23 @@ void initLocalXbee(UART_HandleTypeDef *hxbee, UART_HandleTypeDef *hterm)
 		{
 		case XBEE_MSG_OK:
 			len = sprintf((char*)initmsg, "\r\nXbee Initialization Success\r\n");
-			HAL_UART_Transmit(hterm, initmsg, len, 100);
+			uartTxWrite(hterm, initmsg, len);
 			break;
 		case XBEE_ERR_APIMODE_ENABLE:
 			len = sprintf((char*)initmsg, "\r\nXbee Initialization Failure! API Mode could not be enabled.\r\n");
-			HAL_UART_Transmit(hterm, initmsg, len, 100);
+			uartTxWrite(hterm, initmsg, len);
 			break;
 		case XBEE_MSG_SETTING_CHANGED:
 			len = sprintf((char*)initmsg, "\r\nXbee Initialization Success! API Mode was enabled.\r\n");
-			HAL_UART_Transmit(hterm, initmsg, len, 100);
+			uartTxWrite(hterm, initmsg, len);
 			break;
 		case XBEE_ERR_UART_SYNC:
 			len = sprintf((char*)initmsg, "\r\nXbee Initialization Failure! UART failed to sync.\r\n");
-			HAL_UART_Transmit(hterm, initmsg, len, 100);
+			uartTxWrite(hterm, initmsg, len);
+			break;
+		default:
+			len = sprintf((char*)initmsg, "\r\nXbee Initialization Failure! Error code %d.\r\n", initstat);
+			uartTxWrite(hterm, initmsg, len);
 			break;
 		}
 	}
@@ -243,32 +387,37 @@ void initLocalXbee(UART_HandleTypeDef *hxbee, UART_HandleTypeDef *hterm)
  *	This function is therefore only used when the settings of the
  *	local Xbee are unknown. The Xbee module can ALWAYS enter command mode,
  *	even when API mode is enabled (assuming matching UART baud rates).
+ *
+ *	@param *xbee, handle for the local xbee module
  */
-void xbeeEnterCMDMode()
+void xbeeEnterCMDMode(xbee_module *xbee)
 {
-	uint8_t tmp = xbee[0].settings.CC;
+	uint8_t tmp = xbee->settings.CC;
 	uint8_t cmdsequence[3] = {tmp,tmp,tmp};
 
 	// GT + 3xCC + GT
-	HAL_Delay(xbee[0].settings.GT+XBEE_ADDED_GT_MARGIN);
-	while(HAL_UART_Transmit(xbee[0].hxbee, cmdsequence, 3, 100) == HAL_BUSY)
-	{
-		//Busy loop
-	}
-	HAL_Delay(xbee[0].settings.GT+XBEE_ADDED_GT_MARGIN);
+	// Anything still queued must be on the line before the guard time starts,
+	// and the sequence itself must be out before the trailing guard time.
+	uartTxFlush(xbee->hxbee, 100);
+	platformDelayMs(xbee->settings.GT+XBEE_ADDED_GT_MARGIN);
+	uartTxWrite(xbee->hxbee, cmdsequence, 3);
+	uartTxFlush(xbee->hxbee, 100);
+	platformDelayMs(xbee->settings.GT+XBEE_ADDED_GT_MARGIN);
+	xbee->cmdmode = true;
+	xbee->cmdtick = HAL_GetTick();
 }
 
 
 /*
  * Makes the local Xbee module exit command mode.
+ *
+ * @param *xbee, handle for the local xbee module
  */
-void xbeeExitCMDMode()
+void xbeeExitCMDMode(xbee_module *xbee)
 {
 	uint8_t cmdsequence[5] = {'A','T','C','N','\r'};
-	while(HAL_UART_Transmit(xbee[0].hxbee, cmdsequence, 5, 100) == HAL_BUSY)
-	{
-		// Busy loop
-	}
+	uartTxWrite(xbee->hxbee, cmdsequence, 5);
+	xbee->cmdmode = false;
 }
 
 
@@ -288,97 +437,1547 @@ bool isCoordinator(xbee_module *xbee)
 
 /*
  *	Initializes the xbee_module struct with some default values.
+ *	The values come from the settings descriptor table (XBEE_SETTINGS_LIST),
+ *	and nothing is marked as changed afterwards.
  *
  *	@param *xbee, handle for target xbee module
  */
 void xbeeSetDefaultValues(xbee_module *xbee)
 {
-	// +++ Networking and security +++
-	xbee->settings.C8 = 0;		// 802.15.4 Compatibility
-	xbee->settings.CH = 0;		// Operating Channel
-	xbee->settings.ID = 0;		// Network ID
-	xbee->settings.DH = 0;		// Destination Address High
-	xbee->settings.DL = 0;		// Destination Address Low
-	xbee->settings.MY = 0;		// Source Address
-	xbee->settings.SH = 0;		// IEE 64-bit extended address High
-	xbee->settings.SL = 0;		// IEE 64-bit extended address Low
-	xbee->settings.MM = 0;		// MAC Mode
-	xbee->settings.RR = 0;		// XBee Retries
-	xbee->settings.RN = 0;		// Random Delay Slots
-	xbee->settings.NT = 0;		// Node Discover Timeout
-	xbee->settings.NO = 0;		// Node Discovery Options
-	xbee->settings.CE = 0;		// Coordinator Enable
-	xbee->settings.SC = 0;		// Scan Channels
-	xbee->settings.SD = 0;		// Scan Duration
-	xbee->settings.A1 = 0;		// End Device Association
-	xbee->settings.A2 = 0;		// Coordinator Association
-	xbee->settings.EE = 0;		// Encryption Enable
-	for(int i = 0; i < 20; ++i)
-	{
-		xbee->settings.NI[i] = 0;
-	}
-
-	// +++ RF Interfacing Commands +++
-	xbee->settings.PL = 0;		// TX Power Level
-	xbee->settings.PM = 0;		// Power Mode
-	xbee->settings.CA = 0;		// CCA Threshold
-
-	// +++ Sleep Commands +++
-	xbee->settings.SM = 0;		// Sleep Mode
-	xbee->settings.ST = 0;		// Time Before Sleep
-	xbee->settings.SP = 0;		// Cyclic Sleep Period
-	xbee->settings.DP = 0;		// Disassociated Cyclic Sleep Period
-	xbee->settings.SO = 0;		// Sleep Options
-
-	// +++ Serial Interfacing Commands +++
-	xbee->settings.BD = 0;		// Interface Data Rate
-	xbee->settings.NB = 0;		// Parity
-	xbee->settings.RO = 0;		// Inter-character Silence
-	xbee->settings.D7 = 0;		// DIO7/CTS
-	xbee->settings.D6 = 0;		// DIO6/RTS
-	xbee->settings.AP = 0;		// API Mode Enable
-
-	// +++ I/O Settings Commands +++
-	xbee->settings.D0 = 0;		// DIO0/AD0
-	xbee->settings.D1 = 0;		// DIO1/AD1
-	xbee->settings.D2 = 0;		// DIO2/AD2
-	xbee->settings.D3 = 0;		// DIO3/AD3
-	xbee->settings.D4 = 0;		// DIO4
-	xbee->settings.D5 = 0;		// DIO5/ASSOCIATED_INDICATOR
-	xbee->settings.D8 = 0;		// DI8/DTR/SLP_RQ
-	xbee->settings.P0 = 0;		// RSSI/PWM0
-	xbee->settings.P1 = 0;		// PWM1
-	xbee->settings.P2 = 0;		// SPI_MISO
-	xbee->settings.M0 = 0;		// PWM0 Duty Cycle
-	xbee->settings.M1 = 0;		// PWM1 Duty Cycle
-	xbee->settings.P5 = 0;		// SPI_MISO
-	xbee->settings.P6 = 0;		// SPI_MOSI
-	xbee->settings.P7 = 0;		// SPI_SSEL
-	xbee->settings.P8 = 0;		// DIO18/SPI_SCLK
-	xbee->settings.P9 = 0;		// SPI_ATTN
-	xbee->settings.PR = 0;		// Pull-up/Down Resistor Enable
-	xbee->settings.PD = 0;		// Pull Up/Down Direction
-	xbee->settings.IU = 0;		// I/O Output Enable
-	xbee->settings.IT = 0;		// Samples before TX
-	xbee->settings.IC = 0;		// DIO Change Detect
-	xbee->settings.IR = 0;		// Sample Rate
-	xbee->settings.RP = 0;		// RSSI PWM Timer
-
-	// +++ I/O Line Passing Commands +++
-	xbee->settings.IA[0] = 0;
- 	xbee->settings.IA[1] = 0;	// I/O Input Address
-	xbee->settings.T0 = 0;		// D0 Timeout
-	xbee->settings.T1 = 0;		// D1 Output Timeout
-	xbee->settings.T2 = 0;		// D2 Output Timeout
-	xbee->settings.T3 = 0;		// D3 Output Timeout
-	xbee->settings.T4 = 0;		// D4 Output Timeout
-	xbee->settings.T5 = 0;		// D5 Output Timeout
-	xbee->settings.T6 = 0;		// D6 Output Timeout
-	xbee->settings.T7 = 0;		// D7 Output Timeout
-	xbee->settings.PT = 0;		// PWM Output Timeout
-
-	// +++ Command Mode Options +++
-	xbee->settings.CT = 0x64;   // Command Mode Timeout
-	xbee->settings.GT = 0x3E8;	// Silence Period
-	xbee->settings.CC = 0x2B;	// Command Character
+	for(uint8_t idx = 0; idx < XBEE_SETTING_COUNT; ++idx)
+	{
+		if(xbeeSettingTable[idx].width > 8)
+		{
+			memset((uint8_t *)&xbee->settings + xbeeSettingTable[idx].offset, 0, xbeeSettingTable[idx].width);
+		}
+		else
+		{
+			xbeeSetSetting(&xbee->settings, idx, xbeeSettingTable[idx].def);
+		}
+	}
+	for(int i = 0; i < XBEE_SETTING_WORDS; ++i)
+	{
+		xbee->dirty[i] = 0;
+		xbee->writing[i] = 0;
+	}
+}
+
+
+// ++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
+// ++++++++++++++++++++++++++++ API FRAME ENGINE ++++++++++++++++++++++++++++++
+// ++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
+
+static void xbeeHandleATResponse(xbee_module *local, const uint8_t *frame, uint16_t len);
+
+
+/*
+ *	Reads a 32-bit big endian value out of a frame.
+ */
+static inline uint32_t xbeeGetU32(const uint8_t *p)
+{
+	return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | p[3];
+}
+
+/*
+ *	Returns the API frame decoder to its idle state (waiting for 0x7E).
+ *	A partly received frame is dropped and frame counters are cleared.
+ *
+ *	@param *parser, decoder state to reset
+ */
+void xbeeParserReset(xbee_parser *parser)
+{
+	if(parser->block != NULL)
+	{
+		xbeeFrameRelease(parser->block->pool, parser->block);
+	}
+	parser->block = NULL;
+	parser->state = XBEE_PARSE_DELIM;
+	parser->len = 0;
+	parser->cnt = 0;
+	parser->sum = 0;
+	parser->unescape = false;
+	parser->frames = 0;
+	parser->cserrors = 0;
+	parser->overflows = 0;
+	parser->nobuffer = 0;
+}
+
+
+/*
+ *	Finds the RF data of a received RX Packet (0x80 or 0x81).
+ *
+ *	@param *frame, received frame block
+ *	@param *len, receives the length of the RF data
+ *	@retval start of the RF data inside the block, NULL if the frame is
+ *			no RX Packet
+ */
+const uint8_t *xbeeRxData(xbee_frame *frame, uint8_t *len)
+{
+	const uint8_t *data = xbeeFrameData(frame);
+	uint8_t hlen;
+
+	if(data[0] == XBEE_API_RX64)
+	{
+		// 0x80 | 64-bit source (8) | RSSI | Options | Data
+		hlen = 11;
+	}
+	else if(data[0] == XBEE_API_RX16)
+	{
+		// 0x81 | 16-bit source (2) | RSSI | Options | Data
+		hlen = 5;
+	}
+	else
+	{
+		return NULL;
+	}
+	if(frame->len < hlen)
+	{
+		return NULL;
+	}
+	*len = (uint8_t)(frame->len - hlen);
+	return &data[hlen];
+}
+
+
+/*
+ *	Reads the source address of a received RX Packet (0x80 or 0x81).
+ *
+ *	@param *frame, received frame block
+ *	@param *sh, *sl, receive the 64-bit source address (0 for 0x81)
+ *	@param *my, receives the 16-bit source address (XBEE_ADDR16_UNKNOWN for 0x80)
+ *	@retval false if the frame is no RX Packet
+ */
+bool xbeeRxSource(xbee_frame *frame, uint32_t *sh, uint32_t *sl, uint16_t *my)
+{
+	const uint8_t *data = xbeeFrameData(frame);
+
+	*sh = 0;
+	*sl = 0;
+	*my = XBEE_ADDR16_UNKNOWN;
+	if(data[0] == XBEE_API_RX64 && frame->len >= 11)
+	{
+		*sh = xbeeGetU32(&data[1]);
+		*sl = xbeeGetU32(&data[5]);
+		return true;
+	}
+	if(data[0] == XBEE_API_RX16 && frame->len >= 5)
+	{
+		*my = ((uint16_t)data[1] << 8) | data[2];
+		return true;
+	}
+	return false;
+}
+
+
+/*
+ *	Routes a received API frame to the parts of the driver that are waiting
+ *	for it, then to the application callback.
+ */
+static void xbeeDispatchFrame(xbee_module *xbee, xbee_frame *block)
+{
+	const uint8_t *frame = xbeeFrameData(block);
+	uint16_t len = block->len;
+	xbee_node *node = NULL;
+
+	switch(frame[0])
+	{
+	case XBEE_API_RX64:
+	case XBEE_API_RX64_IO:
+		// 0x80 | 64-bit source (8) | RSSI | Options | Data
+		if(len >= 11)
+		{
+			node = xbeeNodeFind64(&xbee->radio->nodes, xbeeGetU32(&frame[1]), xbeeGetU32(&frame[5]));
+			if(node == NULL)
+			{
+				node = xbeeNodeAdd(&xbee->radio->nodes, xbeeGetU32(&frame[1]), xbeeGetU32(&frame[5]), XBEE_ADDR16_UNKNOWN);
+			}
+			node->rssi = frame[9];
+		}
+		break;
+	case XBEE_API_RX16:
+	case XBEE_API_RX16_IO:
+		// 0x81 | 16-bit source (2) | RSSI | Options | Data
+		if(len >= 5)
+		{
+			node = xbeeNodeFind16(&xbee->radio->nodes, ((uint16_t)frame[1] << 8) | frame[2]);
+			if(node != NULL)
+			{
+				node->rssi = frame[3];
+			}
+		}
+		break;
+	case XBEE_API_AT_RESPONSE:
+		xbeeHandleATResponse(xbee, frame, len);
+		xbeeInitHandleResponse(xbee, frame, len);
+		xbeeDiscoverHandleResponse(xbee, frame, len);
+		xbeeRemoteATHandleResponse(xbee, frame, len);
+		break;
+	case XBEE_API_REMOTE_AT_RESPONSE:
+		xbeeHandleATResponse(xbee, frame, len);
+		xbeeRemoteATHandleResponse(xbee, frame, len);
+		break;
+	case XBEE_API_TX_STATUS:
+		xbeeTxHandleStatus(xbee, frame, len);
+		break;
+	default:
+		break;
+	}
+
+	if(node != NULL)
+	{
+		node->lastseen = HAL_GetTick();
+		++node->rxframes;
+	}
+
+	if(xbee->onframe != NULL)
+	{
+		if(xbee->stats.rxstamp != 0)
+		{
+			xbeeStatsRecord(&xbee->stats.rxlatency, platformCycles() - xbee->stats.rxstamp);
+		}
+		xbee->onframe(xbee, block);
+	}
+}
+
+
+// Non-zero if any byte of the word is zero
+#define XBEE_HASZERO(w) (((w) - 0x01010101UL) & ~(w) & 0x80808080UL)
+
+/*
+ *	Tells whether any of the four bytes of a word has to be escaped.
+ *	0x11 and 0x13 only differ in bit 1, so they share one test.
+ */
+static inline bool xbeeEscapeWord(uint32_t w)
+{
+	return XBEE_HASZERO(w ^ 0x7E7E7E7EUL) || XBEE_HASZERO(w ^ 0x7D7D7D7DUL) ||
+		   XBEE_HASZERO((w & 0xFDFDFDFDUL) ^ 0x11111111UL);
+}
+
+static inline bool xbeeEscapeByte(uint8_t c)
+{
+	return c == XBEE_API_START_DELIM || c == XBEE_API_ESCAPE || c == XBEE_API_XON || c == XBEE_API_XOFF;
+}
+
+
+/*
+ *	Stores frame data bytes in the block being received and adds them to
+ *	the running checksum.
+ */
+static void xbeeParseData(xbee_parser *p, const uint8_t *data, uint16_t n)
+{
+	uint8_t sum = p->sum;
+	if(p->block != NULL)
+	{
+		uint8_t *dst = xbeeFrameData(p->block) + p->cnt;
+		for(uint16_t k = 0; k < n; ++k)
+		{
+			dst[k] = data[k];
+			sum += data[k];
+		}
+	}
+	else
+	{
+		for(uint16_t k = 0; k < n; ++k)
+		{
+			sum += data[k];
+		}
+	}
+	p->sum = sum;
+	p->cnt += n;
+	if(p->cnt == p->len)
+	{
+		p->state = XBEE_PARSE_CHECKSUM;
+	}
+}
+
+
+/*
+ *	Takes one byte following the start delimiter (length, frame data or
+ *	checksum) through the frame decoder.
+ */
+static void xbeeParseByte(xbee_module *xbee, uint8_t c)
+{
+	xbee_parser *p = &xbee->parser;
+
+	switch(p->state)
+	{
+	case XBEE_PARSE_DELIM:
+		break;
+
+	case XBEE_PARSE_LEN_MSB:
+		p->len = (uint16_t)c << 8;
+		p->state = XBEE_PARSE_LEN_LSB;
+		break;
+
+	case XBEE_PARSE_LEN_LSB:
+		p->len |= c;
+		p->cnt = 0;
+		p->sum = 0;
+		if((p->len == 0) || (p->len > XBEE_API_MAX_FRAME))
+		{
+			// Can not be a frame we are able to hold, resynchronize
+			++p->overflows;
+			p->state = XBEE_PARSE_DELIM;
+		}
+		else
+		{
+			p->block = xbeeFrameAlloc(&xbee->radio->pool);
+			if(p->block == NULL)
+			{
+				// The frame is still walked through to stay in sync
+				++p->nobuffer;
+			}
+			p->state = XBEE_PARSE_DATA;
+		}
+		break;
+
+	case XBEE_PARSE_DATA:
+		xbeeParseData(p, &c, 1);
+		break;
+
+	case XBEE_PARSE_CHECKSUM:
+		// Sum of frame data and checksum byte must equal 0xFF
+		if((uint8_t)(p->sum + c) == 0xFF)
+		{
+			if(p->block != NULL)
+			{
+				++p->frames;
+				p->block->len = p->len;
+				xbeeDispatchFrame(xbee, p->block);
+			}
+		}
+		else
+		{
+			++p->cserrors;
+		}
+		xbeeFrameRelease(&xbee->radio->pool, p->block);
+		p->block = NULL;
+		p->state = XBEE_PARSE_DELIM;
+		break;
+	}
+}
+
+
+/*
+ *	Stores escaped frame data in the block being received. Words without
+ *	any special byte are stored whole, the others byte by byte. Stops at
+ *	a start delimiter or once the frame data is complete.
+ *
+ *	@retval Number of bytes taken from data
+ */
+static uint16_t xbeeParseEscapedData(xbee_parser *p, const uint8_t *data, uint16_t len)
+{
+	uint8_t *dst = (p->block != NULL) ? xbeeFrameData(p->block) : NULL;
+	uint8_t sum = p->sum;
+	uint16_t cnt = p->cnt;
+	bool unescape = p->unescape;
+	uint16_t i = 0;
+	uint16_t bytewise = 0;	// Bytes left of a word that held a special byte
+
+	while(i < len && cnt < p->len)
+	{
+		if(bytewise == 0 && !unescape && i + 4 <= len && cnt + 4 <= p->len)
+		{
+			uint32_t w;
+			memcpy(&w, &data[i], 4);
+			if(!xbeeEscapeWord(w))
+			{
+				if(dst != NULL)
+				{
+					memcpy(&dst[cnt], &w, 4);
+				}
+				sum += data[i] + data[i+1] + data[i+2] + data[i+3];
+				cnt += 4;
+				i += 4;
+				continue;
+			}
+			bytewise = 4;
+		}
+
+		uint8_t c = data[i];
+		if(c == XBEE_API_START_DELIM)
+		{
+			break;
+		}
+		++i;
+		if(bytewise > 0)
+		{
+			--bytewise;
+		}
+		if(c == XBEE_API_XON || c == XBEE_API_XOFF)
+		{
+			continue;
+		}
+		if(c == XBEE_API_ESCAPE)
+		{
+			unescape = true;
+			continue;
+		}
+		if(unescape)
+		{
+			c ^= XBEE_API_ESCAPE_XOR;
+			unescape = false;
+		}
+		if(dst != NULL)
+		{
+			dst[cnt] = c;
+		}
+		sum += c;
+		++cnt;
+	}
+
+	p->sum = sum;
+	p->cnt = cnt;
+	p->unescape = unescape;
+	if(cnt == p->len)
+	{
+		p->state = XBEE_PARSE_CHECKSUM;
+	}
+	return i;
+}
+
+
+/*
+ *	Frame decoder for escaped API mode (AP = 2). A start delimiter is never
+ *	escaped, so one inside a frame always begins a new frame (the cut one
+ *	is counted as a checksum error). Bare XON/XOFF bytes are flow control
+ *	and are dropped.
+ */
+static void xbeeParseEscaped(xbee_module *xbee, const uint8_t *data, uint16_t len)
+{
+	xbee_parser *p = &xbee->parser;
+	uint16_t i = 0;
+
+	while(i < len)
+	{
+		if(p->state == XBEE_PARSE_DATA && data[i] != XBEE_API_START_DELIM)
+		{
+			i += xbeeParseEscapedData(p, &data[i], len - i);
+			continue;
+		}
+
+		uint8_t c = data[i++];
+		if(c == XBEE_API_START_DELIM)
+		{
+			if(p->state != XBEE_PARSE_DELIM)
+			{
+				++p->cserrors;
+				xbeeFrameRelease(&xbee->radio->pool, p->block);
+				p->block = NULL;
+			}
+			p->unescape = false;
+			p->state = XBEE_PARSE_LEN_MSB;
+		}
+		else if(c == XBEE_API_XON || c == XBEE_API_XOFF)
+		{
+			continue;
+		}
+		else if(c == XBEE_API_ESCAPE)
+		{
+			p->unescape = true;
+		}
+		else if(p->unescape)
+		{
+			p->unescape = false;
+			xbeeParseByte(xbee, c ^ XBEE_API_ESCAPE_XOR);
+		}
+		else
+		{
+			xbeeParseByte(xbee, c);
+		}
+	}
+}
+
+
+/*
+ *	Feeds received UART bytes through the API frame decoder of target module.
+ *	The decoder keeps its state between calls so data can be passed along
+ *	in whatever chunks the UART delivered it in. Frame data is stored in a
+ *	block from the pool of the radio and every complete frame with a valid
+ *	checksum is handed on in that block, no further copies are made. Frames
+ *	arriving while the pool is empty are dropped and counted. The bytes are
+ *	unescaped on the way when the module runs in escaped API mode.
+ *
+ *	@param *xbee, handle for target xbee module
+ *	@param *data, received bytes
+ *	@param len, number of received bytes
+ */
+void xbeeParseBytes(xbee_module *xbee, const uint8_t *data, uint16_t len)
+{
+	xbee_parser *p = &xbee->parser;
+	uint16_t i = 0;
+
+	if(xbee->settings.AP == XBEE_API_ESCAPED)
+	{
+		xbeeParseEscaped(xbee, data, len);
+		return;
+	}
+
+	while(i < len)
+	{
+		if(p->state == XBEE_PARSE_DELIM)
+		{
+			// Skip anything that is not the start of a frame
+			while((i < len) && (data[i] != XBEE_API_START_DELIM))
+			{
+				++i;
+			}
+			if(i < len)
+			{
+				p->state = XBEE_PARSE_LEN_MSB;
+				++i;
+			}
+		}
+		else if(p->state == XBEE_PARSE_DATA)
+		{
+			// Copy as much of the frame data as this chunk holds in one go
+			uint16_t n = p->len - p->cnt;
+			if(n > (len - i))
+			{
+				n = len - i;
+			}
+			xbeeParseData(p, &data[i], n);
+			i += n;
+		}
+		else
+		{
+			xbeeParseByte(xbee, data[i++]);
+		}
+	}
+}
+
+
+/*
+ *	Decodes everything received from target module so far. Bytes are
+ *	parsed where the UART DMA stored them, and frame data is copied once,
+ *	into its pool block. Call regularly from the main loop.
+ *
+ *	@param *xbee, handle for target xbee module
+ */
+void xbeeReceive(xbee_module *xbee)
+{
+	uart_rxring *ring = uartRxFind(xbee->hxbee);
+	const uint8_t *data;
+	uint16_t n;
+
+	if(ring == NULL)
+	{
+		return;
+	}
+	xbee->stats.rxstamp = ring->stamp;
+	while((n = uartRxPeek(ring, &data)) > 0)
+	{
+		xbeeParseBytes(xbee, data, n);
+		uartRxConsume(ring, n);
+	}
+	xbee->stats.rxstamp = 0;
+}
+
+
+/*
+ *	Calculates the API frame checksum of the given frame data.
+ *
+ *	@param *data, frame data (API identifier + payload)
+ *	@param len, length of frame data
+ *	@retval 0xFF minus the 8-bit sum of the frame data
+ */
+uint8_t xbeeChecksum(const uint8_t *data, uint16_t len)
+{
+	uint8_t sum = 0;
+	for(uint16_t i = 0; i < len; ++i)
+	{
+		sum += data[i];
+	}
+	return 0xFF - sum;
+}
+
+
+/*
+ *	Wraps frame data into a complete API frame (delimiter, length and checksum)
+ *	ready to be written to the UART.
+ *
+ *	@param *dst, destination for the encoded frame
+ *	@param size, size of destination
+ *	@param *data, frame data (API identifier + payload)
+ *	@param len, length of frame data
+ *	@retval Length of the encoded frame, 0 if it does not fit in dst
+ */
+uint16_t xbeeEncodeFrame(uint8_t *dst, uint16_t size, const uint8_t *data, uint16_t len)
+{
+	if((len == 0) || ((uint32_t)len + 4 > size))
+	{
+		return 0;
+	}
+
+	dst[0] = XBEE_API_START_DELIM;
+	dst[1] = (uint8_t)(len >> 8);
+	dst[2] = (uint8_t)len;
+	uint8_t sum = 0;
+	for(uint16_t i = 0; i < len; ++i)
+	{
+		dst[3+i] = data[i];
+		sum += data[i];
+	}
+	dst[3+len] = 0xFF - sum;
+
+	return len + 4;
+}
+
+
+/*
+ *	Finds the first byte that is escaped in escaped API mode. Four bytes
+ *	are checked at a time, a word holding a special byte is walked byte
+ *	by byte.
+ *
+ *	@param *data, bytes to check
+ *	@param len, number of bytes
+ *	@retval Number of leading bytes that are sent as they are, len if none
+ *			of them has to be escaped
+ */
+uint16_t xbeeEscapeScan(const uint8_t *data, uint16_t len)
+{
+	uint16_t i = 0;
+
+	while(i + 4 <= len)
+	{
+		uint32_t w;
+		// Compiles to a single (unaligned) load on the Cortex-M4
+		memcpy(&w, &data[i], 4);
+		if(xbeeEscapeWord(w))
+		{
+			break;
+		}
+		i += 4;
+	}
+	while(i < len && !xbeeEscapeByte(data[i]))
+	{
+		++i;
+	}
+	return i;
+}
+
+
+/*
+ *	Calculates the length of data once it has been escaped.
+ *
+ *	@param *data, bytes to escape
+ *	@param len, number of bytes
+ *	@retval len plus one for every byte that has to be escaped
+ */
+uint16_t xbeeEscapedLength(const uint8_t *data, uint16_t len)
+{
+	uint16_t n = len;
+	uint16_t i = 0;
+
+	for(; i + 4 <= len; i += 4)
+	{
+		uint32_t w;
+		memcpy(&w, &data[i], 4);
+		if(xbeeEscapeWord(w))
+		{
+			for(uint16_t k = i; k < i + 4; ++k)
+			{
+				n += xbeeEscapeByte(data[k]);
+			}
+		}
+	}
+	for(; i < len; ++i)
+	{
+		n += xbeeEscapeByte(data[i]);
+	}
+	return n;
+}
+
+
+/*
+ *	Escapes as much of data into dst as can be done without running out
+ *	of room in the middle of a word, a word at a time.
+ *
+ *	@param *taken, set to the number of bytes of data that were escaped
+ *	@retval Number of bytes written
+ */
+static uint16_t xbeeEscapeWords(uint8_t *dst, uint16_t room, const uint8_t *data, uint16_t len, uint16_t *taken)
+{
+	uint16_t i = 0;
+	uint16_t n = 0;
+
+	while(i + 4 <= len && n + 8 <= room)
+	{
+		uint32_t w;
+		memcpy(&w, &data[i], 4);
+		if(!xbeeEscapeWord(w))
+		{
+			memcpy(&dst[n], &w, 4);
+			n += 4;
+		}
+		else
+		{
+			for(uint16_t k = i; k < i + 4; ++k)
+			{
+				uint8_t c = data[k];
+				if(xbeeEscapeByte(c))
+				{
+					dst[n++] = XBEE_API_ESCAPE;
+					c ^= XBEE_API_ESCAPE_XOR;
+				}
+				dst[n++] = c;
+			}
+		}
+		i += 4;
+	}
+	*taken = i;
+	return n;
+}
+
+
+/*
+ *	Copies bytes into reserved transmit queue room, moving on to its
+ *	second part once the first one is full.
+ */
+static void xbeeSpanWrite(uart_txspan *span, const uint8_t *data, uint16_t n)
+{
+	uint16_t first = (n < span->len[0]) ? n : span->len[0];
+
+	memcpy(span->data[0], data, first);
+	span->data[0] += first;
+	span->len[0] -= first;
+	if(first < n)
+	{
+		span->data[0] = span->data[1] + (n - first);
+		span->len[0] = span->len[1] - (n - first);
+		memcpy(span->data[1], &data[first], n - first);
+		span->len[1] = 0;
+	}
+}
+
+
+/*
+ *	Escapes data into room that is known to hold all of it. The few bytes
+ *	at the end of each part of the room, and the tail of the data, go one
+ *	at a time so an escape pair can be split across the wrap.
+ */
+static void xbeeEscapeInto(uart_txspan *span, const uint8_t *data, uint16_t len)
+{
+	while(len > 0)
+	{
+		uint16_t taken;
+		uint16_t n = xbeeEscapeWords(span->data[0], span->len[0], data, len, &taken);
+		span->data[0] += n;
+		span->len[0] -= n;
+		data += taken;
+		len -= taken;
+		if(len > 0)
+		{
+			uint8_t pair[2] = {XBEE_API_ESCAPE, *data ^ XBEE_API_ESCAPE_XOR};
+			if(xbeeEscapeByte(*data))
+			{
+				xbeeSpanWrite(span, pair, 2);
+			}
+			else
+			{
+				xbeeSpanWrite(span, data, 1);
+			}
+			++data;
+			--len;
+		}
+	}
+}
+
+
+/*
+ *	Escapes data for escaped API mode (AP = 2). Only what follows the start
+ *	delimiter of a frame is escaped.
+ *
+ *	@param *dst, destination for the escaped bytes
+ *	@param size, size of destination
+ *	@param *data, bytes to escape
+ *	@param len, number of bytes
+ *	@retval Number of bytes written, 0 if they do not fit in dst
+ */
+uint16_t xbeeEscape(uint8_t *dst, uint16_t size, const uint8_t *data, uint16_t len)
+{
+	uint16_t n = xbeeEscapedLength(data, len);
+	if(n > size)
+	{
+		return 0;
+	}
+
+	uart_txspan span = {{dst, NULL}, {n, 0}};
+	xbeeEscapeInto(&span, data, len);
+	return n;
+}
+
+
+// ++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
+// +++++++++++++++++++++++++++ AT COMMAND BATCHES +++++++++++++++++++++++++++++
+// ++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
+
+// The table above must cover every entry of XBEE_SETTINGS_LIST
+typedef char xbee_setting_table_check[(sizeof(xbeeSettingTable)/sizeof(xbee_setting_desc) == XBEE_SETTING_COUNT) ? 1 : -1];
+
+
+/*
+ *	Looks up an AT parameter by its two letter command.
+ *
+ *	@param *cmd, AT command, e.g. "CH" (case sensitive, only two chars are used)
+ *	@retval Descriptor of the parameter, NULL if it is not part of xbee_settings
+ */
+const xbee_setting_desc *xbeeFindSetting(const char *cmd)
+{
+	for(int i = 0; i < XBEE_SETTING_COUNT; ++i)
+	{
+		if(xbeeSettingTable[i].cmd[0] == cmd[0] && xbeeSettingTable[i].cmd[1] == cmd[1])
+		{
+			return &xbeeSettingTable[i];
+		}
+	}
+	return NULL;
+}
+
+
+/*
+ *	Reads a numeric AT parameter out of a settings struct.
+ *
+ *	@param *settings, settings to read from
+ *	@param idx, parameter index (XBEE_SETTING_xx)
+ *	@retval Parameter value, 0 for string parameters
+ */
+uint64_t xbeeGetSetting(const xbee_settings *settings, uint8_t idx)
+{
+	const uint8_t *field = (const uint8_t *)settings + xbeeSettingTable[idx].offset;
+	switch(xbeeSettingTable[idx].width)
+	{
+	case 1:
+		return *field;
+	case 2:
+		return *(const uint16_t *)field;
+	case 4:
+		return *(const uint32_t *)field;
+	case 8:
+		return ((uint64_t)((const uint32_t *)field)[0] << 32) | ((const uint32_t *)field)[1];
+	default:
+		return 0;
+	}
+}
+
+
+/*
+ *	Stores a numeric AT parameter in a settings struct.
+ *
+ *	@param *settings, settings to write to
+ *	@param idx, parameter index (XBEE_SETTING_xx)
+ *	@param value, new parameter value
+ */
+void xbeeSetSetting(xbee_settings *settings, uint8_t idx, uint64_t value)
+{
+	uint8_t *field = (uint8_t *)settings + xbeeSettingTable[idx].offset;
+	switch(xbeeSettingTable[idx].width)
+	{
+	case 1:
+		*field = (uint8_t)value;
+		break;
+	case 2:
+		*(uint16_t *)field = (uint16_t)value;
+		break;
+	case 4:
+		*(uint32_t *)field = (uint32_t)value;
+		break;
+	case 8:
+		((uint32_t *)field)[0] = (uint32_t)(value >> 32);
+		((uint32_t *)field)[1] = (uint32_t)value;
+		break;
+	}
+}
+
+
+/*
+ *	Prepares an empty batch for target module.
+ *
+ *	@param *batch, batch to initialize
+ *	@param *xbee, handle for target xbee module (local)
+ */
+void xbeeBatchInit(xbee_at_batch *batch, xbee_module *xbee)
+{
+	batch->xbee = xbee;
+	batch->failed = 0;
+	for(int i = 0; i < XBEE_SETTING_WORDS; ++i)
+	{
+		batch->read[i] = 0;
+		batch->write[i] = 0;
+	}
+}
+
+
+/*
+ *	Adds a parameter read to a batch. The reply is stored in the
+ *	modules xbee_settings when the batch is run.
+ *
+ *	@param *batch, target batch
+ *	@param *cmd, two letter AT command
+ *	@retval false if the command is not part of xbee_settings
+ */
+bool xbeeBatchRead(xbee_at_batch *batch, const char *cmd)
+{
+	const xbee_setting_desc *desc = xbeeFindSetting(cmd);
+	if(desc == NULL)
+	{
+		return false;
+	}
+	uint8_t idx = desc - xbeeSettingTable;
+	batch->read[idx/32] |= (1UL << (idx%32));
+	return true;
+}
+
+
+/*
+ *	Adds a parameter write to a batch. The value currently held in the
+ *	modules xbee_settings is sent when the batch is run. The setting stays
+ *	marked as changed until the module has answered the write with "OK",
+ *	so a write that fails or times out is sent again by xbeeSyncSettings().
+ *
+ *	@param *batch, target batch
+ *	@param *cmd, two letter AT command
+ *	@retval false if the command is not part of xbee_settings or read only
+ */
+bool xbeeBatchWrite(xbee_at_batch *batch, const char *cmd)
+{
+	const xbee_setting_desc *desc = xbeeFindSetting(cmd);
+	if(desc == NULL || (desc->flags & XBEE_SETTING_READONLY))
+	{
+		return false;
+	}
+	uint8_t idx = desc - xbeeSettingTable;
+	batch->write[idx/32] |= (1UL << (idx%32));
+	xbeeMarkDirty(batch->xbee, idx);
+	return true;
+}
+
+
+/*
+ *	Reads one carriage return terminated response line from the
+ *	local module.
+ *
+ *	@param *line, destination, NULL terminated without the \r
+ *	@param size, size of destination
+ *	@param timeout, maximum time to wait in milliseconds
+ *	@retval true if a complete line was received
+ */
+static bool xbeeReadLine(xbee_module *xbee, char *line, uint16_t size, uint32_t timeout)
+{
+	uart_rxring *ring = uartRxFind(xbee->hxbee);
+	uint16_t cnt = 0;
+	platform_timer timer = {0};
+
+	if(ring == NULL)
+	{
+		return false;
+	}
+
+	platformTimerStart(&timer, timeout*1000, NULL, NULL);
+	while(timer.active)
+	{
+		uint8_t c;
+		if(uartRxRead(ring, &c, 1) == 0)
+		{
+			platformSleepTickless();
+			continue;
+		}
+		if(c == '\r')
+		{
+			platformTimerStop(&timer);
+			line[cnt] = 0x0;
+			return true;
+		}
+		if(cnt < size-1)
+		{
+			line[cnt++] = c;
+		}
+	}
+	return false;
+}
+
+
+/*
+ *	Sends one chained command line ("ATxx,yy,zz\r") and stores the
+ *	response of each command.
+ *
+ *	@param *batch, batch the commands belong to
+ *	@param *line, command line without the terminating \r
+ *	@param *ops, parameter index per command, -1 for commands without a value (AC, WR, CN)
+ *	@param n, number of commands on the line
+ */
+static XBEE_STAT xbeeBatchSendLine(xbee_at_batch *batch, char *line, uint16_t len, const int8_t *ops, uint8_t n)
+{
+	xbee_module *xbee = batch->xbee;
+	char resp[24];
+
+	line[len++] = '\r';
+	uartTxWrite(xbee->hxbee, (uint8_t *)line, len);
+
+	for(uint8_t i = 0; i < n; ++i)
+	{
+		if(!xbeeReadLine(xbee, resp, sizeof(resp), XBEE_AT_TIMEOUT))
+		{
+			// Module state is unknown, the next batch will start over
+			xbee->cmdmode = false;
+			return XBEE_ERR_AT_TIMEOUT;
+		}
+		xbee->cmdtick = HAL_GetTick();
+
+		if(!strcmp(resp, "ERROR"))
+		{
+			++batch->failed;
+			continue;
+		}
+		if(ops[i] < 0)
+		{
+			continue;
+		}
+
+		uint8_t idx = (uint8_t)ops[i];
+		if(batch->write[idx/32] & (1UL << (idx%32)))
+		{
+			// Write acknowledged with "OK", the module has the value now
+			xbee->dirty[idx/32] &= ~(1UL << (idx%32));
+			continue;
+		}
+		if(xbeeSettingTable[idx].width > 8)
+		{
+			uint8_t *field = (uint8_t *)&xbee->settings + xbeeSettingTable[idx].offset;
+			strncpy((char *)field, resp, xbeeSettingTable[idx].width);
+		}
+		else
+		{
+			xbeeSetSetting(&xbee->settings, idx, strtoull(resp, NULL, 16));
+		}
+	}
+	return XBEE_MSG_OK;
+}
+
+
+/*
+ *	Runs all reads and writes of a batch in a single command mode session.
+ *	Commands are chained with commas into as few lines as possible
+ *	(at most XBEE_AT_LINE_MAX characters each), so only one pair of guard
+ *	times is spent no matter how many parameters are involved. If the
+ *	module is still in command mode from an earlier XBEE_BATCH_KEEPOPEN
+ *	batch no guard times are spent at all.
+ *
+ *	@param *batch, batch to run
+ *	@param flags, XBEE_BATCH_APPLY, XBEE_BATCH_SAVE and/or XBEE_BATCH_KEEPOPEN
+ *	@retval XBEE_MSG_OK, XBEE_ERR_AT_COMMAND if any command was answered
+ *			with ERROR, XBEE_ERR_AT_TIMEOUT if the module stopped answering
+ */
+XBEE_STAT xbeeBatchRun(xbee_at_batch *batch, uint8_t flags)
+{
+	xbee_module *xbee = batch->xbee;
+	char line[XBEE_AT_LINE_MAX+2];
+	int8_t ops[XBEE_AT_LINE_MAX/3];
+	uint16_t len = 2;
+	uint8_t n = 0;
+	XBEE_STAT stat;
+
+	// Command mode times out after CT x 100 ms without commands
+	if(!xbee->cmdmode || (HAL_GetTick() - xbee->cmdtick) + XBEE_AT_TIMEOUT >= (uint32_t)xbee->settings.CT*100)
+	{
+		xbeeEnterCMDMode(xbee);
+	}
+	uartRxDiscard(xbee->hxbee);
+	batch->failed = 0;
+	line[0] = 'A';
+	line[1] = 'T';
+
+	for(uint8_t idx = 0; idx < XBEE_SETTING_COUNT; ++idx)
+	{
+		bool rd = batch->read[idx/32] & (1UL << (idx%32));
+		bool wr = batch->write[idx/32] & (1UL << (idx%32));
+		if(!rd && !wr)
+		{
+			continue;
+		}
+
+		// Format "CH", "CHC" or "NIname"
+		char item[XBEE_AT_LINE_MAX];
+		uint16_t ilen;
+		if(!wr)
+		{
+			ilen = sprintf(item, "%.2s", xbeeSettingTable[idx].cmd);
+		}
+		else if(xbeeSettingTable[idx].width > 8)
+		{
+			const char *field = (const char *)&xbee->settings + xbeeSettingTable[idx].offset;
+			ilen = sprintf(item, "%.2s%.*s", xbeeSettingTable[idx].cmd, xbeeSettingTable[idx].width, field);
+		}
+		else
+		{
+			uint64_t value = xbeeGetSetting(&xbee->settings, idx);
+			if(value >> 32)
+			{
+				ilen = sprintf(item, "%.2s%lX%08lX", xbeeSettingTable[idx].cmd,
+						(unsigned long)(value >> 32), (unsigned long)(value & 0xFFFFFFFF));
+			}
+			else
+			{
+				ilen = sprintf(item, "%.2s%lX", xbeeSettingTable[idx].cmd, (unsigned long)value);
+			}
+		}
+
+		// A string may itself contain commas, so it always ends its line
+		if(n > 0 && ((len + 1 + ilen > XBEE_AT_LINE_MAX) || n == sizeof(ops)))
+		{
+			stat = xbeeBatchSendLine(batch, line, len, ops, n);
+			if(stat != XBEE_MSG_OK)
+			{
+				return stat;
+			}
+			len = 2;
+			n = 0;
+		}
+		if(n > 0)
+		{
+			line[len++] = ',';
+		}
+		memcpy(&line[len], item, ilen);
+		len += ilen;
+		ops[n++] = idx;
+		if(wr && xbeeSettingTable[idx].width > 8)
+		{
+			stat = xbeeBatchSendLine(batch, line, len, ops, n);
+			if(stat != XBEE_MSG_OK)
+			{
+				return stat;
+			}
+			len = 2;
+			n = 0;
+		}
+	}
+
+	// ++ Finishing commands share the last line when there is room ++
+	const char *finish[3] = {"AC", "WR", "CN"};
+	bool use[3] = {(flags & XBEE_BATCH_APPLY) != 0, (flags & XBEE_BATCH_SAVE) != 0, !(flags & XBEE_BATCH_KEEPOPEN)};
+	for(int i = 0; i < 3; ++i)
+	{
+		if(!use[i])
+		{
+			continue;
+		}
+		if(n > 0 && ((len + 3 > XBEE_AT_LINE_MAX) || n == sizeof(ops)))
+		{
+			stat = xbeeBatchSendLine(batch, line, len, ops, n);
+			if(stat != XBEE_MSG_OK)
+			{
+				return stat;
+			}
+			len = 2;
+			n = 0;
+		}
+		if(n > 0)
+		{
+			line[len++] = ',';
+		}
+		line[len++] = finish[i][0];
+		line[len++] = finish[i][1];
+		ops[n++] = -1;
+	}
+	if(n > 0)
+	{
+		stat = xbeeBatchSendLine(batch, line, len, ops, n);
+		if(stat != XBEE_MSG_OK)
+		{
+			return stat;
+		}
+	}
+	if(use[2])
+	{
+		xbee->cmdmode = false;
+	}
+
+	return (batch->failed == 0) ? XBEE_MSG_OK : XBEE_ERR_AT_COMMAND;
+}
+
+
+/*
+ *	Reads every parameter of xbee_settings from the local module in a
+ *	single command mode session.
+ *
+ *	@param *xbee, handle for target xbee module (local)
+ *	@retval Status of the batch, see xbeeBatchRun()
+ */
+XBEE_STAT xbeeReadSettings(xbee_module *xbee)
+{
+	xbee_at_batch batch;
+	xbeeBatchInit(&batch, xbee);
+	for(uint8_t idx = 0; idx < XBEE_SETTING_COUNT; ++idx)
+	{
+		if(!(xbeeSettingTable[idx].flags & XBEE_SETTING_WRITEONLY))
+		{
+			batch.read[idx/32] |= (1UL << (idx%32));
+		}
+	}
+	return xbeeBatchRun(&batch, 0);
+}
+
+
+// ++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
+// ++++++++++++++++++++++++ INCREMENTAL SETTINGS SYNC +++++++++++++++++++++++++
+// ++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
+
+/*
+ *	Changes a numeric setting of target module. The setting is marked as
+ *	changed only if the value actually differs, the module itself is
+ *	updated on the next xbeeSyncSettings().
+ *
+ *	@param *xbee, handle for target xbee module
+ *	@param idx, parameter index (XBEE_SETTING_xx)
+ *	@param value, new value
+ */
+void xbeeChangeSetting(xbee_module *xbee, uint8_t idx, uint64_t value)
+{
+	if(xbeeGetSetting(&xbee->settings, idx) != value)
+	{
+		xbeeSetSetting(&xbee->settings, idx, value);
+		xbeeMarkDirty(xbee, idx);
+	}
+}
+
+
+/*
+ *	Marks a setting as changed, e.g. after xbee_settings (or the NI string)
+ *	has been modified directly.
+ *
+ *	@param *xbee, handle for target xbee module
+ *	@param idx, parameter index (XBEE_SETTING_xx)
+ */
+void xbeeMarkDirty(xbee_module *xbee, uint8_t idx)
+{
+	if(!(xbeeSettingTable[idx].flags & XBEE_SETTING_READONLY))
+	{
+		xbee->dirty[idx/32] |= (1UL << (idx%32));
+	}
+}
+
+
+/*
+ *	Returns the next API frame ID for AT command frames sent through
+ *	target module. 0 is skipped since it tells the module not to send a
+ *	response, and so are IDs of remote requests still waiting for theirs
+ *	and the ID of an ongoing discovery.
+ *
+ *	@param *xbee, handle for target xbee module
+ */
+uint8_t xbeeNextFrameId(xbee_module *xbee)
+{
+	do
+	{
+		if(++xbee->frameid == 0)
+		{
+			xbee->frameid = 1;
+		}
+	} while(xbeeRemoteATBusy(xbee, xbee->frameid) || xbeeDiscoverBusy(xbee, xbee->frameid));
+	return xbee->frameid;
+}
+
+
+/*
+ *	Queues a complete API frame in escaped form. The frame is escaped
+ *	straight into the transmit queue the DMA sends from. UARTs without a
+ *	transmit queue get it through a buffer on the stack instead.
+ *
+ *	@param *xbee, handle for the local xbee module
+ *	@param *frame, complete API frame, starting with the start delimiter
+ *	@param len, length of the frame
+ *	@retval XBEE_MSG_OK, or XBEE_ERR_TX_FULL if the frame could not be queued
+ */
+static XBEE_STAT xbeeWriteEscaped(xbee_module *xbee, const uint8_t *frame, uint16_t len)
+{
+	uint16_t n = 1 + xbeeEscapedLength(&frame[1], len - 1);
+	uart_txspan span;
+
+	if(uartTxFind(xbee->hxbee) == NULL)
+	{
+		uint8_t buf[2*(XBEE_API_MAX_FRAME+4)];
+		buf[0] = frame[0];
+		xbeeEscape(&buf[1], sizeof(buf) - 1, &frame[1], len - 1);
+		return (uartTxWrite(xbee->hxbee, buf, n) == UART_TX_OK) ? XBEE_MSG_OK : XBEE_ERR_TX_FULL;
+	}
+
+	if(uartTxReserve(xbee->hxbee, n, &span) != UART_TX_OK)
+	{
+		return XBEE_ERR_TX_FULL;
+	}
+	xbeeSpanWrite(&span, frame, 1);
+	xbeeEscapeInto(&span, &frame[1], len - 1);
+	uartTxCommit(xbee->hxbee, n);
+	return XBEE_MSG_OK;
+}
+
+
+/*
+ *	Encodes frame data as an API frame and queues it on the UART of the
+ *	local module.
+ *
+ *	@param *xbee, handle for the local xbee module
+ *	@param *data, frame data (API identifier + payload)
+ *	@param len, length of frame data
+ *	@retval XBEE_MSG_OK, or XBEE_ERR_TX_FULL if the frame could not be queued
+ */
+XBEE_STAT xbeeSendFrame(xbee_module *xbee, const uint8_t *data, uint16_t len)
+{
+	uint8_t frame[XBEE_API_MAX_FRAME+4];
+	uint16_t flen = xbeeEncodeFrame(frame, sizeof(frame), data, len);
+	if(flen == 0)
+	{
+		return XBEE_ERR_TX_FULL;
+	}
+	if(xbee->settings.AP == XBEE_API_ESCAPED)
+	{
+		return xbeeWriteEscaped(xbee, frame, flen);
+	}
+	if(uartTxWrite(xbee->hxbee, frame, flen) != UART_TX_OK)
+	{
+		return XBEE_ERR_TX_FULL;
+	}
+	return XBEE_MSG_OK;
+}
+
+
+/*
+ *	Returns a block to the pool once the UART is done with it.
+ *	Called from the transfer complete interrupt.
+ */
+static void xbeeReleaseSent(void *ctx)
+{
+	xbee_frame *frame = (xbee_frame *)ctx;
+	xbeeFrameRelease(frame->pool, frame);
+}
+
+
+/*
+ *	Sends an API frame held in a pool block without copying it. The frame
+ *	data (block->len bytes) is wrapped into a complete API frame inside the
+ *	block and handed to the UART by reference. The block is referenced
+ *	until it has been transmitted, the caller keeps its own reference and
+ *	must not change the block before it is released by the driver. In
+ *	escaped API mode a frame with bytes to escape is escaped into the
+ *	transmit queue instead and the block is not referenced.
+ *
+ *	@param *xbee, handle for target xbee module
+ *	@param *frame, block holding the frame data
+ *	@retval XBEE_MSG_OK, or XBEE_ERR_TX_FULL if the frame could not be queued
+ */
+XBEE_STAT xbeeSendBlock(xbee_module *xbee, xbee_frame *frame)
+{
+	uint16_t len = frame->len;
+	if(len == 0 || len > XBEE_API_MAX_FRAME)
+	{
+		return XBEE_ERR_TX_FULL;
+	}
+
+	frame->raw[0] = XBEE_API_START_DELIM;
+	frame->raw[1] = (uint8_t)(len >> 8);
+	frame->raw[2] = (uint8_t)len;
+	frame->raw[XBEE_FRAME_HEADROOM+len] = xbeeChecksum(xbeeFrameData(frame), len);
+
+	uint16_t flen = XBEE_FRAME_HEADROOM+len+1;
+	if(xbee->settings.AP == XBEE_API_ESCAPED && xbeeEscapeScan(&frame->raw[1], flen-1) != flen-1)
+	{
+		// Has to be escaped, which can not be done in place
+		return xbeeWriteEscaped(xbee, frame->raw, flen);
+	}
+
+	xbeeFrameRef(frame);
+	if(uartTxWriteRef(xbee->hxbee, frame->raw, flen, xbeeReleaseSent, frame) != UART_TX_OK)
+	{
+		xbeeFrameRelease(frame->pool, frame);
+		return XBEE_ERR_TX_FULL;
+	}
+	return XBEE_MSG_OK;
+}
+
+
+/*
+ *	Writes the parameter value of a setting most significant byte first,
+ *	as the API frames carry it.
+ *
+ *	@retval Number of bytes written
+ */
+uint8_t xbeeEncodeSetting(const xbee_settings *settings, uint8_t idx, uint8_t *dst)
+{
+	uint8_t width = xbeeSettingTable[idx].width;
+	if(width > 8)
+	{
+		const uint8_t *field = (const uint8_t *)settings + xbeeSettingTable[idx].offset;
+		uint8_t n = 0;
+		while(n < width && field[n] != 0x0)
+		{
+			dst[n] = field[n];
+			++n;
+		}
+		return n;
+	}
+
+	uint64_t value = xbeeGetSetting(settings, idx);
+	for(uint8_t i = 0; i < width; ++i)
+	{
+		dst[i] = (uint8_t)(value >> (8*(width-1-i)));
+	}
+	return width;
+}
+
+
+/*
+ *	Pushes every setting marked as changed to target module using API
+ *	frames, so the module never has to leave API mode. The local module
+ *	receives AT Command - Queue Parameter Value frames (0x09) followed by an
+ *	AT Command frame (0x08) for the last one, which applies them all. Remote
+ *	modules receive Remote AT Command Requests (0x17) through the local
+ *	module, with "apply changes" set on the last one.
+ *
+ *	A setting is no longer marked once its frame is queued, and is marked
+ *	again if the module answers with an error.
+ *
+ *	@param *xbee, handle for target xbee module
+ *	@retval XBEE_MSG_OK, or XBEE_ERR_TX_FULL if the UART queue filled up
+ *			(the remaining settings stay marked)
+ */
+XBEE_STAT xbeeSyncSettings(xbee_module *xbee)
+{
+	uint8_t data[XBEE_API_MAX_FRAME];
+	int16_t last = -1;
+
+	for(uint8_t idx = 0; idx < XBEE_SETTING_COUNT; ++idx)
+	{
+		if(xbee->dirty[idx/32] & (1UL << (idx%32)))
+		{
+			last = idx;
+		}
+	}
+
+	for(int16_t idx = 0; idx <= last; ++idx)
+	{
+		if(!(xbee->dirty[idx/32] & (1UL << (idx%32))))
+		{
+			continue;
+		}
+
+		uint16_t len = 0;
+		if(xbee->via != NULL)
+		{
+			data[len++] = XBEE_API_REMOTE_AT;
+			data[len++] = xbeeNextFrameId(xbee->via);
+			for(int i = 3; i >= 0; --i)
+			{
+				data[len++] = (uint8_t)(xbee->settings.SH >> (8*i));
+			}
+			for(int i = 3; i >= 0; --i)
+			{
+				data[len++] = (uint8_t)(xbee->settings.SL >> (8*i));
+			}
+			data[len++] = 0xFF;		// 16-bit address unknown, use 64-bit
+			data[len++] = 0xFE;
+			data[len++] = (idx == last) ? 0x02 : 0x00;	// Apply changes
+		}
+		else
+		{
+			data[len++] = (idx == last) ? XBEE_API_AT_CMD : XBEE_API_AT_QUEUE;
+			data[len++] = xbeeNextFrameId(xbee);
+		}
+		data[len++] = xbeeSettingTable[idx].cmd[0];
+		data[len++] = xbeeSettingTable[idx].cmd[1];
+		len += xbeeEncodeSetting(&xbee->settings, idx, &data[len]);
+
+		// Remote frames are sent through the local module
+		xbee_module *local = (xbee->via != NULL) ? xbee->via : xbee;
+		if(xbeeSendFrame(local, data, len) != XBEE_MSG_OK)
+		{
+			return XBEE_ERR_TX_FULL;
+		}
+		xbee->dirty[idx/32] &= ~(1UL << (idx%32));
+		xbee->writing[idx/32] |= (1UL << (idx%32));
+	}
+
+	return XBEE_MSG_OK;
+}
+
+
+/*
+ *	Handles Local (0x88) and Remote (0x97) AT Command Responses that
+ *	concern a field of xbee_settings. A failed write marks the setting
+ *	as changed again, a returned parameter value is stored. A failed read
+ *	leaves the setting as it is, the module still has its own value.
+ *
+ *	@param *local, handle for the local module the frame was received on
+ */
+static void xbeeHandleATResponse(xbee_module *local, const uint8_t *frame, uint16_t len)
+{
+	xbee_module *target = NULL;
+	uint16_t pos;
+
+	if(frame[0] == XBEE_API_AT_RESPONSE)
+	{
+		// 0x88 | Frame ID | AT command (2) | Status | Data
+		if(len < 5)
+		{
+			return;
+		}
+		target = local;
+		pos = 2;
+	}
+	else
+	{
+		// 0x97 | Frame ID | 64-bit source (8) | 16-bit source (2) | AT command (2) | Status | Data
+		if(len < 15)
+		{
+			return;
+		}
+		uint32_t sh = xbeeGetU32(&frame[2]);
+		uint32_t sl = xbeeGetU32(&frame[6]);
+		for(int i = 0; i < MAX_STORED_DEVICES-1; ++i)
+		{
+			xbee_module *remote = &local->radio->remote[i];
+			if(remote->via == local && remote->settings.SH == sh && remote->settings.SL == sl)
+			{
+				target = remote;
+			}
+		}
+		pos = 12;
+	}
+
+	const xbee_setting_desc *desc = xbeeFindSetting((const char *)&frame[pos]);
+	if(target == NULL || desc == NULL)
+	{
+		return;
+	}
+	uint8_t idx = desc - xbeeSettingTable;
+	uint8_t status = frame[pos+2];
+	const uint8_t *value = &frame[pos+3];
+	uint16_t vlen = len - (pos+3);
+	bool write = (target->writing[idx/32] & (1UL << (idx%32))) != 0;
+	target->writing[idx/32] &= ~(1UL << (idx%32));
+
+	if(status != 0)
+	{
+		if(write)
+		{
+			xbeeMarkDirty(target, idx);
+		}
+	}
+	else if(vlen > 0)
+	{
+		if(desc->width > 8)
+		{
+			uint8_t *field = (uint8_t *)&target->settings + desc->offset;
+			memset(field, 0, desc->width);
+			memcpy(field, value, (vlen < desc->width) ? vlen : desc->width);
+		}
+		else
+		{
+			uint64_t v = 0;
+			for(uint16_t i = 0; i < vlen && i < 8; ++i)
+			{
+				v = (v << 8) | value[i];
+			}
+			xbeeSetSetting(&target->settings, idx, v);
+		}
+	}
 }
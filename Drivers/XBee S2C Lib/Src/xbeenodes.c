@@ -0,0 +1,297 @@
+/*
+Copyright 2018 Jesper Wlivaara
+
+Permission is hereby granted, free of charge, to any person obtaining
+a copy of this software and associated documentation files (the "Software"),
+to deal in the Software without restriction, including without limitation the
+rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is furnished to
+do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all copies
+or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR
+PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE
+FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+
+#include "xbeenodes.h"
+
+
+static uint16_t xbeeHash64(uint32_t sh, uint32_t sl)
+{
+	return (uint16_t)(((sl ^ (sh * 0x9E3779B1UL)) * 0x9E3779B1UL) >> 16) & (XBEE_NODE_BUCKETS-1);
+}
+
+
+static uint16_t xbeeHash16(uint16_t my)
+{
+	return (uint16_t)(((uint32_t)my * 0x9E3779B1UL) >> 16) & (XBEE_NODE_BUCKETS-1);
+}
+
+
+/*
+ *	Unlinks a node from the LRU list.
+ */
+static void xbeeLruUnlink(xbee_nodetable *table, uint16_t idx)
+{
+	xbee_node *n = &table->node[idx];
+	if(n->prev != XBEE_NODE_NONE)
+	{
+		table->node[n->prev].next = n->next;
+	}
+	else
+	{
+		table->mru = n->next;
+	}
+	if(n->next != XBEE_NODE_NONE)
+	{
+		table->node[n->next].prev = n->prev;
+	}
+	else
+	{
+		table->lru = n->prev;
+	}
+}
+
+
+/*
+ *	Puts a node first in the LRU list.
+ */
+static void xbeeLruPush(xbee_nodetable *table, uint16_t idx)
+{
+	xbee_node *n = &table->node[idx];
+	n->prev = XBEE_NODE_NONE;
+	n->next = table->mru;
+	if(table->mru != XBEE_NODE_NONE)
+	{
+		table->node[table->mru].prev = idx;
+	}
+	table->mru = idx;
+	if(table->lru == XBEE_NODE_NONE)
+	{
+		table->lru = idx;
+	}
+}
+
+
+/*
+ *	Marks a node as the most recently used one.
+ */
+static void xbeeLruTouch(xbee_nodetable *table, uint16_t idx)
+{
+	if(table->mru != idx)
+	{
+		xbeeLruUnlink(table, idx);
+		xbeeLruPush(table, idx);
+	}
+}
+
+
+/*
+ *	Removes a node from the chain of its 16-bit hash bucket.
+ */
+static void xbeeUnlink16(xbee_nodetable *table, uint16_t idx)
+{
+	uint16_t my = table->node[idx].MY;
+	if(my == XBEE_ADDR16_UNKNOWN)
+	{
+		return;
+	}
+	uint16_t *link = &table->bucket16[xbeeHash16(my)];
+	while(*link != XBEE_NODE_NONE)
+	{
+		if(*link == idx)
+		{
+			*link = table->node[idx].next16;
+			return;
+		}
+		link = &table->node[*link].next16;
+	}
+}
+
+
+/*
+ *	Empties the registry.
+ *
+ *	@param *table, registry to initialize
+ */
+void xbeeNodesInit(xbee_nodetable *table)
+{
+	for(uint16_t i = 0; i < XBEE_NODE_BUCKETS; ++i)
+	{
+		table->bucket64[i] = XBEE_NODE_NONE;
+		table->bucket16[i] = XBEE_NODE_NONE;
+	}
+	for(uint16_t i = 0; i < XBEE_MAX_NODES; ++i)
+	{
+		table->node[i].used = false;
+		table->node[i].next = (i+1 < XBEE_MAX_NODES) ? i+1 : XBEE_NODE_NONE;
+	}
+	table->freelist = 0;
+	table->mru = XBEE_NODE_NONE;
+	table->lru = XBEE_NODE_NONE;
+	table->count = 0;
+	table->evictions = 0;
+}
+
+
+/*
+ *	Looks up a node by its 64-bit address.
+ *
+ *	@param *table, registry to search
+ *	@param sh, sl, 64-bit address of the node
+ *	@retval Pointer to the node, NULL if it is not registered
+ */
+xbee_node *xbeeNodeFind64(xbee_nodetable *table, uint32_t sh, uint32_t sl)
+{
+	uint16_t idx = table->bucket64[xbeeHash64(sh, sl)];
+	while(idx != XBEE_NODE_NONE)
+	{
+		xbee_node *n = &table->node[idx];
+		if(n->SL == sl && n->SH == sh)
+		{
+			xbeeLruTouch(table, idx);
+			return n;
+		}
+		idx = n->next64;
+	}
+	return NULL;
+}
+
+
+/*
+ *	Looks up a node by its 16-bit address.
+ *
+ *	@param *table, registry to search
+ *	@param my, 16-bit address of the node
+ *	@retval Pointer to the node, NULL if it is not registered
+ */
+xbee_node *xbeeNodeFind16(xbee_nodetable *table, uint16_t my)
+{
+	if(my == XBEE_ADDR16_UNKNOWN)
+	{
+		return NULL;
+	}
+	uint16_t idx = table->bucket16[xbeeHash16(my)];
+	while(idx != XBEE_NODE_NONE)
+	{
+		xbee_node *n = &table->node[idx];
+		if(n->MY == my)
+		{
+			xbeeLruTouch(table, idx);
+			return n;
+		}
+		idx = n->next16;
+	}
+	return NULL;
+}
+
+
+/*
+ *	Registers a node, or returns it if it is already registered (its
+ *	16-bit address is updated). When the registry is full the least
+ *	recently used node is evicted to make room.
+ *
+ *	@param *table, target registry
+ *	@param sh, sl, 64-bit address of the node
+ *	@param my, 16-bit address of the node, XBEE_ADDR16_UNKNOWN if none
+ *	@retval Pointer to the node
+ */
+xbee_node *xbeeNodeAdd(xbee_nodetable *table, uint32_t sh, uint32_t sl, uint16_t my)
+{
+	xbee_node *n = xbeeNodeFind64(table, sh, sl);
+	if(n != NULL)
+	{
+		xbeeNodeSetMY(table, n, my);
+		return n;
+	}
+
+	if(table->freelist == XBEE_NODE_NONE)
+	{
+		xbeeNodeRemove(table, &table->node[table->lru]);
+		++table->evictions;
+	}
+
+	uint16_t idx = table->freelist;
+	n = &table->node[idx];
+	table->freelist = n->next;
+
+	memset(n, 0, sizeof(xbee_node));
+	n->used = true;
+	n->SH = sh;
+	n->SL = sl;
+	n->MY = XBEE_ADDR16_UNKNOWN;
+
+	uint16_t b = xbeeHash64(sh, sl);
+	n->next64 = table->bucket64[b];
+	table->bucket64[b] = idx;
+	xbeeLruPush(table, idx);
+	++table->count;
+
+	xbeeNodeSetMY(table, n, my);
+	return n;
+}
+
+
+/*
+ *	Changes the 16-bit address of a registered node.
+ *
+ *	@param *table, target registry
+ *	@param *node, registered node
+ *	@param my, new 16-bit address, XBEE_ADDR16_UNKNOWN if none
+ */
+void xbeeNodeSetMY(xbee_nodetable *table, xbee_node *node, uint16_t my)
+{
+	if(node->MY == my)
+	{
+		return;
+	}
+
+	uint16_t idx = node - table->node;
+	xbeeUnlink16(table, idx);
+	node->MY = my;
+	if(my != XBEE_ADDR16_UNKNOWN)
+	{
+		uint16_t b = xbeeHash16(my);
+		node->next16 = table->bucket16[b];
+		table->bucket16[b] = idx;
+	}
+}
+
+
+/*
+ *	Removes a node from the registry.
+ *
+ *	@param *table, target registry
+ *	@param *node, registered node
+ */
+void xbeeNodeRemove(xbee_nodetable *table, xbee_node *node)
+{
+	uint16_t idx = node - table->node;
+	if(!node->used)
+	{
+		return;
+	}
+
+	uint16_t *link = &table->bucket64[xbeeHash64(node->SH, node->SL)];
+	while(*link != XBEE_NODE_NONE)
+	{
+		if(*link == idx)
+		{
+			*link = node->next64;
+			break;
+		}
+		link = &table->node[*link].next64;
+	}
+	xbeeUnlink16(table, idx);
+	xbeeLruUnlink(table, idx);
+
+	node->used = false;
+	node->next = table->freelist;
+	table->freelist = idx;
+	--table->count;
+}
@@ -0,0 +1,119 @@
+/*
+Copyright 2018 Jesper Wlivaara
+
+Permission is hereby granted, free of charge, to any person obtaining
+a copy of this software and associated documentation files (the "Software"),
+to deal in the Software without restriction, including without limitation the
+rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is furnished to
+do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all copies
+or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR
+PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE
+FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+
+#include "xbeelib.h"
+
+
+/*
+ *	Puts every block of the pool on the free list. Blocks still referenced
+ *	anywhere must not be used after this.
+ *
+ *	@param *pool, pool to initialize
+ */
+void xbeePoolInit(xbee_pool *pool)
+{
+	for(uint8_t i = 0; i < XBEE_POOL_BLOCKS; ++i)
+	{
+		pool->block[i].refs = 0;
+		pool->block[i].len = 0;
+		pool->block[i].next = (i+1 < XBEE_POOL_BLOCKS) ? i+1 : XBEE_POOL_NONE;
+		pool->block[i].pool = pool;
+	}
+	pool->freelist = 0;
+	pool->used = 0;
+	pool->highwater = 0;
+	pool->allocs = 0;
+	pool->exhausted = 0;
+}
+
+
+/*
+ *	Takes a block from the pool. The caller holds the only reference.
+ *	Safe to call from interrupt.
+ *
+ *	@param *pool, pool to allocate from
+ *	@retval the block, NULL if every block is in use
+ */
+xbee_frame *xbeeFrameAlloc(xbee_pool *pool)
+{
+	xbee_frame *frame = NULL;
+
+	uint32_t primask = __get_PRIMASK();
+	__disable_irq();
+	if(pool->freelist != XBEE_POOL_NONE)
+	{
+		frame = &pool->block[pool->freelist];
+		pool->freelist = frame->next;
+		frame->refs = 1;
+		frame->len = 0;
+		++pool->allocs;
+		if(++pool->used > pool->highwater)
+		{
+			pool->highwater = pool->used;
+		}
+	}
+	else
+	{
+		++pool->exhausted;
+	}
+	__set_PRIMASK(primask);
+
+	return frame;
+}
+
+
+/*
+ *	Takes one more reference to a block. Safe to call from interrupt.
+ *
+ *	@param *frame, block to hold on to
+ */
+void xbeeFrameRef(xbee_frame *frame)
+{
+	uint32_t primask = __get_PRIMASK();
+	__disable_irq();
+	++frame->refs;
+	__set_PRIMASK(primask);
+}
+
+
+/*
+ *	Gives back one reference to a block, the block returns to the pool
+ *	with the last one. Safe to call from interrupt.
+ *
+ *	@param *pool, pool the block belongs to
+ *	@param *frame, block to release (NULL is ignored)
+ */
+void xbeeFrameRelease(xbee_pool *pool, xbee_frame *frame)
+{
+	if(frame == NULL)
+	{
+		return;
+	}
+
+	uint32_t primask = __get_PRIMASK();
+	__disable_irq();
+	if(frame->refs > 0 && --frame->refs == 0)
+	{
+		frame->next = pool->freelist;
+		pool->freelist = (uint8_t)(frame - pool->block);
+		--pool->used;
+	}
+	__set_PRIMASK(primask);
+}
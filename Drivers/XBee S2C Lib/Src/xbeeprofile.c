@@ -0,0 +1,272 @@
+/*
+Copyright 2018 Jesper Wlivaara
+
+Permission is hereby granted, free of charge, to any person obtaining
+a copy of this software and associated documentation files (the "Software"),
+to deal in the Software without restriction, including without limitation the
+rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is furnished to
+do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all copies
+or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR
+PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE
+FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+
+#include "xbeelib.h"
+
+#if XBEE_ENABLE_PROFILE
+
+#if XBEE_PROFILE_RAM
+// Behaves like the flash page: erasing sets every bit, writing can only clear bits
+static uint8_t profilePage[XBEE_PROFILE_PAGE_SIZE] __attribute__((aligned(8))) = {[0 ... XBEE_PROFILE_PAGE_SIZE-1] = 0xFF};
+#define PROFILE_BASE ((uint8_t *)profilePage)
+#else
+#define PROFILE_BASE ((uint8_t *)XBEE_PROFILE_ADDR)
+#endif
+
+
+/*
+ *	CRC-32 (IEEE 802.3), bitwise. Only run when a profile is loaded or
+ *	saved, so a table is not worth the flash.
+ */
+static uint32_t xbeeProfileCRC(const uint8_t *data, uint16_t len)
+{
+	uint32_t crc = 0xFFFFFFFF;
+	for(uint16_t i = 0; i < len; ++i)
+	{
+		crc ^= data[i];
+		for(int b = 0; b < 8; ++b)
+		{
+			crc = (crc >> 1) ^ (0xEDB88320 & -(crc & 1));
+		}
+	}
+	return ~crc;
+}
+
+
+/*
+ *	Erases the profile page.
+ */
+static void xbeeProfileErasePage()
+{
+#if XBEE_PROFILE_RAM
+	memset(profilePage, 0xFF, sizeof(profilePage));
+#else
+	FLASH_EraseInitTypeDef erase;
+	uint32_t error;
+
+	erase.TypeErase = FLASH_TYPEERASE_PAGES;
+	erase.PageAddress = XBEE_PROFILE_ADDR;
+	erase.NbPages = 1;
+	HAL_FLASH_Unlock();
+	HAL_FLASHEx_Erase(&erase, &error);
+	HAL_FLASH_Lock();
+#endif
+}
+
+
+/*
+ *	Writes a record into an erased slot of the page.
+ *
+ *	@retval true if the slot reads back as written
+ */
+static bool xbeeProfileWriteSlot(uint16_t slot, const xbee_profile *profile)
+{
+	uint8_t *dst = PROFILE_BASE + slot*XBEE_PROFILE_SLOT;
+	const uint8_t *src = (const uint8_t *)profile;
+
+#if XBEE_PROFILE_RAM
+	for(uint16_t i = 0; i < sizeof(xbee_profile); ++i)
+	{
+		dst[i] &= src[i];
+	}
+#else
+	// The F3 flash is programmed a half-word at a time
+	HAL_FLASH_Unlock();
+	for(uint16_t i = 0; i < sizeof(xbee_profile); i += 2)
+	{
+		uint16_t half = src[i] | ((i+1U < sizeof(xbee_profile)) ? (src[i+1] << 8) : 0xFF00);
+		if(HAL_FLASH_Program(FLASH_TYPEPROGRAM_HALFWORD, XBEE_PROFILE_ADDR + slot*XBEE_PROFILE_SLOT + i, half) != HAL_OK)
+		{
+			break;
+		}
+	}
+	HAL_FLASH_Lock();
+#endif
+	return (memcmp(dst, src, sizeof(xbee_profile)) == 0);
+}
+
+
+/*
+ *	Tells if a slot holds a complete record written by this version of
+ *	the driver.
+ */
+static bool xbeeProfileValid(const xbee_profile *profile)
+{
+	return (profile->magic == XBEE_PROFILE_MAGIC && profile->version == XBEE_PROFILE_VERSION
+			&& profile->size == sizeof(xbee_settings)
+			&& profile->crc == xbeeProfileCRC((const uint8_t *)profile, offsetof(xbee_profile, crc)));
+}
+
+
+/*
+ *	Number of slots of the page that have been written. Records are
+ *	appended in order, so the first erased slot ends the search.
+ */
+uint16_t xbeeProfileUsed()
+{
+	uint16_t slot = 0;
+	while(slot < XBEE_PROFILE_SLOTS)
+	{
+		const xbee_profile *rec = (const xbee_profile *)(PROFILE_BASE + slot*XBEE_PROFILE_SLOT);
+		if(rec->magic == 0xFFFF)
+		{
+			break;
+		}
+		++slot;
+	}
+	return slot;
+}
+
+
+/*
+ *	Identifies the radio on a UART in the records.
+ */
+static uint32_t xbeeProfilePort(UART_HandleTypeDef *hxbee)
+{
+	return (uint32_t)(uintptr_t)hxbee->Instance;
+}
+
+
+/*
+ *	Finds the most recent valid record of a radio. A record cut short by
+ *	a reset fails its CRC and the one before it is used.
+ *
+ *	@param *profile, destination
+ *	@param *hxbee, UART the radio is on
+ *	@retval true if a valid record was found
+ */
+bool xbeeProfileLoad(xbee_profile *profile, UART_HandleTypeDef *hxbee)
+{
+	uint32_t port = xbeeProfilePort(hxbee);
+
+	for(int slot = xbeeProfileUsed()-1; slot >= 0; --slot)
+	{
+		const xbee_profile *rec = (const xbee_profile *)(PROFILE_BASE + slot*XBEE_PROFILE_SLOT);
+		if(rec->port == port && xbeeProfileValid(rec))
+		{
+			memcpy(profile, rec, sizeof(xbee_profile));
+			return true;
+		}
+	}
+	return false;
+}
+
+
+/*
+ *	Erases the page and writes the latest valid record of every other
+ *	radio back to the start of it, so filling the page up with one radio
+ *	does not cost the others their warm boot.
+ *
+ *	@param port, radio whose records are dropped (its new one follows)
+ *	@retval first free slot
+ */
+static uint16_t xbeeProfileCompact(uint32_t port)
+{
+	xbee_profile keep[(XBEE_PROFILE_RADIOS > 1) ? XBEE_PROFILE_RADIOS-1 : 1];
+	uint8_t count = 0;
+
+	for(int slot = xbeeProfileUsed()-1; slot >= 0 && count+1 < XBEE_PROFILE_RADIOS; --slot)
+	{
+		const xbee_profile *rec = (const xbee_profile *)(PROFILE_BASE + slot*XBEE_PROFILE_SLOT);
+		if(rec->port == port || !xbeeProfileValid(rec))
+		{
+			continue;
+		}
+		bool newer = false;
+		for(uint8_t i = 0; i < count; ++i)
+		{
+			newer |= (keep[i].port == rec->port);
+		}
+		if(!newer)
+		{
+			memcpy(&keep[count++], rec, sizeof(xbee_profile));
+		}
+	}
+
+	xbeeProfileErasePage();
+	uint16_t slot = 0;
+	for(uint8_t i = 0; i < count; ++i)
+	{
+		if(xbeeProfileWriteSlot(slot, &keep[i]))
+		{
+			++slot;
+		}
+	}
+	return slot;
+}
+
+
+/*
+ *	Stores the current baud rate and settings of the local module as the
+ *	new profile. Nothing is written if they match the stored profile, so
+ *	a warm boot never wears the flash. Each save takes the next slot of
+ *	the page, the page is erased only once every slot has been used and
+ *	the latest records of the other radios are written back.
+ *
+ *	@param *xbee, handle for the local xbee module
+ *	@retval true if the profile is stored
+ */
+bool xbeeProfileSave(xbee_module *xbee)
+{
+	xbee_profile profile;
+	xbee_profile last;
+
+	memset(&profile, 0, sizeof(xbee_profile));
+	profile.magic = XBEE_PROFILE_MAGIC;
+	profile.version = XBEE_PROFILE_VERSION;
+	profile.size = sizeof(xbee_settings);
+	profile.port = xbeeProfilePort(xbee->hxbee);
+	profile.baud = xbee->hxbee->Init.BaudRate;
+	memcpy(&profile.settings, &xbee->settings, sizeof(xbee_settings));
+	profile.crc = xbeeProfileCRC((const uint8_t *)&profile, offsetof(xbee_profile, crc));
+
+	if(xbeeProfileLoad(&last, xbee->hxbee) && last.crc == profile.crc && !memcmp(&last, &profile, sizeof(xbee_profile)))
+	{
+		return true;
+	}
+
+	uint16_t slot = xbeeProfileUsed();
+	if(slot >= XBEE_PROFILE_SLOTS)
+	{
+		slot = xbeeProfileCompact(profile.port);
+	}
+	if(xbeeProfileWriteSlot(slot, &profile))
+	{
+		return true;
+	}
+
+	// A slot that did not take the record is skipped, try once on a fresh page
+	slot = xbeeProfileCompact(profile.port);
+	return (slot < XBEE_PROFILE_SLOTS) && xbeeProfileWriteSlot(slot, &profile);
+}
+
+
+/*
+ *	Forgets the stored profile, the next bring-up syncs from scratch.
+ */
+void xbeeProfileErase()
+{
+	if(xbeeProfileUsed() > 0)
+	{
+		xbeeProfileErasePage();
+	}
+}
+
+#endif
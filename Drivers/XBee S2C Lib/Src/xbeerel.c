@@ -0,0 +1,444 @@
+/*
+Copyright 2018 Jesper Wlivaara
+
+Permission is hereby granted, free of charge, to any person obtaining
+a copy of this software and associated documentation files (the "Software"),
+to deal in the Software without restriction, including without limitation the
+rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is furnished to
+do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all copies
+or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR
+PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE
+FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+
+#include "xbeelib.h"
+
+#define REL_INDEX(seq) ((uint8_t)(seq) % XBEE_REL_WINDOW)
+
+
+/*
+ *	Sets up one end of a link. Frames still held from before are given
+ *	back. The link starts in a new epoch, so the peer takes the first
+ *	frame as sequence number 0 even if it still has the old link.
+ *
+ *	@param *link, link to initialize
+ *	@param *xbee, handle for the local xbee module
+ *	@param sh, sl, 64-bit address of the peer
+ *	@param my, 16-bit address of the peer, XBEE_ADDR16_UNKNOWN to send by sh/sl
+ *	@param window, frames allowed in flight (1..XBEE_REL_WINDOW)
+ *	@param options, XBEE_TXOPT_xx of the data frames
+ *	@param cb, called with every frame received on the link
+ *	@param *ctx, passed on to cb
+ */
+void xbeeRelInit(xbee_rel_link *link, xbee_module *xbee, uint32_t sh, uint32_t sl, uint16_t my,
+				 uint8_t window, uint8_t options, xbee_rel_callback cb, void *ctx)
+{
+	// Any epoch other than the last one will do
+	uint8_t epoch = link->epoch + 1 + (uint8_t)(platformCycles() & 0x3F);
+
+	platformTimerStop(&link->timer);
+	if(link->xbee != NULL)
+	{
+		for(int i = 0; i < XBEE_REL_WINDOW; ++i)
+		{
+			xbeeFrameRelease(&link->xbee->radio->pool, link->held[i]);
+		}
+	}
+	memset(link, 0, sizeof(xbee_rel_link));
+	link->xbee = xbee;
+	link->sh = sh;
+	link->sl = sl;
+	link->my = my;
+	link->options = options;
+	link->epoch = epoch;
+	link->cb = cb;
+	link->ctx = ctx;
+	xbeeRelSetWindow(link, window);
+}
+
+
+/*
+ *	Changes how many frames may be in flight. Frames already in flight
+ *	stay there.
+ *
+ *	@param *link, link to change
+ *	@param window, 1 to XBEE_REL_WINDOW frames
+ */
+void xbeeRelSetWindow(xbee_rel_link *link, uint8_t window)
+{
+	if(window < 1)
+	{
+		window = 1;
+	}
+	if(window > XBEE_REL_WINDOW)
+	{
+		window = XBEE_REL_WINDOW;
+	}
+	link->window = window;
+}
+
+
+/*
+ *	Frames sent (or waiting to be sent) and not acknowledged yet.
+ */
+uint8_t xbeeRelPending(xbee_rel_link *link)
+{
+	return (uint8_t)(link->nxt - link->una);
+}
+
+
+/*
+ *	Writes the header of a frame, with the acknowledgement of what has
+ *	been received when the epoch of the peer is known.
+ */
+static void xbeeRelHeader(xbee_rel_link *link, uint8_t *dst, uint8_t flags, uint8_t seq)
+{
+	uint8_t sack = 0;
+
+	for(uint8_t n = 0; n < XBEE_REL_WINDOW-1; ++n)
+	{
+		if(link->held[REL_INDEX(link->expected+1+n)] != NULL)
+		{
+			sack |= 1 << n;
+		}
+	}
+	if(link->synced)
+	{
+		flags |= XBEE_REL_FLAG_ACK;
+	}
+	dst[0] = XBEE_REL_TYPE;
+	dst[1] = flags;
+	dst[2] = link->epoch;
+	dst[3] = seq;
+	dst[4] = link->una;
+	dst[5] = link->peerepoch;
+	dst[6] = link->expected;
+	dst[7] = sack;
+}
+
+
+/*
+ *	Data frames are acknowledged by the peer, not by their TX Status.
+ */
+static void xbeeRelSent(xbee_module *xbee, uint8_t frameid, uint8_t status, void *ctx)
+{
+	(void)xbee;
+	(void)frameid;
+	(void)status;
+	(void)ctx;
+}
+
+
+/*
+ *	Sends an acknowledgement on its own.
+ */
+static void xbeeRelSendAck(xbee_rel_link *link)
+{
+	uint8_t frame[XBEE_REL_HEADER];
+
+	xbeeRelHeader(link, frame, 0, link->nxt);
+	if(xbeeTransmitTo(link->xbee, link->sh, link->sl, link->my, frame, sizeof(frame), XBEE_TXOPT_URGENT,
+					  xbeeRelSent, link, NULL) == XBEE_MSG_OK)
+	{
+		link->ackpending = false;
+		++link->acks;
+	}
+	else if(!link->ackpending)
+	{
+		// Tried again from xbeeRelService()
+		link->ackpending = true;
+		link->ackdue = HAL_GetTick();
+	}
+}
+
+
+/*
+ *	Sends the frames waiting for room in the transmit queue, oldest first.
+ */
+static void xbeeRelPump(xbee_rel_link *link)
+{
+	uint8_t frame[XBEE_MAX_PAYLOAD];
+
+	for(uint8_t seq = link->una; seq != link->nxt; ++seq)
+	{
+		xbee_rel_entry *entry = &link->entry[REL_INDEX(seq)];
+		if(entry->state != XBEE_REL_UNSENT)
+		{
+			continue;
+		}
+		xbeeRelHeader(link, frame, XBEE_REL_FLAG_DATA, seq);
+		memcpy(&frame[XBEE_REL_HEADER], entry->data, entry->len);
+		if(xbeeTransmitTo(link->xbee, link->sh, link->sl, link->my, frame, XBEE_REL_HEADER+entry->len,
+						  link->options, xbeeRelSent, link, NULL) != XBEE_MSG_OK)
+		{
+			return;
+		}
+		link->ackpending = false;	// Taken along (if owed at all)
+		entry->state = XBEE_REL_SENT;
+		entry->sent = HAL_GetTick();
+		++link->sentframes;
+		if(++entry->tries > 1)
+		{
+			++link->retransmits;
+		}
+	}
+}
+
+
+/*
+ *	Sets the timer for the soonest retransmission or acknowledgement.
+ */
+static void xbeeRelArm(xbee_rel_link *link)
+{
+	uint32_t now = HAL_GetTick();
+	uint32_t soonest = UINT32_MAX;
+
+	for(uint8_t seq = link->una; seq != link->nxt; ++seq)
+	{
+		xbee_rel_entry *entry = &link->entry[REL_INDEX(seq)];
+		if(entry->state == XBEE_REL_SENT && !entry->sacked && !link->broken)
+		{
+			uint32_t waited = now - entry->sent;
+			uint32_t left = (waited < XBEE_REL_RTO) ? XBEE_REL_RTO - waited : 0;
+			if(left < soonest)
+			{
+				soonest = left;
+			}
+		}
+	}
+	if(link->ackpending)
+	{
+		uint32_t left = ((int32_t)(link->ackdue - now) > 0) ? link->ackdue - now : 0;
+		if(left < soonest)
+		{
+			soonest = left;
+		}
+	}
+	if(soonest != UINT32_MAX)
+	{
+		platformTimerStart(&link->timer, (soonest+1)*1000, NULL, NULL);
+	}
+}
+
+
+/*
+ *	Queues a frame on the link. It is sent at once if the transmit queue
+ *	has room, and again until the peer acknowledges it.
+ *
+ *	@param *link, link to send on
+ *	@param *data, frame data
+ *	@param len, 1 to XBEE_REL_DATA bytes
+ *	@retval XBEE_MSG_OK, XBEE_ERR_TX_BUSY if the window is full,
+ *			XBEE_ERR_TX_FULL if the frame is too long or the link is broken
+ */
+XBEE_STAT xbeeRelSend(xbee_rel_link *link, const uint8_t *data, uint8_t len)
+{
+	if(link->broken || len == 0 || len > XBEE_REL_DATA)
+	{
+		return XBEE_ERR_TX_FULL;
+	}
+	if(xbeeRelPending(link) >= link->window)
+	{
+		return XBEE_ERR_TX_BUSY;
+	}
+
+	xbee_rel_entry *entry = &link->entry[REL_INDEX(link->nxt)];
+	entry->state = XBEE_REL_UNSENT;
+	entry->len = len;
+	entry->tries = 0;
+	entry->sacked = false;
+	entry->fast = false;
+	memcpy(entry->data, data, len);
+	++link->nxt;
+
+	xbeeRelPump(link);
+	xbeeRelArm(link);
+	return XBEE_MSG_OK;
+}
+
+
+/*
+ *	Takes the acknowledgement in the header of a frame from the peer.
+ *	Frames before "ack" are done, frames in the selective bitmap are held
+ *	by the peer. Frames before the last held one have been lost and are
+ *	sent again without waiting for their timeout, once.
+ */
+static void xbeeRelTakeAck(xbee_rel_link *link, uint8_t ack, uint8_t sack)
+{
+	uint8_t inflight = xbeeRelPending(link);
+	if((uint8_t)(ack - link->una) > inflight)
+	{
+		// Acknowledges frames never sent, stale
+		return;
+	}
+	while(link->una != ack)
+	{
+		link->entry[REL_INDEX(link->una)].state = XBEE_REL_FREE;
+		++link->una;
+	}
+
+	uint8_t last = 0;
+	for(uint8_t n = 0; n < XBEE_REL_WINDOW-1; ++n)
+	{
+		uint8_t seq = ack+1+n;
+		if((sack & (1 << n)) && (uint8_t)(seq - link->una) < xbeeRelPending(link))
+		{
+			link->entry[REL_INDEX(seq)].sacked = true;
+			last = n+1;
+		}
+	}
+	for(uint8_t n = 0; n < last; ++n)
+	{
+		xbee_rel_entry *entry = &link->entry[REL_INDEX(ack+n)];
+		if(entry->state == XBEE_REL_SENT && !entry->sacked && !entry->fast)
+		{
+			entry->fast = true;
+			entry->state = XBEE_REL_UNSENT;
+		}
+	}
+}
+
+
+/*
+ *	Hands received frames to the application, in order, from "expected"
+ *	on for as long as they are there.
+ */
+static void xbeeRelDeliver(xbee_rel_link *link, xbee_frame *frame)
+{
+	uint8_t len;
+	const uint8_t *p = xbeeRxData(frame, &len);
+
+	++link->expected;
+	++link->delivered;
+	if(link->cb != NULL)
+	{
+		link->cb(link, &p[XBEE_REL_HEADER], len - XBEE_REL_HEADER, link->ctx);
+	}
+}
+
+
+/*
+ *	Takes a frame of the link: its acknowledgement and its data. Pass
+ *	every received frame.
+ *
+ *	@param *link, link the frame may be for
+ *	@param *frame, received frame block
+ *	@retval true if the frame was from the peer of the link
+ */
+bool xbeeRelHandleFrame(xbee_rel_link *link, xbee_frame *frame)
+{
+	uint8_t len;
+	const uint8_t *p = xbeeRxData(frame, &len);
+	uint32_t sh, sl;
+	uint16_t my;
+
+	if(p == NULL || len < XBEE_REL_HEADER || p[0] != XBEE_REL_TYPE)
+	{
+		return false;
+	}
+	xbeeRxSource(frame, &sh, &sl, &my);
+	if(my != link->my || (my == XBEE_ADDR16_UNKNOWN && (sh != link->sh || sl != link->sl)))
+	{
+		return false;
+	}
+
+	if((p[1] & XBEE_REL_FLAG_ACK) && p[5] == link->epoch)
+	{
+		xbeeRelTakeAck(link, p[6], p[7]);
+	}
+
+	if(p[1] & XBEE_REL_FLAG_DATA)
+	{
+		if(!link->synced || p[2] != link->peerepoch)
+		{
+			// The peer started over, or we did and the peer goes on with
+			// its link. Frames before its Una were taken by the link we had
+			// before (the ones delivered but not acknowledged come again).
+			for(int i = 0; i < XBEE_REL_WINDOW; ++i)
+			{
+				xbeeFrameRelease(frame->pool, link->held[i]);
+				link->held[i] = NULL;
+			}
+			link->synced = true;
+			link->peerepoch = p[2];
+			link->expected = p[4];
+		}
+
+		uint8_t ahead = p[3] - link->expected;
+		if(ahead == 0)
+		{
+			xbeeRelDeliver(link, frame);
+			xbee_frame *next;
+			while((next = link->held[REL_INDEX(link->expected)]) != NULL)
+			{
+				link->held[REL_INDEX(link->expected)] = NULL;
+				xbeeRelDeliver(link, next);
+				xbeeFrameRelease(next->pool, next);
+			}
+			if(!link->ackpending)
+			{
+				link->ackpending = true;
+				link->ackdue = HAL_GetTick() + XBEE_REL_ACK_DELAY;
+			}
+		}
+		else if(ahead < XBEE_REL_WINDOW && link->held[REL_INDEX(p[3])] == NULL)
+		{
+			// Past a gap, kept until the gap is filled
+			xbeeFrameRef(frame);
+			link->held[REL_INDEX(p[3])] = frame;
+			xbeeRelSendAck(link);
+		}
+		else
+		{
+			// Delivered before (or held already), the peer missed the acknowledgement
+			++link->duplicates;
+			xbeeRelSendAck(link);
+		}
+	}
+
+	xbeeRelPump(link);
+	xbeeRelArm(link);
+	return true;
+}
+
+
+/*
+ *	Sends frames again whose acknowledgement is overdue, and owed
+ *	acknowledgements no frame has taken along. Call from the main loop.
+ *
+ *	@param *link, link to serve
+ */
+void xbeeRelService(xbee_rel_link *link)
+{
+	uint32_t now = HAL_GetTick();
+
+	for(uint8_t seq = link->una; seq != link->nxt; ++seq)
+	{
+		xbee_rel_entry *entry = &link->entry[REL_INDEX(seq)];
+		if(entry->state == XBEE_REL_SENT && !entry->sacked && (now - entry->sent) >= XBEE_REL_RTO)
+		{
+			if(entry->tries >= XBEE_REL_RETRIES)
+			{
+				link->broken = true;
+				continue;
+			}
+			entry->state = XBEE_REL_UNSENT;
+		}
+	}
+	xbeeRelPump(link);
+	if(link->ackpending && (int32_t)(now - link->ackdue) >= 0)
+	{
+		xbeeRelSendAck(link);
+	}
+	if(!link->timer.active)
+	{
+		xbeeRelArm(link);
+	}
+}
@@ -0,0 +1,373 @@
+/*
+Copyright 2018 Jesper Wlivaara
+
+Permission is hereby granted, free of charge, to any person obtaining
+a copy of this software and associated documentation files (the "Software"),
+to deal in the Software without restriction, including without limitation the
+rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is furnished to
+do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all copies
+or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR
+PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE
+FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+
+#include "xbeelib.h"
+
+
+/*
+ *	Empties the remote request queue.
+ *
+ *	@param *rat, remote AT state to initialize
+ */
+void xbeeRemoteATInit(xbee_ratstate *rat)
+{
+	memset(rat, 0, sizeof(xbee_ratstate));
+}
+
+
+/*
+ *	Takes a free place in the queue for a request.
+ *
+ *	@retval XBEE_MSG_OK, or XBEE_ERR_TX_BUSY if the queue is full
+ */
+static XBEE_STAT xbeeATEnqueue(xbee_module *xbee, bool local, uint32_t sh, uint32_t sl, const char *cmd,
+							   const uint8_t *param, uint8_t plen, uint8_t options,
+							   xbee_rat_callback cb, void *ctx)
+{
+	if(plen > XBEE_RAT_MAX_PARAM)
+	{
+		return XBEE_ERR_TX_FULL;
+	}
+
+	for(int i = 0; i < XBEE_RAT_QUEUE; ++i)
+	{
+		xbee_rat_request *req = &xbee->rat.req[i];
+		if(req->state != XBEE_RAT_FREE)
+		{
+			continue;
+		}
+		req->state = XBEE_RAT_QUEUED;
+		req->frameid = 0;
+		req->tries = 0;
+		req->options = options;
+		req->local = local;
+		req->seq = xbee->rat.seq++;
+		req->sh = sh;
+		req->sl = sl;
+		req->cmd[0] = cmd[0];
+		req->cmd[1] = cmd[1];
+		req->plen = plen;
+		memcpy(req->param, param, plen);
+		req->cb = cb;
+		req->ctx = ctx;
+		return XBEE_MSG_OK;
+	}
+	return XBEE_ERR_TX_BUSY;
+}
+
+
+/*
+ *	Queues a Remote AT Command Request. Requests to different nodes are
+ *	kept in flight at the same time (up to XBEE_RAT_INFLIGHT) and are
+ *	matched with their responses by frame ID, so the round trip to one
+ *	node never holds up the others. Unanswered requests are resent up to
+ *	XBEE_RAT_RETRIES times. Requests go out from xbeeRemoteATService().
+ *
+ *	@param *xbee, handle for the local xbee module
+ *	@param sh, sl, 64-bit address of the remote node
+ *	@param *cmd, two letter AT command
+ *	@param *param, parameter value, NULL/0 to read the parameter
+ *	@param plen, length of the parameter value
+ *	@param options, XBEE_RATOPT_xx
+ *	@param cb, called when the request is finished (may be NULL)
+ *	@param *ctx, passed on to cb
+ *	@retval XBEE_MSG_OK, or XBEE_ERR_TX_BUSY if the queue is full
+ */
+XBEE_STAT xbeeRemoteAT(xbee_module *xbee, uint32_t sh, uint32_t sl, const char *cmd,
+					   const uint8_t *param, uint8_t plen, uint8_t options,
+					   xbee_rat_callback cb, void *ctx)
+{
+	return xbeeATEnqueue(xbee, false, sh, sl, cmd, param, plen, options, cb, ctx);
+}
+
+
+/*
+ *	Queues a local AT Command frame (0x08). Unlike command mode this
+ *	never interrupts traffic: the module keeps running in API mode and
+ *	changes are applied as soon as the command is executed. The response
+ *	(0x88) is also stored in the modules xbee_settings.
+ *
+ *	@param *xbee, handle for the local xbee module
+ *	@param *cmd, two letter AT command
+ *	@param *param, parameter value, NULL/0 to read the parameter
+ *	@param plen, length of the parameter value
+ *	@param cb, called when the request is finished (may be NULL)
+ *	@param *ctx, passed on to cb
+ *	@retval XBEE_MSG_OK, or XBEE_ERR_TX_BUSY if the queue is full
+ */
+XBEE_STAT xbeeLocalAT(xbee_module *xbee, const char *cmd, const uint8_t *param, uint8_t plen,
+					  xbee_rat_callback cb, void *ctx)
+{
+	return xbeeATEnqueue(xbee, true, 0, 0, cmd, param, plen, 0, cb, ctx);
+}
+
+
+/*
+ *	Queues a numeric parameter write to a remote node. The value is sent
+ *	with the width of the matching xbee_settings field (4 bytes for
+ *	commands that are not part of it).
+ *
+ *	@see xbeeRemoteAT()
+ */
+XBEE_STAT xbeeRemoteATSet(xbee_module *xbee, uint32_t sh, uint32_t sl, const char *cmd,
+						  uint32_t value, uint8_t options, xbee_rat_callback cb, void *ctx)
+{
+	const xbee_setting_desc *desc = xbeeFindSetting(cmd);
+	uint8_t width = (desc != NULL && desc->width <= 4) ? desc->width : 4;
+	uint8_t param[4];
+
+	for(uint8_t i = 0; i < width; ++i)
+	{
+		param[i] = (uint8_t)(value >> (8*(width-1-i)));
+	}
+	return xbeeRemoteAT(xbee, sh, sl, cmd, param, width, options, cb, ctx);
+}
+
+
+/*
+ *	Tells if a frame ID belongs to a remote request waiting for its
+ *	response, so the ID is not handed out again.
+ *
+ *	@param *xbee, handle for the local xbee module
+ *	@param frameid, frame ID to check
+ */
+bool xbeeRemoteATBusy(xbee_module *xbee, uint8_t frameid)
+{
+	for(int i = 0; i < XBEE_RAT_QUEUE; ++i)
+	{
+		if(xbee->rat.req[i].state == XBEE_RAT_SENT && xbee->rat.req[i].frameid == frameid)
+		{
+			return true;
+		}
+	}
+	return false;
+}
+
+
+/*
+ *	Number of remote requests that are queued or in flight.
+ *
+ *	@param *xbee, handle for the local xbee module
+ */
+uint8_t xbeeRemoteATPending(xbee_module *xbee)
+{
+	uint8_t n = 0;
+	for(int i = 0; i < XBEE_RAT_QUEUE; ++i)
+	{
+		if(xbee->rat.req[i].state != XBEE_RAT_FREE)
+		{
+			++n;
+		}
+	}
+	return n;
+}
+
+
+/*
+ *	Finishes a request and frees its place in the queue.
+ */
+static void xbeeRemoteATComplete(xbee_module *xbee, xbee_rat_request *req, xbee_node *node,
+								 uint8_t status, const uint8_t *data, uint8_t len)
+{
+	if(req->state == XBEE_RAT_SENT)
+	{
+		--xbee->rat.inflight;
+	}
+	req->state = XBEE_RAT_FREE;
+	if(status == XBEE_RATS_OK)
+	{
+		++xbee->rat.completed;
+	}
+	else
+	{
+		++xbee->rat.failed;
+	}
+
+	if(req->cb != NULL)
+	{
+		char cmd[3] = {req->cmd[0], req->cmd[1], 0x0};
+		req->cb(xbee, node, cmd, status, data, len, req->ctx);
+	}
+}
+
+
+/*
+ *	Sends a queued request.
+ *
+ *	@retval false if the UART queue had no room, the request stays queued
+ */
+static bool xbeeRemoteATSend(xbee_module *xbee, xbee_rat_request *req)
+{
+	uint8_t data[15+XBEE_RAT_MAX_PARAM];
+	uint16_t len = 0;
+	uint8_t frameid = xbeeNextFrameId(xbee);
+
+	if(req->local)
+	{
+		// 0x08 | Frame ID | AT command (2) | Parameter
+		data[len++] = XBEE_API_AT_CMD;
+		data[len++] = frameid;
+	}
+	else
+	{
+		// 0x17 | Frame ID | 64-bit dest (8) | 16-bit dest (2) | Options | AT command (2) | Parameter
+		data[len++] = XBEE_API_REMOTE_AT;
+		data[len++] = frameid;
+		for(int i = 3; i >= 0; --i)
+		{
+			data[len++] = (uint8_t)(req->sh >> (8*i));
+		}
+		for(int i = 3; i >= 0; --i)
+		{
+			data[len++] = (uint8_t)(req->sl >> (8*i));
+		}
+		data[len++] = 0xFF;
+		data[len++] = 0xFE;
+		data[len++] = req->options;
+	}
+	data[len++] = req->cmd[0];
+	data[len++] = req->cmd[1];
+	memcpy(&data[len], req->param, req->plen);
+	len += req->plen;
+
+	if(xbeeSendFrame(xbee, data, len) != XBEE_MSG_OK)
+	{
+		return false;
+	}
+	if(req->state != XBEE_RAT_SENT)
+	{
+		++xbee->rat.inflight;
+	}
+	req->state = XBEE_RAT_SENT;
+	req->frameid = frameid;
+	req->sent = HAL_GetTick();
+	++req->tries;
+	return true;
+}
+
+
+/*
+ *	Handles a Remote AT Command Response (0x97), or an AT Command Response
+ *	(0x88) to a local request. Remote results are recorded in the node
+ *	registry: the node is registered (or refreshed) with the 16-bit address
+ *	it answered from, and MY/NI reads update its entry.
+ *
+ *	@param *xbee, handle for the local xbee module
+ */
+void xbeeRemoteATHandleResponse(xbee_module *xbee, const uint8_t *frame, uint16_t len)
+{
+	bool local = (frame[0] == XBEE_API_AT_RESPONSE);
+
+	// 0x88 | Frame ID | AT command (2) | Status | Data
+	// 0x97 | Frame ID | 64-bit source (8) | 16-bit source (2) | AT command (2) | Status | Data
+	if(len < (local ? 5 : 15))
+	{
+		return;
+	}
+
+	for(int i = 0; i < XBEE_RAT_QUEUE; ++i)
+	{
+		xbee_rat_request *req = &xbee->rat.req[i];
+		if(req->state != XBEE_RAT_SENT || req->frameid != frame[1] || req->local != local)
+		{
+			continue;
+		}
+		if(local)
+		{
+			xbeeRemoteATComplete(xbee, req, NULL, frame[4], &frame[5], (uint8_t)(len - 5));
+			return;
+		}
+
+		uint8_t status = frame[14];
+		const uint8_t *value = &frame[15];
+		uint8_t vlen = (uint8_t)(len - 15);
+		xbee_node *node = NULL;
+
+		if(status != XBEE_RATS_TX_FAILURE)
+		{
+			uint16_t my = ((uint16_t)frame[10] << 8) | frame[11];
+			node = xbeeNodeAdd(&xbee->radio->nodes, req->sh, req->sl, my);
+			node->lastseen = HAL_GetTick();
+		}
+		if(node != NULL && status == XBEE_RATS_OK && vlen > 0)
+		{
+			if(req->cmd[0] == 'M' && req->cmd[1] == 'Y' && vlen == 2)
+			{
+				xbeeNodeSetMY(&xbee->radio->nodes, node, ((uint16_t)value[0] << 8) | value[1]);
+			}
+			else if(req->cmd[0] == 'N' && req->cmd[1] == 'I')
+			{
+				uint8_t n = (vlen < sizeof(node->NI)-1) ? vlen : sizeof(node->NI)-1;
+				memcpy(node->NI, value, n);
+				node->NI[n] = 0x0;
+			}
+		}
+
+		xbeeRemoteATComplete(xbee, req, node, status, value, vlen);
+		return;
+	}
+}
+
+
+/*
+ *	Drives the remote request queue: resends or fails requests that got
+ *	no response in time, then sends queued requests (oldest first) while
+ *	there is room in flight. Call regularly from the main loop.
+ *
+ *	@param *xbee, handle for the local xbee module
+ */
+void xbeeRemoteATService(xbee_module *xbee)
+{
+	uint32_t now = HAL_GetTick();
+
+	for(int i = 0; i < XBEE_RAT_QUEUE; ++i)
+	{
+		xbee_rat_request *req = &xbee->rat.req[i];
+		if(req->state != XBEE_RAT_SENT || (now - req->sent) <= XBEE_RAT_TIMEOUT)
+		{
+			continue;
+		}
+		if(req->tries > XBEE_RAT_RETRIES)
+		{
+			xbeeRemoteATComplete(xbee, req, NULL, XBEE_RATS_TIMEOUT, NULL, 0);
+		}
+		else if(xbeeRemoteATSend(xbee, req))
+		{
+			++xbee->rat.retries;
+		}
+	}
+
+	while(xbee->rat.inflight < XBEE_RAT_INFLIGHT)
+	{
+		xbee_rat_request *oldest = NULL;
+		for(int i = 0; i < XBEE_RAT_QUEUE; ++i)
+		{
+			xbee_rat_request *req = &xbee->rat.req[i];
+			if(req->state == XBEE_RAT_QUEUED && (oldest == NULL || (int32_t)(req->seq - oldest->seq) < 0))
+			{
+				oldest = req;
+			}
+		}
+		if(oldest == NULL || !xbeeRemoteATSend(xbee, oldest))
+		{
+			break;
+		}
+	}
+}
@@ -0,0 +1,183 @@
+/*
+Copyright 2018 Jesper Wlivaara
+
+Permission is hereby granted, free of charge, to any person obtaining
+a copy of this software and associated documentation files (the "Software"),
+to deal in the Software without restriction, including without limitation the
+rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is furnished to
+do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all copies
+or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR
+PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE
+FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+
+#include "xbeelib.h"
+#include "stdio.h"
+
+
+/*
+ *	Clears the statistics of target module. Counters owned by the parser,
+ *	the UART and the TX window are left alone.
+ *
+ *	@param *xbee, handle for target xbee module
+ */
+void xbeeStatsReset(xbee_module *xbee)
+{
+	memset(&xbee->stats, 0, sizeof(xbee_stats));
+}
+
+
+/*
+ *	Prints the non-empty buckets of a histogram on one line.
+ */
+static void xbeeStatsPrintHist(terminal *term, const char *name, const xbee_hist *hist)
+{
+	char msg[24];
+
+	terminalPrint(term, name);
+	for(int i = 0; i < XBEE_HIST_BUCKETS; ++i)
+	{
+		if(hist->bucket[i] != 0)
+		{
+			sprintf(msg, " 2^%d:%lu", i, (unsigned long)hist->bucket[i]);
+			terminalPrint(term, msg);
+		}
+	}
+	sprintf(msg, " max:%lu\r\n", (unsigned long)hist->max);
+	terminalPrint(term, msg);
+}
+
+
+/*
+ *	Prints every counter and histogram of target module to a terminal.
+ *	Latencies are in core cycles.
+ *
+ *	@param *xbee, handle for target xbee module
+ *	@param *term, terminal to print on
+ */
+void xbeeStatsPrint(xbee_module *xbee, terminal *term)
+{
+	char msg[128];	// Longest line, every counter at 10 digits, is 114 characters
+	uart_rxring *ring = uartRxFind(xbee->hxbee);
+	uart_txqueue *queue = uartTxFind(xbee->hxbee);
+
+	snprintf(msg, sizeof(msg), "rx frames %lu checksum %lu oversize %lu nobuffer %lu overrun %lu\r\n",
+			(unsigned long)xbee->parser.frames, (unsigned long)xbee->parser.cserrors,
+			(unsigned long)xbee->parser.overflows, (unsigned long)xbee->parser.nobuffer,
+			(unsigned long)((ring != NULL) ? ring->overruns : 0));
+	terminalPrint(term, msg);
+	snprintf(msg, sizeof(msg), "tx sent %lu acked %lu noack(EA) %lu cca(EC) %lu purged %lu timeout %lu\r\n",
+			(unsigned long)xbee->tx.sent, (unsigned long)xbee->tx.acked,
+			(unsigned long)xbee->stats.txnoack, (unsigned long)xbee->stats.txcca,
+			(unsigned long)xbee->stats.txpurged, (unsigned long)xbee->tx.timeouts);
+	terminalPrint(term, msg);
+	if(queue != NULL)
+	{
+		snprintf(msg, sizeof(msg), "txq depth %u max %u of %u rejected %lu\r\n",
+				(unsigned)(queue->written - queue->sent), (unsigned)queue->highwater,
+				(unsigned)queue->size, (unsigned long)queue->rejected);
+		terminalPrint(term, msg);
+	}
+	snprintf(msg, sizeof(msg), "txq urgent %u bulk %u inflight %u fairshare %lu\r\n",
+			(unsigned)xbee->tx.queued[XBEE_TX_URGENT], (unsigned)xbee->tx.queued[XBEE_TX_BULK],
+			(unsigned)xbee->tx.inflight, (unsigned long)xbee->tx.fairshare);
+	terminalPrint(term, msg);
+	snprintf(msg, sizeof(msg), "pool used %u max %u of %u exhausted %lu\r\n", (unsigned)xbee->radio->pool.used,
+			(unsigned)xbee->radio->pool.highwater, (unsigned)XBEE_POOL_BLOCKS, (unsigned long)xbee->radio->pool.exhausted);
+	terminalPrint(term, msg);
+	snprintf(msg, sizeof(msg), "init %s %lu ms sync %lu ms\r\n", xbee->init.warm ? "warm" : "cold",
+			(unsigned long)xbee->init.elapsed, (unsigned long)xbee->synctime);
+	terminalPrint(term, msg);
+	xbeeStatsPrintHist(term, "rx latency", &xbee->stats.rxlatency);
+	xbeeStatsPrintHist(term, "tx latency", &xbee->stats.txlatency);
+	xbeeStatsPrintHist(term, "urgent wait", &xbee->stats.txqueue[XBEE_TX_URGENT]);
+	xbeeStatsPrintHist(term, "bulk wait", &xbee->stats.txqueue[XBEE_TX_BULK]);
+}
+
+
+/*
+ *	Stores a 32-bit value least significant byte first.
+ */
+static uint8_t *xbeeStatsPut(uint8_t *dst, uint32_t value)
+{
+	dst[0] = (uint8_t)value;
+	dst[1] = (uint8_t)(value >> 8);
+	dst[2] = (uint8_t)(value >> 16);
+	dst[3] = (uint8_t)(value >> 24);
+	return dst + 4;
+}
+
+
+/*
+ *	Writes the statistics of target module in binary form, for tools that
+ *	collect them over the terminal or the radio. Layout:
+ *	'X' 'S' | XBEE_STATS_VERSION | Number of values | Values (32-bit, LSB first)
+ *	The values are, in order: rx frames, checksum errors, oversize frames,
+ *	no buffer, UART overruns, TX queue max depth, TX queue rejects, tx sent,
+ *	acked, noack, cca, purged, timeouts, pool exhausted, bulk fair share
+ *	sends, rx latency buckets and max, tx latency buckets and max, then
+ *	the queue wait buckets and max of every TX class, urgent first.
+ *
+ *	@param *xbee, handle for target xbee module
+ *	@param *dst, destination buffer
+ *	@param size, size of destination
+ *	@retval number of bytes written, 0 if dst is too small
+ */
+uint16_t xbeeStatsDump(xbee_module *xbee, uint8_t *dst, uint16_t size)
+{
+	uart_rxring *ring = uartRxFind(xbee->hxbee);
+	uart_txqueue *queue = uartTxFind(xbee->hxbee);
+	uint8_t *p = dst;
+
+	if(size < XBEE_STATS_DUMP_SIZE)
+	{
+		return 0;
+	}
+
+	*p++ = 'X';
+	*p++ = 'S';
+	*p++ = XBEE_STATS_VERSION;
+	*p++ = XBEE_STATS_VALUES;
+	p = xbeeStatsPut(p, xbee->parser.frames);
+	p = xbeeStatsPut(p, xbee->parser.cserrors);
+	p = xbeeStatsPut(p, xbee->parser.overflows);
+	p = xbeeStatsPut(p, xbee->parser.nobuffer);
+	p = xbeeStatsPut(p, (ring != NULL) ? ring->overruns : 0);
+	p = xbeeStatsPut(p, (queue != NULL) ? queue->highwater : 0);
+	p = xbeeStatsPut(p, (queue != NULL) ? queue->rejected : 0);
+	p = xbeeStatsPut(p, xbee->tx.sent);
+	p = xbeeStatsPut(p, xbee->tx.acked);
+	p = xbeeStatsPut(p, xbee->stats.txnoack);
+	p = xbeeStatsPut(p, xbee->stats.txcca);
+	p = xbeeStatsPut(p, xbee->stats.txpurged);
+	p = xbeeStatsPut(p, xbee->tx.timeouts);
+	p = xbeeStatsPut(p, xbee->radio->pool.exhausted);
+	p = xbeeStatsPut(p, xbee->tx.fairshare);
+	for(int i = 0; i < XBEE_HIST_BUCKETS; ++i)
+	{
+		p = xbeeStatsPut(p, xbee->stats.rxlatency.bucket[i]);
+	}
+	p = xbeeStatsPut(p, xbee->stats.rxlatency.max);
+	for(int i = 0; i < XBEE_HIST_BUCKETS; ++i)
+	{
+		p = xbeeStatsPut(p, xbee->stats.txlatency.bucket[i]);
+	}
+	p = xbeeStatsPut(p, xbee->stats.txlatency.max);
+	for(int c = 0; c < XBEE_TX_CLASSES; ++c)
+	{
+		for(int i = 0; i < XBEE_HIST_BUCKETS; ++i)
+		{
+			p = xbeeStatsPut(p, xbee->stats.txqueue[c].bucket[i]);
+		}
+		p = xbeeStatsPut(p, xbee->stats.txqueue[c].max);
+	}
+
+	return (uint16_t)(p - dst);
+}
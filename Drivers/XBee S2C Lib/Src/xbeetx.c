@@ -0,0 +1,459 @@
+/*
+Copyright 2018 Jesper Wlivaara
+
+Permission is hereby granted, free of charge, to any person obtaining
+a copy of this software and associated documentation files (the "Software"),
+to deal in the Software without restriction, including without limitation the
+rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is furnished to
+do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all copies
+or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR
+PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE
+FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+
+#include "xbeelib.h"
+
+
+/*
+ *	Clears the in-flight window and sets it to its full size.
+ *
+ *	@param *tx, transmit state to initialize
+ */
+void xbeeTxInit(xbee_txstate *tx)
+{
+	memset(tx, 0, sizeof(xbee_txstate));
+	tx->window = XBEE_TX_WINDOW;
+}
+
+
+/*
+ *	Changes how many frames may wait for a TX Status at the same time.
+ *	A window of 1 gives plain send-and-wait behavior.
+ *
+ *	@param *xbee, handle for the local xbee module
+ *	@param window, 1 to XBEE_TX_WINDOW frames
+ */
+void xbeeTxSetWindow(xbee_module *xbee, uint8_t window)
+{
+	if(window < 1)
+	{
+		window = 1;
+	}
+	if(window > XBEE_TX_WINDOW)
+	{
+		window = XBEE_TX_WINDOW;
+	}
+	xbee->tx.window = window;
+}
+
+
+/*
+ *	Finds a free slot and a frame ID that is not in use by another slot.
+ *	Bulk frames leave XBEE_TX_URGENT_RESERVE slots to urgent ones.
+ *
+ *	@param cls, XBEE_TX_CLASS of the frame
+ *	@retval Slot to use, NULL if the queue is full
+ */
+static xbee_tx_slot *xbeeTxAlloc(xbee_txstate *tx, uint8_t cls)
+{
+	xbee_tx_slot *free = NULL;
+	uint8_t used = 0;
+
+	for(int i = 0; i < XBEE_TX_QUEUE; ++i)
+	{
+		if(tx->slot[i].state != XBEE_TX_FREE)
+		{
+			++used;
+		}
+		else if(free == NULL)
+		{
+			free = &tx->slot[i];
+		}
+	}
+	if(free == NULL || (cls == XBEE_TX_BULK && used >= XBEE_TX_QUEUE - XBEE_TX_URGENT_RESERVE))
+	{
+		return NULL;
+	}
+
+	bool inuse;
+	do
+	{
+		if(++tx->frameid == 0)
+		{
+			tx->frameid = 1;
+		}
+		inuse = false;
+		for(int i = 0; i < XBEE_TX_QUEUE; ++i)
+		{
+			if(tx->slot[i].state != XBEE_TX_FREE && tx->slot[i].frameid == tx->frameid)
+			{
+				inuse = true;
+			}
+		}
+	} while(inuse);
+
+	free->frameid = tx->frameid;
+	return free;
+}
+
+
+/*
+ *	Picks the queued frame to send next: the oldest urgent one, unless
+ *	bulk frames have waited through XBEE_TX_URGENT_BURST urgent sends,
+ *	then the oldest bulk one. Bulk frames only go while fewer than
+ *	XBEE_TX_BULK_INFLIGHT of them are in flight.
+ *
+ *	@retval Slot to send, NULL if nothing can be sent now
+ */
+static xbee_tx_slot *xbeeTxNext(xbee_txstate *tx)
+{
+	xbee_tx_slot *next = NULL;
+	bool bulk = (tx->queued[XBEE_TX_BULK] > 0 && tx->bulkinflight < XBEE_TX_BULK_INFLIGHT);
+	uint8_t cls;
+
+	if(tx->queued[XBEE_TX_URGENT] > 0 && !(bulk && tx->burst >= XBEE_TX_URGENT_BURST))
+	{
+		cls = XBEE_TX_URGENT;
+	}
+	else if(bulk)
+	{
+		cls = XBEE_TX_BULK;
+	}
+	else
+	{
+		return NULL;
+	}
+
+	for(int i = 0; i < XBEE_TX_QUEUE; ++i)
+	{
+		xbee_tx_slot *slot = &tx->slot[i];
+		if(slot->state == XBEE_TX_QUEUED && slot->cls == cls &&
+		   (next == NULL || (int16_t)(slot->seq - next->seq) < 0))
+		{
+			next = slot;
+		}
+	}
+	return next;
+}
+
+
+/*
+ *	Hands queued frames to the UART while the window has room. A frame
+ *	that does not fit in the UART queue stays queued and is tried again
+ *	from xbeeTxService().
+ */
+static void xbeeTxKick(xbee_module *xbee)
+{
+	xbee_txstate *tx = &xbee->tx;
+	xbee_tx_slot *slot;
+
+	while(tx->inflight < tx->window && (slot = xbeeTxNext(tx)) != NULL)
+	{
+		if(xbeeSendBlock(xbee, slot->frame) != XBEE_MSG_OK)
+		{
+			return;
+		}
+		xbeeFrameRelease(slot->frame->pool, slot->frame);
+		slot->frame = NULL;
+
+		if(slot->cls == XBEE_TX_URGENT)
+		{
+			if(tx->queued[XBEE_TX_BULK] > 0)
+			{
+				++tx->burst;
+			}
+		}
+		else
+		{
+			if(tx->queued[XBEE_TX_URGENT] > 0)
+			{
+				++tx->fairshare;
+			}
+			tx->burst = 0;
+			++tx->bulkinflight;
+		}
+		// The TX latency runs from here, the time held in the queue is
+		// counted apart
+		uint32_t now = platformCycles();
+		xbeeStatsRecord(&xbee->stats.txqueue[slot->cls], now - slot->cycles);
+		slot->cycles = now;
+
+		slot->state = XBEE_TX_PENDING;
+		slot->submitted = HAL_GetTick();
+		--tx->queued[slot->cls];
+		++tx->inflight;
+		++tx->sent;
+		if(slot->node != NULL)
+		{
+			++slot->node->txframes;
+		}
+	}
+}
+
+
+/*
+ *	Builds a TX request in a pool block and queues it in its class,
+ *	common part of xbeeTransmit64/16.
+ *
+ *	@param *hdr, API identifier and destination address of the request
+ *	@param hlen, length of hdr
+ */
+static XBEE_STAT xbeeTransmit(xbee_module *xbee, const uint8_t *hdr, uint8_t hlen, xbee_node *node,
+							  const uint8_t *data, uint8_t len, uint8_t options,
+							  xbee_tx_callback cb, void *ctx, uint8_t *frameid)
+{
+	uint8_t cls = (options & XBEE_TXOPT_URGENT) ? XBEE_TX_URGENT : XBEE_TX_BULK;
+	xbee_tx_slot *slot;
+	xbee_frame *block;
+
+	if(len > XBEE_MAX_PAYLOAD)
+	{
+		return XBEE_ERR_TX_FULL;
+	}
+	slot = xbeeTxAlloc(&xbee->tx, cls);
+	if(slot == NULL)
+	{
+		return XBEE_ERR_TX_BUSY;
+	}
+	uint8_t reserve = (cls == XBEE_TX_BULK) ? 2*XBEE_TX_POOL_RESERVE : XBEE_TX_POOL_RESERVE;
+	block = (xbee->radio->pool.used + reserve < XBEE_POOL_BLOCKS) ? xbeeFrameAlloc(&xbee->radio->pool) : NULL;
+	if(block == NULL)
+	{
+		// Frame ID stays unused, slot is still free
+		return XBEE_ERR_TX_FULL;
+	}
+
+	// API identifier | Frame ID | Destination | Options | RF Data
+	uint8_t *frame = xbeeFrameData(block);
+	frame[0] = hdr[0];
+	frame[1] = slot->frameid;
+	memcpy(&frame[2], &hdr[1], hlen-1);
+	frame[hlen+1] = options & ~XBEE_TXOPT_URGENT;
+	memcpy(&frame[hlen+2], data, len);
+	block->len = hlen+2+len;
+
+	slot->state = XBEE_TX_QUEUED;
+	slot->status = XBEE_TXS_SUCCESS;
+	slot->cls = cls;
+	slot->seq = ++xbee->tx.seq;
+	slot->frame = block;
+	slot->cycles = platformCycles();
+	slot->node = node;
+	slot->cb = cb;
+	slot->ctx = ctx;
+	++xbee->tx.queued[cls];
+	if(frameid != NULL)
+	{
+		*frameid = slot->frameid;
+	}
+
+	xbeeTxKick(xbee);
+	return XBEE_MSG_OK;
+}
+
+
+/*
+ *	Sends RF data to a node by its 64-bit address (API frame 0x00).
+ *	Returns as soon as the frame is queued. Frames with XBEE_TXOPT_URGENT
+ *	go ahead of queued bulk frames. The outcome is reported to "cb" when
+ *	the TX Status arrives, or can be polled with xbeeTxPoll() using the
+ *	returned frame ID if no callback is given.
+ *
+ *	@param *xbee, handle for the local xbee module
+ *	@param sh, sl, 64-bit destination address (0x0, 0xFFFF for broadcast)
+ *	@param *data, RF payload, at most XBEE_MAX_PAYLOAD bytes
+ *	@param len, payload length
+ *	@param options, XBEE_TXOPT_xx
+ *	@param cb, completion callback, NULL to poll instead
+ *	@param *ctx, passed on to cb
+ *	@param *frameid, receives the frame ID of the request (may be NULL)
+ *	@retval XBEE_MSG_OK, XBEE_ERR_TX_BUSY if the queue of the class is full,
+ *			XBEE_ERR_TX_FULL if the frame pool is down to its reserve
+ */
+XBEE_STAT xbeeTransmit64(xbee_module *xbee, uint32_t sh, uint32_t sl, const uint8_t *data, uint8_t len,
+						 uint8_t options, xbee_tx_callback cb, void *ctx, uint8_t *frameid)
+{
+	uint8_t hdr[9];
+	hdr[0] = XBEE_API_TX64;
+	for(int i = 0; i < 4; ++i)
+	{
+		hdr[1+i] = (uint8_t)(sh >> (24-8*i));
+		hdr[5+i] = (uint8_t)(sl >> (24-8*i));
+	}
+	return xbeeTransmit(xbee, hdr, sizeof(hdr), xbeeNodeFind64(&xbee->radio->nodes, sh, sl),
+						data, len, options, cb, ctx, frameid);
+}
+
+
+/*
+ *	Sends RF data to a node by its 16-bit address (API frame 0x01).
+ *	See xbeeTransmit64().
+ *
+ *	@param my, 16-bit destination address (0xFFFF for broadcast)
+ */
+XBEE_STAT xbeeTransmit16(xbee_module *xbee, uint16_t my, const uint8_t *data, uint8_t len,
+						 uint8_t options, xbee_tx_callback cb, void *ctx, uint8_t *frameid)
+{
+	uint8_t hdr[3];
+	hdr[0] = XBEE_API_TX16;
+	hdr[1] = (uint8_t)(my >> 8);
+	hdr[2] = (uint8_t)my;
+	return xbeeTransmit(xbee, hdr, sizeof(hdr), xbeeNodeFind16(&xbee->radio->nodes, my),
+						data, len, options, cb, ctx, frameid);
+}
+
+
+/*
+ *	Sends RF data by 16-bit address if there is one, else by 64-bit
+ *	address. See xbeeTransmit64().
+ *
+ *	@param my, 16-bit destination address, XBEE_ADDR16_UNKNOWN to send by sh/sl
+ */
+XBEE_STAT xbeeTransmitTo(xbee_module *xbee, uint32_t sh, uint32_t sl, uint16_t my, const uint8_t *data,
+						 uint8_t len, uint8_t options, xbee_tx_callback cb, void *ctx, uint8_t *frameid)
+{
+	if(my != XBEE_ADDR16_UNKNOWN)
+	{
+		return xbeeTransmit16(xbee, my, data, len, options, cb, ctx, frameid);
+	}
+	return xbeeTransmit64(xbee, sh, sl, data, len, options, cb, ctx, frameid);
+}
+
+
+/*
+ *	Finishes a frame: updates counters and either calls its callback
+ *	and frees the slot, or keeps the result for xbeeTxPoll().
+ */
+static void xbeeTxComplete(xbee_module *xbee, xbee_tx_slot *slot, uint8_t status)
+{
+	--xbee->tx.inflight;
+	if(slot->cls == XBEE_TX_BULK)
+	{
+		--xbee->tx.bulkinflight;
+	}
+	if(status != XBEE_TXS_TIMEOUT)
+	{
+		xbeeStatsRecord(&xbee->stats.txlatency, platformCycles() - slot->cycles);
+	}
+	if(status == XBEE_TXS_NOACK)
+	{
+		++xbee->stats.txnoack;
+	}
+	else if(status == XBEE_TXS_CCA)
+	{
+		++xbee->stats.txcca;
+	}
+	else if(status == XBEE_TXS_PURGED)
+	{
+		++xbee->stats.txpurged;
+	}
+
+	if(status == XBEE_TXS_SUCCESS)
+	{
+		++xbee->tx.acked;
+	}
+	else
+	{
+		++xbee->tx.failed;
+		if(slot->node != NULL)
+		{
+			++slot->node->txfail;
+		}
+	}
+
+	slot->status = status;
+	if(slot->cb != NULL)
+	{
+		slot->state = XBEE_TX_FREE;
+		slot->cb(xbee, slot->frameid, status, slot->ctx);
+	}
+	else
+	{
+		slot->state = XBEE_TX_DONE;
+	}
+}
+
+
+/*
+ *	Checks the outcome of a frame sent without a callback. A finished
+ *	frame is released by this call.
+ *
+ *	@param *xbee, handle for the local xbee module
+ *	@param frameid, frame ID returned when the frame was sent
+ *	@param *status, receives the XBEE_TX_STATUS once done
+ *	@retval XBEE_TX_PENDING (queued or in flight), XBEE_TX_DONE,
+ *			or XBEE_TX_FREE for an unknown frame ID
+ */
+XBEE_TX_STATE xbeeTxPoll(xbee_module *xbee, uint8_t frameid, uint8_t *status)
+{
+	for(int i = 0; i < XBEE_TX_QUEUE; ++i)
+	{
+		xbee_tx_slot *slot = &xbee->tx.slot[i];
+		if(slot->state != XBEE_TX_FREE && slot->frameid == frameid)
+		{
+			if(slot->state == XBEE_TX_DONE)
+			{
+				*status = slot->status;
+				slot->state = XBEE_TX_FREE;
+				return XBEE_TX_DONE;
+			}
+			return XBEE_TX_PENDING;
+		}
+	}
+	return XBEE_TX_FREE;
+}
+
+
+/*
+ *	Handles a TX Status frame (0x89 | Frame ID | Status).
+ *
+ *	@param *xbee, handle for the local xbee module
+ */
+void xbeeTxHandleStatus(xbee_module *xbee, const uint8_t *frame, uint16_t len)
+{
+	if(len < 3)
+	{
+		return;
+	}
+	for(int i = 0; i < XBEE_TX_QUEUE; ++i)
+	{
+		xbee_tx_slot *slot = &xbee->tx.slot[i];
+		if(slot->state == XBEE_TX_PENDING && slot->frameid == frame[1])
+		{
+			xbeeTxComplete(xbee, slot, frame[2]);
+			xbeeTxKick(xbee);
+			return;
+		}
+	}
+}
+
+
+/*
+ *	Gives up on frames whose TX Status has not arrived within
+ *	XBEE_TX_TIMEOUT, so a lost status frame can not shrink the window
+ *	for good, and sends queued frames that did not fit in the UART queue
+ *	before. Call regularly from the main loop.
+ *
+ *	@param *xbee, handle for the local xbee module
+ */
+void xbeeTxService(xbee_module *xbee)
+{
+	uint32_t now = HAL_GetTick();
+	for(int i = 0; i < XBEE_TX_QUEUE; ++i)
+	{
+		xbee_tx_slot *slot = &xbee->tx.slot[i];
+		if(slot->state == XBEE_TX_PENDING && (now - slot->submitted) > XBEE_TX_TIMEOUT)
+		{
+			++xbee->tx.timeouts;
+			xbeeTxComplete(xbee, slot, XBEE_TXS_TIMEOUT);
+		}
+	}
+	xbeeTxKick(xbee);
+}
@@ -21,26 +21,171 @@ FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TOR
 #ifndef MISCFUNC_H_
 #define MISCFUNC_H_
 
+#include "platformtimer.h"
 #include "xbeelib.h"
 
+#define UART_TXREFS 8	// Buffers that can be queued by reference per UART (power of two)
+
 typedef struct {
 	uint8_t *data;
 	uint16_t datacnt;
 	uint16_t size;
 } buffer;
 
-void platformDelayUs(uint32_t udelay);
+/*
+ * Receive ring for a UART running a circular DMA transfer.
+ * The DMA writes into "data" continuously, the USART IDLE interrupt and
+ * the DMA half/full transfer interrupts publish how far it has come by
+ * advancing "produced". The main loop takes bytes by advancing "consumed".
+ * Each counter has exactly one writer, so neither side ever has to lock
+ * or stop the peripheral. The counters only give amounts and are free to
+ * wrap, positions in "data" are kept apart in "dmapos" and "readpos" as
+ * the size need not be a power of two. A ring with no "huart" is fed by
+ * software, which advances "produced" itself.
+ */
+typedef struct {
+	UART_HandleTypeDef *huart;
+	uint8_t *data;
+	uint16_t size;
+	uint16_t dmapos;			// Last DMA write index seen (ISR only)
+	uint16_t readpos;			// Index of the next byte to read (reader only)
+	volatile uint32_t produced;	// Total bytes published by the ISR
+	volatile uint32_t consumed;	// Total bytes taken by the reader
+	uint32_t overruns;			// Bytes lost because the DMA lapped the reader
+	volatile uint32_t stamp;	// platformCycles() when "produced" last advanced
+} uart_rxring;
+
+/*
+ * Room reserved in a transmit queue with uartTxReserve(). The queue is a
+ * ring, so the room may be split in two: data[0] is filled first and
+ * continues at data[1] (len[1] is 0 if it is not split).
+ */
+typedef struct {
+	uint8_t *data[2];
+	uint16_t len[2];
+} uart_txspan;
+
+typedef enum {
+	UART_TX_OK = 0x0,
+	UART_TX_FULL = 0x1		// Not enough room in the queue, nothing was queued
+} UART_TX_STAT;
+
+// Called (possibly from interrupt) once a referenced buffer has been sent
+typedef void (*uart_tx_release)(void *ctx);
+
+/*
+ * A buffer queued by reference with uartTxWriteRef(). It goes out once the
+ * queue has sent everything that was written before it ("mark"), and is
+ * transmitted straight from the callers memory.
+ */
+typedef struct {
+	const uint8_t *data;
+	uint16_t len;
+	uint32_t mark;				// Value of "written" when the reference was queued
+	uart_tx_release release;
+	void *ctx;
+} uart_txref;
+
+/*
+ * Transmit queue for a UART. Writers copy their data in and return at once,
+ * the DMA (or TX interrupt) drains the queue in the background and restarts
+ * itself from the transfer complete callback until the queue is empty.
+ * Buffers queued by reference are sent in order between the copied bytes.
+ * As in the receive ring, the counters only give amounts and positions in
+ * "data" are kept apart.
+ */
+typedef struct {
+	UART_HandleTypeDef *huart;
+	uint8_t *data;
+	uint16_t size;
+	uint16_t writepos;			// Index the next write goes to (writers only)
+	uint16_t sendpos;			// Index of the next byte to send (ISR only)
+	volatile uint32_t written;	// Total bytes queued by writers
+	volatile uint32_t sent;		// Total bytes transmitted
+	volatile uint16_t inflight;	// Bytes handed to the ongoing transfer
+	uint16_t highwater;			// Deepest the queue has been (bytes)
+	uint32_t rejected;			// Writes refused because the queue was full
+	uart_txref ref[UART_TXREFS];
+	volatile uint8_t refput;	// Total references queued by writers
+	volatile uint8_t refget;	// Total references transmitted
+	volatile bool refbusy;		// The ongoing transfer is ref[refget]
+} uart_txqueue;
+
+typedef enum {
+	TERM_STATE_NORMAL = 0x0,
+	TERM_STATE_CR = 0x1,		// CR received, a following LF belongs to it
+	TERM_STATE_ESC = 0x2,		// ESC received
+	TERM_STATE_CSI = 0x3		// Inside an ESC [ control sequence
+} TERM_STATE;
+
+struct xbee_module;
+
+/*
+ * A terminal on a UART. It edits a command line in "cache" and sends the
+ * commands it runs to the xbee module it was set up with.
+ */
+typedef struct terminal {
+	UART_HandleTypeDef *huart;
+	buffer *cache;				// Command line being typed
+	uint8_t state;				// Line editor state (TERM_STATE)
+	struct xbee_module *xbee;
+} terminal;
+
+// Handler of a terminal command, argv[0] is the command name
+typedef void (*term_handler)(terminal *term, int argc, char **argv);
+
+typedef struct {
+	const char *name;
+	term_handler handler;
+	const char *help;
+} term_command;
+
+void platformCycleCounterInit();
+uint32_t platformCycles();
+bool uartTxInit(uart_txqueue *queue, UART_HandleTypeDef *huart, uint8_t *storage, uint16_t size);
+void uartTxISR(UART_HandleTypeDef *huart);
+uart_txqueue *uartTxFind(UART_HandleTypeDef *huart);
+UART_TX_STAT uartTxWrite(UART_HandleTypeDef *huart, const uint8_t *data, uint16_t len);
+UART_TX_STAT uartTxWriteRef(UART_HandleTypeDef *huart, const uint8_t *data, uint16_t len,
+							uart_tx_release release, void *ctx);
+UART_TX_STAT uartTxReserve(UART_HandleTypeDef *huart, uint16_t len, uart_txspan *span);
+void uartTxCommit(UART_HandleTypeDef *huart, uint16_t len);
+uint16_t uartTxFree(UART_HandleTypeDef *huart);
+bool uartTxFlush(UART_HandleTypeDef *huart, uint32_t timeout);
+bool uartRxStart(uart_rxring *ring, UART_HandleTypeDef *huart, uint8_t *storage, uint16_t size);
+void uartRxISR(UART_HandleTypeDef *huart);
+uart_rxring *uartRxFind(UART_HandleTypeDef *huart);
+uint16_t uartRxAvailable(uart_rxring *ring);
+uint16_t uartRxRead(uart_rxring *ring, uint8_t *dst, uint16_t max);
+uint16_t uartRxPeek(uart_rxring *ring, const uint8_t **data);
+void uartRxConsume(uart_rxring *ring, uint16_t n);
+void uartRxDiscard(UART_HandleTypeDef *huart);
+bool uartSetBaudRate(UART_HandleTypeDef *huart, uint32_t baud);
 bool readAvailableData(UART_HandleTypeDef *huart, buffer *secbuf);
-void handleTerminalInput(buffer *inp);
-void termInit(buffer *termCache, UART_HandleTypeDef *huart);
-void terminalPrintNlCr();
-void terminalPrintRightArrow();
-void terminalPrintLeftArrow();
-void terminalProcessCommandBuffer();
+void handleTerminalInput(terminal *term, buffer *inp);
+void termInit(terminal *term, buffer *cache, UART_HandleTypeDef *huart, struct xbee_module *xbee);
+void terminalPrint(terminal *term, const char *str);
+void terminalPrintNlCr(terminal *term);
+void terminalPrintRightArrow(terminal *term);
+void terminalPrintLeftArrow(terminal *term);
+void terminalProcessCommandBuffer(terminal *term);
 
 #define MAX_TERM_CMD_LEN 100
+#define TERM_MAX_ARGS 8		// Words a terminal command line is split into
 #define UART_RXBUF_SIZE 200
 
+// UARTs that can be served by uartRxStart() and uartTxInit(), one per
+// radio and one per terminal. Two radios and a terminal need
+// -DMAX_UART_RINGS=3 -DMAX_UART_TXQUEUES=3.
+#ifndef MAX_UART_RINGS
+#define MAX_UART_RINGS 2
+#endif
+#ifndef MAX_UART_TXQUEUES
+#define MAX_UART_TXQUEUES 2
+#endif
+
+#define UART_TXBUF_SIZE 272	// Holds the largest frame in escaped API mode
+
 
 
 #endif /* MISCFUNC_H_ */
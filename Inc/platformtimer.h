@@ -0,0 +1,73 @@
+/*
+Copyright 2018 Jesper Wlivaara
+
+Permission is hereby granted, free of charge, to any person obtaining
+a copy of this software and associated documentation files (the "Software"),
+to deal in the Software without restriction, including without limitation the
+rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is furnished to
+do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all copies
+or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR
+PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE
+FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+
+#ifndef PLATFORMTIMER_H_
+#define PLATFORMTIMER_H_
+
+#include "xbeeport.h"
+#include "stdbool.h"
+
+/*
+ * Timer service on TIM2. The timer runs freely at 1 MHz and its compare
+ * channel 1 interrupt is set for the soonest of any number of software
+ * timers. Waiting is done with __WFI, so the core sleeps until the timer,
+ * or any other interrupt, wakes it up.
+ *
+ * The application must call platformTimerInit() once and forward
+ * TIM2_IRQHandler to platformTimerISR(). Until it has, timers still run
+ * out, on the HAL tick with 1 ms resolution, checked every time
+ * platformSleep() is woken by SysTick.
+ */
+
+// Blocking waits with the soonest timer at least this far away also stop
+// the SysTick interrupt, the HAL tick count is caught up afterwards
+#define PLATFORM_TICKLESS_MIN_US 2000
+
+// Called from the timer interrupt when a timer runs out
+typedef void (*platform_timer_cb)(void *ctx);
+
+typedef struct platform_timer {
+	uint32_t deadline;			// Timer count (us) the timer runs out at
+	platform_timer_cb cb;		// May be NULL
+	void *ctx;
+	volatile bool active;		// Cleared when the timer runs out or is stopped
+	struct platform_timer *next;
+} platform_timer;
+
+typedef struct {
+	uint32_t wakeups;			// Returns from __WFI
+	uint32_t sleepus;			// Time spent in __WFI (us)
+	uint32_t ticklessms;		// SysTick interrupts skipped during long delays
+	uint32_t expired;			// Timers that have run out
+} platform_timer_stats;
+
+extern platform_timer_stats platformTimerStats;
+
+void platformTimerInit();
+void platformTimerISR();
+uint32_t platformTimeUs();
+void platformTimerStart(platform_timer *timer, uint32_t us, platform_timer_cb cb, void *ctx);
+void platformTimerStop(platform_timer *timer);
+void platformSleep();
+void platformSleepTickless();
+void platformDelayUs(uint32_t udelay);
+void platformDelayMs(uint32_t mdelay);
+
+#endif /* PLATFORMTIMER_H_ */
@@ -0,0 +1,489 @@
+/*
+Copyright 2018 Jesper Wlivaara
+
+Permission is hereby granted, free of charge, to any person obtaining
+a copy of this software and associated documentation files (the "Software"),
+to deal in the Software without restriction, including without limitation the
+rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is furnished to
+do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all copies
+or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR
+PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE
+FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+
+#include "bench.h"
+
+#if XBEE_ENABLE_BENCH
+
+// Scratch radio, so benchmarks never touch the live module, registry, pool or rings
+static xbee_radio benchRadio;
+static uint8_t benchStream[UART_RXBUF_SIZE];
+static uint8_t benchBuf[UART_RXBUF_SIZE];
+static uint8_t benchBig[XBEE_API_MAX_FRAME+1];
+static uint8_t benchEsc[2*(XBEE_API_MAX_FRAME+4)];
+static uint8_t benchEscRef[2*(XBEE_API_MAX_FRAME+4)];
+static const uint8_t *benchExpect;		// Frame data the escaped mode decoder has to deliver
+static uint16_t benchExpectLen;
+static uint32_t benchMismatches;	// Results of the driver that differ from the byte loops
+
+// Frame data of a short recorded session: modem status, AT responses,
+// 16-bit RX packets with small sensor payloads and TX status reports
+static const uint8_t benchRecorded[] = {
+	5,  0x8A, 0x00, 0x00, 0x00, 0x00,
+	8,  0x88, 0x01, 'Z', 'Z', 0x00, 0x00, 0x0C, 0x00,
+	14, 0x81, 0x00, 0x01, 0x28, 0x00, 'T', '=', '2', '1', '.', '5', 0x0D, 0x0A, 0x00,
+	3,  0x89, 0x02, 0x00,
+	14, 0x81, 0x00, 0x02, 0x31, 0x00, 'H', '=', '4', '3', '.', '0', 0x0D, 0x0A, 0x00,
+	3,  0x89, 0x03, 0x01,
+	0
+};
+
+typedef struct {
+	uint32_t cycles;	// Fastest run
+	uint32_t bytes;		// Bytes handled per run
+	uint32_t ops;		// Frames, lookups or keys handled per run
+	uint32_t allocs;	// Pool blocks taken per run
+} bench_result;
+
+
+/**
+ *	Prints one result line: cycles per operation and per byte, the
+ *	matching throughput and time at the current core clock, and pool
+ *	allocations per operation.
+ */
+static void benchReport(terminal *term, const char *name, const bench_result *res)
+{
+	char msg[120];
+	if(res->cycles == 0)
+	{
+		return;
+	}
+	uint32_t perop = res->cycles / res->ops;
+	uint32_t ns = (uint32_t)(((uint64_t)res->cycles * 1000000000ULL / SystemCoreClock) / res->ops);
+	int len = sprintf(msg, "%-10s %7lu cyc/op %6lu ns/op", name, (unsigned long)perop, (unsigned long)ns);
+
+	if(res->bytes > 0)
+	{
+		uint32_t bps = (uint32_t)((uint64_t)SystemCoreClock * res->bytes / res->cycles);
+		uint32_t perbyte10 = (uint32_t)((uint64_t)res->cycles * 10 / res->bytes);
+		len += sprintf(&msg[len], " %4lu.%lu cyc/B %8lu B/s", (unsigned long)(perbyte10 / 10),
+					   (unsigned long)(perbyte10 % 10), (unsigned long)bps);
+	}
+	len += sprintf(&msg[len], " %lu.%02lu alloc/op\r\n", (unsigned long)(res->allocs / res->ops),
+				   (unsigned long)((res->allocs * 100 / res->ops) % 100));
+	terminalPrint(term, msg);
+}
+
+
+/**
+ *	Fills benchStream with whole API frames made from the given frame
+ *	data list (length byte followed by the frame data, 0 ends the list),
+ *	repeating the list until the stream is full.
+ *
+ *	@return number of stream bytes used, *frames is set to the frame count
+ */
+static uint16_t benchBuildStream(const uint8_t *list, uint32_t *frames)
+{
+	uint16_t pos = 0;
+	const uint8_t *p = list;
+
+	*frames = 0;
+	for(;;)
+	{
+		if(*p == 0)
+		{
+			p = list;
+		}
+		uint16_t n = xbeeEncodeFrame(&benchStream[pos], sizeof(benchStream) - pos, &p[1], p[0]);
+		if(n == 0)
+		{
+			return pos;
+		}
+		pos += n;
+		p += p[0] + 1;
+		++*frames;
+	}
+}
+
+
+/**
+ *	UART receive path: copying a full ring out as readAvailableData() does.
+ */
+static void benchRxCopy(bench_result *res)
+{
+	uart_rxring ring = {NULL, benchStream, sizeof(benchStream), 0, 0, 0, 0, 0, 0};
+
+	for(int r = 0; r < BENCH_REPEAT; ++r)
+	{
+		ring.produced += sizeof(benchStream);
+		uint32_t start = platformCycles();
+		uartRxRead(&ring, benchBuf, sizeof(benchBuf));
+		uint32_t cycles = platformCycles() - start;
+		if(r == 0 || cycles < res->cycles)
+		{
+			res->cycles = cycles;
+		}
+	}
+	res->bytes = sizeof(benchStream);
+	res->ops = 1;
+}
+
+
+/**
+ *	API frame decoding of a byte stream, fed in one chunk.
+ */
+static void benchParse(bench_result *res, const uint8_t *list)
+{
+	uint16_t len = benchBuildStream(list, &res->ops);
+
+	xbeeParserReset(&benchRadio.local.parser);
+	for(int r = 0; r < BENCH_REPEAT; ++r)
+	{
+		uint32_t allocs = benchRadio.pool.allocs;
+		uint32_t start = platformCycles();
+		xbeeParseBytes(&benchRadio.local, benchStream, len);
+		uint32_t cycles = platformCycles() - start;
+		if(r == 0 || cycles < res->cycles)
+		{
+			res->cycles = cycles;
+		}
+		res->allocs = benchRadio.pool.allocs - allocs;
+	}
+	res->bytes = len;
+}
+
+
+/**
+ *	API frame encoding of a maximum size TX16 request.
+ */
+static void benchEncode(bench_result *res)
+{
+	uint8_t data[XBEE_API_MAX_FRAME];
+
+	memset(data, 0x55, sizeof(data));
+	data[0] = XBEE_API_TX16;
+	for(int r = 0; r < BENCH_REPEAT; ++r)
+	{
+		uint32_t start = platformCycles();
+		xbeeEncodeFrame(benchBuf, sizeof(benchBuf), data, sizeof(data));
+		uint32_t cycles = platformCycles() - start;
+		if(r == 0 || cycles < res->cycles)
+		{
+			res->cycles = cycles;
+		}
+	}
+	res->bytes = sizeof(data);
+	res->ops = 1;
+}
+
+
+/**
+ *	Checksum of a maximum size frame.
+ */
+static void benchChecksum(bench_result *res)
+{
+	volatile uint8_t sum;
+
+	for(int r = 0; r < BENCH_REPEAT; ++r)
+	{
+		uint32_t start = platformCycles();
+		sum = xbeeChecksum(benchStream, XBEE_API_MAX_FRAME);
+		uint32_t cycles = platformCycles() - start;
+		if(r == 0 || cycles < res->cycles)
+		{
+			res->cycles = cycles;
+		}
+	}
+	(void)sum;
+	res->bytes = XBEE_API_MAX_FRAME;
+	res->ops = 1;
+}
+
+
+/**
+ *	Escaping done the plain way, one byte at a time, for comparison with
+ *	xbeeEscape().
+ */
+static uint16_t benchEscapeBytes(uint8_t *dst, const uint8_t *data, uint16_t len)
+{
+	uint16_t n = 0;
+	for(uint16_t i = 0; i < len; ++i)
+	{
+		uint8_t c = data[i];
+		if(c == XBEE_API_START_DELIM || c == XBEE_API_ESCAPE || c == XBEE_API_XON || c == XBEE_API_XOFF)
+		{
+			dst[n++] = XBEE_API_ESCAPE;
+			c ^= XBEE_API_ESCAPE_XOR;
+		}
+		dst[n++] = c;
+	}
+	return n;
+}
+
+
+/**
+ *	Unescaping and checksumming done the plain way, one byte at a time,
+ *	for comparison with the escaped mode frame decoder.
+ */
+static uint16_t benchUnescapeBytes(uint8_t *dst, const uint8_t *data, uint16_t len, uint8_t *sum)
+{
+	uint16_t n = 0;
+	uint8_t s = 0;
+	bool esc = false;
+	for(uint16_t i = 0; i < len; ++i)
+	{
+		uint8_t c = data[i];
+		if(c == XBEE_API_ESCAPE)
+		{
+			esc = true;
+			continue;
+		}
+		if(esc)
+		{
+			c ^= XBEE_API_ESCAPE_XOR;
+			esc = false;
+		}
+		dst[n++] = c;
+		s += c;
+	}
+	*sum = s;
+	return n;
+}
+
+
+/**
+ *	Checks a frame delivered by the escaped mode decoder against the
+ *	frame that was escaped.
+ */
+static void benchCheckFrame(xbee_module *xbee, xbee_frame *frame)
+{
+	(void)xbee;
+	if(frame->len == benchExpectLen && memcmp(xbeeFrameData(frame), benchExpect, benchExpectLen) == 0)
+	{
+		benchExpect = NULL;
+	}
+}
+
+
+/**
+ *	Escaped API mode (AP = 2) on a maximum size TX16 request: escaping it
+ *	into a UART buffer and decoding it again, each with the word at a time
+ *	scanner of the driver and with a plain byte loop. The driver decode is
+ *	the whole frame decoder, pool block included. "worst" makes every
+ *	payload byte one that has to be escaped. Afterwards the results of the
+ *	driver are checked against the byte loops, differences are counted
+ *	in benchMismatches.
+ *
+ *	@param *res, four results: escape, escape by byte, decode, decode by byte
+ */
+static void benchEscaped(bench_result *res, bool worst)
+{
+	uint8_t data[XBEE_API_MAX_FRAME];
+	uint32_t seed = 0x2545F491;
+
+	data[0] = XBEE_API_TX16;
+	for(uint16_t i = 1; i < sizeof(data); ++i)
+	{
+		seed ^= seed << 13;
+		seed ^= seed >> 17;
+		seed ^= seed << 5;
+		data[i] = worst ? XBEE_API_START_DELIM : (uint8_t)seed;
+	}
+	uint16_t flen = xbeeEncodeFrame(benchBuf, sizeof(benchBuf), data, sizeof(data));
+	uint16_t elen = 0;
+
+	xbeeParserReset(&benchRadio.local.parser);
+	benchRadio.local.settings.AP = XBEE_API_ESCAPED;
+	for(int r = 0; r < BENCH_REPEAT; ++r)
+	{
+		uint8_t sum;
+		uint32_t t0 = platformCycles();
+		elen = xbeeEscape(&benchEsc[1], sizeof(benchEsc) - 1, &benchBuf[1], flen - 1);
+		uint32_t t1 = platformCycles();
+		benchEscapeBytes(&benchEsc[1], &benchBuf[1], flen - 1);
+		uint32_t t2 = platformCycles();
+		benchEsc[0] = XBEE_API_START_DELIM;
+		xbeeParseBytes(&benchRadio.local, benchEsc, elen + 1);
+		uint32_t t3 = platformCycles();
+		benchUnescapeBytes(benchStream, &benchEsc[1], elen, &sum);
+		uint32_t t4 = platformCycles();
+		uint32_t cycles[4] = {t1 - t0, t2 - t1, t3 - t2, t4 - t3};
+		for(int k = 0; k < 4; ++k)
+		{
+			if(r == 0 || cycles[k] < res[k].cycles)
+			{
+				res[k].cycles = cycles[k];
+			}
+		}
+	}
+
+	// Same bytes as the byte loops, and the decoder gives the frame back
+	uint8_t sum;
+	uint16_t reflen = benchEscapeBytes(benchEscRef, &benchBuf[1], flen - 1);
+	elen = xbeeEscape(&benchEsc[1], sizeof(benchEsc) - 1, &benchBuf[1], flen - 1);
+	if(elen != reflen || memcmp(&benchEsc[1], benchEscRef, elen) != 0)
+	{
+		++benchMismatches;
+	}
+	if(benchUnescapeBytes(benchStream, &benchEsc[1], elen, &sum) != flen - 1 ||
+	   memcmp(benchStream, &benchBuf[1], flen - 1) != 0)
+	{
+		++benchMismatches;
+	}
+	benchExpect = data;
+	benchExpectLen = sizeof(data);
+	benchRadio.local.onframe = benchCheckFrame;
+	xbeeParseBytes(&benchRadio.local, benchEsc, elen + 1);
+	benchRadio.local.onframe = NULL;
+	if(benchExpect != NULL)
+	{
+		++benchMismatches;
+	}
+
+	benchRadio.local.settings.AP = 0;
+	for(int k = 0; k < 4; ++k)
+	{
+		res[k].bytes = flen;
+		res[k].ops = 1;
+	}
+}
+
+
+/**
+ *	Node registry lookups by 64-bit and by 16-bit address in a full table.
+ */
+static void benchLookup(bench_result *res64, bench_result *res16)
+{
+	xbeeNodesInit(&benchRadio.nodes);
+	for(uint16_t i = 0; i < XBEE_MAX_NODES; ++i)
+	{
+		xbeeNodeAdd(&benchRadio.nodes, 0x0013A200, 0x40A00000 + i*0x1F3, 0x100 + i);
+	}
+
+	for(int r = 0; r < BENCH_REPEAT; ++r)
+	{
+		uint32_t start = platformCycles();
+		for(uint16_t i = 0; i < XBEE_MAX_NODES; ++i)
+		{
+			xbeeNodeFind64(&benchRadio.nodes, 0x0013A200, 0x40A00000 + i*0x1F3);
+		}
+		uint32_t mid = platformCycles();
+		for(uint16_t i = 0; i < XBEE_MAX_NODES; ++i)
+		{
+			xbeeNodeFind16(&benchRadio.nodes, 0x100 + i);
+		}
+		uint32_t end = platformCycles();
+		if(r == 0 || (mid - start) < res64->cycles)
+		{
+			res64->cycles = mid - start;
+		}
+		if(r == 0 || (end - mid) < res16->cycles)
+		{
+			res16->cycles = end - mid;
+		}
+	}
+	res64->ops = XBEE_MAX_NODES;
+	res16->ops = XBEE_MAX_NODES;
+}
+
+
+/**
+ *	Terminal keystroke handling: a character followed by a backspace,
+ *	echo to the terminal UART included. Leaves the command line as it was.
+ */
+static void benchTerminal(terminal *term, bench_result *res)
+{
+	uint8_t key;
+	buffer inp = {&key, 1, 1};
+
+	for(int r = 0; r < BENCH_REPEAT; ++r)
+	{
+		uartTxFlush(term->huart, 100);
+		uint32_t start = platformCycles();
+		key = 'x';
+		handleTerminalInput(term, &inp);
+		key = 0x8;
+		handleTerminalInput(term, &inp);
+		uint32_t cycles = platformCycles() - start;
+		if(r == 0 || cycles < res->cycles)
+		{
+			res->cycles = cycles;
+		}
+	}
+	res->ops = 2;
+}
+
+
+/**
+ *	Runs every benchmark and prints the results to a terminal. Runs with
+ *	interrupts enabled, BENCH_REPEAT runs of each case keep the noise out.
+ *
+ *	@param *term, terminal to print on, its keystroke handling is measured
+ *	@retval Results of the word at a time escape scanner that differ from
+ *			the byte loops, 0 if all match
+ */
+uint32_t benchRun(terminal *term)
+{
+	bench_result res[16];
+	char msg[60];
+
+	memset(res, 0, sizeof(res));
+	benchMismatches = 0;
+	platformCycleCounterInit();
+	benchRadio.local.radio = &benchRadio;
+	xbeePoolInit(&benchRadio.pool);
+	xbeeNodesInit(&benchRadio.nodes);
+
+	benchRxCopy(&res[0]);
+	benchParse(&res[1], benchRecorded);
+
+	// Synthetic stream of the largest AT responses that fit a block
+	memset(benchBig, 0x55, sizeof(benchBig));
+	benchBig[0] = XBEE_API_MAX_FRAME - 1;
+	benchBig[1] = XBEE_API_AT_RESPONSE;
+	benchBig[3] = 'Z';
+	benchBig[4] = 'Z';
+	benchBig[5] = 0x00;
+	benchBig[XBEE_API_MAX_FRAME] = 0;
+	benchParse(&res[2], benchBig);
+	benchEncode(&res[3]);
+	benchChecksum(&res[4]);
+	benchLookup(&res[5], &res[6]);
+	benchTerminal(term, &res[7]);
+	benchEscaped(&res[8], false);
+	benchEscaped(&res[12], true);
+
+	sprintf(msg, "core clock %lu Hz, best of %d runs\r\n", (unsigned long)SystemCoreClock, BENCH_REPEAT);
+	terminalPrint(term, msg);
+	benchReport(term, "rx copy", &res[0]);
+	benchReport(term, "parse rec", &res[1]);
+	benchReport(term, "parse max", &res[2]);
+	benchReport(term, "encode", &res[3]);
+	benchReport(term, "checksum", &res[4]);
+	benchReport(term, "find64", &res[5]);
+	benchReport(term, "find16", &res[6]);
+	benchReport(term, "term key", &res[7]);
+	benchReport(term, "esc rand", &res[8]);
+	benchReport(term, " bytewise", &res[9]);
+	benchReport(term, "unesc rand", &res[10]);
+	benchReport(term, " bytewise", &res[11]);
+	benchReport(term, "esc worst", &res[12]);
+	benchReport(term, " bytewise", &res[13]);
+	benchReport(term, "unesc wrst", &res[14]);
+	benchReport(term, " bytewise", &res[15]);
+	if(benchMismatches > 0)
+	{
+		sprintf(msg, "escaped: %lu differ from bytewise\r\n", (unsigned long)benchMismatches);
+		terminalPrint(term, msg);
+	}
+	return benchMismatches;
+}
+
+#endif /* XBEE_ENABLE_BENCH */
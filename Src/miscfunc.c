@@ -19,57 +19,372 @@ FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TOR
 */
 
 #include "miscfunc.h"
+#include "bench.h"
+#include "ctype.h"
 
-buffer *termCache;
-UART_HandleTypeDef *hterm;
+// Receive rings started with uartRxStart(), looked up by UART handle
+uart_rxring *rxrings[MAX_UART_RINGS];
+
+// Transmit queues set up with uartTxInit(), looked up by UART handle
+uart_txqueue *txqueues[MAX_UART_TXQUEUES];
+
+
+/*
+ *	Moves a position in a ring of "size" bytes on by "n" bytes.
+ */
+static uint16_t uartRingAdvance(uint16_t pos, uint32_t n, uint16_t size)
+{
+	return (uint16_t)((pos + n % size) % size);
+}
 
 /**
- *	Initializes the terminal.
+ *	Initializes a terminal.
  *
- *	@param *termCache, data buffer that the terminal can use
+ *	@param *term, terminal to initialize
+ *	@param *cache, data buffer that the terminal can use
  *	@param *huart, STM32 HAL UART handle for the connection going to the terminal
+ *	@param *xbee, handle for the xbee module the terminal commands go to
  */
-void termInit(buffer *termbuf, UART_HandleTypeDef *huart)
+void termInit(terminal *term, buffer *cache, UART_HandleTypeDef *huart, xbee_module *xbee)
 {
-	termCache = termbuf;
-	hterm = huart;
+	term->huart = huart;
+	term->cache = cache;
+	term->state = TERM_STATE_NORMAL;
+	term->xbee = xbee;
 
 	char msg[50];
 	uint16_t len;
 	len = sprintf(msg, "\r\nTERMINAL INITIALIZED\r\n");
-	HAL_UART_Transmit(hterm, (uint8_t*)msg, len, 50);
+	uartTxWrite(term->huart, (uint8_t*)msg, len);
 	len = sprintf(msg, "=====================\r\n");
-	HAL_UART_Transmit(hterm, (uint8_t*)msg, len, 50);
-	terminalPrintRightArrow();
+	uartTxWrite(term->huart, (uint8_t*)msg, len);
+	terminalPrintRightArrow(term);
+}
+
+
+/**
+ * Starts the Cortex-M DWT cycle counter used by platformCycles().
+ * Weak so that other platforms can provide their own.
+ */
+__weak void platformCycleCounterInit()
+{
+#ifdef DWT
+	CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+	DWT->CYCCNT = 0;
+	DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+#endif
+}
+
+
+/**
+ * Current value of the core cycle counter, wraps every 2^32 cycles
+ * (67 s at 64 MHz). Requires platformCycleCounterInit().
+ */
+__weak uint32_t platformCycles()
+{
+#ifdef DWT
+	return DWT->CYCCNT;
+#else
+	return 0;
+#endif
+}
+
+
+/**
+ *	Starts continuous reception on target UART into a circular DMA buffer
+ *	and enables the USART IDLE interrupt, so that a burst of received bytes
+ *	is published as soon as the line goes quiet. Requires the UART to have
+ *	a DMA RX channel linked to it (huart->hdmarx) in the HAL configuration.
+ *
+ *	The application must forward the following to uartRxISR(huart):
+ *	- the USARTx_IRQHandler (before calling HAL_UART_IRQHandler)
+ *	- HAL_UART_RxHalfCpltCallback and HAL_UART_RxCpltCallback
+ *	The USART and DMA interrupts must share the same priority.
+ *
+ *	@param *ring, receive ring to initialize
+ *	@param *huart, STM HAL library handle for target uart interface
+ *	@param *storage, memory the DMA will write to
+ *	@param size, size of storage
+ *	@return true if reception was started, false otherwise
+ */
+bool uartRxStart(uart_rxring *ring, UART_HandleTypeDef *huart, uint8_t *storage, uint16_t size)
+{
+	if(huart->hdmarx == NULL || size == 0)
+	{
+		return false;
+	}
+
+	// Claim a slot in the lookup table (or reuse the one for this UART)
+	int slot = -1;
+	for(int i = 0; i < MAX_UART_RINGS; ++i)
+	{
+		if(rxrings[i] == ring || rxrings[i] == NULL || rxrings[i]->huart == huart)
+		{
+			slot = i;
+			break;
+		}
+	}
+	if(slot < 0)
+	{
+		return false;
+	}
+
+	ring->huart = huart;
+	ring->data = storage;
+	ring->size = size;
+	ring->dmapos = 0;
+	ring->readpos = 0;
+	ring->produced = 0;
+	ring->consumed = 0;
+	ring->overruns = 0;
+	ring->stamp = 0;
+	rxrings[slot] = ring;
+
+	if(huart->hdmarx->Init.Mode != DMA_CIRCULAR)
+	{
+		huart->hdmarx->Init.Mode = DMA_CIRCULAR;
+		HAL_DMA_Init(huart->hdmarx);
+	}
+
+	if(HAL_UART_Receive_DMA(huart, storage, size) != HAL_OK)
+	{
+		return false;
+	}
+	__HAL_UART_CLEAR_IDLEFLAG(huart);
+	__HAL_UART_ENABLE_IT(huart, UART_IT_IDLE);
+	return true;
+}
+
+
+/**
+ *	Publishes the bytes the DMA has written since the last call.
+ *	Called from the USART interrupt (IDLE line) and from the DMA
+ *	half/full transfer callbacks, which together guarantee that the DMA
+ *	can never lap the published position unnoticed.
+ *
+ *	@param *huart, STM HAL library handle for target uart interface
+ */
+void uartRxISR(UART_HandleTypeDef *huart)
+{
+	if(__HAL_UART_GET_FLAG(huart, UART_FLAG_IDLE))
+	{
+		__HAL_UART_CLEAR_IDLEFLAG(huart);
+	}
+
+	uart_rxring *ring = uartRxFind(huart);
+	if(ring == NULL)
+	{
+		return;
+	}
+
+	uint16_t pos = ring->size - (uint16_t)__HAL_DMA_GET_COUNTER(huart->hdmarx);
+	if(pos >= ring->size)
+	{
+		pos = 0;
+	}
+	if(pos != ring->dmapos)
+	{
+		uint16_t delta = (pos > ring->dmapos) ? (pos - ring->dmapos) : (ring->size - ring->dmapos + pos);
+		ring->dmapos = pos;
+		ring->produced += delta;
+		ring->stamp = platformCycles();
+	}
+}
+
+
+/**
+ *	Looks up the receive ring that has been started on target UART.
+ *
+ *	@param *huart, STM HAL library handle for target uart interface
+ *	@return pointer to the ring, NULL if uartRxStart() was never called
+ */
+uart_rxring *uartRxFind(UART_HandleTypeDef *huart)
+{
+	for(int i = 0; i < MAX_UART_RINGS; ++i)
+	{
+		if(rxrings[i] != NULL && rxrings[i]->huart == huart)
+		{
+			return rxrings[i];
+		}
+	}
+	return NULL;
+}
+
+
+/**
+ *	Number of received bytes waiting to be read. If the DMA has lapped
+ *	the reader the oldest bytes are discarded and counted as overruns.
+ *	The DMA may already have written past what the ISR has published,
+ *	over the oldest bytes, so those count towards the lap as well. A ring
+ *	without a UART is fed by software and has no DMA to ask.
+ *
+ *	@param *ring, target receive ring
+ *	@return number of bytes that can be read
+ */
+uint16_t uartRxAvailable(uart_rxring *ring)
+{
+	uint32_t primask = __get_PRIMASK();
+	__disable_irq();
+	uint32_t produced = ring->produced;
+	uint16_t unpublished = 0;
+	if(ring->huart != NULL)
+	{
+		uint16_t pos = ring->size - (uint16_t)__HAL_DMA_GET_COUNTER(ring->huart->hdmarx);
+		if(pos >= ring->size)
+		{
+			pos = 0;
+		}
+		unpublished = (pos >= ring->dmapos) ? (pos - ring->dmapos) : (ring->size - ring->dmapos + pos);
+	}
+	__set_PRIMASK(primask);
+
+	uint32_t written = produced - ring->consumed + unpublished;
+	if(written > ring->size)
+	{
+		ring->overruns += written - ring->size;
+		ring->consumed += written - ring->size;
+		ring->readpos = uartRingAdvance(ring->readpos, written - ring->size, ring->size);
+	}
+	return (uint16_t)(produced - ring->consumed);
+}
+
+
+/**
+ *	Copies up to "max" received bytes out of the ring. Never blocks and
+ *	never touches the peripheral.
+ *
+ *	@param *ring, target receive ring
+ *	@param *dst, destination buffer
+ *	@param max, size of destination buffer
+ *	@return number of bytes copied
+ */
+uint16_t uartRxRead(uart_rxring *ring, uint8_t *dst, uint16_t max)
+{
+	uint16_t n = uartRxAvailable(ring);
+	if(n > max)
+	{
+		n = max;
+	}
+
+	uint16_t idx = ring->readpos;
+	uint16_t first = ring->size - idx;
+	if(first > n)
+	{
+		first = n;
+	}
+	memcpy(dst, &ring->data[idx], first);
+	memcpy(&dst[first], ring->data, n - first);
+
+	uartRxConsume(ring, n);
+	return n;
+}
+
+
+/**
+ *	Gives direct access to the oldest received bytes, for readers that
+ *	can work on the data where the DMA put it. Only the contiguous part
+ *	up to the end of the ring is returned, the rest follows on the next
+ *	call. Release the bytes with uartRxConsume() when done.
+ *
+ *	@param *ring, target receive ring
+ *	@param **data, set to the first unread byte
+ *	@return number of bytes available at *data
+ */
+uint16_t uartRxPeek(uart_rxring *ring, const uint8_t **data)
+{
+	uint16_t n = uartRxAvailable(ring);
+	uint16_t idx = ring->readpos;
+	if(n > ring->size - idx)
+	{
+		n = ring->size - idx;
+	}
+	*data = &ring->data[idx];
+	return n;
+}
+
+
+/**
+ *	Releases bytes obtained with uartRxPeek().
+ *
+ *	@param *ring, target receive ring
+ *	@param n, number of bytes used
+ */
+void uartRxConsume(uart_rxring *ring, uint16_t n)
+{
+	ring->consumed += n;
+	ring->readpos = uartRingAdvance(ring->readpos, n, ring->size);
+}
+
+
+/**
+ *	Throws away everything received so far on target UART.
+ *
+ *	@param *huart, STM HAL library handle for target uart interface
+ */
+void uartRxDiscard(UART_HandleTypeDef *huart)
+{
+	uart_rxring *ring = uartRxFind(huart);
+	if(ring != NULL)
+	{
+		uint32_t n = ring->produced - ring->consumed;
+		ring->consumed += n;
+		ring->readpos = uartRingAdvance(ring->readpos, n, ring->size);
+	}
 }
 
 
 /**
- * Creates a blocking mode delay of 'udelay' microseconds.
- * At systemclock 64 Mhz, Prescaler TIM2->PSC = 64
- * => Tim2 updates every 1 us. NOTE: Requires TIM2 to be enabled in
- * HAL Drivers with its clock source set to internal.
+ *	Changes the baud rate of target UART. Queued output is sent at the old
+ *	rate first, and reception into the receive ring (if any) is restarted
+ *	at the new rate.
+ *
+ *	@param *huart, STM HAL library handle for target uart interface
+ *	@param baud, new baud rate
+ *	@return true if the UART was reinitialized
  */
-void platformDelayUs(uint32_t udelay)
+bool uartSetBaudRate(UART_HandleTypeDef *huart, uint32_t baud)
 {
-	/* 1. Clear update event flag
-	 *2. Set autoreload value
-	 *3. Enable timer
-	 *4. Wait until timer counts to udelay
-	 *5. Disable timer
-	 */
-	TIM2->SR = 0;
-	TIM2->ARR = udelay;
-	TIM2->CR1 |= TIM_CR1_CEN;
-	while(!(TIM2->SR & TIM_SR_UIF));
-	TIM2->CR1 &= ~TIM_CR1_CEN;
+	uartTxFlush(huart, 100);
+	uart_txqueue *queue = uartTxFind(huart);
+	if(queue != NULL)
+	{
+		// Anything the flush could not get out is dropped with the abort
+		queue->sent = queue->written;
+		queue->sendpos = queue->writepos;
+		queue->inflight = 0;
+		queue->refbusy = false;
+		while(queue->refput != queue->refget)
+		{
+			uart_txref *ref = &queue->ref[queue->refget++ % UART_TXREFS];
+			if(ref->release != NULL)
+			{
+				ref->release(ref->ctx);
+			}
+		}
+	}
+
+	HAL_UART_Abort(huart);
+	huart->Init.BaudRate = baud;
+	if(HAL_UART_Init(huart) != HAL_OK)
+	{
+		return false;
+	}
+
+	uart_rxring *ring = uartRxFind(huart);
+	if(ring != NULL)
+	{
+		return uartRxStart(ring, huart, ring->data, ring->size);
+	}
+	return true;
 }
 
 
 /**
  *	Reads available data from target UART and copies it over
- *	to a temporary buffer. This function works with UART interrupts
- *	and utilizes a timeout process to terminate data reception.
+ *	to a temporary buffer. Data is taken from the receive ring started
+ *	with uartRxStart(), so the call returns immediately and reception
+ *	keeps running while it copies. Bytes that do not fit in the
+ *	secondary buffer are left in the ring for the next call.
  *
  *	@param *huart, STM HAL library handle for target uart interface
  *	@param *secbuf, pointer to the secondary storage buffer
@@ -78,102 +393,514 @@ void platformDelayUs(uint32_t udelay)
  */
 bool readAvailableData(UART_HandleTypeDef *huart, buffer *secbuf)
 {
-	//TODO: Tweak timeout values
-	uint32_t timeout_usmax = 10;
-	uint32_t timeout_ticks = 0;
-	uint32_t timeout_usdelay = 100;
-	uint16_t savedval = 0;
+	uart_rxring *ring = uartRxFind(huart);
+	if(ring == NULL)
+	{
+		secbuf->datacnt = 0;
+		return false;
+	}
+
+	secbuf->datacnt = uartRxRead(ring, secbuf->data, secbuf->size);
+	return (secbuf->datacnt > 0);
+}
+
 
-	// These values will differ only if data
-	// has been received on the Rx pin.
-	if (huart->RxXferCount != huart->RxXferSize)
+/**
+ *	Sets up a transmit queue for target UART. Transfers are made with DMA
+ *	if the UART has a TX DMA channel linked to it, otherwise with the TX
+ *	interrupt. The application must forward HAL_UART_TxCpltCallback
+ *	to uartTxISR(huart).
+ *
+ *	@param *queue, transmit queue to initialize
+ *	@param *huart, STM HAL library handle for target uart interface
+ *	@param *storage, memory used to hold queued data
+ *	@param size, size of storage
+ *	@return true if the queue was set up, false if no slot was available
+ */
+bool uartTxInit(uart_txqueue *queue, UART_HandleTypeDef *huart, uint8_t *storage, uint16_t size)
+{
+	int slot = -1;
+	for(int i = 0; i < MAX_UART_TXQUEUES; ++i)
 	{
-		while (timeout_ticks < timeout_usmax)
+		if(txqueues[i] == queue || txqueues[i] == NULL || txqueues[i]->huart == huart)
 		{
-			if(savedval != huart->RxXferCount)
-			{
-				savedval = huart->RxXferCount;
-			}
-			else
-			{
-				platformDelayUs(timeout_usdelay);
-				++timeout_ticks;
-			}
+			slot = i;
+			break;
 		}
+	}
+	if(slot < 0 || size == 0)
+	{
+		return false;
+	}
+
+	queue->huart = huart;
+	queue->data = storage;
+	queue->size = size;
+	queue->writepos = 0;
+	queue->sendpos = 0;
+	queue->written = 0;
+	queue->sent = 0;
+	queue->inflight = 0;
+	queue->highwater = 0;
+	queue->rejected = 0;
+	queue->refput = 0;
+	queue->refget = 0;
+	queue->refbusy = false;
+	txqueues[slot] = queue;
+	return true;
+}
+
+
+/**
+ *	Hands the next contiguous part of the queue to the UART, unless a
+ *	transfer is already ongoing. A buffer queued by reference is sent as
+ *	soon as everything written before it has gone out. Must be called
+ *	with interrupts disabled or from the transfer complete interrupt.
+ */
+static void uartTxKick(uart_txqueue *queue)
+{
+	if(queue->inflight != 0 || queue->refbusy)
+	{
+		return;
+	}
 
-		uint16_t cnt = huart->RxXferSize-huart->RxXferCount;
-		HAL_UART_AbortReceive_IT(huart);
-		while(huart->RxState != HAL_UART_STATE_READY)
+	uint32_t pending = queue->written - queue->sent;
+	uart_txref *ref = NULL;
+	if(queue->refput != queue->refget)
+	{
+		// Copied bytes only go out up to the next referenced buffer
+		ref = &queue->ref[queue->refget % UART_TXREFS];
+		pending = ref->mark - queue->sent;
+	}
+
+	const uint8_t *data;
+	uint16_t n;
+	if(pending != 0)
+	{
+		uint16_t idx = queue->sendpos;
+		data = &queue->data[idx];
+		n = queue->size - idx;
+		if(n > pending)
 		{
-			// Wait for abort process to complete.
+			n = (uint16_t)pending;
 		}
+		ref = NULL;
+	}
+	else if(ref != NULL)
+	{
+		data = ref->data;
+		n = ref->len;
+	}
+	else
+	{
+		return;
+	}
+
+	HAL_StatusTypeDef stat;
+	if(queue->huart->hdmatx != NULL)
+	{
+		stat = HAL_UART_Transmit_DMA(queue->huart, (uint8_t*)data, n);
+	}
+	else
+	{
+		stat = HAL_UART_Transmit_IT(queue->huart, (uint8_t*)data, n);
+	}
 
-		if (cnt > secbuf->size)
+	// If the UART is busy the data stays queued and is retried on
+	// the next write or flush
+	if(stat == HAL_OK)
+	{
+		if(ref != NULL)
 		{
-			// Received data will not fit in secondary buffer
-			// therefore do not copy over
-			HAL_UART_Receive_IT(huart, (uint8_t*)(huart->pRxBuffPtr-cnt), huart->RxXferSize);
-			secbuf->datacnt = 0;
-			return false;
+			queue->refbusy = true;
 		}
 		else
 		{
-			// Copy over to secondary buffer and re-enable interrupts
-			for (int i = 0; i < cnt; ++i) {
-				secbuf->data[i] = *((huart->pRxBuffPtr-cnt)+i);
-			}
-			HAL_UART_Receive_IT(huart, (uint8_t*)(huart->pRxBuffPtr-cnt), huart->RxXferSize);
-			secbuf->datacnt = cnt;
-			return true;
+			queue->inflight = n;
 		}
 	}
-	return false;
 }
 
 
 /**
- * 	Basic terminal behavior on character input.
- * 	Will echo typed characters back to configured UART when
- * 	they are added to a command. Will process said command when
- * 	carriage return is sent. Lastly it will also erase characters
- * 	from a command when	backspace is sent.
+ *	Transfer complete handler. Marks the finished transfer as sent and
+ *	starts the next one.
  *
- *	@param *inp, received char(s) for terminal to handle
+ *	@param *huart, STM HAL library handle for target uart interface
+ */
+void uartTxISR(UART_HandleTypeDef *huart)
+{
+	uart_txqueue *queue = uartTxFind(huart);
+	if(queue == NULL)
+	{
+		return;
+	}
+
+	if(queue->refbusy)
+	{
+		uart_txref *ref = &queue->ref[queue->refget % UART_TXREFS];
+		queue->refbusy = false;
+		++queue->refget;
+		if(ref->release != NULL)
+		{
+			ref->release(ref->ctx);
+		}
+	}
+	else
+	{
+		queue->sent += queue->inflight;
+		queue->sendpos = uartRingAdvance(queue->sendpos, queue->inflight, queue->size);
+		queue->inflight = 0;
+	}
+	uartTxKick(queue);
+}
+
+
+/**
+ *	Looks up the transmit queue set up for target UART.
+ *
+ *	@param *huart, STM HAL library handle for target uart interface
+ *	@return pointer to the queue, NULL if uartTxInit() was never called
+ */
+uart_txqueue *uartTxFind(UART_HandleTypeDef *huart)
+{
+	for(int i = 0; i < MAX_UART_TXQUEUES; ++i)
+	{
+		if(txqueues[i] != NULL && txqueues[i]->huart == huart)
+		{
+			return txqueues[i];
+		}
+	}
+	return NULL;
+}
+
+
+/**
+ *	Reserves room for "len" bytes at the end of the transmit queue of target
+ *	UART, to be filled in place (e.g. by an encoder writing straight into the
+ *	buffer the DMA sends from) and published with uartTxCommit(). Nothing
+ *	is sent until then, and nothing else may be written in between.
+ *
+ *	@param *huart, STM HAL library handle for target uart interface
+ *	@param len, number of bytes to reserve
+ *	@param *span, set to the reserved room
+ *	@return UART_TX_OK, UART_TX_FULL if there was no room or the UART has
+ *			no transmit queue
+ */
+UART_TX_STAT uartTxReserve(UART_HandleTypeDef *huart, uint16_t len, uart_txspan *span)
+{
+	uart_txqueue *queue = uartTxFind(huart);
+	if(queue == NULL)
+	{
+		return UART_TX_FULL;
+	}
+
+	uint32_t used = queue->written - queue->sent;
+	if(used + len > queue->size)
+	{
+		++queue->rejected;
+		return UART_TX_FULL;
+	}
+
+	// The writer owns everything between "written" and "sent + size"
+	uint16_t idx = queue->writepos;
+	uint16_t first = queue->size - idx;
+	if(first > len)
+	{
+		first = len;
+	}
+	span->data[0] = &queue->data[idx];
+	span->len[0] = first;
+	span->data[1] = queue->data;
+	span->len[1] = len - first;
+	return UART_TX_OK;
+}
+
+
+/**
+ *	Publishes bytes written into room taken with uartTxReserve() and
+ *	starts sending them.
+ *
+ *	@param *huart, STM HAL library handle for target uart interface
+ *	@param len, number of bytes written, at most the reserved amount
+ */
+void uartTxCommit(UART_HandleTypeDef *huart, uint16_t len)
+{
+	uart_txqueue *queue = uartTxFind(huart);
+	if(queue == NULL)
+	{
+		return;
+	}
+
+	uint32_t primask = __get_PRIMASK();
+	__disable_irq();
+	queue->written += len;
+	queue->writepos = uartRingAdvance(queue->writepos, len, queue->size);
+	uint32_t used = queue->written - queue->sent;
+	if(used > queue->highwater)
+	{
+		queue->highwater = (uint16_t)used;
+	}
+	uartTxKick(queue);
+	__set_PRIMASK(primask);
+}
+
+
+/**
+ *	Queues data for transmission on target UART without blocking.
+ *	Data is either queued as a whole or not at all, so a frame is never
+ *	split by a full queue. UARTs without a transmit queue fall back to a
+ *	blocking transmit.
  *
+ *	@param *huart, STM HAL library handle for target uart interface
+ *	@param *data, data to send (copied, may be reused on return)
+ *	@param len, number of bytes
+ *	@return UART_TX_OK if queued, UART_TX_FULL if there was no room
  */
-void handleTerminalInput(buffer *inp)
+UART_TX_STAT uartTxWrite(UART_HandleTypeDef *huart, const uint8_t *data, uint16_t len)
 {
-	char last = inp->data[inp->datacnt-1];
+	if(uartTxFind(huart) == NULL)
+	{
+		return (HAL_UART_Transmit(huart, (uint8_t*)data, len, 50) == HAL_OK) ? UART_TX_OK : UART_TX_FULL;
+	}
 
-	// Backspace
-	if((last == 0x8) && (termCache->datacnt > 0))
+	uart_txspan span;
+	if(uartTxReserve(huart, len, &span) != UART_TX_OK)
 	{
-		char bkspace = 0x08;
-		uint8_t msg[5];
-		uint8_t len = sprintf((char*)msg,"%c %c", bkspace, bkspace);
-		HAL_UART_Transmit(hterm, msg, len, 50);
-		--termCache->datacnt;
+		return UART_TX_FULL;
 	}
-	// Leaving room for NULL char
-	else if((termCache->datacnt+inp->datacnt) <= (termCache->size-1))
+	memcpy(span.data[0], data, span.len[0]);
+	memcpy(span.data[1], &data[span.len[0]], span.len[1]);
+	uartTxCommit(huart, len);
+
+	return UART_TX_OK;
+}
+
+
+/**
+ *	Queues a buffer for transmission on target UART by reference, without
+ *	copying it. The buffer goes out after everything queued before it and
+ *	must stay untouched until "release" has been called, which may happen
+ *	from the transfer complete interrupt. UARTs without a transmit queue
+ *	fall back to a blocking transmit and release at once.
+ *
+ *	@param *huart, STM HAL library handle for target uart interface
+ *	@param *data, data to send (referenced, not copied)
+ *	@param len, number of bytes
+ *	@param release, called once the data is sent (may be NULL)
+ *	@param *ctx, passed on to release
+ *	@return UART_TX_OK if queued, UART_TX_FULL if all references are in use
+ */
+UART_TX_STAT uartTxWriteRef(UART_HandleTypeDef *huart, const uint8_t *data, uint16_t len,
+							uart_tx_release release, void *ctx)
+{
+	uart_txqueue *queue = uartTxFind(huart);
+	if(queue == NULL)
 	{
-		for (int i = 0; i < inp->datacnt; ++i)
+		UART_TX_STAT stat = uartTxWrite(huart, data, len);
+		if(release != NULL)
 		{
-			termCache->data[termCache->datacnt+i] = inp->data[0+i];
+			release(ctx);
 		}
-		termCache->datacnt += inp->datacnt;
-		HAL_UART_Transmit(hterm, inp->data, inp->datacnt, 50);
+		return stat;
 	}
 
+	if(len == 0)
+	{
+		if(release != NULL)
+		{
+			release(ctx);
+		}
+		return UART_TX_OK;
+	}
+	if((uint8_t)(queue->refput - queue->refget) >= UART_TXREFS)
+	{
+		++queue->rejected;
+		return UART_TX_FULL;
+	}
+
+	uart_txref *ref = &queue->ref[queue->refput % UART_TXREFS];
+	ref->data = data;
+	ref->len = len;
+	ref->release = release;
+	ref->ctx = ctx;
+
+	uint32_t primask = __get_PRIMASK();
+	__disable_irq();
+	ref->mark = queue->written;
+	++queue->refput;
+	uartTxKick(queue);
+	__set_PRIMASK(primask);
+
+	return UART_TX_OK;
+}
+
+
+/**
+ *	Free space in the transmit queue of target UART.
+ *
+ *	@param *huart, STM HAL library handle for target uart interface
+ *	@return number of bytes that can be queued right now
+ */
+uint16_t uartTxFree(UART_HandleTypeDef *huart)
+{
+	uart_txqueue *queue = uartTxFind(huart);
+	if(queue == NULL)
+	{
+		return 0;
+	}
+	return queue->size - (uint16_t)(queue->written - queue->sent);
+}
+
+
+/**
+ *	Waits until everything queued on target UART has been transmitted.
+ *	Only needed where timing on the line matters, e.g. before the guard
+ *	time following the command mode sequence.
+ *
+ *	@param *huart, STM HAL library handle for target uart interface
+ *	@param timeout, maximum time to wait in milliseconds
+ *	@return true if the queue was drained, false on timeout
+ */
+bool uartTxFlush(UART_HandleTypeDef *huart, uint32_t timeout)
+{
+	uart_txqueue *queue = uartTxFind(huart);
+	if(queue == NULL)
+	{
+		return true;
+	}
+
+	uint32_t start = HAL_GetTick();
+	while(queue->sent != queue->written || queue->refput != queue->refget)
+	{
+		if(queue->inflight == 0 && !queue->refbusy)
+		{
+			uint32_t primask = __get_PRIMASK();
+			__disable_irq();
+			uartTxKick(queue);
+			__set_PRIMASK(primask);
+		}
+		if((HAL_GetTick() - start) > timeout)
+		{
+			return false;
+		}
+		platformSleep();
+	}
+	return true;
+}
+
+
+/**
+ * 	Terminal line editor. Every received byte is handled, so a chunk may
+ * 	hold any number of keystrokes and complete command lines:
+ * 	- printable characters are added to the command and echoed
+ * 	- backspace (or DEL) erases the last character, Ctrl-U the whole line
+ * 	- CR, LF or CR LF ends the line and runs the command
+ * 	- escape sequences (arrow keys etc.) are ignored
+ * 	Echo is collected and queued once per chunk, nothing here blocks.
+ *
+ *	@param *term, terminal the input belongs to
+ *	@param *inp, received char(s) for terminal to handle
+ *
+ */
+void handleTerminalInput(terminal *term, buffer *inp)
+{
+	uint8_t echo[MAX_TERM_CMD_LEN];
+	uint16_t elen = 0;
 
-	// If last char is carriage return, proceed to process command.
-	if(last == 0xD)
+	for(uint16_t i = 0; i < inp->datacnt; ++i)
 	{
-		// Remove \r
-		termCache->data[termCache->datacnt-1] = 0x0;
-		--termCache->datacnt;
+		uint8_t c = inp->data[i];
+
+		switch(term->state)
+		{
+		case TERM_STATE_ESC:
+			// ESC [ starts a control sequence, anything else is a two byte sequence
+			term->state = (c == '[') ? TERM_STATE_CSI : TERM_STATE_NORMAL;
+			continue;
+		case TERM_STATE_CSI:
+			// Parameter bytes until the final byte (0x40..0x7E)
+			if(c >= 0x40 && c <= 0x7E)
+			{
+				term->state = TERM_STATE_NORMAL;
+			}
+			continue;
+		case TERM_STATE_CR:
+			term->state = TERM_STATE_NORMAL;
+			if(c == '\n')
+			{
+				// Second half of CR LF
+				continue;
+			}
+			break;
+		default:
+			break;
+		}
+
+		if(c == '\r' || c == '\n')
+		{
+			uartTxWrite(term->huart, echo, elen);
+			elen = 0;
+			term->state = (c == '\r') ? TERM_STATE_CR : TERM_STATE_NORMAL;
+			terminalProcessCommandBuffer(term);
+		}
+		else if(c == 0x08 || c == 0x7F)
+		{
+			if(term->cache->datacnt > 0)
+			{
+				--term->cache->datacnt;
+				if(elen > sizeof(echo) - 3)
+				{
+					uartTxWrite(term->huart, echo, elen);
+					elen = 0;
+				}
+				echo[elen++] = 0x08;
+				echo[elen++] = ' ';
+				echo[elen++] = 0x08;
+			}
+		}
+		else if(c == 0x15)
+		{
+			// Ctrl-U, erase the line
+			uartTxWrite(term->huart, echo, elen);
+			elen = 0;
+			while(term->cache->datacnt > 0)
+			{
+				uartTxWrite(term->huart, (const uint8_t*)"\b \b", 3);
+				--term->cache->datacnt;
+			}
+		}
+		else if(c == 0x1B)
+		{
+			term->state = TERM_STATE_ESC;
+		}
+		// Leaving room for NULL char
+		else if(c >= 0x20 && c < 0x7F && term->cache->datacnt < term->cache->size-1)
+		{
+			term->cache->data[term->cache->datacnt++] = c;
+			if(elen == sizeof(echo))
+			{
+				uartTxWrite(term->huart, echo, elen);
+				elen = 0;
+			}
+			echo[elen++] = c;
+		}
+	}
+
+	uartTxWrite(term->huart, echo, elen);
+}
 
-		terminalProcessCommandBuffer();
+
+/**
+ * 	Prints a NULL terminated string to the terminals uart. Waits for
+ * 	room in the transmit queue, so long output is not cut short.
+ */
+void terminalPrint(terminal *term, const char *str)
+{
+	uint16_t len = strlen(str);
+	if(uartTxWrite(term->huart, (const uint8_t*)str, len) == UART_TX_FULL && uartTxFlush(term->huart, 100))
+	{
+		uartTxWrite(term->huart, (const uint8_t*)str, len);
 	}
 }
 
@@ -182,13 +909,9 @@ void handleTerminalInput(buffer *inp)
  * 	Prints command sequence Newline+Carriage return
  * 	to the terminals uart.
  */
-void terminalPrintNlCr()
+void terminalPrintNlCr(terminal *term)
 {
-	uint8_t nl = '\n';
-	uint8_t cr = '\r';
-	uint8_t nlcr[2];
-	sprintf((char*)nlcr, "%c%c", nl, cr);
-	HAL_UART_Transmit(hterm, nlcr, 2, 10);
+	uartTxWrite(term->huart, (const uint8_t*)"\n\r", 2);
 }
 
 
@@ -196,11 +919,9 @@ void terminalPrintNlCr()
  * 	Prints command sequence "> "
  * 	to the terminals uart.
  */
-void terminalPrintRightArrow()
+void terminalPrintRightArrow(terminal *term)
 {
-	uint8_t arrow[2];
-	sprintf((char*)arrow, "> ");
-	HAL_UART_Transmit(hterm, arrow, 2, 10);
+	uartTxWrite(term->huart, (const uint8_t*)"> ", 2);
 }
 
 
@@ -208,36 +929,436 @@ void terminalPrintRightArrow()
  * 	Prints command sequence "> "
  * 	to the terminals uart.
  */
-void terminalPrintLeftArrow()
+void terminalPrintLeftArrow(terminal *term)
 {
-	uint8_t arrow[2];
-	sprintf((char*)arrow, "< ");
-	HAL_UART_Transmit(hterm, arrow, 2, 10);
+	uartTxWrite(term->huart, (const uint8_t*)"< ", 2);
 }
 
 
-void terminalProcessCommandBuffer()
+/**
+ *	Prints the response to an AT command typed in the terminal. Values of
+ *	known settings are decoded with the settings descriptor table, the
+ *	line being typed meanwhile is printed again after the response.
+ */
+static void terminalATResponse(xbee_module *xbee, xbee_node *node, const char *cmd,
+							   uint8_t status, const uint8_t *data, uint8_t len, void *ctx)
 {
-	// Echo command buffer contents
-	terminalPrintNlCr();
-	HAL_UART_Transmit(hterm, termCache->data, termCache->datacnt, 50);
-	terminalPrintNlCr();
+	static const char *const statustext[] = {"OK", "ERROR", "INVALID COMMAND", "INVALID PARAMETER", "TX FAILURE"};
+	terminal *term = ctx;
+	const xbee_setting_desc *desc = xbeeFindSetting(cmd);
+	char msg[48];
 
-	// Ensure NULL char at end
-	termCache->data[termCache->datacnt] = 0x0;
-	if(!strncmp((char *)termCache->data, "AT", 2 ))
+	(void)xbee;
+	terminalPrintNlCr(term);
+	terminalPrintLeftArrow(term);
+	if(node != NULL)
+	{
+		sprintf(msg, "%08lX%08lX ", (unsigned long)node->SH, (unsigned long)node->SL);
+		terminalPrint(term, msg);
+	}
+	sprintf(msg, "AT%s ", cmd);
+	terminalPrint(term, msg);
+
+	if(status != 0 || len == 0)
+	{
+		terminalPrint(term, (status < 5) ? statustext[status] : "TIMEOUT");
+	}
+	else if(desc != NULL && desc->width > 8)
+	{
+		// String setting (NI)
+		uartTxWrite(term->huart, data, len);
+	}
+	else if(len <= 4)
+	{
+		uint32_t value = 0;
+		for(uint8_t i = 0; i < len; ++i)
+		{
+			value = (value << 8) | data[i];
+		}
+		sprintf(msg, "%lX", (unsigned long)value);
+		terminalPrint(term, msg);
+	}
+	else
+	{
+		for(uint8_t i = 0; i < len; ++i)
+		{
+			sprintf(msg, "%02X", data[i]);
+			terminalPrint(term, msg);
+		}
+	}
+
+	terminalPrintNlCr(term);
+	terminalPrintRightArrow(term);
+	uartTxWrite(term->huart, term->cache->data, term->cache->datacnt);
+}
+
+
+/**
+ *	Checks that a string only holds hexadecimal digits.
+ */
+static bool terminalIsHex(const char *str, uint8_t len)
+{
+	for(uint8_t i = 0; i < len; ++i)
+	{
+		char c = str[i];
+		if(!((c >= '0' && c <= '9') || (c >= 'A' && c <= 'F') || (c >= 'a' && c <= 'f')))
+		{
+			return false;
+		}
+	}
+	return (len > 0);
+}
+
+
+/**
+ *	Converts a hexadecimal value of any length to bytes, most significant
+ *	first and right aligned in "width" bytes.
+ *
+ *	@retval false if the value does not fit
+ */
+static bool terminalParseHex(const char *str, uint8_t len, uint8_t *dst, uint8_t width)
+{
+	// Leading zeros do not count towards the width
+	while(len > 1 && *str == '0')
+	{
+		++str;
+		--len;
+	}
+	if(len > 2*width)
 	{
-		// Generate Xbee AT-CMD
-		terminalPrintLeftArrow();
-		uint8_t msg[20];
-		uint16_t len = sprintf((char *)msg, "TEMP RESPONSE");
-		HAL_UART_Transmit(hterm, msg, len, 50);
+		return false;
 	}
 
-	terminalPrintNlCr();
-	terminalPrintRightArrow();
-	termCache->datacnt = 0;
+	memset(dst, 0, width);
+	for(uint8_t i = 0; i < len; ++i)
+	{
+		char c = toupper((unsigned char)str[len-1-i]);
+		uint8_t digit = (c <= '9') ? c - '0' : c - 'A' + 10;
+		dst[width-1-i/2] |= digit << (4*(i%2));
+	}
+	return true;
 }
 
 
+/**
+ *	Sends an AT command typed in the terminal as an API frame and returns
+ *	at once, the response is printed when it arrives. The local module
+ *	stays in API mode, so live traffic is never held up by command mode.
+ *	Format: ATxx[value] [@address]
+ *	- value is hexadecimal for numeric settings of any width (up to 16
+ *	  bytes for KY), text for string settings
+ *	- address is a 64-bit (16 digits) or 16-bit (up to 4 digits) address
+ *	  in hexadecimal, the 16-bit one must be known in the node registry
+ *
+ *	@param *term, terminal the command was typed in
+ *	@param *line, NULL terminated command line
+ */
+static void terminalATCommand(terminal *term, char *line)
+{
+	uint8_t param[XBEE_RAT_MAX_PARAM];
+	uint8_t plen = 0;
+	char cmd[3] = {0, 0, 0};
+	char *addr = strchr(line, '@');
+	XBEE_STAT stat;
+
+	if(strlen(line) < 4)
+	{
+		terminalPrint(term, "USAGE: ATxx[value] [@address]");
+		return;
+	}
+	cmd[0] = toupper((unsigned char)line[2]);
+	cmd[1] = toupper((unsigned char)line[3]);
 
+	// Value, without surrounding spaces. An address marker inside the
+	// command name ("AT@1234", "ATC@12") leaves no room for a command.
+	char *value = &line[4];
+	char *end = (addr != NULL) ? addr : &line[strlen(line)];
+	if(end < value)
+	{
+		terminalPrint(term, "USAGE: ATxx[value] [@address]");
+		return;
+	}
+	while(*value == ' ' && value < end)
+	{
+		++value;
+	}
+	while(end > value && end[-1] == ' ')
+	{
+		--end;
+	}
+	uint8_t vlen = end - value;
+
+	const xbee_setting_desc *desc = xbeeFindSetting(cmd);
+	if(vlen > 0)
+	{
+		// Known settings are sent with their own width, others (KY) with as
+		// few bytes as the value needs
+		uint8_t width = (desc != NULL) ? desc->width : (vlen+1)/2;
+		if((desc == NULL || desc->width <= 8) && terminalIsHex(value, vlen))
+		{
+			if(width > XBEE_RAT_MAX_PARAM || !terminalParseHex(value, vlen, param, width))
+			{
+				terminalPrint(term, "VALUE TOO LONG");
+				return;
+			}
+			plen = width;
+		}
+		else if(vlen <= XBEE_RAT_MAX_PARAM)
+		{
+			memcpy(param, value, vlen);
+			plen = vlen;
+		}
+		else
+		{
+			terminalPrint(term, "VALUE TOO LONG");
+			return;
+		}
+	}
+
+	if(addr == NULL)
+	{
+		stat = xbeeLocalAT(term->xbee, cmd, param, plen, terminalATResponse, term);
+	}
+	else
+	{
+		++addr;
+		uint8_t alen = strlen(addr);
+		uint32_t sh = 0, sl = 0;
+		if(alen > 4 && alen <= 16 && terminalIsHex(addr, alen))
+		{
+			sl = strtoul(&addr[(alen > 8) ? alen-8 : 0], NULL, 16);
+			if(alen > 8)
+			{
+				addr[alen-8] = 0x0;
+				sh = strtoul(addr, NULL, 16);
+			}
+		}
+		else if(terminalIsHex(addr, alen))
+		{
+			xbee_node *node = xbeeNodeFind16(&term->xbee->radio->nodes, (uint16_t)strtoul(addr, NULL, 16));
+			if(node == NULL)
+			{
+				terminalPrint(term, "UNKNOWN NODE");
+				return;
+			}
+			sh = node->SH;
+			sl = node->SL;
+		}
+		else
+		{
+			terminalPrint(term, "INVALID ADDRESS");
+			return;
+		}
+		stat = xbeeRemoteAT(term->xbee, sh, sl, cmd, param, plen, (plen > 0) ? XBEE_RATOPT_APPLY : 0,
+							terminalATResponse, term);
+	}
+
+	if(stat != XBEE_MSG_OK)
+	{
+		terminalPrint(term, "BUSY");
+		return;
+	}
+	xbeeRemoteATService(term->xbee);
+}
+
+
+// Binary statistics on their way out, the transmit queue sends them from
+// here (they are larger than the queue) until terminalStatsSent()
+static uint8_t termStatsDump[XBEE_STATS_DUMP_SIZE];
+static volatile bool termStatsBusy;
+
+
+/**
+ *	Release callback of the binary statistics, the buffer is free again.
+ */
+static void terminalStatsSent(void *ctx)
+{
+	(void)ctx;
+	termStatsBusy = false;
+}
+
+
+/**
+ *	stats [bin], prints the statistics of the local module, or writes
+ *	them in binary form.
+ */
+static void terminalCmdStats(terminal *term, int argc, char **argv)
+{
+	if(argc > 1 && !strcmp(argv[1], "bin"))
+	{
+		if(termStatsBusy)
+		{
+			terminalPrint(term, "busy");
+			return;
+		}
+		uint16_t len = xbeeStatsDump(term->xbee, termStatsDump, sizeof(termStatsDump));
+		termStatsBusy = true;
+		if(uartTxWriteRef(term->huart, termStatsDump, len, terminalStatsSent, NULL) != UART_TX_OK)
+		{
+			termStatsBusy = false;
+		}
+	}
+	else
+	{
+		xbeeStatsPrint(term->xbee, term);
+	}
+}
+
+
+#if XBEE_ENABLE_BENCH
+/**
+ *	bench, runs the driver benchmarks.
+ */
+static void terminalCmdBench(terminal *term, int argc, char **argv)
+{
+	(void)argc;
+	(void)argv;
+	benchRun(term);
+}
+#endif
+
+
+/**
+ *	power, shows how the waiting time has been spent.
+ */
+static void terminalCmdPower(terminal *term, int argc, char **argv)
+{
+	char msg[128];
+	uint32_t uptime = HAL_GetTick();
+
+	(void)argc;
+	(void)argv;
+
+	snprintf(msg, sizeof(msg), "up %lu ms asleep %lu ms (%lu%%) wakeups %lu tickless %lu ms timers %lu",
+			(unsigned long)uptime, (unsigned long)(platformTimerStats.sleepus / 1000),
+			(unsigned long)((uptime > 0) ? platformTimerStats.sleepus / 10 / uptime : 0),
+			(unsigned long)platformTimerStats.wakeups, (unsigned long)platformTimerStats.ticklessms,
+			(unsigned long)platformTimerStats.expired);
+	terminalPrint(term, msg);
+}
+
+
+#if XBEE_ENABLE_PROFILE
+/**
+ *	profile [clear], shows the stored link profile, or forgets it so the
+ *	next bring-up syncs from scratch.
+ */
+static void terminalCmdProfile(terminal *term, int argc, char **argv)
+{
+	char msg[128];
+	xbee_profile profile;
+
+	if(argc > 1 && !strcmp(argv[1], "clear"))
+	{
+		xbeeProfileErase();
+	}
+	if(!xbeeProfileLoad(&profile, term->xbee->hxbee))
+	{
+		terminalPrint(term, "no profile");
+		return;
+	}
+	snprintf(msg, sizeof(msg), "baud %lu GT %u AP %u slots %u of %u last init %s %lu ms",
+			(unsigned long)profile.baud, (unsigned)profile.settings.GT, (unsigned)profile.settings.AP,
+			(unsigned)xbeeProfileUsed(), (unsigned)XBEE_PROFILE_SLOTS,
+			term->xbee->init.warm ? "warm" : "cold", (unsigned long)term->xbee->init.elapsed);
+	terminalPrint(term, msg);
+}
+#endif
+
+
+static void terminalCmdHelp(terminal *term, int argc, char **argv);
+
+// Terminal commands, must be kept sorted by name (looked up with bsearch)
+static const term_command termCommands[] = {
+#if XBEE_ENABLE_BENCH
+	{"bench", terminalCmdBench, "run driver benchmarks"},
+#endif
+	{"help", terminalCmdHelp, "list commands"},
+	{"power", terminalCmdPower, "show sleep and wake up counters"},
+#if XBEE_ENABLE_PROFILE
+	{"profile", terminalCmdProfile, "[clear] show the stored link profile"},
+#endif
+	{"stats", terminalCmdStats, "[bin] show module statistics"},
+};
+
+#define TERM_COMMAND_COUNT (sizeof(termCommands)/sizeof(termCommands[0]))
+
+
+/**
+ *	help, lists the commands.
+ */
+static void terminalCmdHelp(terminal *term, int argc, char **argv)
+{
+	char msg[60];
+
+	(void)argc;
+	(void)argv;
+
+	terminalPrint(term, "ATxx[value] [@address] send AT command");
+	for(uint8_t i = 0; i < TERM_COMMAND_COUNT; ++i)
+	{
+		sprintf(msg, "\r\n%-10s %s", termCommands[i].name, termCommands[i].help);
+		terminalPrint(term, msg);
+	}
+}
+
+
+/**
+ *	bsearch() comparison of a command name with a table entry.
+ */
+static int terminalCompareCommand(const void *key, const void *entry)
+{
+	return strcmp((const char *)key, ((const term_command *)entry)->name);
+}
+
+
+/**
+ *	Runs the command line held in the terminal buffer. Lines starting
+ *	with "AT" are passed to the radio as they are, everything else is
+ *	split on spaces and looked up in the command table.
+ */
+void terminalProcessCommandBuffer(terminal *term)
+{
+	char *argv[TERM_MAX_ARGS];
+	int argc = 0;
+
+	terminalPrintNlCr(term);
+
+	// Ensure NULL char at end
+	term->cache->data[term->cache->datacnt] = 0x0;
+	char *line = (char *)term->cache->data;
+
+	if(!strncmp(line, "AT", 2))
+	{
+		// Generate Xbee AT-CMD, the response is printed when it arrives
+		terminalATCommand(term, line);
+		terminalPrintNlCr(term);
+	}
+	else
+	{
+		char *tok = strtok(line, " ");
+		while(tok != NULL && argc < TERM_MAX_ARGS)
+		{
+			argv[argc++] = tok;
+			tok = strtok(NULL, " ");
+		}
+
+		if(argc > 0)
+		{
+			const term_command *cmd = bsearch(argv[0], termCommands, TERM_COMMAND_COUNT,
+											  sizeof(term_command), terminalCompareCommand);
+			if(cmd != NULL)
+			{
+				cmd->handler(term, argc, argv);
+			}
+			else
+			{
+				terminalPrint(term, "UNKNOWN COMMAND, TYPE help");
+			}
+			terminalPrintNlCr(term);
+		}
+	}
+
+	terminalPrintRightArrow(term);
+	term->cache->datacnt = 0;
+}
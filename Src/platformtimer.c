@@ -0,0 +1,324 @@
+/*
+Copyright 2018 Jesper Wlivaara
+
+Permission is hereby granted, free of charge, to any person obtaining
+a copy of this software and associated documentation files (the "Software"),
+to deal in the Software without restriction, including without limitation the
+rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is furnished to
+do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all copies
+or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR
+PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE
+FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+
+#include "platformtimer.h"
+
+platform_timer_stats platformTimerStats;
+
+// Running timers, soonest first
+static platform_timer *timerList;
+static bool timerStarted;
+
+
+/**
+ * Sets TIM2 up as a free running 1 MHz counter with its compare
+ * interrupt enabled. NOTE: Requires TIM2 to be enabled in HAL Drivers
+ * with its clock source set to internal, and TIM2_IRQHandler to call
+ * platformTimerISR().
+ */
+void platformTimerInit()
+{
+#ifdef TIM2
+	TIM2->CR1 = 0;
+	TIM2->PSC = SystemCoreClock / 1000000 - 1;
+	TIM2->ARR = 0xFFFFFFFF;
+	TIM2->CNT = 0;
+	TIM2->EGR = TIM_EGR_UG;		// Load the prescaler
+	TIM2->SR = 0;
+	TIM2->DIER = 0;
+	TIM2->CR1 = TIM_CR1_CEN;
+	HAL_NVIC_SetPriority(TIM2_IRQn, 0, 0);
+	HAL_NVIC_EnableIRQ(TIM2_IRQn);
+#endif
+	// Timers started on the HAL tick count in another time base, stop them
+	for(platform_timer *timer = timerList; timer != NULL; timer = timer->next)
+	{
+		timer->active = false;
+	}
+	timerList = NULL;
+	timerStarted = true;
+}
+
+
+/**
+ * Current timer count in microseconds, wraps every 2^32 us (71 minutes).
+ * Before platformTimerInit() it follows the HAL tick, 1 ms at a time.
+ * Weak so that other platforms (or a virtual clock) can provide their own.
+ */
+__weak uint32_t platformTimeUs()
+{
+#ifdef TIM2
+	if(timerStarted)
+	{
+		return TIM2->CNT;
+	}
+#endif
+	return HAL_GetTick() * 1000;
+}
+
+
+/**
+ * Sets the compare interrupt for the soonest timer, or disables it when
+ * no timer is running. Must be called with interrupts disabled.
+ */
+static void platformTimerArm()
+{
+#ifdef TIM2
+	if(!timerStarted)
+	{
+		return;
+	}
+	if(timerList == NULL)
+	{
+		TIM2->DIER &= ~TIM_DIER_CC1IE;
+		return;
+	}
+	TIM2->CCR1 = timerList->deadline;
+	TIM2->SR = ~TIM_SR_CC1IF;
+	TIM2->DIER |= TIM_DIER_CC1IE;
+	if((int32_t)(timerList->deadline - platformTimeUs()) <= 0)
+	{
+		// Already due, the compare match may have been missed
+		TIM2->EGR = TIM_EGR_CC1G;
+	}
+#endif
+}
+
+
+/**
+ * Takes a timer out of the running list. Must be called with interrupts disabled.
+ */
+static void platformTimerUnlink(platform_timer *timer)
+{
+	platform_timer **pp = &timerList;
+	while(*pp != NULL)
+	{
+		if(*pp == timer)
+		{
+			*pp = timer->next;
+			break;
+		}
+		pp = &(*pp)->next;
+	}
+	timer->active = false;
+}
+
+
+/**
+ * Runs out every timer that is due. Must be called with interrupts disabled.
+ */
+static void platformTimerExpire()
+{
+	uint32_t now = platformTimeUs();
+	while(timerList != NULL && (int32_t)(timerList->deadline - now) <= 0)
+	{
+		platform_timer *timer = timerList;
+		timerList = timer->next;
+		timer->active = false;
+		++platformTimerStats.expired;
+		if(timer->cb != NULL)
+		{
+			timer->cb(timer->ctx);
+		}
+		now = platformTimeUs();
+	}
+}
+
+
+/**
+ * Compare interrupt handler. Runs out every timer that is due and sets
+ * the compare for the next one.
+ */
+void platformTimerISR()
+{
+#ifdef TIM2
+	TIM2->SR = ~TIM_SR_CC1IF;
+#endif
+	platformTimerExpire();
+	platformTimerArm();
+}
+
+
+/**
+ * Starts (or restarts) a software timer. The timer struct must stay
+ * valid until the timer has run out or been stopped, and must be zeroed
+ * (or stopped) before it is started the first time.
+ *
+ * @param *timer, timer to start
+ * @param us, time until it runs out in microseconds
+ * @param cb, called from the timer interrupt when it runs out (may be NULL)
+ * @param *ctx, passed on to cb
+ */
+void platformTimerStart(platform_timer *timer, uint32_t us, platform_timer_cb cb, void *ctx)
+{
+	uint32_t primask = __get_PRIMASK();
+	__disable_irq();
+
+	if(timer->active)
+	{
+		platformTimerUnlink(timer);
+	}
+	uint32_t now = platformTimeUs();
+	timer->deadline = now + us;
+	timer->cb = cb;
+	timer->ctx = ctx;
+	timer->active = true;
+
+	// Keep the list sorted by time left
+	platform_timer **pp = &timerList;
+	while(*pp != NULL && ((*pp)->deadline - now) <= us)
+	{
+		pp = &(*pp)->next;
+	}
+	timer->next = *pp;
+	*pp = timer;
+	if(timerList == timer)
+	{
+		platformTimerArm();
+	}
+
+	__set_PRIMASK(primask);
+}
+
+
+/**
+ * Stops a software timer, nothing happens if it is not running.
+ *
+ * @param *timer, timer to stop
+ */
+void platformTimerStop(platform_timer *timer)
+{
+	uint32_t primask = __get_PRIMASK();
+	__disable_irq();
+	if(timer->active)
+	{
+		bool first = (timerList == timer);
+		platformTimerUnlink(timer);
+		if(first)
+		{
+			platformTimerArm();
+		}
+	}
+	__set_PRIMASK(primask);
+}
+
+
+/**
+ * Sleeps until the next interrupt. Used by every wait, so the time spent
+ * asleep and the number of wake ups tell how the waiting was spent.
+ * Before platformTimerInit() the SysTick interrupt wakes it every
+ * millisecond, and the timers are run out here instead of in the ISR.
+ *
+ * @param tickless, also stop the SysTick interrupt if the soonest timer
+ *		  is at least PLATFORM_TICKLESS_MIN_US away, the HAL tick count
+ *		  is caught up with the milliseconds that went by afterwards
+ */
+static void platformSleepMode(bool tickless)
+{
+	uint32_t start = platformTimeUs();
+	tickless = (tickless && timerStarted && timerList != NULL &&
+				(int32_t)(timerList->deadline - start) >= PLATFORM_TICKLESS_MIN_US);
+	if(tickless)
+	{
+		HAL_SuspendTick();
+	}
+
+	__WFI();
+	uint32_t slept = platformTimeUs() - start;
+	++platformTimerStats.wakeups;
+	platformTimerStats.sleepus += slept;
+
+	if(tickless)
+	{
+		// Millisecond boundaries passed while the tick was stopped
+		uint32_t ms = (start % 1000 + slept) / 1000;
+		for(uint32_t i = 0; i < ms; ++i)
+		{
+			HAL_IncTick();
+		}
+		platformTimerStats.ticklessms += ms;
+		HAL_ResumeTick();
+	}
+
+	if(!timerStarted)
+	{
+		uint32_t primask = __get_PRIMASK();
+		__disable_irq();
+		platformTimerExpire();
+		__set_PRIMASK(primask);
+	}
+}
+
+
+/**
+ * Sleeps until the next interrupt, for the main loop. SysTick keeps
+ * running, so code that polls HAL_GetTick() is still woken every
+ * millisecond.
+ * Weak so that other platforms (or a virtual clock) can provide their own.
+ */
+__weak void platformSleep()
+{
+	platformSleepMode(false);
+}
+
+
+/**
+ * Sleeps until the next interrupt, for waits that block the caller until
+ * a timer runs out or data arrives (delays, guard times, reply timeouts).
+ * Nothing else runs that could poll the HAL tick, so SysTick is stopped
+ * as well while the soonest timer is far enough away.
+ * Weak so that other platforms (or a virtual clock) can provide their own.
+ */
+__weak void platformSleepTickless()
+{
+	platformSleepMode(true);
+}
+
+
+/**
+ * Sleeps for 'udelay' microseconds. Before platformTimerInit() it falls
+ * back to HAL_Delay().
+ * Weak so that other platforms can provide their own.
+ */
+__weak void platformDelayUs(uint32_t udelay)
+{
+	platform_timer timer = {0};
+
+	if(!timerStarted)
+	{
+		HAL_Delay((udelay + 999) / 1000);
+		return;
+	}
+
+	platformTimerStart(&timer, udelay, NULL, NULL);
+	while(timer.active)
+	{
+		platformSleepTickless();
+	}
+}
+
+
+/**
+ * Sleeps for 'mdelay' milliseconds, see platformDelayUs().
+ */
+void platformDelayMs(uint32_t mdelay)
+{
+	platformDelayUs(mdelay * 1000);
+}
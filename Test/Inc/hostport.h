@@ -0,0 +1,212 @@
+/*
+Copyright 2018 Jesper Wlivaara
+
+Permission is hereby granted, free of charge, to any person obtaining
+a copy of this software and associated documentation files (the "Software"),
+to deal in the Software without restriction, including without limitation the
+rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is furnished to
+do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all copies
+or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR
+PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE
+FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+
+#ifndef TEST_INC_HOSTPORT_H_
+#define TEST_INC_HOSTPORT_H_
+
+/*
+ * HAL shim of the host build, selected with
+ * -DXBEE_PORT_HEADER=\"hostport.h\" (see xbeeport.h).
+ *
+ * It provides every name the driver takes from the STM32 HAL and CMSIS,
+ * backed by the fake peripherals in hosthal.c: UARTs with DMA that move
+ * bytes at their baud rate, TIM2 as a 1 MHz counter with a compare
+ * interrupt, and a SysTick millisecond count. All of them run on the
+ * virtual clock of xbeesim.h, __WFI() jumps straight to the next
+ * interrupt, so a 1 s guard time costs no wall clock time.
+ */
+
+#include "stdint.h"
+#include "stdbool.h"
+#include "stddef.h"
+#include "stdio.h"
+#include "string.h"
+
+// +++ CMSIS core +++
+
+#define __weak __attribute__((weak))
+
+// Count leading zeros, the argument is never 0 where the driver uses it
+#define __CLZ(x) ((uint8_t)__builtin_clz(x))
+
+// Interrupts only run while the core sleeps or waits in the HAL, so
+// masking them is bookkeeping only
+extern uint32_t simPrimask;
+
+static inline uint32_t __get_PRIMASK(void)
+{
+	return simPrimask;
+}
+
+static inline void __set_PRIMASK(uint32_t primask)
+{
+	simPrimask = primask;
+}
+
+static inline void __disable_irq(void)
+{
+	simPrimask = 1;
+}
+
+static inline void __enable_irq(void)
+{
+	simPrimask = 0;
+}
+
+// Sleeps until the next interrupt of the virtual clock
+void simWaitForInterrupt(void);
+#define __WFI() simWaitForInterrupt()
+
+// Core clock of the STM32F303K8 running from the PLL
+extern uint32_t SystemCoreClock;
+
+// There is no DWT on the host, platformCycles() counts SystemCoreClock
+// cycles of the virtual clock instead (see hosthal.c)
+
+typedef enum {
+	USART1_IRQn = 37,
+	USART2_IRQn = 38,
+	TIM2_IRQn = 28
+} IRQn_Type;
+
+void HAL_NVIC_SetPriority(IRQn_Type irq, uint32_t preempt, uint32_t sub);
+void HAL_NVIC_EnableIRQ(IRQn_Type irq);
+void HAL_NVIC_DisableIRQ(IRQn_Type irq);
+
+// +++ HAL base +++
+
+typedef enum {
+	HAL_OK = 0x0,
+	HAL_ERROR = 0x1,
+	HAL_BUSY = 0x2,
+	HAL_TIMEOUT = 0x3
+} HAL_StatusTypeDef;
+
+#define HAL_MAX_DELAY 0xFFFFFFFFU
+
+uint32_t HAL_GetTick(void);
+void HAL_Delay(uint32_t delay);
+void HAL_IncTick(void);
+void HAL_SuspendTick(void);
+void HAL_ResumeTick(void);
+
+// +++ TIM2 +++
+
+typedef struct {
+	volatile uint32_t CR1;
+	volatile uint32_t DIER;
+	volatile uint32_t SR;
+	volatile uint32_t EGR;
+	volatile uint32_t CNT;
+	volatile uint32_t PSC;
+	volatile uint32_t ARR;
+	volatile uint32_t CCR1;
+} TIM_TypeDef;
+
+extern TIM_TypeDef simTIM2;
+#define TIM2 (&simTIM2)
+
+#define TIM_CR1_CEN		0x0001
+#define TIM_DIER_CC1IE	0x0002
+#define TIM_SR_CC1IF	0x0002
+#define TIM_EGR_UG		0x0001
+#define TIM_EGR_CC1G	0x0002
+
+// +++ DMA +++
+
+typedef struct {
+	volatile uint32_t CCR;
+	volatile uint32_t CNDTR;		// Transfers left, reloaded in circular mode
+} DMA_Channel_TypeDef;
+
+#define DMA_NORMAL		0x00000000U
+#define DMA_CIRCULAR	0x00000020U
+
+typedef struct {
+	uint32_t Mode;					// DMA_NORMAL or DMA_CIRCULAR
+} DMA_InitTypeDef;
+
+typedef struct __DMA_HandleTypeDef {
+	DMA_Channel_TypeDef *Instance;
+	DMA_InitTypeDef Init;
+} DMA_HandleTypeDef;
+
+#define __HAL_DMA_GET_COUNTER(__HANDLE__) ((__HANDLE__)->Instance->CNDTR)
+
+HAL_StatusTypeDef HAL_DMA_Init(DMA_HandleTypeDef *hdma);
+
+// +++ UART +++
+
+typedef struct {
+	volatile uint32_t CR1;
+	volatile uint32_t ISR;
+} USART_TypeDef;
+
+#define UART_FLAG_IDLE	0x00000010U
+#define UART_IT_IDLE	0x00000010U
+
+typedef struct {
+	uint32_t BaudRate;
+} UART_InitTypeDef;
+
+struct sim_uart;
+
+typedef struct __UART_HandleTypeDef {
+	USART_TypeDef *Instance;
+	UART_InitTypeDef Init;
+	DMA_HandleTypeDef *hdmatx;		// NULL: transmit with the TX interrupt
+	DMA_HandleTypeDef *hdmarx;
+	struct sim_uart *sim;			// Wire the UART is connected to (xbeesim.h)
+} UART_HandleTypeDef;
+
+#define __HAL_UART_GET_FLAG(__HANDLE__, __FLAG__) (((__HANDLE__)->Instance->ISR & (__FLAG__)) == (__FLAG__))
+#define __HAL_UART_CLEAR_IDLEFLAG(__HANDLE__) ((__HANDLE__)->Instance->ISR &= ~UART_FLAG_IDLE)
+#define __HAL_UART_ENABLE_IT(__HANDLE__, __IT__) ((__HANDLE__)->Instance->CR1 |= (__IT__))
+#define __HAL_UART_DISABLE_IT(__HANDLE__, __IT__) ((__HANDLE__)->Instance->CR1 &= ~(__IT__))
+
+HAL_StatusTypeDef HAL_UART_Init(UART_HandleTypeDef *huart);
+HAL_StatusTypeDef HAL_UART_Abort(UART_HandleTypeDef *huart);
+HAL_StatusTypeDef HAL_UART_Transmit(UART_HandleTypeDef *huart, uint8_t *data, uint16_t size, uint32_t timeout);
+HAL_StatusTypeDef HAL_UART_Transmit_DMA(UART_HandleTypeDef *huart, uint8_t *data, uint16_t size);
+HAL_StatusTypeDef HAL_UART_Transmit_IT(UART_HandleTypeDef *huart, uint8_t *data, uint16_t size);
+HAL_StatusTypeDef HAL_UART_Receive_DMA(UART_HandleTypeDef *huart, uint8_t *data, uint16_t size);
+void HAL_UART_TxCpltCallback(UART_HandleTypeDef *huart);
+void HAL_UART_RxHalfCpltCallback(UART_HandleTypeDef *huart);
+void HAL_UART_RxCpltCallback(UART_HandleTypeDef *huart);
+
+// +++ Flash +++
+// The host build keeps the link profile in RAM (XBEE_PROFILE_RAM), these
+// only exist so that the flash variant compiles, and always fail.
+
+#define FLASH_TYPEERASE_PAGES		0x00U
+#define FLASH_TYPEPROGRAM_HALFWORD	0x01U
+
+typedef struct {
+	uint32_t TypeErase;
+	uint32_t PageAddress;
+	uint32_t NbPages;
+} FLASH_EraseInitTypeDef;
+
+HAL_StatusTypeDef HAL_FLASH_Unlock(void);
+HAL_StatusTypeDef HAL_FLASH_Lock(void);
+HAL_StatusTypeDef HAL_FLASH_Program(uint32_t type, uint32_t address, uint64_t data);
+HAL_StatusTypeDef HAL_FLASHEx_Erase(FLASH_EraseInitTypeDef *erase, uint32_t *error);
+
+#endif /* TEST_INC_HOSTPORT_H_ */
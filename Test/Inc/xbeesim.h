@@ -0,0 +1,287 @@
+/*
+Copyright 2018 Jesper Wlivaara
+
+Permission is hereby granted, free of charge, to any person obtaining
+a copy of this software and associated documentation files (the "Software"),
+to deal in the Software without restriction, including without limitation the
+rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is furnished to
+do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all copies
+or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR
+PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE
+FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+
+#ifndef TEST_INC_XBEESIM_H_
+#define TEST_INC_XBEESIM_H_
+
+#include "xbeelib.h"
+
+/*
+ * Host simulation of the hardware around the driver:
+ * - a virtual clock (microseconds) with an event queue, which the fake
+ *   peripherals of hosthal.c and the radio model run on
+ * - UART wires that move bytes at the baud rate of each end, a byte sent
+ *   at another rate than the receiver uses arrives garbled or not at all
+ * - a behavioural model of the XBee S2C (802.15.4 firmware): the command
+ *   sequence with its guard times, AT command mode, API frames (AP = 1
+ *   and 2), the interface rate, pin and cyclic sleep, and RF traffic
+ *   between the radios on a simulated channel
+ */
+
+/*
+ * GENERAL SETTINGS
+ * MODIFY TO FIT YOUR APPLICATION
+ */
+
+// Events that can be pending at once
+#define SIM_EVENTS 4096
+
+// Bytes a transmitter (radio or test) can have waiting
+#define SIM_SERIAL_QUEUE 4096
+
+// RF requests a radio holds while it is busy on the air
+#define SIM_RADIO_TXQ 8
+
+// Radios on one channel
+#define SIM_AIR_RADIOS 8
+
+// Longest API frame data the radio model takes
+#define SIM_API_MAX 256
+
+// UART buffers of a test bench node
+#define SIM_NODE_RX 256
+#define SIM_NODE_TX 1024
+
+// +++ Virtual clock +++
+
+typedef void (*sim_event_fn)(void *ctx, uint32_t arg);
+
+extern uint64_t simNow;		// Virtual time (us)
+extern bool simHostCycles;	// platformCycles() counts host time, for benchmarks
+
+void simReset(void);
+void simSchedule(uint64_t at, sim_event_fn fn, void *ctx, uint32_t arg);
+void simAdvance(uint64_t until);
+void simRunFor(uint32_t us);
+uint32_t simRandom(void);
+void simSeed(uint32_t seed);
+
+// +++ UART wires +++
+
+// Called with every byte that arrives at one end of a wire, sent at "baud"
+typedef void (*sim_rx_fn)(void *ctx, uint8_t byte, uint32_t baud);
+
+/*
+ * The MCU side of a wire: the peripheral registers and DMA channels
+ * behind a UART_HandleTypeDef, and the far end its bytes go to.
+ */
+typedef struct sim_uart {
+	UART_HandleTypeDef *huart;
+	USART_TypeDef regs;
+	DMA_Channel_TypeDef rxch;
+	DMA_Channel_TypeDef txch;
+	DMA_HandleTypeDef hdmarx;
+	DMA_HandleTypeDef hdmatx;
+	sim_rx_fn peer;			// Far end, NULL if nothing is connected
+	void *peerctx;
+	// Transmitter
+	const uint8_t *txdata;	// Read one byte at a time, like the DMA does
+	uint16_t txlen;
+	uint16_t txpos;
+	bool txbusy;
+	uint32_t txgen;			// Bumped by an abort, stale byte events are ignored
+	// Receiver
+	uint8_t *rxbuf;
+	uint16_t rxsize;
+	uint16_t rxpos;
+	bool rxrun;
+	bool rxcircular;
+	bool rxidle;			// A byte arrived since the last IDLE
+	uint32_t rxgen;
+	uint64_t rxlast;
+	uint32_t rxbytes;		// Bytes stored by the DMA
+	uint32_t rxlost;		// Bytes that arrived while reception was stopped
+	uint32_t rxgarbled;		// Bytes lost to a framing error (baud mismatch)
+	uint32_t txbytes;
+} sim_uart;
+
+/*
+ * A transmitter that is not an MCU UART (the radio, or a test sending
+ * bursts), sending its queue one byte time after the other.
+ */
+typedef struct {
+	sim_rx_fn dst;
+	void *dstctx;
+	uint8_t data[SIM_SERIAL_QUEUE];
+	uint32_t baud[SIM_SERIAL_QUEUE];	// Rate each byte is sent at
+	uint32_t put;
+	uint32_t get;
+	bool busy;
+	uint32_t gen;
+	uint32_t dropped;		// Bytes that did not fit the queue
+} sim_serial;
+
+void simUartInit(sim_uart *uart, UART_HandleTypeDef *huart, uint32_t baud, bool txdma);
+void simUartConnect(sim_uart *uart, sim_rx_fn peer, void *peerctx);
+void simUartReceive(void *ctx, uint8_t byte, uint32_t baud);
+uint32_t simByteTime(uint32_t baud);
+bool simLineDecode(uint8_t byte, uint32_t txbaud, uint32_t rxbaud, uint8_t *out);
+void simSerialInit(sim_serial *ser, sim_rx_fn dst, void *dstctx);
+void simSerialWrite(sim_serial *ser, const uint8_t *data, uint16_t len, uint32_t baud);
+void simSerialFlush(sim_serial *ser);
+uint32_t simSerialPending(sim_serial *ser);
+
+// Interrupt handlers of the application, weak defaults in hosthal.c
+// forward them to the driver like the sample stm32f3xx_it.c does
+void simUsartIRQHandler(UART_HandleTypeDef *huart);
+void TIM2_IRQHandler(void);
+
+// +++ Radio model +++
+
+typedef enum {
+	SIM_SLEEP_AWAKE = 0x0,
+	SIM_SLEEP_PIN = 0x1,		// Asleep because SLEEP_RQ is asserted (SM = 1 or 2)
+	SIM_SLEEP_CYCLIC = 0x2		// Asleep for SP (SM = 4 or 5)
+} SIM_SLEEP;
+
+struct sim_air;
+
+// One RF request waiting for the air
+typedef struct {
+	uint8_t frameid;
+	uint8_t options;
+	bool addr64;			// Sent to dst64, otherwise to dst16
+	uint64_t dst64;
+	uint16_t dst16;
+	uint8_t len;
+	uint8_t data[XBEE_MAX_PAYLOAD];
+} sim_rf_request;
+
+typedef struct sim_radio {
+	const char *name;
+	struct sim_air *air;
+	sim_uart *uart;			// MCU UART the radio is wired to
+	sim_serial out;			// Radio to MCU
+	// Settings, as written (value) and as saved with WR (saved)
+	uint64_t value[XBEE_SETTING_COUNT];
+	uint64_t saved[XBEE_SETTING_COUNT];
+	char ni[21];
+	char savedni[21];
+	uint32_t sh;
+	uint32_t sl;
+	// Settings in effect (applied with AC, CN or on reset)
+	uint32_t baud;
+	uint8_t ap;
+	uint16_t gt;
+	uint8_t cc;
+	uint16_t ct;
+	uint8_t sm;
+	// Command sequence and command mode
+	uint8_t plus;			// Command characters received in a row
+	uint64_t lastrx;		// Time the last byte came in from the MCU
+	uint32_t guardgen;
+	bool cmdmode;
+	uint32_t ctgen;
+	char line[80];
+	uint8_t linelen;
+	bool overlong;
+	// API frame receiver
+	uint8_t apistate;
+	bool apiesc;
+	uint16_t apilen;
+	uint16_t apicnt;
+	uint8_t apisum;
+	uint8_t apibuf[SIM_API_MAX];
+	// Sleep
+	uint8_t sleep;			// SIM_SLEEP
+	bool sleeprq;			// SLEEP_RQ pin
+	uint32_t sleepgen;
+	// RF
+	sim_rf_request txq[SIM_RADIO_TXQ];
+	uint8_t txput;
+	uint8_t txget;
+	bool rfbusy;
+	uint8_t macseq;
+	uint32_t ea;			// ACK failures (EA)
+	uint32_t ec;			// CCA failures (EC)
+	uint8_t lastrssi;		// DB
+	// Counters
+	uint32_t cmdentries;	// Times command mode was entered
+	uint32_t cmdlines;		// Command lines carried out
+	uint32_t apiframes;		// API frames received from the MCU
+	uint32_t apierrors;		// API frames with a bad checksum or too long
+	uint32_t garbled;		// Bytes from the MCU that arrived garbled
+	uint32_t asleepbytes;	// Bytes from the MCU that arrived while asleep
+	uint32_t rftx;			// RF frames that went on the air (retries included)
+	uint32_t rfrx;			// RF frames received
+	uint32_t rfmissed;		// RF frames addressed to the radio while it slept
+	uint32_t resets;
+} sim_radio;
+
+/*
+ * The radio channel. Every RF frame takes its airtime at 250 kbit/s plus
+ * the CSMA backoff, and each try is lost with probability "loss" (in
+ * parts per million).
+ */
+typedef struct sim_air {
+	sim_radio *radio[SIM_AIR_RADIOS];
+	uint8_t count;
+	uint32_t loss;			// Parts per million of frames lost on the air
+	uint32_t frames;		// RF frames sent (retries included)
+	uint32_t lost;
+	uint64_t busyuntil;		// The channel is in use until then
+} sim_air;
+
+void simAirInit(sim_air *air);
+void simRadioInit(sim_radio *radio, const char *name, sim_air *air, uint32_t sh, uint32_t sl);
+void simRadioAttach(sim_radio *radio, sim_uart *uart);
+bool simRadioSet(sim_radio *radio, const char *cmd, uint64_t value);
+uint64_t simRadioGet(sim_radio *radio, const char *cmd);
+void simRadioSave(sim_radio *radio);
+void simRadioReset(sim_radio *radio);
+void simRadioSetSleepRq(sim_radio *radio, bool asserted);
+bool simRadioAwake(sim_radio *radio);
+
+// +++ Test bench +++
+
+/*
+ * One MCU with its radio: the UART wired to the radio model, the receive
+ * ring and transmit queue of miscfunc.c on it, and the driver state.
+ */
+typedef struct {
+	UART_HandleTypeDef huart;
+	sim_uart uart;
+	sim_radio radio;
+	uart_rxring rxring;
+	uart_txqueue txqueue;
+	uint8_t rxdata[SIM_NODE_RX];
+	uint8_t txdata[SIM_NODE_TX];
+	xbee_radio xbee;
+} sim_node;
+
+// Checks made by a test program, failures are printed as they happen
+extern uint32_t simChecks;
+extern uint32_t simFailures;
+
+#define SIM_CHECK(cond) \
+	do { \
+		++simChecks; \
+		if(!(cond)) \
+		{ \
+			++simFailures; \
+			printf("%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); \
+		} \
+	} while(0)
+
+int simReport(const char *name);
+void simNodeInit(sim_node *node, const char *name, sim_air *air, uint32_t sh, uint32_t sl, uint32_t baud);
+void simNodesRun(sim_node **nodes, uint8_t count, uint32_t us);
+
+#endif /* TEST_INC_XBEESIM_H_ */
@@ -0,0 +1,76 @@
+/*
+Copyright 2018 Jesper Wlivaara
+
+Permission is hereby granted, free of charge, to any person obtaining
+a copy of this software and associated documentation files (the "Software"),
+to deal in the Software without restriction, including without limitation the
+rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is furnished to
+do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all copies
+or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR
+PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE
+FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+
+#include "xbeesim.h"
+#include "platformtimer.h"
+#include "bench.h"
+
+/*
+ * The "bench" terminal command run on the host: the hot path benchmarks
+ * of bench.c, timed in host time instead of target cycles, with the
+ * terminal UART printed to stdout. The core clock is set to 1 GHz for the
+ * run, so a cycle is a nanosecond of host time. Compare the figures with
+ * each other, not with the target. Fails if the word at a time escape
+ * scanner gives other results than the byte loops it is timed against.
+ */
+
+static sim_uart termUart;
+static UART_HandleTypeDef huart;
+static uart_txqueue txqueue;
+static uint8_t txdata[UART_TXBUF_SIZE];
+static uint8_t cachedata[MAX_TERM_CMD_LEN];
+static buffer cache = {cachedata, 0, sizeof(cachedata)};
+static terminal term;
+static xbee_radio radio;
+
+
+// Far end of the terminal UART
+static void termOutput(void *ctx, uint8_t byte, uint32_t baud)
+{
+	(void)ctx;
+	(void)baud;
+	if(byte != '\r')
+	{
+		putchar(byte);
+	}
+}
+
+
+int main()
+{
+	simReset();
+	platformTimerInit();
+	simUartInit(&termUart, &huart, 921600, true);
+	simUartConnect(&termUart, termOutput, NULL);
+	uartTxInit(&txqueue, &huart, txdata, sizeof(txdata));
+	radio.local.radio = &radio;
+	termInit(&term, &cache, &huart, &radio.local);
+	uartTxFlush(&huart, 100);
+	putchar('\n');
+
+	uint32_t clock = SystemCoreClock;
+	SystemCoreClock = 1000000000;
+	simHostCycles = true;
+	uint32_t mismatches = benchRun(&term);
+	simHostCycles = false;
+	SystemCoreClock = clock;
+	uartTxFlush(&huart, 1000);
+	return (mismatches == 0) ? 0 : 1;
+}
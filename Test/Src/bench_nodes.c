@@ -0,0 +1,128 @@
+/*
+Copyright 2018 Jesper Wlivaara
+
+Permission is hereby granted, free of charge, to any person obtaining
+a copy of this software and associated documentation files (the "Software"),
+to deal in the Software without restriction, including without limitation the
+rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is furnished to
+do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all copies
+or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR
+PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE
+FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+
+#include "stdio.h"
+#include "time.h"
+#include "xbeenodes.h"
+
+/*
+ * Lookup cost of the node registry, built on its own once per table size
+ * (see the Makefile) with as many hash buckets as nodes. Times are host
+ * CPU time, what matters is how little they change with the size.
+ */
+
+#define BENCH_LOOKUPS 4000000
+
+static xbee_nodetable table;
+static uint32_t sl[XBEE_MAX_NODES];
+static uint16_t my[XBEE_MAX_NODES];
+static uint32_t failures;
+static volatile uintptr_t sink;		// Keeps the lookups from being optimized away
+
+#define BENCH_SH 0x0013A200
+
+
+static uint32_t benchRandom(void)
+{
+	static uint32_t state = 0x2545F491;
+	state ^= state << 13;
+	state ^= state >> 17;
+	state ^= state << 5;
+	return state;
+}
+
+
+static double benchNow(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+
+static void benchFill(void)
+{
+	xbeeNodesInit(&table);
+	for(uint16_t i = 0; i < XBEE_MAX_NODES; ++i)
+	{
+		sl[i] = 0x40000000 | (benchRandom() & 0x00FFFFFF);
+		my[i] = 0x0100 + i;
+		xbeeNodeAdd(&table, BENCH_SH, sl[i], my[i]);
+	}
+	if(table.count != XBEE_MAX_NODES || table.evictions != 0)
+	{
+		++failures;
+	}
+	for(uint16_t i = 0; i < XBEE_MAX_NODES; ++i)
+	{
+		xbee_node *n = xbeeNodeFind64(&table, BENCH_SH, sl[i]);
+		if(n == NULL || n->MY != my[i] || xbeeNodeFind16(&table, my[i]) != n)
+		{
+			++failures;
+		}
+	}
+}
+
+
+int main()
+{
+	double start;
+
+	benchFill();
+	printf("%u nodes, %u buckets, %lu bytes\n", XBEE_MAX_NODES, XBEE_NODE_BUCKETS,
+		   (unsigned long)sizeof(xbee_nodetable));
+
+	start = benchNow();
+	for(uint32_t i = 0; i < BENCH_LOOKUPS; ++i)
+	{
+		sink = (uintptr_t)xbeeNodeFind64(&table, BENCH_SH, sl[benchRandom() % XBEE_MAX_NODES]);
+	}
+	printf("  64-bit lookup:  %5.1f ns\n", (benchNow() - start) / BENCH_LOOKUPS);
+
+	start = benchNow();
+	for(uint32_t i = 0; i < BENCH_LOOKUPS; ++i)
+	{
+		sink = (uintptr_t)xbeeNodeFind16(&table, my[benchRandom() % XBEE_MAX_NODES]);
+	}
+	printf("  16-bit lookup:  %5.1f ns\n", (benchNow() - start) / BENCH_LOOKUPS);
+
+	// Addresses that are not in the registry walk a whole chain
+	start = benchNow();
+	for(uint32_t i = 0; i < BENCH_LOOKUPS; ++i)
+	{
+		sink = (uintptr_t)xbeeNodeFind64(&table, BENCH_SH, 0x50000000 | (benchRandom() & 0x00FFFFFF));
+	}
+	printf("  64-bit miss:    %5.1f ns\n", (benchNow() - start) / BENCH_LOOKUPS);
+
+	// Every new node evicts the least recently used one
+	start = benchNow();
+	for(uint32_t i = 0; i < BENCH_LOOKUPS/4; ++i)
+	{
+		sink = (uintptr_t)xbeeNodeAdd(&table, BENCH_SH, 0x60000000 + i, XBEE_ADDR16_UNKNOWN);
+	}
+	printf("  add and evict:  %5.1f ns\n", (benchNow() - start) / (BENCH_LOOKUPS/4));
+	if(table.count != XBEE_MAX_NODES || table.evictions != BENCH_LOOKUPS/4)
+	{
+		++failures;
+	}
+
+	printf("nodes %u: %lu failed\n", XBEE_MAX_NODES, (unsigned long)failures);
+	return (failures == 0) ? 0 : 1;
+}
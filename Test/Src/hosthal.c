@@ -0,0 +1,825 @@
+/*
+Copyright 2018 Jesper Wlivaara
+
+Permission is hereby granted, free of charge, to any person obtaining
+a copy of this software and associated documentation files (the "Software"),
+to deal in the Software without restriction, including without limitation the
+rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is furnished to
+do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all copies
+or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR
+PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE
+FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+
+#include "time.h"
+#include "xbeesim.h"
+
+uint64_t simNow;
+bool simHostCycles;
+uint32_t simPrimask;
+uint32_t SystemCoreClock = 64000000;
+TIM_TypeDef simTIM2;
+
+typedef struct {
+	uint64_t at;
+	uint32_t seq;			// Keeps events at the same time in the order they were scheduled
+	sim_event_fn fn;
+	void *ctx;
+	uint32_t arg;
+} sim_event;
+
+// Pending events, a binary heap ordered by (at, seq)
+static sim_event events[SIM_EVENTS];
+static uint32_t eventCount;
+static uint32_t eventSeq;
+
+static bool inInterrupt;	// An event or interrupt handler is running
+static bool woken;			// An interrupt has run since __WFI() was entered
+static bool tickSuspended;
+static uint32_t tickOffset;	// HAL tick = tickOffset + ms of virtual time
+static uint32_t tickFrozen;	// HAL tick while SysTick is suspended
+static uint32_t rngState = 0x2545F491;
+
+
+// ++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
+// ++++++++++++++++++++++++++++ VIRTUAL CLOCK +++++++++++++++++++++++++++++++++
+// ++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
+
+static void simFail(const char *msg)
+{
+	fprintf(stderr, "sim: %s (t = %llu us)\n", msg, (unsigned long long)simNow);
+	abort();
+}
+
+
+static bool simEventBefore(const sim_event *a, const sim_event *b)
+{
+	return (a->at < b->at) || (a->at == b->at && a->seq < b->seq);
+}
+
+
+/*
+ *	Starts the simulation over: no events pending, time and peripherals at 0.
+ *	Call before anything else, and not while driver timers are running.
+ */
+void simReset(void)
+{
+	eventCount = 0;
+	eventSeq = 0;
+	simNow = 0;
+	simPrimask = 0;
+	inInterrupt = false;
+	tickSuspended = false;
+	tickOffset = 0;
+	memset(&simTIM2, 0, sizeof(simTIM2));
+}
+
+
+/*
+ *	Runs "fn(ctx, arg)" at virtual time "at" (us). Events at the same time
+ *	run in the order they were scheduled.
+ */
+void simSchedule(uint64_t at, sim_event_fn fn, void *ctx, uint32_t arg)
+{
+	if(eventCount >= SIM_EVENTS)
+	{
+		simFail("event queue full");
+	}
+	sim_event ev = {(at < simNow) ? simNow : at, eventSeq++, fn, ctx, arg};
+	uint32_t i = eventCount++;
+	while(i > 0 && simEventBefore(&ev, &events[(i-1)/2]))
+	{
+		events[i] = events[(i-1)/2];
+		i = (i-1)/2;
+	}
+	events[i] = ev;
+}
+
+
+static sim_event simPop(void)
+{
+	sim_event top = events[0];
+	sim_event last = events[--eventCount];
+	uint32_t i = 0;
+	for(;;)
+	{
+		uint32_t c = 2*i + 1;
+		if(c >= eventCount)
+		{
+			break;
+		}
+		if(c+1 < eventCount && simEventBefore(&events[c+1], &events[c]))
+		{
+			++c;
+		}
+		if(!simEventBefore(&events[c], &last))
+		{
+			break;
+		}
+		events[i] = events[c];
+		i = c;
+	}
+	events[i] = last;
+	return top;
+}
+
+
+/*
+ *	Moves the clock to "t". TIM2 counts 1 us per us while enabled and
+ *	raises its compare flag when it passes CCR1.
+ */
+static void simSetTime(uint64_t t)
+{
+	if(simTIM2.CR1 & TIM_CR1_CEN)
+	{
+		uint32_t delta = (uint32_t)(t - simNow);
+		uint32_t match = simTIM2.CCR1 - simTIM2.CNT;
+		if(match != 0 && match <= delta)
+		{
+			simTIM2.SR |= TIM_SR_CC1IF;
+		}
+		simTIM2.CNT += delta;
+	}
+	simNow = t;
+}
+
+
+/*
+ *	Time of the next TIM2 compare match, UINT64_MAX if the timer is stopped.
+ */
+static uint64_t simTimerMatch(void)
+{
+	if(!(simTIM2.CR1 & TIM_CR1_CEN) || !(simTIM2.DIER & TIM_DIER_CC1IE))
+	{
+		return UINT64_MAX;
+	}
+	uint32_t match = simTIM2.CCR1 - simTIM2.CNT;
+	return simNow + ((match != 0) ? match : 0x100000000ULL);
+}
+
+
+/*
+ *	Runs the TIM2 interrupt if it is enabled and pending.
+ *
+ *	@retval true if it ran
+ */
+static bool simTimerInterrupt(void)
+{
+	if(simTIM2.EGR & TIM_EGR_CC1G)
+	{
+		simTIM2.EGR &= ~TIM_EGR_CC1G;
+		simTIM2.SR |= TIM_SR_CC1IF;
+	}
+	if(!(simTIM2.DIER & TIM_DIER_CC1IE) || !(simTIM2.SR & TIM_SR_CC1IF))
+	{
+		return false;
+	}
+	inInterrupt = true;
+	woken = true;
+	TIM2_IRQHandler();
+	inInterrupt = false;
+	return true;
+}
+
+
+/*
+ *	Runs every event and interrupt due up to "until", then sets the clock to it.
+ *	Must not be called from an event or interrupt handler.
+ */
+void simAdvance(uint64_t until)
+{
+	if(inInterrupt)
+	{
+		simFail("time advanced from interrupt context");
+	}
+	for(;;)
+	{
+		while(simTimerInterrupt())
+		{
+		}
+
+		uint64_t next = simTimerMatch();
+		bool event = false;
+		if(eventCount > 0 && events[0].at <= next)
+		{
+			next = events[0].at;
+			event = true;
+		}
+		if(next > until)
+		{
+			break;
+		}
+		simSetTime(next);
+		if(event)
+		{
+			sim_event ev = simPop();
+			inInterrupt = true;
+			ev.fn(ev.ctx, ev.arg);
+			inInterrupt = false;
+		}
+	}
+	if(until > simNow)
+	{
+		simSetTime(until);
+	}
+}
+
+
+/*
+ *	Lets "us" microseconds of virtual time pass.
+ */
+void simRunFor(uint32_t us)
+{
+	simAdvance(simNow + us);
+}
+
+
+/*
+ *	Runs interrupt code from an event, the way the NVIC would.
+ */
+static void simInterrupt(void (*handler)(UART_HandleTypeDef *), UART_HandleTypeDef *huart)
+{
+	woken = true;
+	handler(huart);
+}
+
+
+/*
+ *	__WFI(): sleeps until an interrupt has run. Events that only concern
+ *	the simulated hardware (a byte reaching the radio, the radio timing
+ *	out) pass without waking the core. SysTick wakes it every millisecond
+ *	unless it has been suspended.
+ */
+void simWaitForInterrupt(void)
+{
+	woken = false;
+	while(!woken)
+	{
+		if(simTimerInterrupt())
+		{
+			break;
+		}
+		uint64_t next = simTimerMatch();
+		if(eventCount > 0 && events[0].at < next)
+		{
+			next = events[0].at;
+		}
+		uint64_t tick = tickSuspended ? UINT64_MAX : (simNow/1000 + 1)*1000;
+		if(tick <= next)
+		{
+			simAdvance(tick);
+			break;
+		}
+		if(next == UINT64_MAX)
+		{
+			simFail("__WFI() with nothing left that could wake the core");
+		}
+		simAdvance(next);
+	}
+}
+
+
+/*
+ *	Deterministic pseudo random numbers (xorshift32) for the radio model
+ *	and the tests.
+ */
+uint32_t simRandom(void)
+{
+	rngState ^= rngState << 13;
+	rngState ^= rngState >> 17;
+	rngState ^= rngState << 5;
+	return rngState;
+}
+
+
+void simSeed(uint32_t seed)
+{
+	rngState = (seed != 0) ? seed : 0x2545F491;
+}
+
+
+// ++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
+// ++++++++++++++++++++++++++++ CORE AND HAL BASE +++++++++++++++++++++++++++++
+// ++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
+
+uint32_t HAL_GetTick(void)
+{
+	return tickSuspended ? tickFrozen : tickOffset + (uint32_t)(simNow / 1000);
+}
+
+
+void HAL_IncTick(void)
+{
+	if(tickSuspended)
+	{
+		++tickFrozen;
+	}
+	else
+	{
+		++tickOffset;
+	}
+}
+
+
+void HAL_SuspendTick(void)
+{
+	if(!tickSuspended)
+	{
+		tickFrozen = HAL_GetTick();
+		tickSuspended = true;
+	}
+}
+
+
+void HAL_ResumeTick(void)
+{
+	if(tickSuspended)
+	{
+		tickOffset = tickFrozen - (uint32_t)(simNow / 1000);
+		tickSuspended = false;
+	}
+}
+
+
+/*
+ *	Busy waits like the HAL does, at least "delay" + 1 ticks.
+ */
+void HAL_Delay(uint32_t delay)
+{
+	uint32_t start = HAL_GetTick();
+	uint32_t wait = delay;
+	if(wait < HAL_MAX_DELAY)
+	{
+		++wait;
+	}
+	if(tickSuspended)
+	{
+		simFail("HAL_Delay() with SysTick suspended");
+	}
+	while((HAL_GetTick() - start) < wait)
+	{
+		simAdvance((simNow/1000 + 1)*1000);
+	}
+}
+
+
+void HAL_NVIC_SetPriority(IRQn_Type irq, uint32_t preempt, uint32_t sub)
+{
+	(void)irq;
+	(void)preempt;
+	(void)sub;
+}
+
+
+void HAL_NVIC_EnableIRQ(IRQn_Type irq)
+{
+	(void)irq;
+}
+
+
+void HAL_NVIC_DisableIRQ(IRQn_Type irq)
+{
+	(void)irq;
+}
+
+
+/*
+ *	Cycle counter of the host build, SystemCoreClock cycles of virtual time,
+ *	or of host time when simHostCycles is set.
+ */
+uint32_t platformCycles()
+{
+	if(simHostCycles)
+	{
+		struct timespec ts;
+		clock_gettime(CLOCK_MONOTONIC, &ts);
+		uint64_t ns = (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+		return (uint32_t)(ns * (SystemCoreClock / 1000000) / 1000);
+	}
+	return (uint32_t)(simNow * (SystemCoreClock / 1000000));
+}
+
+
+// ++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
+// ++++++++++++++++++++++++++++ UART AND DMA ++++++++++++++++++++++++++++++++++
+// ++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
+
+/*
+ *	Time one byte takes on the line at "baud" (8N1, 10 bits), in us.
+ */
+uint32_t simByteTime(uint32_t baud)
+{
+	return (10000000 + baud - 1) / baud;
+}
+
+
+/*
+ *	What a receiver running at "rxbaud" makes of a byte sent at "txbaud".
+ *	It samples the middle of each of its own bit times, counted from the
+ *	falling edge of the start bit, so a byte sent at another rate turns
+ *	into other data or fails the stop bit check.
+ *
+ *	@retval false on a framing error (the byte is lost)
+ */
+bool simLineDecode(uint8_t byte, uint32_t txbaud, uint32_t rxbaud, uint8_t *out)
+{
+	if(txbaud == rxbaud)
+	{
+		*out = byte;
+		return true;
+	}
+
+	// Start bit (0), 8 data bits LSB first, stop bit (1), then idle (1)
+	uint16_t frame = 0x200 | ((uint16_t)byte << 1);
+	uint8_t value = 0;
+	for(uint32_t i = 1; i <= 9; ++i)
+	{
+		uint64_t k = ((2*i + 1) * (uint64_t)txbaud) / (2*(uint64_t)rxbaud);
+		uint8_t bit = (k < 10) ? (frame >> k) & 1 : 1;
+		if(i == 9)
+		{
+			if(bit == 0)
+			{
+				return false;
+			}
+		}
+		else
+		{
+			value |= bit << (i-1);
+		}
+	}
+	*out = value;
+	return true;
+}
+
+
+/*
+ *	Sets a UART handle up on a wire. Reception and transmission use DMA
+ *	channels, or the TX interrupt if "txdma" is false.
+ */
+void simUartInit(sim_uart *uart, UART_HandleTypeDef *huart, uint32_t baud, bool txdma)
+{
+	memset(uart, 0, sizeof(sim_uart));
+	memset(huart, 0, sizeof(UART_HandleTypeDef));
+	uart->huart = huart;
+	uart->hdmarx.Instance = &uart->rxch;
+	uart->hdmarx.Init.Mode = DMA_NORMAL;
+	uart->hdmatx.Instance = &uart->txch;
+	huart->Instance = &uart->regs;
+	huart->Init.BaudRate = baud;
+	huart->hdmarx = &uart->hdmarx;
+	huart->hdmatx = txdma ? &uart->hdmatx : NULL;
+	huart->sim = uart;
+}
+
+
+/*
+ *	Connects the far end of a wire, which is handed every byte the UART sends.
+ */
+void simUartConnect(sim_uart *uart, sim_rx_fn peer, void *peerctx)
+{
+	uart->peer = peer;
+	uart->peerctx = peerctx;
+}
+
+
+static void simUartTxByte(void *ctx, uint32_t gen)
+{
+	sim_uart *uart = ctx;
+	if(gen != uart->txgen || !uart->txbusy)
+	{
+		return;
+	}
+
+	uint8_t byte = uart->txdata[uart->txpos++];
+	++uart->txbytes;
+	if(uart->peer != NULL)
+	{
+		uart->peer(uart->peerctx, byte, uart->huart->Init.BaudRate);
+	}
+	if(uart->txpos < uart->txlen)
+	{
+		simSchedule(simNow + simByteTime(uart->huart->Init.BaudRate), simUartTxByte, uart, uart->txgen);
+		return;
+	}
+	uart->txbusy = false;
+	simInterrupt(HAL_UART_TxCpltCallback, uart->huart);
+}
+
+
+static HAL_StatusTypeDef simUartStartTx(UART_HandleTypeDef *huart, uint8_t *data, uint16_t size)
+{
+	sim_uart *uart = huart->sim;
+	if(uart->txbusy)
+	{
+		return HAL_BUSY;
+	}
+	if(size == 0)
+	{
+		return HAL_ERROR;
+	}
+	uart->txdata = data;
+	uart->txlen = size;
+	uart->txpos = 0;
+	uart->txbusy = true;
+	simSchedule(simNow + simByteTime(huart->Init.BaudRate), simUartTxByte, uart, uart->txgen);
+	return HAL_OK;
+}
+
+
+HAL_StatusTypeDef HAL_UART_Transmit_DMA(UART_HandleTypeDef *huart, uint8_t *data, uint16_t size)
+{
+	return simUartStartTx(huart, data, size);
+}
+
+
+HAL_StatusTypeDef HAL_UART_Transmit_IT(UART_HandleTypeDef *huart, uint8_t *data, uint16_t size)
+{
+	return simUartStartTx(huart, data, size);
+}
+
+
+/*
+ *	Blocking transmit, each byte takes its time on the line.
+ */
+HAL_StatusTypeDef HAL_UART_Transmit(UART_HandleTypeDef *huart, uint8_t *data, uint16_t size, uint32_t timeout)
+{
+	sim_uart *uart = huart->sim;
+	(void)timeout;
+	if(uart->txbusy)
+	{
+		return HAL_BUSY;
+	}
+	uart->txbusy = true;
+	for(uint16_t i = 0; i < size; ++i)
+	{
+		simAdvance(simNow + simByteTime(huart->Init.BaudRate));
+		++uart->txbytes;
+		if(uart->peer != NULL)
+		{
+			uart->peer(uart->peerctx, data[i], huart->Init.BaudRate);
+		}
+	}
+	uart->txbusy = false;
+	return HAL_OK;
+}
+
+
+static void simUartIdle(void *ctx, uint32_t arg)
+{
+	sim_uart *uart = ctx;
+	(void)arg;
+	if(!uart->rxidle || simNow - uart->rxlast < simByteTime(uart->huart->Init.BaudRate))
+	{
+		return;
+	}
+	uart->rxidle = false;
+	uart->regs.ISR |= UART_FLAG_IDLE;
+	if(uart->regs.CR1 & UART_IT_IDLE)
+	{
+		simInterrupt(simUsartIRQHandler, uart->huart);
+	}
+}
+
+
+/*
+ *	A byte arriving at the UART from its far end. The receive DMA stores
+ *	it and counts down CNDTR, raising the half and full transfer
+ *	callbacks, and the line going quiet for one byte time sets IDLE.
+ */
+void simUartReceive(void *ctx, uint8_t byte, uint32_t baud)
+{
+	sim_uart *uart = ctx;
+	UART_HandleTypeDef *huart = uart->huart;
+	uint8_t value;
+
+	uart->rxlast = simNow;
+	uart->rxidle = true;
+	simSchedule(simNow + simByteTime(huart->Init.BaudRate), simUartIdle, uart, 0);
+
+	if(!simLineDecode(byte, baud, huart->Init.BaudRate, &value))
+	{
+		++uart->rxgarbled;
+		return;
+	}
+	if(!uart->rxrun)
+	{
+		++uart->rxlost;
+		return;
+	}
+
+	uart->rxbuf[uart->rxpos++] = value;
+	++uart->rxbytes;
+	if(uart->rxpos == uart->rxsize)
+	{
+		uart->rxpos = 0;
+		uart->rxrun = uart->rxcircular;
+		uart->rxch.CNDTR = uart->rxcircular ? uart->rxsize : 0;
+		simInterrupt(HAL_UART_RxCpltCallback, huart);
+	}
+	else
+	{
+		uart->rxch.CNDTR = uart->rxsize - uart->rxpos;
+		if(uart->rxpos == uart->rxsize/2)
+		{
+			simInterrupt(HAL_UART_RxHalfCpltCallback, huart);
+		}
+	}
+}
+
+
+HAL_StatusTypeDef HAL_UART_Receive_DMA(UART_HandleTypeDef *huart, uint8_t *data, uint16_t size)
+{
+	sim_uart *uart = huart->sim;
+	if(uart->rxrun)
+	{
+		return HAL_BUSY;
+	}
+	if(size == 0)
+	{
+		return HAL_ERROR;
+	}
+	uart->rxbuf = data;
+	uart->rxsize = size;
+	uart->rxpos = 0;
+	uart->rxcircular = (huart->hdmarx->Init.Mode == DMA_CIRCULAR);
+	uart->rxch.CNDTR = size;
+	uart->rxrun = true;
+	return HAL_OK;
+}
+
+
+HAL_StatusTypeDef HAL_UART_Abort(UART_HandleTypeDef *huart)
+{
+	sim_uart *uart = huart->sim;
+	++uart->txgen;
+	uart->txbusy = false;
+	uart->rxrun = false;
+	uart->rxch.CNDTR = 0;
+	return HAL_OK;
+}
+
+
+HAL_StatusTypeDef HAL_UART_Init(UART_HandleTypeDef *huart)
+{
+	return (huart->Init.BaudRate != 0) ? HAL_OK : HAL_ERROR;
+}
+
+
+HAL_StatusTypeDef HAL_DMA_Init(DMA_HandleTypeDef *hdma)
+{
+	(void)hdma;
+	return HAL_OK;
+}
+
+
+// ++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
+// ++++++++++++++++++++++++++++ SERIAL TRANSMITTER ++++++++++++++++++++++++++++
+// ++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
+
+void simSerialInit(sim_serial *ser, sim_rx_fn dst, void *dstctx)
+{
+	memset(ser, 0, sizeof(sim_serial));
+	ser->dst = dst;
+	ser->dstctx = dstctx;
+}
+
+
+static void simSerialByte(void *ctx, uint32_t gen)
+{
+	sim_serial *ser = ctx;
+	if(gen != ser->gen)
+	{
+		return;
+	}
+
+	uint32_t idx = ser->get++ % SIM_SERIAL_QUEUE;
+	if(ser->dst != NULL)
+	{
+		ser->dst(ser->dstctx, ser->data[idx], ser->baud[idx]);
+	}
+	if(ser->get == ser->put)
+	{
+		ser->busy = false;
+		return;
+	}
+	simSchedule(simNow + simByteTime(ser->baud[ser->get % SIM_SERIAL_QUEUE]), simSerialByte, ser, ser->gen);
+}
+
+
+/*
+ *	Queues bytes to be sent at "baud", after everything queued before.
+ */
+void simSerialWrite(sim_serial *ser, const uint8_t *data, uint16_t len, uint32_t baud)
+{
+	for(uint16_t i = 0; i < len; ++i)
+	{
+		if(ser->put - ser->get >= SIM_SERIAL_QUEUE)
+		{
+			ser->dropped += len - i;
+			break;
+		}
+		ser->data[ser->put % SIM_SERIAL_QUEUE] = data[i];
+		ser->baud[ser->put % SIM_SERIAL_QUEUE] = baud;
+		++ser->put;
+	}
+	if(!ser->busy && ser->put != ser->get)
+	{
+		ser->busy = true;
+		simSchedule(simNow + simByteTime(ser->baud[ser->get % SIM_SERIAL_QUEUE]), simSerialByte, ser, ser->gen);
+	}
+}
+
+
+/*
+ *	Drops everything not sent yet.
+ */
+void simSerialFlush(sim_serial *ser)
+{
+	++ser->gen;
+	ser->get = ser->put;
+	ser->busy = false;
+}
+
+
+uint32_t simSerialPending(sim_serial *ser)
+{
+	return ser->put - ser->get;
+}
+
+
+// ++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
+// ++++++++++++++++++++++++++++ FLASH +++++++++++++++++++++++++++++++++++++++++
+// ++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
+
+HAL_StatusTypeDef HAL_FLASH_Unlock(void)
+{
+	return HAL_ERROR;
+}
+
+
+HAL_StatusTypeDef HAL_FLASH_Lock(void)
+{
+	return HAL_ERROR;
+}
+
+
+HAL_StatusTypeDef HAL_FLASH_Program(uint32_t type, uint32_t address, uint64_t data)
+{
+	(void)type;
+	(void)address;
+	(void)data;
+	return HAL_ERROR;
+}
+
+
+HAL_StatusTypeDef HAL_FLASHEx_Erase(FLASH_EraseInitTypeDef *erase, uint32_t *error)
+{
+	(void)erase;
+	*error = 0xFFFFFFFF;
+	return HAL_ERROR;
+}
+
+
+// ++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
+// ++++++++++++++++++++++++++++ APPLICATION GLUE ++++++++++++++++++++++++++++++
+// ++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
+// What main.c and stm32f3xx_it.c do on target. Weak, so a test can
+// replace any of them.
+
+__weak void HAL_UART_TxCpltCallback(UART_HandleTypeDef *huart)
+{
+	uartTxISR(huart);
+}
+
+
+__weak void HAL_UART_RxHalfCpltCallback(UART_HandleTypeDef *huart)
+{
+	uartRxISR(huart);
+}
+
+
+__weak void HAL_UART_RxCpltCallback(UART_HandleTypeDef *huart)
+{
+	uartRxISR(huart);
+}
+
+
+// USARTx_IRQHandler, only the IDLE interrupt is simulated
+__weak void simUsartIRQHandler(UART_HandleTypeDef *huart)
+{
+	uartRxISR(huart);
+}
+
+
+__weak void TIM2_IRQHandler(void)
+{
+	platformTimerISR();
+}
@@ -0,0 +1,215 @@
+/*
+Copyright 2018 Jesper Wlivaara
+
+Permission is hereby granted, free of charge, to any person obtaining
+a copy of this software and associated documentation files (the "Software"),
+to deal in the Software without restriction, including without limitation the
+rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is furnished to
+do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all copies
+or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR
+PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE
+FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+
+#include "xbeesim.h"
+#include "platformtimer.h"
+
+/*
+ * Coalescing of sensor records: a node produces a 4 byte record every
+ * 2 ms for another node, first as one frame per record, then through the
+ * aggregator with a 50 ms deadline, where the payloads fill up before the
+ * deadline, then at one record every 100 ms, where every payload goes out
+ * on its deadline. Reports the frames saved and the latency from producing
+ * a record to the receiving application.
+ */
+
+#define AGG_PERIOD_FAST 2		// ms between records
+#define AGG_PERIOD_SLOW 100
+#define AGG_DEADLINE 50			// ms
+#define AGG_TRANSIT 30			// ms a full payload takes to the other application at most
+#define AGG_RUN 2000			// ms of records per phase
+
+static sim_air air;
+static sim_node nodeA;
+static sim_node nodeB;
+static xbee_aggregator agg;
+
+// Receiving side
+static uint32_t received;
+static uint64_t latencysum;		// us
+static uint32_t latencymax;
+static uint32_t rxframes;
+
+// Sending side
+static uint32_t refused;		// Records the transmit queue had no room for
+static uint32_t sent;
+
+
+// A record is the virtual time (us) it was produced at
+static void recordLatency(const uint8_t *data)
+{
+	uint32_t stamp;
+	memcpy(&stamp, data, sizeof(stamp));
+	uint32_t latency = (uint32_t)simNow - stamp;
+	latencysum += latency;
+	if(latency > latencymax)
+	{
+		latencymax = latency;
+	}
+	++received;
+}
+
+
+static void onFrame(xbee_module *xbee, xbee_frame *frame)
+{
+	xbee_agg_iter it;
+	uint8_t len;
+	(void)xbee;
+
+	++rxframes;
+	if(xbeeAggBegin(&it, frame))
+	{
+		while(xbeeAggNext(&it))
+		{
+			recordLatency(it.data);
+		}
+	}
+	else if(xbeeRxData(frame, &len) != NULL && len == 4)
+	{
+		recordLatency(xbeeRxData(frame, &len));
+	}
+}
+
+
+static void onSent(xbee_module *xbee, uint8_t frameid, uint8_t status, void *ctx)
+{
+	(void)xbee;
+	(void)frameid;
+	(void)status;
+	(void)ctx;
+	++sent;
+}
+
+
+static void resetCounters(void)
+{
+	received = 0;
+	latencysum = 0;
+	latencymax = 0;
+	rxframes = 0;
+	refused = 0;
+	sent = 0;
+}
+
+
+/*
+ *	Produces a record every "period" ms for AGG_RUN ms, sent on its own
+ *	(stream NULL) or through the aggregator. Records the transmit queue
+ *	has no room for are counted in "refused".
+ *
+ *	@retval Records produced
+ */
+static uint32_t produce(uint32_t period, xbee_agg_stream *stream)
+{
+	sim_node *nodes[2] = {&nodeA, &nodeB};
+	uint32_t produced = 0;
+
+	for(uint32_t ms = 0; ms < AGG_RUN + 200; ++ms)
+	{
+		if(ms < AGG_RUN && ms % period == 0)
+		{
+			uint32_t stamp = (uint32_t)simNow;
+			XBEE_STAT stat;
+			if(stream == NULL)
+			{
+				stat = xbeeTransmit16(&nodeA.xbee.local, 0x0002, (uint8_t *)&stamp, sizeof(stamp), 0, onSent, NULL, NULL);
+			}
+			else
+			{
+				stat = xbeeAggPut(&agg, stream, (uint8_t *)&stamp, sizeof(stamp));
+			}
+			if(stat != XBEE_MSG_OK)
+			{
+				++refused;
+			}
+			++produced;
+		}
+		simNodesRun(nodes, 2, 1000);
+		xbeeAggService(&agg);
+	}
+	return produced;
+}
+
+
+static void report(const char *name, uint32_t produced, uint32_t frames)
+{
+	printf("%-24s %4lu records %4lu frames %5lu us mean %6lu us max\n", name, (unsigned long)produced,
+		   (unsigned long)frames, (unsigned long)(latencysum / (received ? received : 1)), (unsigned long)latencymax);
+}
+
+
+int main()
+{
+	simReset();
+	platformTimerInit();
+	simAirInit(&air);
+	simNodeInit(&nodeA, "A", &air, 0x0013A200, 0x4000000A, 115200);
+	simNodeInit(&nodeB, "B", &air, 0x0013A200, 0x4000000B, 115200);
+	simRadioSet(&nodeA.radio, "BD", 7);
+	simRadioSet(&nodeB.radio, "BD", 7);
+	simRadioSet(&nodeA.radio, "MY", 0x0001);
+	simRadioSet(&nodeB.radio, "MY", 0x0002);
+	simRadioReset(&nodeA.radio);
+	simRadioReset(&nodeB.radio);
+	nodeB.xbee.local.onframe = onFrame;
+	SIM_CHECK(xbeeInit(&nodeA.xbee, &nodeA.huart) == XBEE_MSG_SETTING_CHANGED);
+	SIM_CHECK(xbeeInit(&nodeB.xbee, &nodeB.huart) == XBEE_MSG_SETTING_CHANGED);
+	xbeeAggInit(&agg, &nodeA.xbee.local);
+
+	// One frame per record, more than the link carries at this rate
+	resetCounters();
+	uint32_t produced = produce(AGG_PERIOD_FAST, NULL);
+	SIM_CHECK(sent + refused == produced && received == sent && rxframes == sent);
+	report("every 2 ms, direct", produced, rxframes);
+	printf("  %lu records refused by the transmit queue\n", (unsigned long)refused);
+	uint32_t directmean = (uint32_t)(latencysum / (received ? received : 1));
+
+	// Coalesced, the payloads fill up before the deadline
+	resetCounters();
+	xbee_agg_stream *stream = xbeeAggOpen(&agg, 0x0013A200, 0x4000000B, 0x0002, AGG_DEADLINE, 0);
+	SIM_CHECK(stream != NULL);
+	produced = produce(AGG_PERIOD_FAST, stream);
+	SIM_CHECK(xbeeAggClose(&agg, stream) == XBEE_MSG_OK);
+	SIM_CHECK(refused == 0 && received == produced);
+	SIM_CHECK(agg.records == produced && agg.failed == 0);
+	SIM_CHECK(rxframes == agg.payloads && agg.expired <= 1);
+	SIM_CHECK(rxframes * 15 < produced);
+	SIM_CHECK(latencymax < (AGG_DEADLINE + AGG_TRANSIT) * 1000);
+	report("every 2 ms, coalesced", produced, rxframes);
+	printf("  %lu frames saved, %ld us latency on average against direct\n", (unsigned long)(produced - rxframes),
+		   (long)(latencysum / (received ? received : 1)) - (long)directmean);
+
+	// Too few records to fill a payload, each one goes on its deadline
+	resetCounters();
+	uint32_t payloads = agg.payloads;
+	uint32_t expired = agg.expired;
+	stream = xbeeAggOpen(&agg, 0x0013A200, 0x4000000B, 0x0002, AGG_DEADLINE, 0);
+	produced = produce(AGG_PERIOD_SLOW, stream);
+	SIM_CHECK(xbeeAggClose(&agg, stream) == XBEE_MSG_OK);
+	SIM_CHECK(refused == 0 && received == produced);
+	SIM_CHECK(agg.payloads - payloads == produced && agg.expired - expired == produced);
+	SIM_CHECK(latencysum / (received ? received : 1) >= AGG_DEADLINE * 1000);
+	SIM_CHECK(latencymax < (AGG_DEADLINE + AGG_TRANSIT) * 1000);
+	report("every 100 ms, coalesced", produced, rxframes);
+	printf("  oldest record of a payload waited at most %lu us\n",
+		   (unsigned long)(agg.wait.max / (SystemCoreClock / 1000000)));
+
+	return simReport("agg");
+}
@@ -0,0 +1,103 @@
+/*
+Copyright 2018 Jesper Wlivaara
+
+Permission is hereby granted, free of charge, to any person obtaining
+a copy of this software and associated documentation files (the "Software"),
+to deal in the Software without restriction, including without limitation the
+rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is furnished to
+do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all copies
+or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR
+PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE
+FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+
+#include "xbeesim.h"
+#include "platformtimer.h"
+
+/*
+ * Time to ready of the local module at each of the nine interface rates:
+ * a factory radio (transparent mode, default guard time) with the MCU
+ * UART starting at its reset rate of 9600 baud, and a resynchronization
+ * once the rate is known, which probes that rate first with the guard
+ * time the radio was programmed with (XBEE_FAST_GT). Last, the MCU is
+ * reset with nothing stored while the radio keeps its settings.
+ */
+
+static sim_air air;
+static sim_node node;
+
+
+int main()
+{
+	uint32_t worst = 0;
+	uint32_t worstresync = 0;
+
+	simReset();
+	platformTimerInit();
+	simAirInit(&air);
+	simNodeInit(&node, "A", &air, 0x0013A200, 0x4000000A, 9600);
+
+	printf("   baud   ready (ms)   resync (ms)   reboot (ms)\n");
+	for(uint8_t bd = 0; bd < sizeof(baudrates)/sizeof(uint32_t); ++bd)
+	{
+		// Factory radio at this rate, nothing stored on the MCU
+		simRadioSet(&node.radio, "AP", 0);
+		simRadioSet(&node.radio, "BD", bd);
+		simRadioSet(&node.radio, "GT", 0x3E8);
+		simRadioReset(&node.radio);
+		xbeeProfileErase();
+		uartSetBaudRate(&node.huart, 9600);
+
+		uint64_t start = simNow;
+		XBEE_STAT stat = xbeeInit(&node.xbee, &node.huart);
+		uint32_t ready = (uint32_t)((simNow - start) / 1000);
+		SIM_CHECK(stat == XBEE_MSG_SETTING_CHANGED);
+		SIM_CHECK(node.huart.Init.BaudRate == baudrates[bd]);
+		SIM_CHECK(node.radio.ap == XBEE_API_MODE);
+		if(ready > worst)
+		{
+			worst = ready;
+		}
+
+		// The UART is left at the rate found, which is probed first
+		SIM_CHECK(xbeeSyncUART(&node.xbee.local));
+		SIM_CHECK(node.xbee.local.synctime < ready);
+		uint32_t resync = node.xbee.local.synctime;
+		if(resync > worstresync)
+		{
+			worstresync = resync;
+		}
+
+		// The guard time was shortened and saved on the first sync
+		SIM_CHECK(node.radio.saved[XBEE_SETTING_GT] == XBEE_FAST_GT);
+		SIM_CHECK(node.xbee.local.settings.GT == XBEE_FAST_GT);
+
+		// MCU reset: nothing stored and the UART back at 9600
+		xbeeProfileErase();
+		uartSetBaudRate(&node.huart, 9600);
+		start = simNow;
+		stat = xbeeInit(&node.xbee, &node.huart);
+		uint32_t reboot = (uint32_t)((simNow - start) / 1000);
+		SIM_CHECK(stat == XBEE_MSG_OK || stat == XBEE_MSG_SETTING_CHANGED);
+		SIM_CHECK(node.huart.Init.BaudRate == baudrates[bd]);
+		SIM_CHECK(reboot < ready);
+		printf("%7lu %12lu %13lu %13lu\n", (unsigned long)baudrates[bd], (unsigned long)ready,
+			   (unsigned long)resync, (unsigned long)reboot);
+	}
+
+	// Probing the whole table from high to low took over 20 s before
+	SIM_CHECK(worst < 20000);
+	printf("worst time to ready: %lu ms\n", (unsigned long)worst);
+
+	// Resynchronizing with the guard time shortened takes a fraction of it
+	SIM_CHECK(worstresync < 500);
+	printf("worst resync: %lu ms\n", (unsigned long)worstresync);
+	return simReport("baud");
+}
@@ -0,0 +1,230 @@
+/*
+Copyright 2018 Jesper Wlivaara
+
+Permission is hereby granted, free of charge, to any person obtaining
+a copy of this software and associated documentation files (the "Software"),
+to deal in the Software without restriction, including without limitation the
+rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is furnished to
+do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all copies
+or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR
+PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE
+FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+
+#include "xbeesim.h"
+#include "platformtimer.h"
+
+/*
+ * Blocks larger than one RF payload between two radios: the rate a block
+ * gets through at against the same bytes sent as plain frames, a block
+ * over a lossy channel, where the missing fragments are sent again, and
+ * a block too large for the arena of the receiver.
+ */
+
+#define FRAG_SH 0x0013A200
+#define FRAG_SL_A 0x4000000A
+#define FRAG_SL_B 0x4000000B
+#define FRAG_BLOCKS 10			// Blocks timed for the rate
+
+static sim_air air;
+static sim_node nodeA;
+static sim_node nodeB;
+static xbee_frag_sender sender;
+static xbee_frag_receiver receiver;
+static uint8_t block[XBEE_FRAG_ARENA];
+static uint8_t toolarge[XBEE_FRAG_ARENA + 1];
+
+// Sending side
+static bool done;
+static uint8_t result;
+static uint32_t acked;
+
+// Receiving side
+static uint32_t blocks;
+static uint32_t intact;
+
+
+static void onDone(xbee_frag_sender *tx, uint8_t status, void *ctx)
+{
+	(void)tx;
+	(void)ctx;
+	result = status;
+	done = true;
+}
+
+
+static void onBlock(xbee_frag_receiver *rx, const uint8_t *data, uint16_t len, void *ctx)
+{
+	(void)rx;
+	(void)ctx;
+	++blocks;
+	if(len == sizeof(block) && memcmp(data, block, len) == 0)
+	{
+		++intact;
+	}
+}
+
+
+static void onSent(xbee_module *xbee, uint8_t frameid, uint8_t status, void *ctx)
+{
+	(void)xbee;
+	(void)frameid;
+	(void)ctx;
+	if(status == XBEE_TXS_SUCCESS)
+	{
+		++acked;
+	}
+}
+
+
+static void onFrameA(xbee_module *xbee, xbee_frame *frame)
+{
+	(void)xbee;
+	xbeeFragSenderHandleFrame(&sender, frame);
+}
+
+
+static void onFrameB(xbee_module *xbee, xbee_frame *frame)
+{
+	(void)xbee;
+	xbeeFragReceive(&receiver, frame);
+}
+
+
+static void run(void)
+{
+	sim_node *nodes[2] = {&nodeA, &nodeB};
+	simNodesRun(nodes, 2, 1000);
+	xbeeFragSenderService(&sender);
+	xbeeFragReceiverService(&receiver);
+}
+
+
+/*
+ *	Sends a block and runs until the sender is done (at most 30 s).
+ *
+ *	@retval Time the transfer took (us)
+ */
+static uint32_t sendBlock(const uint8_t *data, uint16_t len)
+{
+	uint64_t start = simNow;
+	done = false;
+	SIM_CHECK(xbeeFragSend(&sender, &nodeA.xbee.local, FRAG_SH, FRAG_SL_B, 0x0002, data, len, 0, onDone, NULL) == XBEE_MSG_OK);
+	for(uint32_t ms = 0; ms < 30000 && !done; ++ms)
+	{
+		run();
+	}
+	SIM_CHECK(done);
+	return (uint32_t)(simNow - start);
+}
+
+
+/*
+ *	Sends the bytes of a block as plain frames of XBEE_MAX_PAYLOAD bytes,
+ *	keeping the transmit queue full, and runs until all are acknowledged.
+ *
+ *	@retval Time it took (us)
+ */
+static uint32_t sendFrames(uint16_t len)
+{
+	uint32_t frames = (len + XBEE_MAX_PAYLOAD - 1) / XBEE_MAX_PAYLOAD;
+	uint64_t start = simNow;
+	uint32_t queued = 0;
+
+	acked = 0;
+	for(uint32_t ms = 0; ms < 30000 && acked < frames; ++ms)
+	{
+		while(queued < frames && xbeeTransmit16(&nodeA.xbee.local, 0x0002, &block[queued * XBEE_MAX_PAYLOAD],
+				(queued + 1 < frames) ? XBEE_MAX_PAYLOAD : len - queued * XBEE_MAX_PAYLOAD, 0, onSent, NULL, NULL) == XBEE_MSG_OK)
+		{
+			++queued;
+		}
+		run();
+	}
+	SIM_CHECK(acked == frames);
+	return (uint32_t)(simNow - start);
+}
+
+
+static void testRate(void)
+{
+	uint64_t plain = 0;
+	uint64_t fragmented = 0;
+
+	for(int i = 0; i < FRAG_BLOCKS; ++i)
+	{
+		plain += sendFrames(sizeof(block));
+		fragmented += sendBlock(block, sizeof(block));
+		SIM_CHECK(result == XBEE_FRAG_OK);
+	}
+	SIM_CHECK(blocks == FRAG_BLOCKS && intact == FRAG_BLOCKS);
+	SIM_CHECK(sender.resent == 0);
+
+	uint32_t plainrate = (uint32_t)((uint64_t)sizeof(block) * FRAG_BLOCKS * 1000000 / plain);
+	uint32_t fragrate = (uint32_t)((uint64_t)sizeof(block) * FRAG_BLOCKS * 1000000 / fragmented);
+	SIM_CHECK(fragrate * 10 >= plainrate * 8);
+	printf("%u byte block: %lu bytes/s as fragments, %lu bytes/s as plain frames\n", (unsigned)sizeof(block),
+		   (unsigned long)fragrate, (unsigned long)plainrate);
+}
+
+
+static void testLoss(void)
+{
+	blocks = 0;
+	intact = 0;
+	air.loss = 600000;
+	uint32_t took = sendBlock(block, sizeof(block));
+	air.loss = 0;
+	SIM_CHECK(result == XBEE_FRAG_OK);
+	SIM_CHECK(blocks == 1 && intact == 1);
+	SIM_CHECK(sender.macfail > 0 && sender.resent > 0);
+	printf("60%% of tries lost: block in %lu ms, %lu fragments sent, %lu not acknowledged, %lu sent again\n",
+		   (unsigned long)(took / 1000), (unsigned long)sender.fragments, (unsigned long)sender.macfail,
+		   (unsigned long)sender.resent);
+}
+
+
+static void testTooLarge(void)
+{
+	blocks = 0;
+	sendBlock(toolarge, sizeof(toolarge));
+	SIM_CHECK(result == XBEE_FRAG_REFUSED);
+	SIM_CHECK(blocks == 0);
+}
+
+
+int main()
+{
+	simReset();
+	platformTimerInit();
+	simAirInit(&air);
+	simNodeInit(&nodeA, "A", &air, FRAG_SH, FRAG_SL_A, 115200);
+	simNodeInit(&nodeB, "B", &air, FRAG_SH, FRAG_SL_B, 115200);
+	simRadioSet(&nodeA.radio, "BD", 7);
+	simRadioSet(&nodeB.radio, "BD", 7);
+	simRadioSet(&nodeA.radio, "MY", 0x0001);
+	simRadioSet(&nodeB.radio, "MY", 0x0002);
+	simRadioReset(&nodeA.radio);
+	simRadioReset(&nodeB.radio);
+	nodeA.xbee.local.onframe = onFrameA;
+	nodeB.xbee.local.onframe = onFrameB;
+	SIM_CHECK(xbeeInit(&nodeA.xbee, &nodeA.huart) == XBEE_MSG_SETTING_CHANGED);
+	SIM_CHECK(xbeeInit(&nodeB.xbee, &nodeB.huart) == XBEE_MSG_SETTING_CHANGED);
+	xbeeFragReceiverInit(&receiver, &nodeB.xbee.local, onBlock, NULL);
+	for(uint32_t i = 0; i < sizeof(block); ++i)
+	{
+		block[i] = (uint8_t)simRandom();
+	}
+
+	testRate();
+	testLoss();
+	testTooLarge();
+	return simReport("frag");
+}
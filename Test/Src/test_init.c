@@ -0,0 +1,214 @@
+/*
+Copyright 2018 Jesper Wlivaara
+
+Permission is hereby granted, free of charge, to any person obtaining
+a copy of this software and associated documentation files (the "Software"),
+to deal in the Software without restriction, including without limitation the
+rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is furnished to
+do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all copies
+or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR
+PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE
+FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+
+#include "xbeesim.h"
+#include "platformtimer.h"
+
+/*
+ * Bring-up of the local module against the radio model: a factory
+ * default radio, a warm boot from the stored profile, a radio left at
+ * another interface rate, a radio held asleep, RF data between two
+ * radios once they are up, and failed AT Command Responses.
+ */
+
+static sim_air air;
+static sim_node nodeA;
+static sim_node nodeB;
+
+static uint32_t received;
+static uint8_t lastdata[XBEE_MAX_PAYLOAD];
+static uint8_t lastlen;
+static uint8_t txstatus;
+static bool txdone;
+
+
+static void onFrame(xbee_module *xbee, xbee_frame *frame)
+{
+	const uint8_t *data = xbeeRxData(frame, &lastlen);
+	(void)xbee;
+	if(data != NULL)
+	{
+		memcpy(lastdata, data, lastlen);
+		++received;
+	}
+}
+
+
+static void onSent(xbee_module *xbee, uint8_t frameid, uint8_t status, void *ctx)
+{
+	(void)xbee;
+	(void)frameid;
+	(void)ctx;
+	txstatus = status;
+	txdone = true;
+}
+
+
+static void runUntilSent(void)
+{
+	sim_node *nodes[2] = {&nodeA, &nodeB};
+	txdone = false;
+	for(int i = 0; i < 1000 && !txdone; ++i)
+	{
+		simNodesRun(nodes, 2, 1000);
+	}
+	// The receiving side gets its RX Packet at about the same time
+	simNodesRun(nodes, 2, 50000);
+}
+
+
+static void testFactoryRadio(void)
+{
+	simNodeInit(&nodeA, "A", &air, 0x0013A200, 0x4000000A, 9600);
+
+	uint64_t start = simNow;
+	XBEE_STAT stat = xbeeInit(&nodeA.xbee, &nodeA.huart);
+	SIM_CHECK(stat == XBEE_MSG_SETTING_CHANGED);
+	SIM_CHECK(nodeA.radio.ap == XBEE_API_MODE);
+	SIM_CHECK(nodeA.radio.saved[XBEE_SETTING_AP] == XBEE_API_MODE);
+	SIM_CHECK(!nodeA.radio.cmdmode);
+	SIM_CHECK(nodeA.radio.garbled == 0);
+	printf("factory radio at 9600: %lu ms\n", (unsigned long)((simNow - start) / 1000));
+
+	// Second start up comes back on the stored profile, no command mode
+	uint32_t entries = nodeA.radio.cmdentries;
+	start = simNow;
+	stat = xbeeInit(&nodeA.xbee, &nodeA.huart);
+	SIM_CHECK(stat == XBEE_MSG_OK);
+	SIM_CHECK(nodeA.xbee.local.init.warm);
+	SIM_CHECK(nodeA.radio.cmdentries == entries);
+	printf("warm boot: %lu ms\n", (unsigned long)((simNow - start) / 1000));
+}
+
+
+static void testBaudMismatch(void)
+{
+	xbeeProfileErase();
+	simRadioSet(&nodeA.radio, "BD", 7);
+	simRadioReset(&nodeA.radio);
+	SIM_CHECK(nodeA.radio.baud == 115200);
+
+	XBEE_STAT stat = xbeeInit(&nodeA.xbee, &nodeA.huart);
+	SIM_CHECK(stat == XBEE_MSG_OK || stat == XBEE_MSG_SETTING_CHANGED);
+	SIM_CHECK(nodeA.huart.Init.BaudRate == nodeA.radio.baud);
+	SIM_CHECK(nodeA.radio.garbled > 0);
+	printf("radio at 115200, UART at 9600: synced at %lu\n", (unsigned long)nodeA.huart.Init.BaudRate);
+}
+
+
+static void testSleepingRadio(void)
+{
+	xbeeProfileErase();
+	simRadioSet(&nodeA.radio, "SM", 1);
+	simRadioReset(&nodeA.radio);
+	simRadioSetSleepRq(&nodeA.radio, true);
+
+	XBEE_STAT stat = xbeeInit(&nodeA.xbee, &nodeA.huart);
+	SIM_CHECK(stat == XBEE_ERR_UART_SYNC);
+	SIM_CHECK(nodeA.radio.asleepbytes > 0);
+
+	simRadioSetSleepRq(&nodeA.radio, false);
+	stat = xbeeInit(&nodeA.xbee, &nodeA.huart);
+	SIM_CHECK(stat == XBEE_MSG_OK || stat == XBEE_MSG_SETTING_CHANGED);
+	simRadioSet(&nodeA.radio, "SM", 0);
+	simRadioReset(&nodeA.radio);
+}
+
+
+static void testRfData(void)
+{
+	const uint8_t hello[5] = {'h', 'e', 'l', 'l', 'o'};
+	uint8_t frameid;
+
+	simNodeInit(&nodeB, "B", &air, 0x0013A200, 0x4000000B, 9600);
+	simRadioSet(&nodeB.radio, "MY", 0x0002);
+	simRadioReset(&nodeB.radio);
+	nodeB.xbee.local.onframe = onFrame;
+	XBEE_STAT stat = xbeeInit(&nodeB.xbee, &nodeB.huart);
+	SIM_CHECK(stat == XBEE_MSG_SETTING_CHANGED);
+
+	SIM_CHECK(xbeeTransmit16(&nodeA.xbee.local, 0x0002, hello, sizeof(hello), 0, onSent, NULL, &frameid) == XBEE_MSG_OK);
+	runUntilSent();
+	SIM_CHECK(txdone && txstatus == XBEE_TXS_SUCCESS);
+	SIM_CHECK(received == 1 && lastlen == sizeof(hello) && memcmp(lastdata, hello, sizeof(hello)) == 0);
+
+	// Nobody has MY = 0x0099, the MAC retries run out
+	SIM_CHECK(xbeeTransmit16(&nodeA.xbee.local, 0x0099, hello, sizeof(hello), 0, onSent, NULL, &frameid) == XBEE_MSG_OK);
+	runUntilSent();
+	SIM_CHECK(txdone && txstatus == XBEE_TXS_NOACK);
+	SIM_CHECK(received == 1);
+}
+
+
+/*
+ *	Feeds the local module an AT Command Response (0x88) as if the radio
+ *	had sent it.
+ */
+static void feedATResponse(const char *cmd, uint8_t status)
+{
+	uint8_t frame[5] = {XBEE_API_AT_RESPONSE, 0x01, (uint8_t)cmd[0], (uint8_t)cmd[1], status};
+	uint8_t raw[16];
+	uint16_t len = xbeeEncodeFrame(raw, sizeof(raw), frame, sizeof(frame));
+	xbeeParseBytes(&nodeA.xbee.local, raw, len);
+}
+
+
+static bool isDirty(const char *cmd)
+{
+	uint8_t idx = xbeeFindSetting(cmd) - xbeeSettingTable;
+	return (nodeA.xbee.local.dirty[idx/32] & (1UL << (idx%32))) != 0;
+}
+
+
+static void testFailedResponses(void)
+{
+	// A read or query that fails leaves the mirror alone
+	feedATResponse("NI", 0x01);
+	SIM_CHECK(!isDirty("NI"));
+
+	// A write of the mirror that fails is sent again by the next sync
+	nodeA.xbee.local.settings.CH = 0x0F;
+	xbeeMarkDirty(&nodeA.xbee.local, xbeeFindSetting("CH") - xbeeSettingTable);
+	SIM_CHECK(xbeeSyncSettings(&nodeA.xbee.local) == XBEE_MSG_OK);
+	SIM_CHECK(!isDirty("CH"));
+	feedATResponse("CH", 0x03);
+	SIM_CHECK(isDirty("CH"));
+
+	// Only once, the failure of a later read of it is no write
+	SIM_CHECK(xbeeSyncSettings(&nodeA.xbee.local) == XBEE_MSG_OK);
+	feedATResponse("CH", 0x00);
+	feedATResponse("CH", 0x01);
+	SIM_CHECK(!isDirty("CH"));
+}
+
+
+int main()
+{
+	simReset();
+	platformTimerInit();
+	simAirInit(&air);
+
+	testFactoryRadio();
+	testBaudMismatch();
+	testSleepingRadio();
+	testRfData();
+	testFailedResponses();
+	return simReport("init");
+}
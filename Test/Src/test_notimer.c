@@ -0,0 +1,111 @@
+/*
+Copyright 2018 Jesper Wlivaara
+
+Permission is hereby granted, free of charge, to any person obtaining
+a copy of this software and associated documentation files (the "Software"),
+to deal in the Software without restriction, including without limitation the
+rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is furnished to
+do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all copies
+or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR
+PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE
+FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+
+#include "xbeesim.h"
+#include "platformtimer.h"
+
+/*
+ * Every wait of the driver with platformTimerInit() never called: the
+ * timers fall back to the HAL tick, so the blocking command mode helpers
+ * and the bring-up still time out and finish instead of hanging. Then
+ * the same bring-up on the HAL tick and on the timer service, with the
+ * wake ups and the time asleep of each. The busy-wait the timer service
+ * replaced spent all of that time awake.
+ */
+
+static sim_air air;
+static sim_node node;
+
+
+/*
+ *	Brings a radio with API mode off up from scratch and prints how the
+ *	waiting was spent. A busy-wait would have kept the core awake for all
+ *	of it.
+ *
+ *	@retval Timer service counters of the bring-up alone
+ */
+static platform_timer_stats bringUp(const char *name)
+{
+	xbeeProfileErase();
+	simRadioSet(&node.radio, "AP", 0);
+	simRadioReset(&node.radio);
+
+	platform_timer_stats before = platformTimerStats;
+	uint64_t start = simNow;
+	uint32_t tick = HAL_GetTick();
+	SIM_CHECK(xbeeInit(&node.xbee, &node.huart) == XBEE_MSG_SETTING_CHANGED);
+	uint32_t elapsed = (uint32_t)(simNow - start);
+
+	// The HAL tick kept up with the time, stopped SysTick or not
+	uint32_t ticked = HAL_GetTick() - tick;
+	SIM_CHECK(ticked + 1 >= elapsed / 1000 && ticked <= elapsed / 1000 + 1);
+
+	platform_timer_stats used;
+	used.wakeups = platformTimerStats.wakeups - before.wakeups;
+	used.sleepus = platformTimerStats.sleepus - before.sleepus;
+	used.ticklessms = platformTimerStats.ticklessms - before.ticklessms;
+	used.expired = platformTimerStats.expired - before.expired;
+	printf("%-13s %5lu ms, asleep %5lu ms (%lu%%), %5lu wakeups, %5lu tickless ms\n", name,
+		   (unsigned long)(elapsed / 1000), (unsigned long)(used.sleepus / 1000),
+		   (unsigned long)(used.sleepus / (elapsed / 100)), (unsigned long)used.wakeups,
+		   (unsigned long)used.ticklessms);
+	return used;
+}
+
+
+int main()
+{
+	simReset();
+	simAirInit(&air);
+	simNodeInit(&node, "A", &air, 0x0013A200, 0x4000000A, 9600);
+	node.xbee.local.hxbee = &node.huart;
+	xbeeSetDefaultValues(&node.xbee.local);
+
+	// Blocking sync, then command mode with replies read line by line
+	SIM_CHECK(xbeeSyncUART(&node.xbee.local));
+	SIM_CHECK(xbeeEnsureAPIMode(&node.xbee.local) == XBEE_MSG_SETTING_CHANGED);
+	SIM_CHECK(node.radio.ap == XBEE_API_MODE);
+	SIM_CHECK(xbeeReadSettings(&node.xbee.local) == XBEE_MSG_OK);
+	SIM_CHECK(node.xbee.local.settings.SL == 0x4000000A);
+
+	// A radio that never answers runs into the timeouts
+	simRadioSetSleepRq(&node.radio, true);
+	simRadioSet(&node.radio, "SM", 1);
+	simRadioReset(&node.radio);
+	uint64_t start = simNow;
+	SIM_CHECK(!xbeeSyncUART(&node.xbee.local));
+	printf("sync timed out after %lu ms\n", (unsigned long)((simNow - start) / 1000));
+
+	// Non-blocking bring-up
+	simRadioSetSleepRq(&node.radio, false);
+	SIM_CHECK(xbeeInit(&node.xbee, &node.huart) == XBEE_MSG_OK);
+	SIM_CHECK(platformTimerStats.expired > 0);
+
+	// Cold bring-up on the HAL tick, then on the timer service
+	platform_timer_stats tick = bringUp("HAL tick");
+	platformTimerInit();
+	platform_timer_stats timer = bringUp("timer service");
+	SIM_CHECK(timer.expired > 0);
+	SIM_CHECK(timer.wakeups < tick.wakeups);
+	SIM_CHECK(timer.ticklessms > 0 && tick.ticklessms == 0);
+	SIM_CHECK(timer.sleepus >= tick.sleepus);
+	SIM_CHECK(timer.wakeups * 20 < tick.wakeups);
+	return simReport("notimer");
+}
@@ -0,0 +1,69 @@
+/*
+Copyright 2018 Jesper Wlivaara
+
+Permission is hereby granted, free of charge, to any person obtaining
+a copy of this software and associated documentation files (the "Software"),
+to deal in the Software without restriction, including without limitation the
+rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is furnished to
+do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all copies
+or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR
+PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE
+FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+
+#include "xbeesim.h"
+
+/*
+ * Link profile page shared by two radios: one radio saving over and over
+ * fills the page up, and the erase that follows must keep the profile of
+ * the other radio.
+ */
+
+static sim_uart uartA;
+static sim_uart uartB;
+static UART_HandleTypeDef huartA;
+static UART_HandleTypeDef huartB;
+static xbee_module xbeeA;
+static xbee_module xbeeB;
+
+
+int main()
+{
+	xbee_profile profile;
+
+	simReset();
+	simUartInit(&uartA, &huartA, 115200, true);
+	simUartInit(&uartB, &huartB, 9600, true);
+	xbeeA.hxbee = &huartA;
+	xbeeB.hxbee = &huartB;
+	xbeeSetDefaultValues(&xbeeA);
+	xbeeSetDefaultValues(&xbeeB);
+	xbeeProfileErase();
+
+	xbeeB.settings.GT = 0x123;
+	SIM_CHECK(xbeeProfileSave(&xbeeB));
+
+	// Every save with changed settings takes a slot, go round the page twice
+	for(uint16_t i = 0; i < 2*XBEE_PROFILE_SLOTS; ++i)
+	{
+		xbeeA.settings.GT = 0x200 + i;
+		SIM_CHECK(xbeeProfileSave(&xbeeA));
+		SIM_CHECK(xbeeProfileLoad(&profile, &huartA) && profile.settings.GT == 0x200 + i);
+		SIM_CHECK(xbeeProfileLoad(&profile, &huartB) && profile.settings.GT == 0x123 && profile.baud == 9600);
+	}
+	SIM_CHECK(xbeeProfileUsed() <= XBEE_PROFILE_SLOTS);
+	printf("%u slots of %u bytes, %u in use\n", (unsigned)XBEE_PROFILE_SLOTS, (unsigned)XBEE_PROFILE_SLOT,
+		   (unsigned)xbeeProfileUsed());
+
+	xbeeProfileErase();
+	SIM_CHECK(!xbeeProfileLoad(&profile, &huartA));
+	SIM_CHECK(!xbeeProfileLoad(&profile, &huartB));
+	return simReport("profile");
+}
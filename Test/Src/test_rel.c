@@ -0,0 +1,223 @@
+/*
+Copyright 2018 Jesper Wlivaara
+
+Permission is hereby granted, free of charge, to any person obtaining
+a copy of this software and associated documentation files (the "Software"),
+to deal in the Software without restriction, including without limitation the
+rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is furnished to
+do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all copies
+or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR
+PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE
+FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+
+#include "xbeesim.h"
+#include "platformtimer.h"
+
+/*
+ * Reliable links between two radios, across a restart of either end:
+ * frames queued after one end starts its link over still arrive, in
+ * order, and neither end gives the link up.
+ */
+
+#define REL_SH 0x0013A200
+#define REL_SL_A 0x4000000A
+#define REL_SL_B 0x4000000B
+
+static sim_air air;
+static sim_node nodeA;
+static sim_node nodeB;
+static xbee_rel_link linkA;
+static xbee_rel_link linkB;
+
+// Frames delivered on each link, each carries its number
+typedef struct {
+	uint32_t count;
+	uint8_t last;
+	uint32_t outoforder;
+} rel_sink;
+
+static rel_sink sinkA;
+static rel_sink sinkB;
+
+
+static void onRel(xbee_rel_link *link, const uint8_t *data, uint8_t len, void *ctx)
+{
+	rel_sink *sink = (rel_sink *)ctx;
+	(void)link;
+	if(len == 0 || (sink->count > 0 && data[0] != (uint8_t)(sink->last + 1)))
+	{
+		++sink->outoforder;
+	}
+	sink->last = data[0];
+	++sink->count;
+}
+
+
+static void onFrameA(xbee_module *xbee, xbee_frame *frame)
+{
+	(void)xbee;
+	xbeeRelHandleFrame(&linkA, frame);
+}
+
+
+static void onFrameB(xbee_module *xbee, xbee_frame *frame)
+{
+	(void)xbee;
+	xbeeRelHandleFrame(&linkB, frame);
+}
+
+
+static void run(uint32_t ms)
+{
+	sim_node *nodes[2] = {&nodeA, &nodeB};
+	for(uint32_t i = 0; i < ms; ++i)
+	{
+		simNodesRun(nodes, 2, 1000);
+		xbeeRelService(&linkA);
+		xbeeRelService(&linkB);
+	}
+}
+
+
+static void linkInitA(void)
+{
+	xbeeRelInit(&linkA, &nodeA.xbee.local, REL_SH, REL_SL_B, 0x0002, 4, 0, onRel, &sinkA);
+}
+
+
+static void linkInitB(void)
+{
+	xbeeRelInit(&linkB, &nodeB.xbee.local, REL_SH, REL_SL_A, 0x0001, 4, 0, onRel, &sinkB);
+}
+
+
+/*
+ *	Sends "count" frames numbered from "first" and waits until they are
+ *	acknowledged (at most 5 s).
+ */
+static void sendFrames(xbee_rel_link *link, uint8_t first, uint8_t count)
+{
+	uint8_t data[20];
+	uint32_t waited = 0;
+
+	memset(data, 0, sizeof(data));
+	for(uint8_t i = 0; i < count && waited < 5000; )
+	{
+		data[0] = first + i;
+		if(xbeeRelSend(link, data, sizeof(data)) == XBEE_MSG_OK)
+		{
+			++i;
+		}
+		else
+		{
+			run(1);
+			++waited;
+		}
+	}
+	while(xbeeRelPending(link) > 0 && !link->broken && waited < 5000)
+	{
+		run(1);
+		++waited;
+	}
+}
+
+
+static void testSetup(void)
+{
+	// At 9600 baud a window of frames takes longer on the UART than
+	// XBEE_REL_RTO, the links run at 115200
+	simNodeInit(&nodeA, "A", &air, REL_SH, REL_SL_A, 115200);
+	simNodeInit(&nodeB, "B", &air, REL_SH, REL_SL_B, 115200);
+	simRadioSet(&nodeA.radio, "BD", 7);
+	simRadioSet(&nodeB.radio, "BD", 7);
+	simRadioSet(&nodeA.radio, "MY", 0x0001);
+	simRadioSet(&nodeB.radio, "MY", 0x0002);
+	simRadioReset(&nodeA.radio);
+	simRadioReset(&nodeB.radio);
+	nodeA.xbee.local.onframe = onFrameA;
+	nodeB.xbee.local.onframe = onFrameB;
+	SIM_CHECK(xbeeInit(&nodeA.xbee, &nodeA.huart) == XBEE_MSG_SETTING_CHANGED);
+	SIM_CHECK(xbeeInit(&nodeB.xbee, &nodeB.huart) == XBEE_MSG_SETTING_CHANGED);
+	linkInitA();
+	linkInitB();
+}
+
+
+static void testSteady(void)
+{
+	// Far enough that the sequence numbers are well past the window
+	sendFrames(&linkA, 0, 60);
+	SIM_CHECK(!linkA.broken && xbeeRelPending(&linkA) == 0);
+	SIM_CHECK(sinkB.count == 60 && sinkB.last == 59 && sinkB.outoforder == 0);
+	printf("60 frames A to B: %lu sent, %lu retransmitted\n",
+		   (unsigned long)linkA.sentframes, (unsigned long)linkA.retransmits);
+}
+
+
+static void testReceiverRestart(void)
+{
+	// B starts over while A goes on at sequence number 60
+	linkInitB();
+	sendFrames(&linkA, 60, 5);
+	SIM_CHECK(!linkA.broken && xbeeRelPending(&linkA) == 0);
+	SIM_CHECK(sinkB.count == 65 && sinkB.last == 64 && sinkB.outoforder == 0);
+
+	// And B can send on its new link
+	sendFrames(&linkB, 0, 5);
+	SIM_CHECK(!linkB.broken && xbeeRelPending(&linkB) == 0);
+	SIM_CHECK(sinkA.count == 5 && sinkA.last == 4 && sinkA.outoforder == 0);
+}
+
+
+static void testSenderRestart(void)
+{
+	// A starts over, B still has the old link of A
+	linkInitA();
+	sendFrames(&linkA, 65, 5);
+	SIM_CHECK(!linkA.broken && xbeeRelPending(&linkA) == 0);
+	SIM_CHECK(sinkB.count == 70 && sinkB.last == 69 && sinkB.outoforder == 0);
+
+	// B goes on at sequence number 5, the new link of A takes it
+	sendFrames(&linkB, 5, 5);
+	SIM_CHECK(!linkB.broken && xbeeRelPending(&linkB) == 0);
+	SIM_CHECK(sinkA.count == 10 && sinkA.last == 9 && sinkA.outoforder == 0);
+}
+
+
+static void testLossyRestart(void)
+{
+	// Restart with frames in flight, and lost on the air even after the
+	// MAC retries
+	air.loss = 400000;
+	sendFrames(&linkA, 70, 30);
+	linkInitB();
+	sendFrames(&linkA, 100, 30);
+	SIM_CHECK(!linkA.broken && xbeeRelPending(&linkA) == 0);
+	SIM_CHECK(sinkB.last == 129);
+	air.loss = 0;
+	printf("with 40%% loss: %lu retransmitted, %lu duplicates\n",
+		   (unsigned long)linkA.retransmits, (unsigned long)linkB.duplicates);
+}
+
+
+int main()
+{
+	simReset();
+	platformTimerInit();
+	simAirInit(&air);
+
+	testSetup();
+	testSteady();
+	testReceiverRestart();
+	testSenderRestart();
+	testLossyRestart();
+	return simReport("rel");
+}
@@ -0,0 +1,258 @@
+/*
+Copyright 2018 Jesper Wlivaara
+
+Permission is hereby granted, free of charge, to any person obtaining
+a copy of this software and associated documentation files (the "Software"),
+to deal in the Software without restriction, including without limitation the
+rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is furnished to
+do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all copies
+or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR
+PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE
+FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+
+#include "xbeesim.h"
+#include "platformtimer.h"
+
+/*
+ * Receive path of miscfunc.c under burst traffic at 230400 baud: a far
+ * end sends bursts of random length with random gaps while the main loop
+ * is busy for random stretches between reads. Every byte has to arrive,
+ * in order, with reception never stopped. A reader that stalls for longer
+ * than the ring holds loses the oldest bytes, counted as overruns, and
+ * goes on in order after them. Last, a ring and a queue whose sizes are
+ * not powers of two carry a stream across the wrap of their byte counters.
+ */
+
+#define STRESS_BAUD 230400
+#define STRESS_BYTES 200000
+#define STRESS_RING 256
+
+static UART_HandleTypeDef huart;
+static sim_uart uart;
+static sim_serial far;
+static uart_rxring ring;
+static uint8_t ringdata[STRESS_RING];
+
+static uint32_t written;	// Bytes handed to the far end
+static uint32_t received;	// Bytes read by the main loop
+static uint32_t mismatches;
+static uint16_t deepest;	// Most bytes waiting at a read
+
+static UART_HandleTypeDef txhuart;
+static sim_uart txuart;
+static uart_txqueue txqueue;
+static uint8_t txdata[UART_TXBUF_SIZE];
+static uint32_t txreceived;	// Bytes sent on txuart that arrived at the far end
+
+
+// Byte number "i" of the stream, a plain counter would hide a lap of the ring
+static uint8_t streamByte(uint32_t i)
+{
+	return (uint8_t)(i ^ (i >> 8) ^ (i >> 16));
+}
+
+
+// Queues the next burst at the far end while it has room for one
+static void feed(uint32_t total)
+{
+	uint8_t burst[1024];
+
+	while(written < total && simSerialPending(&far) < SIM_SERIAL_QUEUE - sizeof(burst))
+	{
+		uint16_t len = 1 + simRandom() % sizeof(burst);
+		if(len > total - written)
+		{
+			len = total - written;
+		}
+		for(uint16_t i = 0; i < len; ++i)
+		{
+			burst[i] = streamByte(written + i);
+		}
+		simSerialWrite(&far, burst, len, STRESS_BAUD);
+		written += len;
+		if(simRandom() % 4 == 0)
+		{
+			// Lets the queue run dry, the line goes quiet until the next call
+			break;
+		}
+	}
+}
+
+
+// Takes every byte waiting, the ring position tells which stream byte it is
+static void drain(void)
+{
+	uint8_t data[STRESS_RING];
+	uint16_t avail = uartRxAvailable(&ring);
+
+	if(avail > deepest)
+	{
+		deepest = avail;
+	}
+	uint32_t first = ring.consumed;
+	uint16_t n = uartRxRead(&ring, data, sizeof(data));
+	for(uint16_t i = 0; i < n; ++i)
+	{
+		if(data[i] != streamByte(first + i))
+		{
+			++mismatches;
+		}
+	}
+	received += n;
+}
+
+
+/*
+ *	Runs the main loop until the far end has sent "total" bytes and they
+ *	are read. Between reads the loop is busy for up to "busy" us, or
+ *	sleeps until the next interrupt.
+ */
+static void runStream(uint32_t total, uint32_t busy)
+{
+	while(received + ring.overruns < total)
+	{
+		feed(total);
+		if(simRandom() % 2 == 0)
+		{
+			simRunFor(simRandom() % busy);
+		}
+		else
+		{
+			platformSleep();
+		}
+		drain();
+	}
+}
+
+
+static void testBursts(void)
+{
+	uint64_t start = simNow;
+
+	runStream(STRESS_BYTES, 4000);
+	SIM_CHECK(received == STRESS_BYTES);
+	SIM_CHECK(mismatches == 0);
+	SIM_CHECK(ring.overruns == 0);
+	SIM_CHECK(uart.rxlost == 0);
+	SIM_CHECK(uart.rxgarbled == 0);
+	SIM_CHECK(far.dropped == 0);
+	printf("%lu bytes at %lu baud in %lu ms, at most %u of %u ring bytes waiting\n",
+		   (unsigned long)received, (unsigned long)STRESS_BAUD, (unsigned long)((simNow - start) / 1000),
+		   deepest, STRESS_RING);
+}
+
+
+static void testStalledReader(void)
+{
+	uint32_t before = received;
+	uint32_t total = written + 4000;
+
+	// A 256 byte ring holds 11 ms at 230400 baud, the reader stalls for 30 ms
+	feed(total);
+	simRunFor(30000);
+	drain();
+	SIM_CHECK(ring.overruns > 0);
+	runStream(total, 1000);
+	SIM_CHECK(mismatches == 0);
+	SIM_CHECK(received - before + ring.overruns == 4000);
+	SIM_CHECK(uart.rxlost == 0);
+	printf("reader stalled for 30 ms: %lu bytes overrun\n", (unsigned long)ring.overruns);
+}
+
+
+// Far end of txuart, checks every byte against the stream
+static void collect(void *ctx, uint8_t byte, uint32_t baud)
+{
+	(void)ctx;
+	(void)baud;
+	if(byte != streamByte(txreceived++))
+	{
+		++mismatches;
+	}
+}
+
+
+static void testCounterWrap(void)
+{
+	const uint32_t start = 0xFFFFFF00;
+	uint8_t rxdata[UART_RXBUF_SIZE];
+	uart_rxring soft = {.data = rxdata, .size = sizeof(rxdata), .produced = start, .consumed = start};
+	uint16_t put = 0;
+	uint32_t total = 0;
+
+	// Receive ring fed by software, read in random pieces
+	mismatches = 0;
+	while(total < 4000)
+	{
+		uint16_t len = 1 + simRandom() % sizeof(rxdata);
+		for(uint16_t i = 0; i < len; ++i)
+		{
+			rxdata[put] = streamByte(total + i);
+			put = (put + 1) % sizeof(rxdata);
+		}
+		soft.produced += len;
+
+		uint8_t data[UART_RXBUF_SIZE];
+		uint16_t n = uartRxRead(&soft, data, sizeof(data));
+		for(uint16_t i = 0; i < n; ++i)
+		{
+			if(data[i] != streamByte(total + i))
+			{
+				++mismatches;
+			}
+		}
+		total += n;
+	}
+	SIM_CHECK(soft.consumed - start == total && soft.consumed < start);
+	SIM_CHECK(soft.overruns == 0 && mismatches == 0);
+
+	// Transmit queue kept full
+	simUartInit(&txuart, &txhuart, STRESS_BAUD, true);
+	simUartConnect(&txuart, collect, NULL);
+	SIM_CHECK(uartTxInit(&txqueue, &txhuart, txdata, sizeof(txdata)));
+	txqueue.written = txqueue.sent = start;
+	mismatches = 0;
+	total = 0;
+	while(total < 4000)
+	{
+		uint8_t data[100];
+		uint16_t len = 1 + simRandom() % sizeof(data);
+		for(uint16_t i = 0; i < len; ++i)
+		{
+			data[i] = streamByte(total + i);
+		}
+		while(uartTxWrite(&txhuart, data, len) != UART_TX_OK)
+		{
+			simRunFor(1000);
+		}
+		total += len;
+	}
+	SIM_CHECK(uartTxFlush(&txhuart, 1000));
+	SIM_CHECK(txqueue.sent - start == total && txqueue.sent < start);
+	SIM_CHECK(txreceived == total && mismatches == 0);
+	printf("counters wrapped: %u byte ring, %u byte queue\n", (unsigned)sizeof(rxdata), (unsigned)sizeof(txdata));
+}
+
+
+int main()
+{
+	simReset();
+	simSeed(2);
+	platformTimerInit();
+	simUartInit(&uart, &huart, STRESS_BAUD, true);
+	simSerialInit(&far, simUartReceive, &uart);
+	SIM_CHECK(uartRxStart(&ring, &huart, ringdata, sizeof(ringdata)));
+
+	testBursts();
+	testStalledReader();
+	testCounterWrap();
+	return simReport("uart");
+}
@@ -0,0 +1,167 @@
+/*
+Copyright 2018 Jesper Wlivaara
+
+Permission is hereby granted, free of charge, to any person obtaining
+a copy of this software and associated documentation files (the "Software"),
+to deal in the Software without restriction, including without limitation the
+rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is furnished to
+do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all copies
+or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR
+PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE
+FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+
+#include "xbeesim.h"
+#include "platformtimer.h"
+
+/*
+ * Throughput of a sensor uplink by TX window: one node sends 80 byte
+ * frames to another as fast as the transmit queue takes them, with 1 to
+ * XBEE_TX_WINDOW frames allowed to wait for their TX Status. At 9600
+ * baud the UART is the bottleneck whatever the window, at the higher
+ * rates a window keeps the radio busy while earlier frames wait for their
+ * MAC acknowledgement, until the UART is the bottleneck again. The urgent
+ * class is used, bulk frames are capped at XBEE_TX_BULK_INFLIGHT in flight.
+ */
+
+#define WINDOW_FRAMES 300
+#define WINDOW_PAYLOAD 80
+
+// The same two nodes are brought up at each rate
+static sim_air air;
+static sim_node txnode;
+static sim_node rxnode;
+
+static uint32_t acked;
+static uint32_t failed;
+static uint32_t received;
+
+
+static void onSent(xbee_module *xbee, uint8_t frameid, uint8_t status, void *ctx)
+{
+	(void)xbee;
+	(void)frameid;
+	(void)ctx;
+	if(status == XBEE_TXS_SUCCESS)
+	{
+		++acked;
+	}
+	else
+	{
+		++failed;
+	}
+}
+
+
+static void onFrame(xbee_module *xbee, xbee_frame *frame)
+{
+	uint8_t len;
+	(void)xbee;
+	if(xbeeRxData(frame, &len) != NULL)
+	{
+		++received;
+	}
+}
+
+
+static void pairInit(uint8_t bd)
+{
+	simAirInit(&air);
+	simNodeInit(&txnode, "TX", &air, 0x0013A200, 0x4000000A, baudrates[bd]);
+	simNodeInit(&rxnode, "RX", &air, 0x0013A200, 0x4000000B, baudrates[bd]);
+	simRadioSet(&txnode.radio, "BD", bd);
+	simRadioSet(&rxnode.radio, "BD", bd);
+	simRadioSet(&txnode.radio, "MY", 0x0001);
+	simRadioSet(&rxnode.radio, "MY", 0x0002);
+	simRadioReset(&txnode.radio);
+	simRadioReset(&rxnode.radio);
+	rxnode.xbee.local.onframe = onFrame;
+	xbeeProfileErase();
+	SIM_CHECK(xbeeInit(&txnode.xbee, &txnode.huart) == XBEE_MSG_SETTING_CHANGED);
+	SIM_CHECK(xbeeInit(&rxnode.xbee, &rxnode.huart) == XBEE_MSG_SETTING_CHANGED);
+}
+
+
+/*
+ *	Sends WINDOW_FRAMES frames with "window" in flight.
+ *
+ *	@retval Frames per second, from the first send to the last TX Status
+ */
+static uint32_t pairRun(uint8_t window)
+{
+	sim_node *nodes[2] = {&txnode, &rxnode};
+	uint8_t data[WINDOW_PAYLOAD];
+	uint32_t sent = 0;
+
+	memset(data, 0x5A, sizeof(data));
+	xbeeTxSetWindow(&txnode.xbee.local, window);
+	acked = 0;
+	failed = 0;
+	received = 0;
+
+	uint64_t start = simNow;
+	while(acked + failed < WINDOW_FRAMES && simNow - start < 60000000)
+	{
+		while(sent < WINDOW_FRAMES &&
+			  xbeeTransmit16(&txnode.xbee.local, 0x0002, data, sizeof(data), XBEE_TXOPT_URGENT,
+							 onSent, NULL, NULL) == XBEE_MSG_OK)
+		{
+			++sent;
+		}
+		simNodesRun(nodes, 2, 100);
+	}
+	uint64_t elapsed = simNow - start;
+
+	// The last RX Packet is on its way to the receiving MCU
+	simNodesRun(nodes, 2, 200000);
+	SIM_CHECK(acked == WINDOW_FRAMES && failed == 0);
+	SIM_CHECK(received == WINDOW_FRAMES);
+
+	// With one frame in flight the others wait in the queue, which the TX
+	// latency leaves out
+	xbee_stats *stats = &txnode.xbee.local.stats;
+	if(window == 1)
+	{
+		SIM_CHECK(stats->txlatency.max < stats->txqueue[XBEE_TX_URGENT].max);
+	}
+	return (uint32_t)((uint64_t)acked * 1000000 / elapsed);
+}
+
+
+int main()
+{
+	uint8_t windows[4] = {1, 2, 4, 8};
+	uint8_t rates[3] = {3, 7, 8};	// BD: 9600, 115200 and 230400 baud
+	uint32_t fps[3][4];
+
+	simReset();
+	platformTimerInit();
+	for(uint8_t r = 0; r < sizeof(rates); ++r)
+	{
+		pairInit(rates[r]);
+		for(uint8_t i = 0; i < sizeof(windows); ++i)
+		{
+			fps[r][i] = pairRun(windows[i]);
+		}
+	}
+
+	printf("window   9600 baud   115200 baud   230400 baud (frames/s)\n");
+	for(uint8_t i = 0; i < sizeof(windows); ++i)
+	{
+		printf("%6u %11lu %13lu %13lu\n", windows[i], (unsigned long)fps[0][i], (unsigned long)fps[1][i],
+			   (unsigned long)fps[2][i]);
+	}
+
+	// Send-and-wait is what limits the fast links
+	SIM_CHECK(fps[1][1] > fps[1][0] * 3 / 2);
+	SIM_CHECK(fps[2][2] > fps[2][0] * 3 / 2);
+	SIM_CHECK(fps[2][3] * 100 >= fps[2][2] * 95);
+	return simReport("window");
+}
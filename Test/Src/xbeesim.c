@@ -0,0 +1,1324 @@
+/*
+Copyright 2018 Jesper Wlivaara
+
+Permission is hereby granted, free of charge, to any person obtaining
+a copy of this software and associated documentation files (the "Software"),
+to deal in the Software without restriction, including without limitation the
+rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is furnished to
+do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all copies
+or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR
+PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE
+FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+
+#include "xbeesim.h"
+#include "ctype.h"
+
+/*
+ * Behavioural model of the XBee S2C with the 802.15.4 firmware, as far
+ * as the driver can tell it apart from the real module. Timing follows
+ * the user guide: the command sequence needs GT of silence on both sides,
+ * command mode times out after CT, and changes take effect with AC, CN
+ * or an AT Command frame. RF frames take their airtime at 250 kbit/s
+ * after a random CSMA backoff, and unicast frames are retried by the MAC
+ * until they are acknowledged.
+ */
+
+// AT command status, as in the AT Command Response frame
+#define SIM_AT_OK			0x0
+#define SIM_AT_ERROR		0x1
+#define SIM_AT_INVALID_CMD	0x2
+#define SIM_AT_INVALID_PARAM	0x3
+
+// Remote AT status of a module that could not be reached
+#define SIM_AT_TX_FAILURE	0x4
+
+// MAC tries of a unicast frame (first try and 3 retries) per XBee retry (RR)
+#define SIM_MAC_TRIES 4
+
+// 802.15.4 timing at 250 kbit/s
+#define SIM_RF_BYTE_US 32		// One byte on the air
+#define SIM_RF_PHY_BYTES 6		// Preamble, SFD and length
+#define SIM_RF_BACKOFF_US 320	// Unit backoff period
+#define SIM_RF_CCA_US 128
+#define SIM_RF_ACK_US 544		// Turnaround and ACK frame
+
+// Remote AT requests a radio can have on the air at once
+#define SIM_RAT_SLOTS 8
+
+// RSSI the model reports for every received frame (-dBm)
+#define SIM_RSSI 0x28
+
+// Factory defaults that are not 0
+static const struct {
+	char cmd[3];
+	uint64_t value;
+} simDefaults[] = {
+	{"CH", 0x0C}, {"ID", 0x3332}, {"NT", 0x19}, {"SC", 0x1FFE}, {"SD", 0x04},
+	{"PL", 0x04}, {"PM", 0x01}, {"CA", 0x2C}, {"ST", 0x1388}, {"DP", 0x3E8},
+	{"BD", 0x03}, {"RO", 0x03}, {"D7", 0x01}, {"D5", 0x01}, {"P0", 0x01},
+	{"P2", 0x01}, {"PR", 0x1FFF}, {"PD", 0x1FFF}, {"IU", 0x01}, {"IT", 0x01},
+	{"RP", 0x28}, {"IA", 0xFFFFFFFFFFFFFFFFULL}, {"T0", 0xFF}, {"T1", 0xFF},
+	{"T2", 0xFF}, {"T3", 0xFF}, {"T4", 0xFF}, {"T5", 0xFF}, {"T6", 0xFF},
+	{"T7", 0xFF}, {"PT", 0xFF}, {"CT", 0x64}, {"GT", 0x3E8}, {"CC", 0x2B}
+};
+
+// Ranges of the settings the model checks
+static const struct {
+	char cmd[3];
+	uint64_t min;
+	uint64_t max;
+} simRanges[] = {
+	{"CH", 0x0B, 0x1A}, {"BD", 0x00, 0x08}, {"AP", 0x00, 0x02}, {"GT", 0x02, 0xCE4},
+	{"CT", 0x02, 0x1770}, {"SM", 0x00, 0x05}, {"RR", 0x00, 0x06}, {"NB", 0x00, 0x04}
+};
+
+// Remote AT requests on the air
+typedef struct {
+	bool used;
+	sim_radio *from;
+	sim_radio *to;
+	uint8_t frameid;
+	uint8_t options;
+	char cmd[2];
+	uint8_t plen;
+	uint8_t param[XBEE_RAT_MAX_PARAM];
+} sim_rat;
+
+static sim_rat simRats[SIM_RAT_SLOTS];
+
+uint32_t simChecks;
+uint32_t simFailures;
+
+static void simRadioApply(sim_radio *radio);
+static void simRadioSleepCheck(void *ctx, uint32_t gen);
+
+
+// ++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
+// ++++++++++++++++++++++++++++ SETTINGS ++++++++++++++++++++++++++++++++++++++
+// ++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
+
+static int simSettingIndex(const char *cmd)
+{
+	for(int i = 0; i < XBEE_SETTING_COUNT; ++i)
+	{
+		if(xbeeSettingTable[i].cmd[0] == cmd[0] && xbeeSettingTable[i].cmd[1] == cmd[1])
+		{
+			return i;
+		}
+	}
+	return -1;
+}
+
+
+static bool simIs(const char *cmd, const char *name)
+{
+	return cmd[0] == name[0] && cmd[1] == name[1];
+}
+
+
+static void simRadioDefaults(sim_radio *radio)
+{
+	memset(radio->value, 0, sizeof(radio->value));
+	memset(radio->ni, 0, sizeof(radio->ni));
+	for(uint32_t i = 0; i < sizeof(simDefaults)/sizeof(simDefaults[0]); ++i)
+	{
+		int idx = simSettingIndex(simDefaults[i].cmd);
+		if(idx >= 0)
+		{
+			radio->value[idx] = simDefaults[i].value;
+		}
+	}
+	radio->value[XBEE_SETTING_SH] = radio->sh;
+	radio->value[XBEE_SETTING_SL] = radio->sl;
+}
+
+
+static bool simInRange(const char *cmd, uint64_t value)
+{
+	for(uint32_t i = 0; i < sizeof(simRanges)/sizeof(simRanges[0]); ++i)
+	{
+		if(simIs(cmd, simRanges[i].cmd))
+		{
+			return value >= simRanges[i].min && value <= simRanges[i].max;
+		}
+	}
+	return true;
+}
+
+
+static uint8_t simPutValue(uint8_t *out, uint64_t value, uint8_t width)
+{
+	for(uint8_t i = 0; i < width; ++i)
+	{
+		out[i] = (uint8_t)(value >> (8*(width-1-i)));
+	}
+	return width;
+}
+
+
+/*
+ *	Carries out one AT command, the same way for command mode and for API
+ *	frames. An empty parameter reads the setting.
+ *
+ *	@param *out, receives the value of a read (room for 20 bytes)
+ *	@param *outlen, receives the length of it
+ *	@param *changed, set if a setting was written
+ *	@retval SIM_AT_xx status
+ */
+static uint8_t simRadioCommand(sim_radio *radio, const char *cmd, const uint8_t *param, uint8_t plen,
+							   uint8_t *out, uint8_t *outlen, bool *changed)
+{
+	*outlen = 0;
+
+	if(simIs(cmd, "AC"))
+	{
+		simRadioApply(radio);
+		return SIM_AT_OK;
+	}
+	if(simIs(cmd, "WR"))
+	{
+		memcpy(radio->saved, radio->value, sizeof(radio->saved));
+		memcpy(radio->savedni, radio->ni, sizeof(radio->savedni));
+		return SIM_AT_OK;
+	}
+	if(simIs(cmd, "RE"))
+	{
+		simRadioDefaults(radio);
+		*changed = true;
+		return SIM_AT_OK;
+	}
+	if(simIs(cmd, "CN") || simIs(cmd, "FR"))
+	{
+		return SIM_AT_OK;
+	}
+	if(simIs(cmd, "KY"))
+	{
+		// Write only, up to 16 bytes
+		return (plen <= 16) ? SIM_AT_OK : SIM_AT_INVALID_PARAM;
+	}
+	if(simIs(cmd, "VR") || simIs(cmd, "HV") || simIs(cmd, "AI") || simIs(cmd, "DB")
+	   || simIs(cmd, "EA") || simIs(cmd, "EC"))
+	{
+		if(plen != 0)
+		{
+			return SIM_AT_ERROR;
+		}
+		uint64_t v = simIs(cmd, "VR") ? 0x2003 : simIs(cmd, "HV") ? 0x2241 : simIs(cmd, "DB") ? radio->lastrssi
+				   : simIs(cmd, "EA") ? radio->ea : simIs(cmd, "EC") ? radio->ec : 0;
+		*outlen = simPutValue(out, v, simIs(cmd, "AI") || simIs(cmd, "DB") ? 1 : 2);
+		return SIM_AT_OK;
+	}
+
+	int idx = simSettingIndex(cmd);
+	if(idx < 0)
+	{
+		return SIM_AT_INVALID_CMD;
+	}
+	uint8_t width = xbeeSettingTable[idx].width;
+
+	if(plen == 0)
+	{
+		if(idx == XBEE_SETTING_NI)
+		{
+			*outlen = strlen(radio->ni);
+			memcpy(out, radio->ni, *outlen);
+		}
+		else
+		{
+			*outlen = simPutValue(out, radio->value[idx], width);
+		}
+		return SIM_AT_OK;
+	}
+
+	if(xbeeSettingTable[idx].flags & XBEE_SETTING_READONLY)
+	{
+		return SIM_AT_ERROR;
+	}
+	if(idx == XBEE_SETTING_NI)
+	{
+		if(plen > 20)
+		{
+			return SIM_AT_INVALID_PARAM;
+		}
+		memset(radio->ni, 0, sizeof(radio->ni));
+		memcpy(radio->ni, param, plen);
+		*changed = true;
+		return SIM_AT_OK;
+	}
+
+	uint64_t v = 0;
+	for(uint8_t i = 0; i < plen; ++i)
+	{
+		if(i + width < plen && param[i] != 0)
+		{
+			return SIM_AT_INVALID_PARAM;
+		}
+		v = (v << 8) | param[i];
+	}
+	if(!simInRange(cmd, v))
+	{
+		return SIM_AT_INVALID_PARAM;
+	}
+	radio->value[idx] = v;
+	*changed = true;
+	return SIM_AT_OK;
+}
+
+
+/*
+ *	Puts the written settings into effect.
+ */
+static void simRadioApply(sim_radio *radio)
+{
+	radio->baud = baudrates[radio->value[XBEE_SETTING_BD]];
+	radio->ap = (uint8_t)radio->value[XBEE_SETTING_AP];
+	radio->gt = (uint16_t)radio->value[XBEE_SETTING_GT];
+	radio->cc = (uint8_t)radio->value[XBEE_SETTING_CC];
+	radio->ct = (uint16_t)radio->value[XBEE_SETTING_CT];
+	radio->sm = (uint8_t)radio->value[XBEE_SETTING_SM];
+
+	if(radio->sm == 1 || radio->sm == 2)
+	{
+		radio->sleep = radio->sleeprq ? SIM_SLEEP_PIN : SIM_SLEEP_AWAKE;
+	}
+	else if(radio->sm == 4 || radio->sm == 5)
+	{
+		simSchedule(simNow, simRadioSleepCheck, radio, ++radio->sleepgen);
+	}
+	else
+	{
+		radio->sleep = SIM_SLEEP_AWAKE;
+	}
+}
+
+
+// ++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
+// ++++++++++++++++++++++++++++ OUTPUT ++++++++++++++++++++++++++++++++++++++++
+// ++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
+
+static void simRadioPrint(sim_radio *radio, const char *text)
+{
+	simSerialWrite(&radio->out, (const uint8_t *)text, strlen(text), radio->baud);
+}
+
+
+/*
+ *	Sends an API frame to the MCU, escaped when AP = 2.
+ */
+static void simRadioSendFrame(sim_radio *radio, const uint8_t *data, uint16_t len)
+{
+	uint8_t raw[2*SIM_API_MAX + 8];
+	uint16_t n = 0;
+	uint8_t head[2] = {(uint8_t)(len >> 8), (uint8_t)len};
+	uint8_t sum = 0;
+
+	raw[n++] = XBEE_API_START_DELIM;
+	for(uint16_t i = 0; i < len + 3; ++i)
+	{
+		uint8_t c;
+		if(i < 2)
+		{
+			c = head[i];
+		}
+		else if(i < len + 2)
+		{
+			c = data[i-2];
+			sum += c;
+		}
+		else
+		{
+			c = 0xFF - sum;
+		}
+		if(radio->ap == XBEE_API_ESCAPED && (c == XBEE_API_START_DELIM || c == XBEE_API_ESCAPE
+		   || c == XBEE_API_XON || c == XBEE_API_XOFF))
+		{
+			raw[n++] = XBEE_API_ESCAPE;
+			c ^= XBEE_API_ESCAPE_XOR;
+		}
+		raw[n++] = c;
+	}
+	simSerialWrite(&radio->out, raw, n, radio->baud);
+}
+
+
+static void simRadioATResponse(sim_radio *radio, uint8_t frameid, const char *cmd, uint8_t status,
+							   const uint8_t *data, uint8_t len)
+{
+	uint8_t frame[5 + 32];
+	frame[0] = XBEE_API_AT_RESPONSE;
+	frame[1] = frameid;
+	frame[2] = cmd[0];
+	frame[3] = cmd[1];
+	frame[4] = status;
+	memcpy(&frame[5], data, len);
+	simRadioSendFrame(radio, frame, 5 + len);
+}
+
+
+static void simRadioTxStatus(sim_radio *radio, uint8_t frameid, uint8_t status)
+{
+	if(frameid != 0)
+	{
+		uint8_t frame[3] = {XBEE_API_TX_STATUS, frameid, status};
+		simRadioSendFrame(radio, frame, 3);
+	}
+}
+
+
+// ++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
+// ++++++++++++++++++++++++++++ COMMAND MODE ++++++++++++++++++++++++++++++++++
+// ++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
+
+static void simRadioLeaveCommandMode(sim_radio *radio)
+{
+	radio->cmdmode = false;
+	++radio->ctgen;
+	simRadioApply(radio);
+}
+
+
+static void simRadioCommandTimeout(void *ctx, uint32_t gen)
+{
+	sim_radio *radio = ctx;
+	if(gen == radio->ctgen && radio->cmdmode)
+	{
+		simRadioLeaveCommandMode(radio);
+	}
+}
+
+
+static void simRadioArmCommandTimeout(sim_radio *radio)
+{
+	simSchedule(simNow + (uint64_t)radio->ct*100000, simRadioCommandTimeout, radio, ++radio->ctgen);
+}
+
+
+/*
+ *	The trailing guard time after the command sequence has passed.
+ */
+static void simRadioGuard(void *ctx, uint32_t gen)
+{
+	sim_radio *radio = ctx;
+	if(gen != radio->guardgen || radio->plus != 3 || !simRadioAwake(radio))
+	{
+		return;
+	}
+	radio->plus = 0;
+	radio->cmdmode = true;
+	radio->linelen = 0;
+	radio->overlong = false;
+	++radio->cmdentries;
+	simRadioPrint(radio, "OK\r");
+	simRadioArmCommandTimeout(radio);
+}
+
+
+static int simHexDigit(char c)
+{
+	if(c >= '0' && c <= '9')
+	{
+		return c - '0';
+	}
+	c = toupper((unsigned char)c);
+	return (c >= 'A' && c <= 'F') ? c - 'A' + 10 : -1;
+}
+
+
+/*
+ *	Carries out one command of a command line, "text" is the command
+ *	and its parameter as typed.
+ *
+ *	@retval true if it was CN
+ */
+static bool simRadioCommandText(sim_radio *radio, const char *text, uint8_t len)
+{
+	char cmd[2];
+	uint8_t param[32];
+	uint8_t plen = 0;
+	uint8_t out[32];
+	uint8_t outlen;
+	bool changed = false;
+	char reply[48];
+
+	if(len < 2)
+	{
+		simRadioPrint(radio, "ERROR\r");
+		return false;
+	}
+	cmd[0] = toupper((unsigned char)text[0]);
+	cmd[1] = toupper((unsigned char)text[1]);
+	text += 2;
+	len -= 2;
+	while(len > 0 && *text == ' ')
+	{
+		++text;
+		--len;
+	}
+
+	if(simIs(cmd, "NI"))
+	{
+		plen = (len <= 32) ? len : 32;
+		memcpy(param, text, plen);
+	}
+	else if(len > 0)
+	{
+		// Hex, right aligned into whole bytes
+		while(len > 1 && *text == '0')
+		{
+			++text;
+			--len;
+		}
+		if(len > 2*sizeof(param))
+		{
+			simRadioPrint(radio, "ERROR\r");
+			return false;
+		}
+		plen = (len + 1) / 2;
+		memset(param, 0, plen);
+		for(uint8_t i = 0; i < len; ++i)
+		{
+			int d = simHexDigit(text[i]);
+			if(d < 0)
+			{
+				simRadioPrint(radio, "ERROR\r");
+				return false;
+			}
+			uint8_t pos = len - 1 - i;
+			param[plen - 1 - pos/2] |= d << (4*(pos%2));
+		}
+	}
+
+	uint8_t status = simRadioCommand(radio, cmd, param, plen, out, &outlen, &changed);
+	if(status != SIM_AT_OK)
+	{
+		simRadioPrint(radio, "ERROR\r");
+		return false;
+	}
+	if(plen > 0 || simIs(cmd, "AC") || simIs(cmd, "WR") || simIs(cmd, "RE") || simIs(cmd, "CN")
+	   || simIs(cmd, "FR") || simIs(cmd, "KY"))
+	{
+		simRadioPrint(radio, "OK\r");
+	}
+	else if(simIs(cmd, "NI"))
+	{
+		snprintf(reply, sizeof(reply), "%.20s\r", radio->ni);
+		simRadioPrint(radio, reply);
+	}
+	else
+	{
+		uint64_t v = 0;
+		for(uint8_t i = 0; i < outlen; ++i)
+		{
+			v = (v << 8) | out[i];
+		}
+		snprintf(reply, sizeof(reply), "%llX\r", (unsigned long long)v);
+		simRadioPrint(radio, reply);
+	}
+	if(simIs(cmd, "FR"))
+	{
+		simRadioReset(radio);
+	}
+	return simIs(cmd, "CN");
+}
+
+
+/*
+ *	Carries out a command line: AT followed by commands separated by commas.
+ */
+static void simRadioCommandLine(sim_radio *radio)
+{
+	char *line = radio->line;
+	uint8_t len = radio->linelen;
+	bool leave = false;
+
+	radio->linelen = 0;
+	++radio->cmdlines;
+	if(radio->overlong || len < 2 || toupper((unsigned char)line[0]) != 'A' || toupper((unsigned char)line[1]) != 'T')
+	{
+		radio->overlong = false;
+		simRadioPrint(radio, "ERROR\r");
+		return;
+	}
+	if(len == 2)
+	{
+		simRadioPrint(radio, "OK\r");
+		return;
+	}
+
+	uint8_t pos = 2;
+	while(pos < len && !leave)
+	{
+		uint8_t end = pos;
+		while(end < len && line[end] != ',')
+		{
+			++end;
+		}
+		leave = simRadioCommandText(radio, &line[pos], end - pos);
+		pos = end + 1;
+	}
+	if(leave)
+	{
+		simRadioLeaveCommandMode(radio);
+	}
+}
+
+
+// ++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
+// ++++++++++++++++++++++++++++ RF CHANNEL ++++++++++++++++++++++++++++++++++++
+// ++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
+
+void simAirInit(sim_air *air)
+{
+	memset(air, 0, sizeof(sim_air));
+}
+
+
+static bool simOnChannel(sim_radio *a, sim_radio *b)
+{
+	return a != b && a->value[XBEE_SETTING_CH] == b->value[XBEE_SETTING_CH]
+		   && a->value[XBEE_SETTING_ID] == b->value[XBEE_SETTING_ID];
+}
+
+
+static sim_radio *simAirFind(sim_radio *from, bool addr64, uint64_t dst64, uint16_t dst16)
+{
+	sim_air *air = from->air;
+	for(uint8_t i = 0; air != NULL && i < air->count; ++i)
+	{
+		sim_radio *r = air->radio[i];
+		if(!simOnChannel(from, r))
+		{
+			continue;
+		}
+		if(addr64 ? (((uint64_t)r->sh << 32) | r->sl) == dst64 : (r->value[XBEE_SETTING_MY] == dst16 && dst16 != 0xFFFE))
+		{
+			return r;
+		}
+	}
+	return NULL;
+}
+
+
+/*
+ *	Puts a frame on the air and returns the time the channel is free again:
+ *	a random CSMA backoff, the clear channel assessment, then the frame.
+ */
+static uint64_t simAirSend(sim_radio *from, uint8_t len)
+{
+	sim_air *air = from->air;
+	uint64_t start = simNow + (simRandom() % 8) * SIM_RF_BACKOFF_US + SIM_RF_CCA_US;
+	if(air != NULL && air->busyuntil > start)
+	{
+		start = air->busyuntil + SIM_RF_CCA_US;
+	}
+	uint64_t end = start + (uint64_t)(SIM_RF_PHY_BYTES + len) * SIM_RF_BYTE_US;
+	if(air != NULL)
+	{
+		air->busyuntil = end;
+		++air->frames;
+	}
+	++from->rftx;
+	return end;
+}
+
+
+static bool simAirLost(sim_air *air)
+{
+	if(air == NULL || air->loss == 0 || (simRandom() % 1000000) >= air->loss)
+	{
+		return false;
+	}
+	++air->lost;
+	return true;
+}
+
+
+/*
+ *	Hands received RF data to the MCU of a radio, as an RX Packet frame
+ *	(addressed the way the sender is) or as plain bytes in transparent mode.
+ */
+static void simRadioDeliver(sim_radio *to, sim_radio *from, const uint8_t *data, uint8_t len, bool broadcast)
+{
+	uint8_t frame[11 + XBEE_MAX_PAYLOAD];
+	uint16_t my = (uint16_t)from->value[XBEE_SETTING_MY];
+	uint8_t n = 0;
+
+	++to->rfrx;
+	to->lastrssi = SIM_RSSI;
+	if(to->ap == 0)
+	{
+		simSerialWrite(&to->out, data, len, to->baud);
+		return;
+	}
+	if(my == 0xFFFE)
+	{
+		frame[n++] = XBEE_API_RX64;
+		n += simPutValue(&frame[n], from->sh, 4);
+		n += simPutValue(&frame[n], from->sl, 4);
+	}
+	else
+	{
+		frame[n++] = XBEE_API_RX16;
+		n += simPutValue(&frame[n], my, 2);
+	}
+	frame[n++] = SIM_RSSI;
+	frame[n++] = broadcast ? 0x02 : 0x00;
+	memcpy(&frame[n], data, len);
+	simRadioSendFrame(to, frame, n + len);
+}
+
+
+static void simRadioRfKick(sim_radio *radio);
+
+/*
+ *	A try of the RF request at the head of the queue is over. "arg" counts
+ *	the tries made so far.
+ */
+static void simRadioRfDone(void *ctx, uint32_t tries)
+{
+	sim_radio *radio = ctx;
+	sim_rf_request *req = &radio->txq[radio->txget % SIM_RADIO_TXQ];
+	bool broadcast = req->addr64 ? (req->dst64 == 0xFFFF) : (req->dst16 == 0xFFFF);
+	uint8_t status = XBEE_TXS_SUCCESS;
+
+	if(broadcast)
+	{
+		for(uint8_t i = 0; i < radio->air->count; ++i)
+		{
+			sim_radio *r = radio->air->radio[i];
+			if(simOnChannel(radio, r) && simRadioAwake(r) && !simAirLost(radio->air))
+			{
+				simRadioDeliver(r, radio, req->data, req->len, true);
+			}
+		}
+	}
+	else
+	{
+		sim_radio *to = simAirFind(radio, req->addr64, req->dst64, req->dst16);
+		bool heard = (to != NULL && simRadioAwake(to) && !simAirLost(radio->air));
+		if(to != NULL && !simRadioAwake(to))
+		{
+			++to->rfmissed;
+		}
+		if(heard && tries == 1)
+		{
+			simRadioDeliver(to, radio, req->data, req->len, false);
+		}
+		else if(heard)
+		{
+			// The MAC filters retries of a frame that already got through,
+			// only the lost ACK case repeats the data and that is not modelled
+			simRadioDeliver(to, radio, req->data, req->len, false);
+		}
+		if(!heard && !(req->options & XBEE_TXOPT_NOACK))
+		{
+			uint32_t maxtries = SIM_MAC_TRIES * (1 + (uint32_t)radio->value[XBEE_SETTING_RR]);
+			if(tries < maxtries)
+			{
+				uint8_t hdr = req->addr64 ? 21 : 9;
+				uint64_t end = simAirSend(radio, hdr + req->len);
+				simSchedule(end + SIM_RF_ACK_US, simRadioRfDone, radio, tries + 1);
+				return;
+			}
+			++radio->ea;
+			status = XBEE_TXS_NOACK;
+		}
+	}
+
+	simRadioTxStatus(radio, req->frameid, status);
+	++radio->txget;
+	radio->rfbusy = false;
+	simRadioRfKick(radio);
+}
+
+
+/*
+ *	Starts the next RF request if the radio is not already on the air.
+ */
+static void simRadioRfKick(sim_radio *radio)
+{
+	if(radio->rfbusy || radio->txget == radio->txput)
+	{
+		return;
+	}
+	sim_rf_request *req = &radio->txq[radio->txget % SIM_RADIO_TXQ];
+	bool ack = !(req->options & XBEE_TXOPT_NOACK) && !(req->addr64 ? req->dst64 == 0xFFFF : req->dst16 == 0xFFFF);
+	uint8_t hdr = req->addr64 ? 21 : 9;
+	uint64_t end = simAirSend(radio, hdr + req->len);
+
+	radio->rfbusy = true;
+	simSchedule(end + (ack ? SIM_RF_ACK_US : 0), simRadioRfDone, radio, 1);
+}
+
+
+/*
+ *	A Remote AT request has made its way to the target and back.
+ */
+static void simRadioRemoteDone(void *ctx, uint32_t slot)
+{
+	sim_rat *rat = &simRats[slot];
+	sim_radio *radio = ctx;
+	sim_radio *to = rat->to;
+	uint8_t frame[15 + 32];
+	uint8_t out[32];
+	uint8_t outlen = 0;
+	uint8_t status = SIM_AT_TX_FAILURE;
+
+	rat->used = false;
+	if(to != NULL && simRadioAwake(to) && !simAirLost(radio->air) && !simAirLost(radio->air))
+	{
+		bool changed = false;
+		status = simRadioCommand(to, rat->cmd, rat->param, rat->plen, out, &outlen, &changed);
+		if(status == SIM_AT_OK && changed && (rat->options & XBEE_RATOPT_APPLY))
+		{
+			simRadioApply(to);
+		}
+		to->lastrssi = SIM_RSSI;
+	}
+	if(rat->frameid == 0)
+	{
+		return;
+	}
+
+	uint8_t n = 0;
+	frame[n++] = XBEE_API_REMOTE_AT_RESPONSE;
+	frame[n++] = rat->frameid;
+	n += simPutValue(&frame[n], (to != NULL) ? to->sh : 0, 4);
+	n += simPutValue(&frame[n], (to != NULL) ? to->sl : 0, 4);
+	n += simPutValue(&frame[n], (to != NULL) ? to->value[XBEE_SETTING_MY] : 0xFFFE, 2);
+	frame[n++] = rat->cmd[0];
+	frame[n++] = rat->cmd[1];
+	frame[n++] = status;
+	memcpy(&frame[n], out, outlen);
+	simRadioSendFrame(radio, frame, n + outlen);
+}
+
+
+/*
+ *	A node answering a Node Discovery.
+ */
+static void simRadioDiscoverReply(void *ctx, uint32_t arg)
+{
+	sim_radio *radio = ctx;
+	uint8_t frameid = arg & 0xFF;
+	uint8_t idx = arg >> 8;
+	uint8_t data[32];
+	uint8_t n = 0;
+
+	if(idx == 0xFF)
+	{
+		// NT is over, the closing empty response
+		simRadioATResponse(radio, frameid, "ND", SIM_AT_OK, NULL, 0);
+		return;
+	}
+	sim_radio *r = radio->air->radio[idx];
+	if(!simRadioAwake(r))
+	{
+		return;
+	}
+	n += simPutValue(&data[n], r->value[XBEE_SETTING_MY], 2);
+	n += simPutValue(&data[n], r->sh, 4);
+	n += simPutValue(&data[n], r->sl, 4);
+	data[n++] = SIM_RSSI;
+	memcpy(&data[n], r->ni, strlen(r->ni) + 1);
+	n += strlen(r->ni) + 1;
+	simRadioATResponse(radio, frameid, "ND", SIM_AT_OK, data, n);
+}
+
+
+// ++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
+// ++++++++++++++++++++++++++++ API MODE ++++++++++++++++++++++++++++++++++++++
+// ++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
+
+static void simRadioHandleFrame(sim_radio *radio, const uint8_t *frame, uint16_t len)
+{
+	uint8_t out[32];
+	uint8_t outlen;
+	bool changed = false;
+
+	++radio->apiframes;
+	switch(frame[0])
+	{
+	case XBEE_API_AT_CMD:
+	case XBEE_API_AT_QUEUE:
+	{
+		// 0x08 | Frame ID | AT command (2) | Parameter
+		if(len < 4)
+		{
+			break;
+		}
+		const char *cmd = (const char *)&frame[2];
+		if(simIs(cmd, "ND"))
+		{
+			uint32_t nt = (uint32_t)radio->value[XBEE_SETTING_NT] * 100000;
+			for(uint8_t i = 0; radio->air != NULL && i < radio->air->count; ++i)
+			{
+				if(simOnChannel(radio, radio->air->radio[i]))
+				{
+					uint64_t at = simNow + (simRandom() % (nt ? nt : 1));
+					simSchedule(at, simRadioDiscoverReply, radio, frame[1] | (i << 8));
+				}
+			}
+			simSchedule(simNow + nt, simRadioDiscoverReply, radio, frame[1] | 0xFF00);
+			break;
+		}
+		uint8_t status = simRadioCommand(radio, cmd, &frame[4], len - 4, out, &outlen, &changed);
+		if(frame[1] != 0)
+		{
+			simRadioATResponse(radio, frame[1], cmd, status, out, outlen);
+		}
+		if(status == SIM_AT_OK && frame[0] == XBEE_API_AT_CMD && (changed || simIs(cmd, "AC")))
+		{
+			// Takes effect once the response is out (queued at the old rate)
+			simRadioApply(radio);
+		}
+		if(simIs(cmd, "FR"))
+		{
+			simRadioReset(radio);
+		}
+		break;
+	}
+
+	case XBEE_API_REMOTE_AT:
+	{
+		// 0x17 | Frame ID | 64-bit dest (8) | 16-bit dest (2) | Options | AT command (2) | Parameter
+		if(len < 15 || len - 15 > XBEE_RAT_MAX_PARAM)
+		{
+			break;
+		}
+		int slot = -1;
+		for(int i = 0; i < SIM_RAT_SLOTS; ++i)
+		{
+			if(!simRats[i].used)
+			{
+				slot = i;
+				break;
+			}
+		}
+		if(slot < 0)
+		{
+			break;
+		}
+		sim_rat *rat = &simRats[slot];
+		uint64_t dst64 = 0;
+		for(int i = 0; i < 8; ++i)
+		{
+			dst64 = (dst64 << 8) | frame[2+i];
+		}
+		uint16_t dst16 = ((uint16_t)frame[10] << 8) | frame[11];
+		rat->used = true;
+		rat->from = radio;
+		rat->to = (dst16 != 0xFFFE) ? simAirFind(radio, false, 0, dst16) : simAirFind(radio, true, dst64, 0);
+		rat->frameid = frame[1];
+		rat->options = frame[12];
+		rat->cmd[0] = frame[13];
+		rat->cmd[1] = frame[14];
+		rat->plen = len - 15;
+		memcpy(rat->param, &frame[15], rat->plen);
+
+		// Request and response each take their turn on the air
+		simAirSend(radio, 21 + 3 + rat->plen);
+		uint64_t end = simAirSend(radio, 21 + 4 + 20);
+		simSchedule(end + 2*SIM_RF_ACK_US, simRadioRemoteDone, radio, slot);
+		break;
+	}
+
+	case XBEE_API_TX64:
+	case XBEE_API_TX16:
+	{
+		// 0x00 | Frame ID | 64-bit dest (8) | Options | Data
+		// 0x01 | Frame ID | 16-bit dest (2) | Options | Data
+		bool addr64 = (frame[0] == XBEE_API_TX64);
+		uint16_t hlen = addr64 ? 11 : 5;
+		if(len < hlen)
+		{
+			break;
+		}
+		if(len - hlen > XBEE_MAX_PAYLOAD || radio->txput - radio->txget >= SIM_RADIO_TXQ)
+		{
+			simRadioTxStatus(radio, frame[1], XBEE_TXS_PURGED);
+			break;
+		}
+		sim_rf_request *req = &radio->txq[radio->txput++ % SIM_RADIO_TXQ];
+		req->frameid = frame[1];
+		req->addr64 = addr64;
+		req->dst64 = 0;
+		req->dst16 = 0;
+		for(int i = 0; i < (addr64 ? 8 : 2); ++i)
+		{
+			if(addr64)
+			{
+				req->dst64 = (req->dst64 << 8) | frame[2+i];
+			}
+			else
+			{
+				req->dst16 = (req->dst16 << 8) | frame[2+i];
+			}
+		}
+		req->options = frame[hlen-1];
+		req->len = len - hlen;
+		memcpy(req->data, &frame[hlen], req->len);
+		simRadioRfKick(radio);
+		break;
+	}
+
+	default:
+		break;
+	}
+}
+
+
+/*
+ *	Feeds a byte from the MCU to the API frame receiver.
+ */
+static void simRadioApiByte(sim_radio *radio, uint8_t c)
+{
+	if(radio->ap == XBEE_API_ESCAPED)
+	{
+		if(c == XBEE_API_START_DELIM)
+		{
+			radio->apistate = 1;
+			radio->apiesc = false;
+			return;
+		}
+		if(c == XBEE_API_ESCAPE)
+		{
+			radio->apiesc = true;
+			return;
+		}
+		if(radio->apiesc)
+		{
+			c ^= XBEE_API_ESCAPE_XOR;
+			radio->apiesc = false;
+		}
+	}
+
+	switch(radio->apistate)
+	{
+	case 0:
+		if(c == XBEE_API_START_DELIM)
+		{
+			radio->apistate = 1;
+		}
+		break;
+	case 1:
+		radio->apilen = (uint16_t)c << 8;
+		radio->apistate = 2;
+		break;
+	case 2:
+		radio->apilen |= c;
+		radio->apicnt = 0;
+		radio->apisum = 0;
+		if(radio->apilen == 0 || radio->apilen > SIM_API_MAX)
+		{
+			++radio->apierrors;
+			radio->apistate = 0;
+			break;
+		}
+		radio->apistate = 3;
+		break;
+	case 3:
+		radio->apibuf[radio->apicnt++] = c;
+		radio->apisum += c;
+		if(radio->apicnt == radio->apilen)
+		{
+			radio->apistate = 4;
+		}
+		break;
+	case 4:
+		radio->apistate = 0;
+		if((uint8_t)(radio->apisum + c) != 0xFF)
+		{
+			++radio->apierrors;
+			break;
+		}
+		simRadioHandleFrame(radio, radio->apibuf, radio->apilen);
+		break;
+	default:
+		radio->apistate = 0;
+		break;
+	}
+}
+
+
+// ++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
+// ++++++++++++++++++++++++++++ UART INPUT AND SLEEP ++++++++++++++++++++++++++
+// ++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
+
+/*
+ *	Cyclic sleep: the radio goes to sleep ST ms after the last activity and
+ *	wakes up again after SP (x10 ms).
+ */
+static void simRadioSleepCheck(void *ctx, uint32_t gen)
+{
+	sim_radio *radio = ctx;
+	if(gen != radio->sleepgen || (radio->sm != 4 && radio->sm != 5))
+	{
+		return;
+	}
+	if(radio->sleep == SIM_SLEEP_CYCLIC)
+	{
+		radio->sleep = SIM_SLEEP_AWAKE;
+		radio->lastrx = simNow;
+	}
+	uint64_t idle = radio->lastrx + radio->value[XBEE_SETTING_ST]*1000;
+	if(radio->cmdmode || radio->rfbusy || simSerialPending(&radio->out) > 0 || idle > simNow)
+	{
+		simSchedule((idle > simNow) ? idle : simNow + 1000, simRadioSleepCheck, radio, gen);
+		return;
+	}
+	radio->sleep = SIM_SLEEP_CYCLIC;
+	uint64_t sp = radio->value[XBEE_SETTING_SP] ? radio->value[XBEE_SETTING_SP]*10000 : 10000;
+	simSchedule(simNow + sp, simRadioSleepCheck, radio, gen);
+}
+
+
+/*
+ *	A byte arriving at the radio from the MCU.
+ */
+static void simRadioRx(void *ctx, uint8_t byte, uint32_t baud)
+{
+	sim_radio *radio = ctx;
+	uint8_t c;
+
+	if(!simRadioAwake(radio))
+	{
+		++radio->asleepbytes;
+		return;
+	}
+
+	uint64_t quiet = simNow - radio->lastrx;
+	uint32_t bytetime = simByteTime(baud);
+	quiet = (quiet > bytetime) ? quiet - bytetime : 0;
+	radio->lastrx = simNow;
+	++radio->guardgen;
+
+	if(!simLineDecode(byte, baud, radio->baud, &c))
+	{
+		++radio->garbled;
+		radio->plus = 0;
+		return;
+	}
+	if(baud != radio->baud)
+	{
+		++radio->garbled;
+	}
+
+	if(radio->cmdmode)
+	{
+		simRadioArmCommandTimeout(radio);
+		if(c == '\r')
+		{
+			simRadioCommandLine(radio);
+		}
+		else if(c != '\n')
+		{
+			if(radio->linelen < sizeof(radio->line))
+			{
+				radio->line[radio->linelen++] = c;
+			}
+			else
+			{
+				radio->overlong = true;
+			}
+		}
+		return;
+	}
+
+	// Command sequence: GT of silence, three command characters, GT of silence
+	if(c == radio->cc && (radio->plus > 0 || quiet >= (uint64_t)radio->gt*1000))
+	{
+		if(++radio->plus == 3)
+		{
+			simSchedule(simNow + (uint64_t)radio->gt*1000, simRadioGuard, radio, radio->guardgen);
+		}
+	}
+	else
+	{
+		radio->plus = 0;
+	}
+
+	if(radio->ap != 0)
+	{
+		simRadioApiByte(radio, c);
+	}
+}
+
+
+// ++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
+// ++++++++++++++++++++++++++++ MODEL SET UP ++++++++++++++++++++++++++++++++++
+// ++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
+
+/*
+ *	Sets a radio up with factory defaults and puts it on the channel
+ *	(air may be NULL for a radio without RF).
+ */
+void simRadioInit(sim_radio *radio, const char *name, sim_air *air, uint32_t sh, uint32_t sl)
+{
+	memset(radio, 0, sizeof(sim_radio));
+	radio->name = name;
+	radio->air = air;
+	radio->sh = sh;
+	radio->sl = sl;
+	simRadioDefaults(radio);
+	memcpy(radio->saved, radio->value, sizeof(radio->saved));
+	simRadioApply(radio);
+	simSerialInit(&radio->out, NULL, NULL);
+	if(air != NULL && air->count < SIM_AIR_RADIOS)
+	{
+		air->radio[air->count++] = radio;
+	}
+}
+
+
+/*
+ *	Wires a radio to an MCU UART.
+ */
+void simRadioAttach(sim_radio *radio, sim_uart *uart)
+{
+	radio->uart = uart;
+	radio->out.dst = simUartReceive;
+	radio->out.dstctx = uart;
+	simUartConnect(uart, simRadioRx, radio);
+}
+
+
+/*
+ *	Writes a setting the way a terminal program on a PC would have, and
+ *	saves it: it is in effect from the next reset (or right away for
+ *	settings that do not change the interface).
+ *
+ *	@retval false for an unknown setting
+ */
+bool simRadioSet(sim_radio *radio, const char *cmd, uint64_t value)
+{
+	int idx = simSettingIndex(cmd);
+	if(idx < 0)
+	{
+		return false;
+	}
+	radio->value[idx] = value;
+	simRadioSave(radio);
+	return true;
+}
+
+
+uint64_t simRadioGet(sim_radio *radio, const char *cmd)
+{
+	int idx = simSettingIndex(cmd);
+	return (idx >= 0) ? radio->value[idx] : 0;
+}
+
+
+/*
+ *	Same as WR.
+ */
+void simRadioSave(sim_radio *radio)
+{
+	memcpy(radio->saved, radio->value, sizeof(radio->saved));
+	memcpy(radio->savedni, radio->ni, sizeof(radio->savedni));
+}
+
+
+/*
+ *	Power cycle: the saved settings come back, command mode and anything
+ *	on its way are dropped, and in API mode the radio reports the reset
+ *	with a Modem Status frame.
+ */
+void simRadioReset(sim_radio *radio)
+{
+	memcpy(radio->value, radio->saved, sizeof(radio->value));
+	memcpy(radio->ni, radio->savedni, sizeof(radio->ni));
+	radio->cmdmode = false;
+	++radio->ctgen;
+	++radio->guardgen;
+	radio->plus = 0;
+	radio->apistate = 0;
+	radio->txget = radio->txput;
+	radio->rfbusy = false;
+	++radio->resets;
+	simSerialFlush(&radio->out);
+	simRadioApply(radio);
+	radio->lastrx = simNow;
+	if(radio->ap != 0)
+	{
+		uint8_t status[2] = {XBEE_API_MODEM_STATUS, 0x00};
+		simRadioSendFrame(radio, status, 2);
+	}
+}
+
+
+/*
+ *	Drives the SLEEP_RQ pin, which puts the radio to sleep with SM = 1 or 2.
+ */
+void simRadioSetSleepRq(sim_radio *radio, bool asserted)
+{
+	radio->sleeprq = asserted;
+	if(radio->sm == 1 || radio->sm == 2)
+	{
+		radio->sleep = asserted ? SIM_SLEEP_PIN : SIM_SLEEP_AWAKE;
+	}
+}
+
+
+bool simRadioAwake(sim_radio *radio)
+{
+	return (radio->sleep == SIM_SLEEP_AWAKE);
+}
+
+
+// ++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
+// ++++++++++++++++++++++++++++ TEST BENCH ++++++++++++++++++++++++++++++++++++
+// ++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
+
+/*
+ *	Sets a node up: a factory default radio on "air", wired to a UART that
+ *	the MCU runs at "baud", with reception and the transmit queue started
+ *	the way main.c does it. Call after simReset() and platformTimerInit().
+ */
+void simNodeInit(sim_node *node, const char *name, sim_air *air, uint32_t sh, uint32_t sl, uint32_t baud)
+{
+	simUartInit(&node->uart, &node->huart, baud, true);
+	simRadioInit(&node->radio, name, air, sh, sl);
+	simRadioAttach(&node->radio, &node->uart);
+	uartTxInit(&node->txqueue, &node->huart, node->txdata, sizeof(node->txdata));
+	uartRxStart(&node->rxring, &node->huart, node->rxdata, sizeof(node->rxdata));
+}
+
+
+/*
+ *	Main loop of the MCUs for "us" of virtual time: every node is serviced,
+ *	then the core sleeps until the next interrupt.
+ */
+void simNodesRun(sim_node **nodes, uint8_t count, uint32_t us)
+{
+	uint64_t end = simNow + us;
+	while(simNow < end)
+	{
+		for(uint8_t i = 0; i < count; ++i)
+		{
+			xbeeService(&nodes[i]->xbee.local);
+		}
+		platformSleep();
+	}
+}
+
+
+/*
+ *	Prints the outcome of a test program.
+ *
+ *	@retval exit code, 0 if every check passed
+ */
+int simReport(const char *name)
+{
+	printf("%s: %lu checks, %lu failed\n", name, (unsigned long)simChecks, (unsigned long)simFailures);
+	return (simFailures == 0) ? 0 : 1;
+}